@@ -0,0 +1,134 @@
+// 检查缓存命中的GET请求不分配堆内存：替换全局的operator new计数，预热后按服务的顺序处理同一个请求（解析、读缓存的文件、编码响应头），有分配就返回非零
+// 用法：make alloc_count && ./alloc_count [rounds N]；改动请求处理路径后跑一次，输出每轮分配的次数和第一次分配的大小
+// 只依赖httpd本身，在当前目录下临时建一个文档目录，结束时删除
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <unistd.h>
+#include "../httpd.h"
+
+#define WARMUP_ROUNDS 16 //文件进缓存、arena的块和SmallVector长到够用
+#define DEFAULT_ROUNDS 1000
+
+namespace
+{
+
+std::atomic<bool> is_counting(false); //只统计测量阶段的分配，程序启动和预热时的分配不算
+std::atomic<size_t> allocations(0);
+std::atomic<size_t> first_size(0); //第一次分配的大小，方便定位是哪里分配的
+
+void* countedAlloc(std::size_t size, std::size_t align){
+	if (is_counting.load(std::memory_order_relaxed)){
+		size_t expected=0;
+		first_size.compare_exchange_strong(expected,size);
+		allocations.fetch_add(1,std::memory_order_relaxed);
+	}
+	if (0==size) size=1;
+	void* p=nullptr;
+	if (align<=alignof(std::max_align_t)) p=malloc(size);
+	else if (0!=posix_memalign(&p,align,size)) p=nullptr;
+	return p;
+}
+
+const char* request_raw= //浏览器请求首页时的典型请求
+	"GET /index.html HTTP/1.1\r\n"
+	"Host: 127.0.0.1:8080\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:118.0) Gecko/20100101 Firefox/118.0\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+	"Accept-Language: zh-CN,zh;q=0.8,zh-TW;q=0.7,zh-HK;q=0.5,en-US;q=0.3,en;q=0.2\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Connection: keep-alive\r\n"
+	"Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+	"Upgrade-Insecure-Requests: 1\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"\r\n";
+
+size_t serveOnce(httpd::Exchange& exchange, httpd::FileSystem& fs){ //和服务处理一个静态文件请求的步骤一样，body在缓存里不需要编码
+	exchange.clear();
+	std::string_view raw(request_raw);
+	size_t len=httpd::Request::completeLength(raw);
+	exchange.request.decode(raw.substr(0,len));
+	auto body=fs.read(exchange.request.getPath());
+	exchange.response.setStatusCodeAndMessage(httpd::StatusCodeAndMessage::Type::OK);
+	exchange.response.setBody(body);
+	exchange.response.setHeader("server","USER202334261359");
+	return exchange.response.encodeHead().size()+exchange.response.getBody()->getSize();
+}
+
+} // namespace
+
+void* operator new(std::size_t size){
+	void* p=countedAlloc(size,alignof(std::max_align_t));
+	if (nullptr==p) throw std::bad_alloc();
+	return p;
+}
+void* operator new[](std::size_t size){
+	return ::operator new(size);
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept{
+	return countedAlloc(size,alignof(std::max_align_t));
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept{
+	return countedAlloc(size,alignof(std::max_align_t));
+}
+void* operator new(std::size_t size, std::align_val_t align){
+	void* p=countedAlloc(size,static_cast<std::size_t>(align));
+	if (nullptr==p) throw std::bad_alloc();
+	return p;
+}
+void* operator new[](std::size_t size, std::align_val_t align){
+	return ::operator new(size,align);
+}
+void operator delete(void* p) noexcept{ free(p); }
+void operator delete[](void* p) noexcept{ free(p); }
+void operator delete(void* p, std::size_t) noexcept{ free(p); }
+void operator delete[](void* p, std::size_t) noexcept{ free(p); }
+void operator delete(void* p, std::align_val_t) noexcept{ free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept{ free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept{ free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept{ free(p); }
+
+int main(int argc, char* argv[])
+{
+	size_t rounds=DEFAULT_ROUNDS;
+	for (int i=1;i+1<argc;++i){
+		if ("rounds"==std::string(argv[i])) rounds=std::max(1L,strtol(argv[++i],NULL,10));
+	}
+
+	char root[]="alloc_count.XXXXXX";
+	if (nullptr==mkdtemp(root)){
+		perror("mkdtemp");
+		return 2;
+	}
+	std::string index_file=std::string(root)+"/index.html";
+	{
+		std::ofstream index(index_file);
+		index << "<html><body><h1>Hello World!</h1></body></html>\n";
+	}
+
+	size_t total=0;
+	{
+		httpd::FileSystem fs(root);
+		httpd::Exchange exchange;
+		for (int i=0;i<WARMUP_ROUNDS;++i) total+=serveOnce(exchange,fs);
+
+		is_counting.store(true);
+		for (size_t i=0;i<rounds;++i) total+=serveOnce(exchange,fs);
+		is_counting.store(false);
+	}
+	unlink(index_file.c_str());
+	rmdir(root);
+
+	size_t count=allocations.load();
+	printf("cached GET: %zu rounds, %zu allocations (%.3f per request), %zu bytes served\n",rounds,count,static_cast<double>(count)/rounds,total);
+	if (0!=count){
+		printf("FAIL: first allocation was %zu bytes\n",first_size.load());
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,24 @@
+#!/bin/bash
+# FastCGI动态请求与静态文件的延迟对比：同一个长连接上顺序发送请求，统计p50/p99
+# 用法：先启动 ./httpd 8080 htdocs fastcgi_spawn /echo ./fcgi_echo 2，再运行 bench/fastcgi.sh [端口] [静态文件路径] [FastCGI路径]
+PORT=${1:-8080}
+STATIC=${2:-/index.html}
+DYNAMIC=${3:-/echo/}
+REQUESTS=${REQUESTS:-2000}
+BODY=${BODY:-1024} #POST请求体的字节数
+
+URL=http://127.0.0.1:$PORT
+CONFIG=$(mktemp)
+DATA=$(mktemp)
+trap 'rm -f $CONFIG $DATA' EXIT
+head -c $BODY /dev/zero | tr '\0' 'a' > $DATA
+
+run() { #curl按配置文件顺序请求，复用同一个连接
+	sort -n | awk -v name="$1" '{ t[NR]=$1 } END { printf "%-28s p50 %.3f ms  p99 %.3f ms  max %.3f ms\n", name, t[int(NR*0.5)]*1000, t[int(NR*0.99)]*1000, t[NR]*1000 }'
+}
+
+for ((i=0;i<REQUESTS;++i)); do echo "url = \"$URL$STATIC\""; echo 'output = "/dev/null"'; done > $CONFIG
+curl -s -K $CONFIG -w "%{time_total}\n" | run "GET $STATIC"
+
+for ((i=0;i<REQUESTS;++i)); do echo "url = \"$URL$DYNAMIC\""; echo 'output = "/dev/null"'; done > $CONFIG
+curl -s -K $CONFIG --data-binary @$DATA -w "%{time_total}\n" | run "POST $DYNAMIC ($BODY B)"
@@ -0,0 +1,138 @@
+// 请求解析的模糊测试：任意输入都不能崩溃，能解析的请求编码后再解析要得到同样的请求，再编码要得到同样的字节
+// 有clang时编成libFuzzer目标：make fuzz_request_libfuzzer，然后 ./fuzz_request_libfuzzer bench/corpus/request
+// 没有clang时用自带的驱动（make fuzz_request，带ASan和UBSan）：./fuzz_request bench/corpus/request [runs N]，先跑完语料，再随机变异语料跑N次
+// 发现问题时打印输入并abort，输入同时写到crash-<hash>，可以直接加进语料
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <filesystem>
+#include "../httpd.h"
+
+namespace
+{
+
+void check(const bool& condition, const char* what, const std::string_view& input){
+	if (condition) return;
+	std::string name="crash-"+std::to_string(std::hash<std::string_view>()(input));
+	std::ofstream(name,std::ios::binary).write(input.data(),input.size());
+	fprintf(stderr,"property failed: %s (input saved to %s, %zu bytes)\n",what,name.c_str(),input.size());
+	abort();
+}
+
+bool sameRequest(const httpd::Request& a, const httpd::Request& b){
+	if (a.getMethod().getType()!=b.getMethod().getType() || a.getPath()!=b.getPath() || a.getVersion().getType()!=b.getVersion().getType()) return false;
+	if (a.getHeaders().size()!=b.getHeaders().size()) return false;
+	for (const auto& field:a.getHeaders()){
+		auto p_value=b.getHeader(field.key);
+		if (nullptr==p_value || *p_value!=field.value) return false;
+	}
+	if ((nullptr==a.getBody())!=(nullptr==b.getBody())) return false;
+	return nullptr==a.getBody() || a.getBody()->getContent()==b.getBody()->getContent();
+}
+
+void fuzzOne(const std::string_view& input){
+	::utils::Arena arena;
+	size_t len=0;
+	try{
+		len=httpd::Request::completeLength(input);
+	}
+	catch(const httpd::HttpException&){
+		return; //请求的边界无法确定，服务会回复400
+	}
+	check(len<=input.size(),"completeLength beyond input",input);
+	if (0==len) return;
+
+	httpd::Request request(arena);
+	try{
+		request.decode(input.substr(0,len));
+	}
+	catch(const httpd::HttpException&){
+		return;
+	}
+	std::string encoded(request.encode());
+	httpd::Request again(arena);
+	try{
+		check(httpd::Request::completeLength(encoded)==encoded.size(),"encoded request is not one complete request",input);
+		again.decode(encoded);
+	}
+	catch(const httpd::HttpException&){
+		check(false,"encoded request does not decode",input);
+	}
+	check(sameRequest(request,again),"decode(encode(request)) differs",input);
+	check(encoded==again.encode(),"encode is not stable",input);
+
+	std::string_view path=request.getPath(); //URL编码和解码互逆
+	check(httpd::utils::urlDecode(httpd::utils::urlEncode(path,arena),arena)==path,"urlDecode(urlEncode(path)) differs",input);
+	std::string_view lower=httpd::utils::toLower(path,arena);
+	check(lower.size()==path.size() && httpd::utils::equalsIgnoreCase(lower,path),"toLower changed more than case",input);
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* p_data, size_t size){
+	fuzzOne(std::string_view(reinterpret_cast<const char*>(p_data),size));
+	return 0;
+}
+
+#ifndef HTTPD_LIBFUZZER
+namespace
+{
+
+std::string mutate(const std::vector<std::string>& corpus, std::mt19937_64& rng){ //在一个语料上做几次随机的字节修改、插入、删除、拼接
+	std::string input=corpus[rng()%corpus.size()];
+	static const char* tokens[]={"\r\n","\n",":"," ","%","%2","%2B","+","content-length: ","Content-Length: 99999999\r\n","\r\n\r\n","GET ","POST ","HTTP/1.1","HTTP/1.0","HTTP/2.0","\t","\0"};
+	for (size_t n=1+rng()%4;n>0;--n){
+		size_t pos=input.empty()? 0:rng()%(input.size()+1);
+		switch (rng()%6){
+			case 0: if (!input.empty() && pos<input.size()) input[pos]=static_cast<char>(rng()); break;
+			case 1: input.insert(pos,1,static_cast<char>(rng())); break;
+			case 2: if (pos<input.size()) input.erase(pos,1+rng()%std::min<size_t>(8,input.size()-pos)); break;
+			case 3: input.insert(pos,tokens[rng()%(sizeof(tokens)/sizeof(tokens[0]))]); break;
+			case 4:{
+				const std::string& other=corpus[rng()%corpus.size()];
+				size_t begin=other.empty()? 0:rng()%other.size();
+				input.insert(pos,other.substr(begin,rng()%64));
+				break;
+			}
+			default: if (pos<input.size()) input.resize(pos); break;
+		}
+	}
+	return input;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	std::cerr.rdbuf(nullptr); //解析出错时会打印到cerr
+	std::vector<std::string> corpus;
+	size_t runs=0;
+	for (int i=1;i<argc;++i){
+		std::string arg=argv[i];
+		if ("runs"==arg && i+1<argc){
+			runs=strtoull(argv[++i],NULL,10);
+			continue;
+		}
+		std::vector<std::filesystem::path> files;
+		if (std::filesystem::is_directory(arg)) for (const auto& entry:std::filesystem::directory_iterator(arg)) files.push_back(entry.path());
+		else files.push_back(arg);
+		for (const auto& file:files){
+			std::ifstream in(file,std::ios::binary);
+			corpus.emplace_back(std::istreambuf_iterator<char>(in),std::istreambuf_iterator<char>());
+		}
+	}
+	if (corpus.empty()){
+		fprintf(stderr,"Usage: %s corpus_dir_or_file... [runs N]\n",argv[0]);
+		return 1;
+	}
+	for (const auto& input:corpus) fuzzOne(input);
+	printf("%zu corpus inputs ok\n",corpus.size());
+	std::mt19937_64 rng(std::random_device{}());
+	for (size_t i=0;i<runs;++i) fuzzOne(mutate(corpus,rng));
+	if (runs>0) printf("%zu mutated inputs ok\n",runs);
+	return 0;
+}
+#endif
@@ -0,0 +1,189 @@
+// 解析和编码热点函数的微基准：每个用例先预热，再按样本计时，每个样本跑够SAMPLE_MS毫秒，报告每次操作纳秒数的中位数、平均值、标准差和95%置信区间
+// 用法：make microbench && ./microbench [过滤子串] [samples N]；改动解析器或编码器前后各跑一次，对比中位数，区间重叠时差异不可信
+// 只依赖httpd本身，不需要外部的基准测试库
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cmath>
+#include "../httpd.h"
+
+#define WARMUP_MS 100 //每个用例先跑这么久，让缓存和分支预测稳定下来
+#define SAMPLE_MS 20 //每个样本至少跑这么久，时钟的误差可以忽略
+#define DEFAULT_SAMPLES 20
+
+namespace
+{
+
+template<typename T>
+inline void keep(const T& value){ //阻止编译器把结果没被用到的计算优化掉
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+int64_t nowNs(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Case{
+	std::string name;
+	std::function<void(size_t)> run; //跑n次操作
+};
+
+void report(const Case& c, const size_t& samples){
+	//预热，同时估计每个样本需要的次数
+	size_t iterations=1;
+	int64_t begin=nowNs();
+	int64_t start=begin;
+	while (start-begin<WARMUP_MS*1000000LL){
+		c.run(iterations);
+		if (nowNs()-start<1000000) iterations*=2; //一轮不到1毫秒时计时不准
+		start=nowNs();
+	}
+	c.run(iterations);
+	double per_op=static_cast<double>(nowNs()-start)/iterations;
+	iterations=std::max<size_t>(1,static_cast<size_t>(SAMPLE_MS*1e6/std::max(per_op,0.1)));
+
+	std::vector<double> times; //每个样本的纳秒每次
+	for (size_t i=0;i<samples;++i){
+		start=nowNs();
+		c.run(iterations);
+		times.push_back(static_cast<double>(nowNs()-start)/iterations);
+	}
+	std::sort(times.begin(),times.end());
+	double mean=std::accumulate(times.begin(),times.end(),0.0)/times.size();
+	double variance=0;
+	for (double t:times) variance+=(t-mean)*(t-mean);
+	double stddev=times.size()>1? std::sqrt(variance/(times.size()-1)):0;
+	double median=times.size()%2? times[times.size()/2]:(times[times.size()/2-1]+times[times.size()/2])/2;
+	double ci=1.96*stddev/std::sqrt(times.size());
+	printf("%-28s %10.1f %10.1f %9.1f %9.1f %9.1f %6.1f%% %10zu\n",c.name.c_str(),median,mean,stddev,times.front(),times.back(),mean>0? ci*100/mean:0,iterations);
+}
+
+const char* request_raw= //浏览器请求首页时的典型请求
+	"GET /sub/%E4%B8%AD%E6%96%87/index.html?lang=zh&q=a+b HTTP/1.1\r\n"
+	"Host: 127.0.0.1:8080\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:118.0) Gecko/20100101 Firefox/118.0\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+	"Accept-Language: zh-CN,zh;q=0.8,zh-TW;q=0.7,zh-HK;q=0.5,en-US;q=0.3,en;q=0.2\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Connection: keep-alive\r\n"
+	"Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+	"Upgrade-Insecure-Requests: 1\r\n"
+	"Sec-Fetch-Dest: document\r\n"
+	"Sec-Fetch-Mode: navigate\r\n"
+	"Sec-Fetch-Site: none\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"\r\n";
+
+std::vector<Case> makeCases(const std::string& rule_file){
+	std::vector<Case> cases;
+	cases.push_back({"Request::completeLength",[](size_t n){
+		std::string_view raw(request_raw);
+		for (size_t i=0;i<n;++i) keep(httpd::Request::completeLength(raw));
+	}});
+	cases.push_back({"Request::decode",[](size_t n){
+		httpd::Exchange exchange;
+		for (size_t i=0;i<n;++i){
+			exchange.clear();
+			exchange.request.decode(request_raw);
+			keep(exchange.request.getPath().size());
+		}
+	}});
+	cases.push_back({"Request::getHeader",[](size_t n){
+		httpd::Exchange exchange;
+		exchange.request.decode(request_raw);
+		for (size_t i=0;i<n;++i){ //服务每个请求都会查的几个头，最后一个不存在
+			keep(exchange.request.getHeader("host"));
+			keep(exchange.request.getHeader("connection"));
+			keep(exchange.request.getHeader("Upgrade"));
+		}
+	}});
+	cases.push_back({"Response::setHeader",[](size_t n){
+		httpd::Exchange exchange;
+		for (size_t i=0;i<n;++i){
+			exchange.response.clear();
+			exchange.response.setHeader("server","USER202334261359");
+			exchange.response.setHeader("cache-control","no-store");
+			exchange.response.setHeader("connection","keep-alive");
+			keep(exchange.response.getHeaders().size());
+		}
+	}});
+	cases.push_back({"Response::encode",[](size_t n){
+		httpd::Exchange exchange;
+		static const char body[]="<html><body><h1>Hello World!</h1></body></html>";
+		for (size_t i=0;i<n;++i){
+			exchange.clear();
+			exchange.response.setStatusCodeAndMessage(httpd::StatusCodeAndMessage::Type::OK);
+			exchange.response.setBody(httpd::Body("text/html",std::string_view(body,sizeof(body)-1)));
+			exchange.response.setHeader("server","USER202334261359");
+			keep(exchange.response.encode().size());
+		}
+	}});
+	cases.push_back({"utils::urlDecode",[](size_t n){
+		::utils::Arena arena;
+		for (size_t i=0;i<n;++i){
+			arena.reset();
+			keep(httpd::utils::urlDecode("/sub/%E4%B8%AD%E6%96%87/index.html?lang=zh&q=a+b",arena).size());
+		}
+	}});
+	cases.push_back({"utils::urlEncode",[](size_t n){
+		::utils::Arena arena;
+		for (size_t i=0;i<n;++i){
+			arena.reset();
+			keep(httpd::utils::urlEncode("/sub/\xE4\xB8\xAD\xE6\x96\x87/index.html?lang=zh&q=a b",arena).size());
+		}
+	}});
+	cases.push_back({"utils::toLower",[](size_t n){
+		::utils::Arena arena;
+		for (size_t i=0;i<n;++i){
+			arena.reset();
+			keep(httpd::utils::toLower("Upgrade-Insecure-Requests",arena).size());
+		}
+	}});
+	auto sp_access=std::make_shared<httpd::IPAccessControl>(std::make_shared<std::string>(rule_file));
+	cases.push_back({"IPAccessControl::isAllow",[sp_access](size_t n){
+		auto sp_ip=std::make_shared<std::string>("127.0.0.1"); //匹配最后一条规则，最坏情况
+		for (size_t i=0;i<n;++i) keep(sp_access->isAllow(sp_ip));
+	}});
+	auto sp_fs=std::make_shared<httpd::FileSystem>(".");
+	cases.push_back({"FileSystem::getMimeType",[sp_fs](size_t n){
+		static const char* names[]={"/index.html","/style.css","/sub/1.png","/vdo.mp4","/data.json","/README"};
+		for (size_t i=0;i<n;++i) keep(sp_fs->getMimeType(names[i%6]));
+	}});
+	return cases;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	std::string filter;
+	size_t samples=DEFAULT_SAMPLES;
+	for (int i=1;i<argc;++i){
+		std::string arg=argv[i];
+		if ("samples"==arg && i+1<argc) samples=std::max(2L,strtol(argv[++i],NULL,10));
+		else filter=arg;
+	}
+
+	std::string rule_file="/tmp/microbench-rules."+std::to_string(getpid()); //16条不匹配的规则后面才是匹配的规则
+	{
+		std::ofstream rules(rule_file);
+		for (int i=0;i<16;++i) rules << "deny from 10." << i << ".0.0/16\n";
+		rules << "allow from 127.0.0.1/32\n";
+	}
+	std::cerr.rdbuf(nullptr);
+	auto cases=makeCases(rule_file);
+	unlink(rule_file.c_str());
+
+	printf("%-28s %10s %10s %9s %9s %9s %7s %10s\n","case (ns/op)","median","mean","stddev","min","max","ci95","iters");
+	for (const auto& c:cases){
+		if (!filter.empty() && c.name.npos==c.name.find(filter)) continue;
+		report(c,samples);
+	}
+	return 0;
+}
@@ -0,0 +1,22 @@
+#!/bin/bash
+# 混合负载下小文件的延迟：一批限速的慢客户端持续下载大文件，同时顺序请求小文件，统计小文件的p50/p99
+# 用法：先启动 ./httpd 8080 htdocs，再运行 bench/mixed.sh [端口] [小文件路径] [大文件路径]
+PORT=${1:-8080}
+SMALL=${2:-/index.html}
+LARGE=${3:-/vdo.mp4}
+SLOW_CLIENTS=${SLOW_CLIENTS:-16} #同时下载大文件的慢客户端数，超过线程数时小文件请求只能排队
+RATE=${RATE:-200k} #慢客户端的下载速率
+REQUESTS=${REQUESTS:-200}
+
+URL=http://127.0.0.1:$PORT
+END=$((SECONDS+3600))
+for ((i=0;i<SLOW_CLIENTS;++i)); do
+	( while [ $SECONDS -lt $END ]; do curl -s --limit-rate $RATE $URL$LARGE -o /dev/null; done ) &
+done
+trap 'kill $(jobs -p) 2>/dev/null' EXIT
+sleep 1
+
+echo "== $REQUESTS x $SMALL with $SLOW_CLIENTS clients downloading $LARGE at $RATE/s"
+for ((i=0;i<REQUESTS;++i)); do
+	curl -s $URL$SMALL -o /dev/null -w "%{time_total}\n"
+done | sort -n | awk '{ t[NR]=$1 } END { printf "p50 %.1f ms  p99 %.1f ms  max %.1f ms\n", t[int(NR*0.5)]*1000, t[int(NR*0.99)]*1000, t[NR]*1000 }'
@@ -0,0 +1,52 @@
+#!/bin/bash
+# 对比socket选项的效果：每种配置启动一次服务，统计延迟的p50/p99和每个请求发出的TCP报文段数（/proc/net/snmp的OutSegs，回环上客户端和服务端的都算在内）
+# 用法：在httpd所在目录运行 bench/socket.sh [docroot] [端口] [小文件路径] [大文件路径]
+# 设置CERT和KEY时再测HTTPS下载大文件（大于1MB不缓存，走sendfile，TCP_CORK的效果主要在这里）
+# 服务端的TCP Fast Open需要 sysctl -w net.ipv4.tcp_fastopen=3，否则fastopen那一行和默认配置一样
+DOC_ROOT=${1:-htdocs}
+PORT=${2:-8080}
+SMALL=${3:-/index.html}
+LARGE=${4:-/big.bin}
+REQUESTS=${REQUESTS:-2000}
+TLS_PORT=$((PORT+1))
+
+CONFIG=$(mktemp)
+trap 'rm -f $CONFIG; [ -n "$SERVER" ] && kill $SERVER 2>/dev/null' EXIT
+
+out_segs(){
+	awk '/^Tcp:/ { if (!n) { for (i=1;i<=NF;++i) if ("OutSegs"==$i) col=i; n=1 } else print $col }' /proc/net/snmp
+}
+
+run(){ # 名字 请求数 curl参数...：同一个curl按配置文件顺序请求，长连接时复用同一个连接
+	local name=$1 count=$2
+	shift 2
+	for ((i=0;i<count;++i)); do echo "url = \"$URL\""; echo 'output = "/dev/null"'; done > $CONFIG
+	local before=$(out_segs)
+	local times=$(curl -s -K $CONFIG -w "%{time_total}\n" "$@")
+	local segs=$(( $(out_segs)-before ))
+	echo "$times" | sort -n | awk -v name="$name" -v segs=$segs '{ t[NR]=$1 } END { printf "  %-24s p50 %8.3f ms  p99 %8.3f ms  %6.1f segs/req\n", name, t[int(NR*0.5)]*1000, t[int(NR*0.99)]*1000, segs/NR }'
+}
+
+bench(){ # 配置名 httpd的tcp选项...
+	local name=$1
+	shift
+	local tls=()
+	[ -n "$CERT" ] && tls=(tls $TLS_PORT $CERT $KEY)
+	./httpd $PORT $DOC_ROOT "${tls[@]}" "$@" >/dev/null 2>&1 &
+	SERVER=$!
+	sleep 0.5
+	echo "== $name"
+	URL=http://127.0.0.1:$PORT$SMALL run "keep-alive $SMALL" $REQUESTS
+	URL=http://127.0.0.1:$PORT$SMALL run "new conn $SMALL" $((REQUESTS/4)) -H "Connection: close" --tcp-fastopen
+	[ -n "$CERT" ] && URL=https://127.0.0.1:$TLS_PORT$LARGE run "https $LARGE" 20 -k --http1.1
+	kill $SERVER
+	wait $SERVER 2>/dev/null
+	SERVER=
+}
+
+bench "default"
+bench "tcp nodelay 0" tcp nodelay 0
+bench "tcp cork 0" tcp cork 0
+bench "tcp defer_accept 0" tcp defer_accept 0
+bench "tcp fastopen 0" tcp fastopen 0
+bench "all off" tcp nodelay 0 tcp cork 0 tcp defer_accept 0 tcp fastopen 0
@@ -0,0 +1,26 @@
+#!/bin/bash
+# 比较HTTPS和HTTP：握手速率（新建/复用会话）和大文件吞吐
+# 用法：先启动 ./httpd 8080 htdocs tls 8443 cert.pem key.pem，再运行 bench/tls.sh [文件路径] [http端口] [https端口]
+# 文件路径相对于docroot，大于1MB的文件才会走sendfile
+FILE=${1:-/big.bin}
+HTTP_PORT=${2:-8080}
+HTTPS_PORT=${3:-8443}
+SECONDS_PER_RUN=${SECONDS_PER_RUN:-5}
+ROUNDS=${ROUNDS:-5}
+
+echo "== handshakes/sec (new sessions)"
+openssl s_time -connect 127.0.0.1:$HTTPS_PORT -new -time $SECONDS_PER_RUN 2>/dev/null | grep "connections/user sec"
+echo "== handshakes/sec (resumed sessions)"
+openssl s_time -connect 127.0.0.1:$HTTPS_PORT -reuse -time $SECONDS_PER_RUN 2>/dev/null | grep "connections/user sec"
+
+throughput(){ # 多次下载取平均，单位MB/s
+	for ((i=0;i<ROUNDS;++i)); do
+		curl -sk "$@" -o /dev/null -w "%{speed_download}\n"
+	done | awk '{ total+=$1 } END { printf "%.1f", total/NR/1048576 }'
+}
+
+echo "== large file throughput (MB/s)"
+echo "http/1.1  plain: $(throughput --http1.1 http://127.0.0.1:$HTTP_PORT$FILE)"
+echo "http/1.1  tls:   $(throughput --http1.1 https://127.0.0.1:$HTTPS_PORT$FILE)"
+echo "h2        plain: $(throughput --http2-prior-knowledge http://127.0.0.1:$HTTP_PORT$FILE)"
+echo "h2        tls:   $(throughput --http2 https://127.0.0.1:$HTTPS_PORT$FILE)"
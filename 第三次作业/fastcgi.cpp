@@ -0,0 +1,686 @@
+#include "fastcgi.h"
+
+
+namespace httpd
+{
+
+namespace fastcgi
+{
+
+namespace
+{
+
+const uint16_t ROLE_RESPONDER=1;
+const uint8_t FLAG_KEEP_CONN=1;
+
+void putHeader(char* p_head, const RecordType& type, const uint16_t& id, const size_t& len){ //FastCGI 1.0 3.3 Records
+	p_head[0]=FASTCGI_VERSION;
+	p_head[1]=static_cast<char>(type);
+	p_head[2]=static_cast<char>(id>>8);
+	p_head[3]=static_cast<char>(id&0xff);
+	p_head[4]=static_cast<char>(len>>8);
+	p_head[5]=static_cast<char>(len&0xff);
+	p_head[6]=0; //不加padding
+	p_head[7]=0;
+}
+
+void appendRecord(std::string& out, const RecordType& type, const uint16_t& id, const std::string_view& content){ //content可以为空，表示流结束
+	char head[FASTCGI_HEADER_LEN];
+	putHeader(head,type,id,content.size());
+	out.append(head,FASTCGI_HEADER_LEN);
+	out.append(content);
+}
+
+void appendLength(std::string& out, const size_t& len){ //FastCGI 1.0 3.4 Name-Value Pairs：小于128用1字节，否则用4字节
+	if (len<128){
+		out.push_back(static_cast<char>(len));
+		return;
+	}
+	out.push_back(static_cast<char>((len>>24)|0x80));
+	out.push_back(static_cast<char>((len>>16)&0xff));
+	out.push_back(static_cast<char>((len>>8)&0xff));
+	out.push_back(static_cast<char>(len&0xff));
+}
+
+void appendPair(std::string& out, const std::string_view& name, const std::string_view& value){
+	appendLength(out,name.size());
+	appendLength(out,value.size());
+	out.append(name);
+	out.append(value);
+}
+
+bool readLength(const std::string_view& data, size_t& pos, size_t& len){
+	if (pos>=data.size()) return false;
+	uint8_t first=data[pos];
+	if (first<128){
+		len=first;
+		++pos;
+		return true;
+	}
+	if (pos+4>data.size()) return false;
+	len=((first&0x7f)<<24)|(static_cast<uint8_t>(data[pos+1])<<16)|(static_cast<uint8_t>(data[pos+2])<<8)|static_cast<uint8_t>(data[pos+3]);
+	pos+=4;
+	return true;
+}
+
+bool readPair(const std::string_view& data, size_t& pos, std::string_view& name, std::string_view& value){ //读出一个名字-值对，读完了或者格式错误返回false
+	size_t name_len=0;
+	size_t value_len=0;
+	if (!readLength(data,pos,name_len) || !readLength(data,pos,value_len) || pos+name_len+value_len>data.size()) return false;
+	name=data.substr(pos,name_len);
+	value=data.substr(pos+name_len,value_len);
+	pos+=name_len+value_len;
+	return true;
+}
+
+bool readAll(int fd, char* buf, size_t len, const int& timeout_ms){ //读满len字节，对方在开始读之前关闭连接返回false；timeout_ms为-1表示不超时
+	size_t done=0;
+	while (done<len){
+		if (timeout_ms>=0){
+			struct pollfd pfd={fd,POLLIN,0};
+			int result=poll(&pfd,1,timeout_ms);
+			if (result<0 && EINTR==errno) continue;
+			if (result<=0) throw std::runtime_error("worker timeout in fastcgi::readAll");
+		}
+		ssize_t result=::read(fd,buf+done,len-done);
+		if (result<0 && EINTR==errno) continue;
+		if (result<0) throw std::runtime_error("read failed in fastcgi::readAll");
+		if (0==result){
+			if (0==done) return false;
+			throw std::runtime_error("worker closed in the middle of a record in fastcgi::readAll");
+		}
+		done+=result;
+	}
+	return true;
+}
+
+std::string_view trim(std::string_view str){
+	while (!str.empty() && (' '==str.front() || '\t'==str.front())) str.remove_prefix(1);
+	while (!str.empty() && (' '==str.back() || '\t'==str.back() || '\r'==str.back())) str.remove_suffix(1);
+	return str;
+}
+
+} // namespace
+
+/*------------implement of Stream--------------*/
+Stream::Stream(std::shared_ptr<Connection> sp_connection, const uint16_t& id):
+	sp_connection(sp_connection),
+	id(id),
+	begin(0),
+	is_sent(false),
+	is_ended(false),
+	is_failed(false),
+	p_cancel(nullptr){}
+
+Stream::~Stream(){
+	bool is_done;
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		is_done=this->is_ended || this->is_failed;
+	}
+	if (!is_done) this->sp_connection->abort(this->id); //worker还在处理，让它停下来，id在收到END_REQUEST之后才能复用
+}
+
+std::string_view Stream::readHead(::utils::Arena& arena){
+	std::unique_lock<std::mutex> lock(this->mtx);
+	size_t searched=this->begin;
+	while (1){
+		auto data=std::string_view(this->buf).substr(this->begin);
+		size_t from=searched-this->begin>=3? searched-this->begin-3:0; //分隔符可能跨两次收到的数据
+		size_t len=0;
+		auto pos=data.find("\r\n\r\n",from);
+		if (data.npos!=pos) len=pos+4;
+		else{
+			pos=data.find("\n\n",from);
+			if (data.npos!=pos) len=pos+2;
+		}
+		if (len>0){
+			auto head=arena.copy(data.substr(0,len));
+			this->begin+=len;
+			this->cv.notify_all();
+			return head;
+		}
+		if (data.size()>PROXY_MAX_HEAD_SIZE) throw HttpException(StatusCodeAndMessage::Type::BadGateway);
+		searched=this->buf.size();
+		if (!this->wait(lock)) throw HttpException(StatusCodeAndMessage::Type::BadGateway); //响应头不完整worker就结束了
+	}
+}
+
+size_t Stream::read(char* buf, const size_t& len){
+	std::unique_lock<std::mutex> lock(this->mtx);
+	if (this->begin==this->buf.size() && !this->wait(lock)){
+		if (this->is_failed) throw std::runtime_error("worker connection lost in fastcgi::Stream::read");
+		return 0;
+	}
+	size_t n=std::min(len,this->buf.size()-this->begin);
+	memcpy(buf,this->buf.data()+this->begin,n);
+	this->begin+=n;
+	if (this->begin==this->buf.size()){
+		this->buf.clear();
+		this->begin=0;
+	}
+	this->cv.notify_all(); //读线程可能在等缓存有空间
+	return n;
+}
+
+void Stream::setSent(){
+	std::lock_guard<std::mutex> lock(this->mtx);
+	this->is_sent=true;
+}
+
+bool Stream::push(const char* p_data, const size_t& len){
+	std::unique_lock<std::mutex> lock(this->mtx);
+	if (this->is_sent){ //一个请求的输出太多时读线程等客户端，同一个连接上的其他请求也会等，所以要有超时
+		bool is_ready=this->cv.wait_for(lock,std::chrono::seconds(FASTCGI_TIMEOUT_SEC),[this](){
+			return this->buf.size()-this->begin<FASTCGI_STREAM_BUFFER_SIZE || this->is_failed;
+		});
+		if (!is_ready) return false;
+	}
+	if (this->is_failed) return true; //已经放弃的请求，数据直接丢掉
+	if (this->begin>0 && this->begin>=this->buf.size()/2){ //读出的部分超过一半了，挪到前面去
+		this->buf.erase(0,this->begin);
+		this->begin=0;
+	}
+	this->buf.append(p_data,len);
+	this->cv.notify_all();
+	return true;
+}
+
+void Stream::end(){
+	std::lock_guard<std::mutex> lock(this->mtx);
+	this->is_ended=true;
+	this->cv.notify_all();
+}
+
+void Stream::fail(){
+	std::lock_guard<std::mutex> lock(this->mtx);
+	this->is_failed=true;
+	this->cv.notify_all();
+}
+
+uint16_t Stream::getId() const{
+	return this->id;
+}
+
+void Stream::setCancelToken(const CancelToken* p_cancel){
+	std::lock_guard<std::mutex> lock(this->mtx);
+	this->p_cancel=p_cancel;
+}
+
+bool Stream::wait(std::unique_lock<std::mutex>& lock){
+	size_t size=this->buf.size();
+	auto is_changed=[this,size](){
+		return this->buf.size()!=size || this->is_ended || this->is_failed;
+	};
+	auto deadline=std::chrono::steady_clock::now()+std::chrono::seconds(FASTCGI_TIMEOUT_SEC);
+	while (!is_changed()){
+		auto now=std::chrono::steady_clock::now();
+		if (now>=deadline) throw HttpException(StatusCodeAndMessage::Type::GatewayTimeout);
+		auto timeout=deadline-now;
+		if (nullptr!=this->p_cancel) timeout=std::min<std::chrono::steady_clock::duration>(timeout,std::chrono::milliseconds(this->p_cancel->waitMs(CANCEL_CHECK_MS))); //分段等待，中间检查请求是否被取消
+		if (this->cv.wait_for(lock,timeout,is_changed)) break;
+		if (nullptr!=this->p_cancel) this->p_cancel->check(); //放弃后Stream析构时让worker中止这个请求
+	}
+	return this->buf.size()>this->begin;
+}
+
+/*------------implement of Connection--------------*/
+Connection::Connection(int fd, const size_t& max_requests, std::function<void()> on_release):
+	fd(fd),
+	max_requests(max_requests),
+	on_release(std::move(on_release)),
+	next_id(1),
+	is_alive(true){}
+
+Connection::~Connection(){
+	::close(this->fd);
+}
+
+std::shared_ptr<Connection> Connection::open(int fd, std::function<void()> on_release){
+	size_t max_requests=1; //不回答GET_VALUES的worker当作不支持多路复用
+	try{
+		std::string query;
+		appendPair(query,"FCGI_MPXS_CONNS","");
+		appendPair(query,"FCGI_MAX_REQS","");
+		std::string record;
+		appendRecord(record,RecordType::GET_VALUES,0,query);
+		struct iovec iov={record.data(),record.size()};
+		utils::writeAll(fd,&iov,1);
+
+		char head[FASTCGI_HEADER_LEN];
+		if (!readAll(fd,head,FASTCGI_HEADER_LEN,FASTCGI_TIMEOUT_SEC*1000)) throw std::runtime_error("worker closed in Connection::open");
+		size_t len=(static_cast<uint8_t>(head[4])<<8)|static_cast<uint8_t>(head[5]);
+		std::string content(len+static_cast<uint8_t>(head[6]),'\0');
+		if (!content.empty() && !readAll(fd,content.data(),content.size(),FASTCGI_TIMEOUT_SEC*1000)) throw std::runtime_error("worker closed in Connection::open");
+		if (static_cast<char>(RecordType::GET_VALUES_RESULT)==head[1]){
+			bool is_mpxs=false;
+			size_t max_reqs=FASTCGI_MAX_REQUESTS;
+			std::string_view data(content.data(),len);
+			std::string_view name,value;
+			size_t pos=0;
+			while (readPair(data,pos,name,value)){
+				if ("FCGI_MPXS_CONNS"==name) is_mpxs="1"==value;
+				else if ("FCGI_MAX_REQS"==name) std::from_chars(value.data(),value.data()+value.size(),max_reqs);
+			}
+			if (is_mpxs) max_requests=std::max<size_t>(1,std::min<size_t>(max_reqs,FASTCGI_MAX_REQUESTS));
+		}
+	}
+	catch(const std::exception& e){
+		::close(fd);
+		throw;
+	}
+	auto sp_connection=std::make_shared<Connection>(fd,max_requests,std::move(on_release));
+	std::thread(&Connection::readLoop,sp_connection).detach(); //读线程持有连接，socket关闭后才退出
+	return sp_connection;
+}
+
+std::shared_ptr<Stream> Connection::begin(const Request& request, const std::string_view& script_name){
+	std::shared_ptr<Stream> sp_stream;
+	{ //找一个没有被占用的id
+		std::lock_guard<std::mutex> lock(this->mtx);
+		if (!this->is_alive || this->streams.size()>=this->max_requests) return nullptr;
+		while (0==this->next_id || this->streams.end()!=this->streams.find(this->next_id)) ++this->next_id;
+		sp_stream=std::make_shared<Stream>(this->shared_from_this(),this->next_id);
+		this->streams.emplace(this->next_id,sp_stream);
+		++this->next_id;
+	}
+	uint16_t id=sp_stream->getId();
+
+	//CGI/1.1的环境变量
+	auto path=request.getPath();
+	auto query_pos=path.find('?');
+	std::string_view query=path.npos==query_pos? std::string_view():path.substr(query_pos+1);
+	auto script_path=path.substr(0,query_pos);
+	std::string_view content;
+	if (nullptr!=request.getBody()) content=request.getBody()->getContent();
+	std::string params;
+	appendPair(params,"GATEWAY_INTERFACE","CGI/1.1");
+	appendPair(params,"SERVER_SOFTWARE","httpd");
+	appendPair(params,"SERVER_PROTOCOL",request.getVersion().toString());
+	appendPair(params,"REQUEST_METHOD",request.getMethod().toString());
+	appendPair(params,"REQUEST_URI",path);
+	appendPair(params,"SCRIPT_NAME",script_name);
+	appendPair(params,"PATH_INFO",script_path.substr(std::min(script_name.size(),script_path.size())));
+	appendPair(params,"QUERY_STRING",query);
+	appendPair(params,"CONTENT_LENGTH",std::to_string(content.size()));
+	std::string name;
+	for (const auto& field:request.getHeaders()){
+		if (field.key.empty() || ':'==field.key[0] || "content-length"==field.key) continue;
+		if ("proxy"==field.key) continue; //HTTP_PROXY会被很多CGI程序当成出站代理的环境变量（httpoxy），客户端不能设置它
+		if ("content-type"==field.key){
+			appendPair(params,"CONTENT_TYPE",field.value);
+			continue;
+		}
+		name="HTTP_";
+		for (char c:field.key) name.push_back('-'==c? '_':toupper(static_cast<unsigned char>(c)));
+		appendPair(params,name,field.value);
+	}
+
+	std::string records;
+	char begin_body[8]={0,ROLE_RESPONDER,FLAG_KEEP_CONN,0,0,0,0,0};
+	appendRecord(records,RecordType::BEGIN_REQUEST,id,std::string_view(begin_body,sizeof(begin_body)));
+	for (size_t offset=0;offset<params.size();offset+=FASTCGI_MAX_CONTENT_LEN) appendRecord(records,RecordType::PARAMS,id,std::string_view(params).substr(offset,FASTCGI_MAX_CONTENT_LEN));
+	appendRecord(records,RecordType::PARAMS,id,std::string_view());
+
+	//请求体按记录切开，每个记录头后面直接引用请求中的数据，不拷贝
+	size_t chunks=(content.size()+FASTCGI_MAX_CONTENT_LEN-1)/FASTCGI_MAX_CONTENT_LEN;
+	std::vector<std::array<char,FASTCGI_HEADER_LEN>> heads(chunks+1);
+	std::vector<struct iovec> iov;
+	iov.reserve(2*chunks+2);
+	iov.push_back({records.data(),records.size()});
+	for (size_t i=0;i<chunks;++i){
+		size_t offset=i*FASTCGI_MAX_CONTENT_LEN;
+		size_t len=std::min<size_t>(FASTCGI_MAX_CONTENT_LEN,content.size()-offset);
+		putHeader(heads[i].data(),RecordType::STDIN,id,len);
+		iov.push_back({heads[i].data(),FASTCGI_HEADER_LEN});
+		iov.push_back({const_cast<char*>(content.data()+offset),len});
+	}
+	putHeader(heads[chunks].data(),RecordType::STDIN,id,0);
+	iov.push_back({heads[chunks].data(),FASTCGI_HEADER_LEN});
+	try{
+		std::lock_guard<std::mutex> lock(this->write_mtx);
+		this->write(iov.data(),iov.size());
+	}
+	catch(const std::exception& e){
+		this->close(); //连接已经不能用了，读线程会让这个请求失败
+		throw;
+	}
+	sp_stream->setSent();
+	return sp_stream;
+}
+
+void Connection::abort(const uint16_t& id){
+	std::lock_guard<std::mutex> lock(this->mtx);
+	auto it=this->streams.find(id);
+	if (this->streams.end()==it || !it->second.expired()) return; //已经收到END_REQUEST，id可能被新的请求用了
+	this->writeAbort(id);
+}
+
+void Connection::writeAbort(const uint16_t& id){
+	char head[FASTCGI_HEADER_LEN];
+	putHeader(head,RecordType::ABORT_REQUEST,id,0);
+	struct iovec iov={head,FASTCGI_HEADER_LEN};
+	try{
+		std::lock_guard<std::mutex> write_lock(this->write_mtx);
+		this->write(&iov,1);
+	}
+	catch(const std::exception& e){
+		std::cerr << e.what() << '\n';
+		this->is_alive=false;
+		shutdown(this->fd,SHUT_RDWR);
+	}
+}
+
+void Connection::close(){
+	this->is_alive=false;
+	shutdown(this->fd,SHUT_RDWR);
+}
+
+size_t Connection::getActive() const{
+	std::lock_guard<std::mutex> lock(this->mtx);
+	return this->streams.size();
+}
+
+bool Connection::isAvailable() const{
+	std::lock_guard<std::mutex> lock(this->mtx);
+	return this->is_alive && this->streams.size()<this->max_requests;
+}
+
+bool Connection::isAlive() const{
+	return this->is_alive;
+}
+
+void Connection::readLoop(){
+	std::vector<char> content(FASTCGI_MAX_CONTENT_LEN+255); //加上最长的padding
+	char head[FASTCGI_HEADER_LEN];
+	try{
+		while (readAll(this->fd,head,FASTCGI_HEADER_LEN,-1)){
+			auto type=static_cast<RecordType>(head[1]);
+			uint16_t id=(static_cast<uint8_t>(head[2])<<8)|static_cast<uint8_t>(head[3]);
+			size_t len=(static_cast<uint8_t>(head[4])<<8)|static_cast<uint8_t>(head[5]);
+			size_t padding=static_cast<uint8_t>(head[6]);
+			if (len+padding>0 && !readAll(this->fd,content.data(),len+padding,-1)) break;
+
+			std::shared_ptr<Stream> sp_stream; //在锁外面释放，Stream析构时会调用abort
+			{
+				std::lock_guard<std::mutex> lock(this->mtx);
+				auto it=this->streams.find(id);
+				if (this->streams.end()!=it) sp_stream=it->second.lock();
+			}
+			if (RecordType::STDOUT==type){
+				if (nullptr!=sp_stream && len>0 && !sp_stream->push(content.data(),len)){ //客户端太久不读，放弃这个请求
+					sp_stream->fail();
+					this->writeAbort(id);
+				}
+			}
+			else if (RecordType::STDERR==type){
+				if (len>0) std::cerr << "FastCGI stderr: " << std::string_view(content.data(),len) << std::flush;
+			}
+			else if (RecordType::END_REQUEST==type){
+				if (nullptr!=sp_stream) sp_stream->end();
+				{
+					std::lock_guard<std::mutex> lock(this->mtx);
+					this->streams.erase(id);
+				}
+				this->on_release();
+			}
+		}
+	}
+	catch(const std::exception& e){
+		if (this->is_alive) std::cerr << e.what() << '\n';
+	}
+
+	//连接断了，还没有结束的请求都失败
+	this->is_alive=false;
+	std::vector<std::shared_ptr<Stream>> failed;
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		for (auto& item:this->streams){
+			auto sp_stream=item.second.lock();
+			if (nullptr!=sp_stream) failed.push_back(sp_stream);
+		}
+		this->streams.clear();
+	}
+	for (auto& sp_stream:failed) sp_stream->fail();
+	failed.clear();
+	this->on_release();
+}
+
+void Connection::write(struct iovec* iov, const size_t& iovcnt){
+	utils::writeAll(this->fd,iov,iovcnt);
+}
+
+/*------------implement of Application--------------*/
+Application::Application(const std::string& address):
+	listen_fd(-1),
+	is_stopping(false),
+	up_upstream(std::make_unique<Upstream>(address)),
+	connecting(0),
+	requests(0),
+	restarts(0){}
+
+Application::Application(const std::string& program, const size_t& workers):
+	listen_fd(-1),
+	program(program),
+	worker_pids(std::max<size_t>(workers,1),-1),
+	is_stopping(false),
+	connecting(0),
+	requests(0),
+	restarts(0){
+	static std::atomic<size_t> count(0);
+	this->socket_path="/tmp/httpd-fastcgi."+std::to_string(getpid())+"."+std::to_string(count++)+".sock";
+	struct sockaddr_un addr={};
+	addr.sun_family=AF_UNIX;
+	memcpy(addr.sun_path,this->socket_path.data(),this->socket_path.size());
+	this->listen_fd=socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+	if (this->listen_fd<0) throw std::runtime_error("socket failed in Application::Application");
+	unlink(this->socket_path.c_str());
+	if (bind(this->listen_fd,reinterpret_cast<struct sockaddr*>(&addr),sizeof(addr))<0 || listen(this->listen_fd,FASTCGI_LISTEN_QUEUE_LEN)<0){
+		::close(this->listen_fd);
+		throw std::runtime_error("bind failed in Application::Application: "+this->socket_path);
+	}
+	this->up_upstream=std::make_unique<Upstream>("unix:"+this->socket_path);
+	this->supervisor=std::thread(&Application::supervise,this); //worker由监管线程启动，监管线程退出时worker也会收到SIGTERM
+}
+
+Application::~Application(){
+	this->is_stopping=true;
+	this->cv.notify_all();
+	if (this->supervisor.joinable()) this->supervisor.join();
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		for (auto& sp_connection:this->connections) sp_connection->close();
+		this->connections.clear();
+	}
+	if (this->listen_fd>=0){
+		::close(this->listen_fd);
+		unlink(this->socket_path.c_str());
+	}
+}
+
+std::shared_ptr<Stream> Application::start(const Request& request, const std::string_view& script_name){
+	++this->requests;
+	for (size_t i=0;i<=FASTCGI_MAX_CONNECTIONS;++i){ //选中的连接可能刚被别的请求占满或者刚断开，换一个再试
+		auto sp_connection=this->acquire();
+		std::shared_ptr<Stream> sp_stream;
+		try{
+			sp_stream=sp_connection->begin(request,script_name);
+		}
+		catch(const std::exception& e){
+			std::cerr << e.what() << '\n';
+			continue;
+		}
+		if (nullptr!=sp_stream) return sp_stream;
+	}
+	throw HttpException(StatusCodeAndMessage::Type::BadGateway);
+}
+
+void Application::appendStats(const std::string& name, std::string& out) const{
+	size_t connections=0;
+	size_t active=0;
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		for (const auto& sp_connection:this->connections){
+			if (!sp_connection->isAlive()) continue;
+			++connections;
+			active+=sp_connection->getActive();
+		}
+	}
+	std::string label="{route=\""+name+"\"} ";
+	out+="fastcgi_requests"+label+std::to_string(this->requests)+"\n";
+	out+="fastcgi_active"+label+std::to_string(active)+"\n";
+	out+="fastcgi_connections"+label+std::to_string(connections)+"\n";
+	out+="fastcgi_worker_restarts"+label+std::to_string(this->restarts)+"\n";
+}
+
+std::shared_ptr<Connection> Application::acquire(){
+	std::unique_lock<std::mutex> lock(this->mtx);
+	auto deadline=std::chrono::steady_clock::now()+std::chrono::seconds(FASTCGI_TIMEOUT_SEC);
+	while (1){
+		auto it=this->connections.begin();
+		while (this->connections.end()!=it){ //去掉已经断开的连接
+			if ((*it)->isAlive()) ++it;
+			else it=this->connections.erase(it);
+		}
+		std::shared_ptr<Connection> sp_best;
+		size_t best_active=SIZE_MAX;
+		for (auto& sp_connection:this->connections){
+			size_t active=sp_connection->getActive();
+			if (active<best_active && sp_connection->isAvailable()){
+				sp_best=sp_connection;
+				best_active=active;
+			}
+		}
+		if (nullptr!=sp_best && 0==best_active) return sp_best;
+
+		//没有空闲的连接就新建一个，请求分散到不同的worker进程上
+		if (this->connections.size()+this->connecting<FASTCGI_MAX_CONNECTIONS){
+			++this->connecting;
+			lock.unlock();
+			std::shared_ptr<Connection> sp_connection;
+			try{
+				sp_connection=Connection::open(this->up_upstream->connectTo(),[this](){ this->cv.notify_all(); });
+			}
+			catch(const std::exception& e){
+				std::cerr << e.what() << '\n';
+			}
+			lock.lock();
+			--this->connecting;
+			if (nullptr!=sp_connection){
+				this->connections.push_back(sp_connection);
+				return sp_connection;
+			}
+			if (nullptr!=sp_best) return sp_best;
+			throw HttpException(StatusCodeAndMessage::Type::BadGateway);
+		}
+		if (nullptr!=sp_best) return sp_best; //连接数到上限了，复用支持多路复用的连接
+		if (std::cv_status::timeout==this->cv.wait_until(lock,deadline)) throw HttpException(StatusCodeAndMessage::Type::ServiceUnavailable);
+	}
+}
+
+void Application::supervise(){
+	while (!this->is_stopping){
+		for (auto& pid:this->worker_pids){
+			if (pid>0){
+				int status=0;
+				if (waitpid(pid,&status,WNOHANG)!=pid) continue;
+				std::cerr << "FastCGI worker " << pid << " exited (status " << status << "), restarting" << std::endl;
+				++this->restarts;
+			}
+			pid=this->spawn(); //失败了下一轮再试
+		}
+		std::unique_lock<std::mutex> lock(this->mtx);
+		this->cv.wait_for(lock,std::chrono::milliseconds(FASTCGI_SUPERVISE_INTERVAL_MS),[this](){ return this->is_stopping.load(); });
+	}
+	for (auto pid:this->worker_pids){
+		if (pid<=0) continue;
+		kill(pid,SIGTERM);
+		waitpid(pid,nullptr,0);
+	}
+}
+
+pid_t Application::spawn() const{
+	pid_t pid=fork();
+	if (pid<0){
+		std::cerr << "fork failed in Application::spawn\n";
+		return -1;
+	}
+	if (0==pid){ //子进程：按FastCGI的约定，监听socket放在0号描述符上
+		prctl(PR_SET_PDEATHSIG,SIGTERM); //服务退出时worker也退出
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK,&mask,nullptr);
+		signal(SIGPIPE,SIG_DFL);
+		dup2(this->listen_fd,0);
+		execl(this->program.c_str(),this->program.c_str(),static_cast<char*>(nullptr));
+		_exit(127);
+	}
+	return pid;
+}
+
+} // namespace fastcgi
+
+/*------------implement of FastCgi--------------*/
+void FastCgi::addRoute(const std::string& prefix, std::unique_ptr<fastcgi::Application> up_application){
+	auto it=this->routes.begin();
+	while (this->routes.end()!=it && it->first.size()>=prefix.size()) ++it;
+	this->routes.emplace(it,prefix,std::move(up_application));
+}
+
+bool FastCgi::handle(Request& request, Response& response){
+	fastcgi::Application* p_application=nullptr;
+	std::string_view prefix;
+	for (auto& route:this->routes){
+		if (0==request.getPath().compare(0,route.first.size(),route.first)){
+			p_application=route.second.get();
+			prefix=route.first;
+			break;
+		}
+	}
+	if (nullptr==p_application) return false;
+
+	auto sp_stream=p_application->start(request,prefix);
+	sp_stream->setCancelToken(request.getCancelToken());
+	auto& arena=request.getArena();
+	auto head=sp_stream->readHead(arena);
+
+	//CGI/1.1 6.3 Response Header Fields：Status决定状态码，只有Location时是重定向
+	response.setStatusCodeAndMessage(StatusCodeAndMessage::Type::OK);
+	bool has_status=false;
+	bool has_location=false;
+	std::string_view type;
+	size_t size=UNKNOWN_BODY_SIZE;
+	while (!head.empty()){
+		auto pos=head.find('\n');
+		auto line=fastcgi::trim(head.substr(0,pos));
+		head.remove_prefix(head.npos==pos? head.size():pos+1);
+		if (line.empty()) break;
+		auto colon=line.find(':');
+		if (line.npos==colon) throw HttpException(StatusCodeAndMessage::Type::BadGateway);
+		auto key=utils::toLower(fastcgi::trim(line.substr(0,colon)),arena);
+		auto value=fastcgi::trim(line.substr(colon+1));
+		if ("status"==key){
+			response.setStatusCodeAndMessage(StatusCodeAndMessage(value.substr(0,3)));
+			has_status=true;
+		}
+		else if ("content-type"==key) type=value;
+		else if ("content-length"==key){
+			auto res=std::from_chars(value.data(),value.data()+value.size(),size);
+			if (std::errc()!=res.ec) throw HttpException(StatusCodeAndMessage::Type::BadGateway);
+		}
+		else if ("connection"!=key && "transfer-encoding"!=key && "keep-alive"!=key){
+			if ("location"==key) has_location=true;
+			response.addHeader(key,value); //worker可能发送多个同名的头部（如set-cookie），都要保留
+		}
+	}
+	if (has_location && !has_status) response.setStatusCodeAndMessage(StatusCodeAndMessage("302"));
+	response.setBody(Body(type.empty()? std::string_view("text/html"):type,sp_stream,size));
+	if (!type.empty()) response.setHeader("content-type",type); //保留worker给的Content-Type，setBody会给文本类型加上charset
+	return true;
+}
+
+void FastCgi::appendStats(std::string& out) const{
+	for (const auto& route:this->routes) route.second->appendStats(route.first,out);
+}
+
+} // namespace httpd
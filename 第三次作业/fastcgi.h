@@ -0,0 +1,158 @@
+#ifndef FASTCGI_H
+#define FASTCGI_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include "httpd.h"
+#include "proxy.h"
+
+#define FASTCGI_VERSION 1
+#define FASTCGI_HEADER_LEN 8 //记录头的长度
+#define FASTCGI_MAX_CONTENT_LEN 65535 //一个记录最多携带的数据
+#define FASTCGI_MAX_CONNECTIONS 8 //每个应用最多保持的长连接数
+#define FASTCGI_MAX_REQUESTS 64 //worker支持多路复用时，一个连接上最多同时进行的请求数
+#define FASTCGI_STREAM_BUFFER_SIZE (1<<20) //每个请求缓存的还没有发给客户端的输出，满了读线程等待客户端
+#define FASTCGI_TIMEOUT_SEC 30 //等待worker或者客户端的超时
+#define FASTCGI_SUPERVISE_INTERVAL_MS 500 //检查worker是否退出的间隔，也限制了崩溃的worker重启的频率
+#define FASTCGI_LISTEN_QUEUE_LEN 128
+
+namespace httpd
+{
+
+namespace fastcgi
+{
+
+enum class RecordType : uint8_t{ //FastCGI 1.0 8. Types and Constants
+    BEGIN_REQUEST=1,
+    ABORT_REQUEST=2,
+    END_REQUEST=3,
+    PARAMS=4,
+    STDIN=5,
+    STDOUT=6,
+    STDERR=7,
+    DATA=8,
+    GET_VALUES=9,
+    GET_VALUES_RESULT=10,
+    UNKNOWN_TYPE=11
+};
+
+class Connection;
+
+/*------------Definition of Stream--------------*/
+class Stream : public BodySource { //一个请求的输出：连接的读线程放进来，工作线程读出来发给客户端
+public:
+    Stream(std::shared_ptr<Connection> sp_connection, const uint16_t& id);
+    ~Stream() override; //没有读完就被放弃（例如客户端断开）时让worker中止这个请求
+
+    std::string_view readHead(::utils::Arena& arena); //读出CGI响应头（到空行为止），存放在arena中
+    size_t read(char* buf, const size_t& len) override;
+
+    void setSent(); //请求已经完整发给worker，之后输出缓存满了读线程才等待，避免和发送请求互相等待
+    bool push(const char* p_data, const size_t& len); //读线程调用，客户端太久不读返回false
+    void end(); //收到END_REQUEST
+    void fail(); //连接断了或者被放弃了
+    uint16_t getId() const;
+    void setCancelToken(const CancelToken* p_cancel); //等待输出时检查客户端是否断开、是否到了截止时间
+
+private:
+    bool wait(std::unique_lock<std::mutex>& lock); //等到有数据或者结束，返回是否有数据
+
+private:
+    std::shared_ptr<Connection> sp_connection;
+    uint16_t id;
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::string buf;
+    size_t begin; //buf中还没有读出的数据的起点
+    bool is_sent;
+    bool is_ended;
+    bool is_failed;
+    const CancelToken* p_cancel;
+};
+
+/*------------Definition of Connection--------------*/
+class Connection : public std::enable_shared_from_this<Connection> { //到worker的一个长连接，多个请求按id复用，一个读线程把输出分给各个请求
+public:
+    Connection(int fd, const size_t& max_requests, std::function<void()> on_release);
+    ~Connection();
+
+    static std::shared_ptr<Connection> open(int fd, std::function<void()> on_release); //用GET_VALUES询问worker是否支持多路复用，然后启动读线程
+    std::shared_ptr<Stream> begin(const Request& request, const std::string_view& script_name); //发送一个请求，失败抛出异常
+    void abort(const uint16_t& id); //Stream析构时调用，请求已经结束的话什么都不做
+    void close(); //关闭socket，读线程随之退出
+    size_t getActive() const; //还没有收到END_REQUEST的请求数
+    bool isAvailable() const; //还能再加一个请求
+    bool isAlive() const;
+
+private:
+    void readLoop();
+    void write(struct iovec* iov, const size_t& iovcnt);
+    void writeAbort(const uint16_t& id);
+
+private:
+    int fd;
+    size_t max_requests;
+    std::function<void()> on_release; //一个请求结束或者连接断开时调用，等待连接的请求可以再试
+    std::mutex write_mtx; //一个请求的记录要连续写完
+    mutable std::mutex mtx;
+    std::map<uint16_t,std::weak_ptr<Stream>> streams; //中止的请求在收到END_REQUEST之前还占着id
+    uint16_t next_id;
+    std::atomic_bool is_alive;
+};
+
+/*------------Definition of Application--------------*/
+class Application{ //一个FastCGI应用：外部的或者由本服务启动并监管的worker进程，以及到它们的长连接
+public:
+    Application(const std::string& address); //外部worker，host:port或者unix:/path/to/socket
+    Application(const std::string& program, const size_t& workers); //在Unix socket上启动workers个program，退出了就重新启动
+    ~Application();
+
+    std::shared_ptr<Stream> start(const Request& request, const std::string_view& script_name); //选一个连接发送请求
+    void appendStats(const std::string& name, std::string& out) const;
+
+private:
+    std::shared_ptr<Connection> acquire(); //优先用空闲的连接，其次新建连接，最后复用忙碌但支持多路复用的连接
+    void supervise();
+    pid_t spawn() const;
+
+private:
+    std::string socket_path; //自己启动worker时监听的Unix socket
+    int listen_fd;
+    std::string program;
+    std::vector<pid_t> worker_pids;
+    std::thread supervisor;
+    std::atomic_bool is_stopping;
+    std::unique_ptr<Upstream> up_upstream; //只用来解析地址和建立连接
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    std::vector<std::shared_ptr<Connection>> connections;
+    size_t connecting; //正在建立的连接数
+    std::atomic<size_t> requests;
+    std::atomic<size_t> restarts;
+};
+
+} // namespace fastcgi
+
+/*------------Definition of FastCgi--------------*/
+class FastCgi{ //按路径前缀把请求交给FastCGI应用，路径前缀作为SCRIPT_NAME，剩下的部分作为PATH_INFO
+public:
+    void addRoute(const std::string& prefix, std::unique_ptr<fastcgi::Application> up_application);
+    bool handle(Request& request, Response& response); //没有匹配的路由返回false，失败抛出HttpException
+    void appendStats(std::string& out) const;
+
+private:
+    std::vector<std::pair<std::string,std::unique_ptr<fastcgi::Application>>> routes; //按前缀长度从长到短排列
+};
+
+} // namespace httpd
+
+#endif // FASTCGI_H
@@ -0,0 +1,225 @@
+// 一个最简单的FastCGI worker：把请求体原样作为响应体返回，用于测试和对比动态请求与静态文件的延迟
+// 由httpd启动时监听socket在0号描述符上（fastcgi_spawn）；单独运行时 ./fcgi_echo /path/to/socket，再用 fastcgi 前缀 unix:/path/to/socket 接入
+// 单线程poll，支持一个连接上多个请求交错进行（FCGI_MPXS_CONNS=1）
+
+#include <iostream>
+#include <string>
+#include <map>
+#include <vector>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <signal.h>
+#include "fastcgi.h"
+
+using namespace std;
+using httpd::fastcgi::RecordType;
+
+namespace
+{
+
+struct EchoRequest{ //一个连接上正在处理的一个请求
+	string params;
+	bool is_keep_conn=false;
+	bool is_head_sent=false;
+};
+
+struct EchoConnection{
+	int fd;
+	string in;
+	map<uint16_t,EchoRequest> requests;
+};
+
+void writeAll(int fd, struct iovec* iov, size_t iovcnt){ //阻塞写完，出错抛出异常
+	while (iovcnt>0){
+		ssize_t len=writev(fd,iov,iovcnt);
+		if (len<0 && EINTR==errno) continue;
+		if (len<0) throw runtime_error("write failed in writeAll");
+		while (iovcnt>0 && static_cast<size_t>(len)>=iov->iov_len){
+			len-=iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if (iovcnt>0){
+			iov->iov_base=static_cast<char*>(iov->iov_base)+len;
+			iov->iov_len-=len;
+		}
+	}
+}
+
+void writeRecord(int fd, const RecordType& type, const uint16_t& id, const char* p_data, const size_t& len){
+	char head[FASTCGI_HEADER_LEN]={FASTCGI_VERSION,static_cast<char>(type),static_cast<char>(id>>8),static_cast<char>(id&0xff),
+		static_cast<char>(len>>8),static_cast<char>(len&0xff),0,0};
+	struct iovec iov[2]={{head,FASTCGI_HEADER_LEN},{const_cast<char*>(p_data),len}};
+	writeAll(fd,iov,2);
+}
+
+void writeEnd(int fd, const uint16_t& id, const uint8_t& protocol_status){ //FastCGI 1.0 5.5 FCGI_END_REQUEST
+	char body[8]={0,0,0,0,static_cast<char>(protocol_status),0,0,0};
+	writeRecord(fd,RecordType::END_REQUEST,id,body,sizeof(body));
+}
+
+void appendPair(string& out, const string& name, const string& value){ //这里的名字和值都短于128字节
+	out.push_back(static_cast<char>(name.size()));
+	out.push_back(static_cast<char>(value.size()));
+	out+=name;
+	out+=value;
+}
+
+string findParam(const string& params, const string& key){ //在编码后的名字-值对中找一个参数
+	size_t pos=0;
+	while (pos<params.size()){
+		size_t lens[2];
+		for (size_t& len:lens){
+			uint8_t first=params[pos];
+			if (first<128){
+				len=first;
+				pos+=1;
+			}
+			else{
+				len=((first&0x7f)<<24)|(static_cast<uint8_t>(params[pos+1])<<16)|(static_cast<uint8_t>(params[pos+2])<<8)|static_cast<uint8_t>(params[pos+3]);
+				pos+=4;
+			}
+		}
+		if (params.compare(pos,lens[0],key)==0 && lens[0]==key.size()) return params.substr(pos+lens[0],lens[1]);
+		pos+=lens[0]+lens[1];
+	}
+	return string();
+}
+
+bool handleRecord(EchoConnection& connection, const RecordType& type, const uint16_t& id, const string& content){ //返回false表示要关闭连接
+	if (0==id){ //管理记录
+		if (RecordType::GET_VALUES==type){
+			string result;
+			appendPair(result,"FCGI_MPXS_CONNS","1");
+			appendPair(result,"FCGI_MAX_CONNS","64");
+			appendPair(result,"FCGI_MAX_REQS","64");
+			writeRecord(connection.fd,RecordType::GET_VALUES_RESULT,0,result.data(),result.size());
+		}
+		else{
+			char body[8]={static_cast<char>(type),0,0,0,0,0,0,0};
+			writeRecord(connection.fd,RecordType::UNKNOWN_TYPE,0,body,sizeof(body));
+		}
+		return true;
+	}
+	if (RecordType::BEGIN_REQUEST==type){
+		if (content.size()<8) return false;
+		if (1!=((static_cast<uint8_t>(content[0])<<8)|static_cast<uint8_t>(content[1]))){ //只支持Responder
+			writeEnd(connection.fd,id,3); //FCGI_UNKNOWN_ROLE
+			return true;
+		}
+		connection.requests[id].is_keep_conn=content[2]&1;
+		return true;
+	}
+	auto it=connection.requests.find(id);
+	if (connection.requests.end()==it) return true; //已经结束的请求，忽略
+	EchoRequest& request=it->second;
+	if (RecordType::PARAMS==type) request.params+=content;
+	else if (RecordType::STDIN==type){
+		if (!request.is_head_sent){ //收到第一段请求体就开始回应，请求体边收边发
+			string type=findParam(request.params,"CONTENT_TYPE");
+			string head="Content-Type: "+(type.empty()? string("text/plain"):type)+"\r\n"
+				+"X-Request-Method: "+findParam(request.params,"REQUEST_METHOD")+"\r\n"
+				+"X-Path-Info: "+findParam(request.params,"PATH_INFO")+"\r\n\r\n";
+			writeRecord(connection.fd,RecordType::STDOUT,id,head.data(),head.size());
+			request.is_head_sent=true;
+		}
+		if (!content.empty()) writeRecord(connection.fd,RecordType::STDOUT,id,content.data(),content.size());
+		else{ //请求体结束
+			writeRecord(connection.fd,RecordType::STDOUT,id,nullptr,0);
+			writeEnd(connection.fd,id,0); //FCGI_REQUEST_COMPLETE
+			bool is_keep_conn=request.is_keep_conn;
+			connection.requests.erase(it);
+			return is_keep_conn;
+		}
+	}
+	else if (RecordType::ABORT_REQUEST==type){
+		writeEnd(connection.fd,id,0);
+		bool is_keep_conn=request.is_keep_conn;
+		connection.requests.erase(it);
+		return is_keep_conn;
+	}
+	return true;
+}
+
+bool handleInput(EchoConnection& connection){ //处理缓冲区里完整的记录，返回false表示要关闭连接
+	size_t pos=0;
+	bool is_ok=true;
+	while (is_ok && connection.in.size()-pos>=FASTCGI_HEADER_LEN){
+		const char* p_head=connection.in.data()+pos;
+		size_t len=(static_cast<uint8_t>(p_head[4])<<8)|static_cast<uint8_t>(p_head[5]);
+		size_t padding=static_cast<uint8_t>(p_head[6]);
+		if (connection.in.size()-pos<FASTCGI_HEADER_LEN+len+padding) break;
+		uint16_t id=(static_cast<uint8_t>(p_head[2])<<8)|static_cast<uint8_t>(p_head[3]);
+		is_ok=handleRecord(connection,static_cast<RecordType>(p_head[1]),id,connection.in.substr(pos+FASTCGI_HEADER_LEN,len));
+		pos+=FASTCGI_HEADER_LEN+len+padding;
+	}
+	connection.in.erase(0,pos);
+	return is_ok;
+}
+
+int listenOn(const char* path){
+	struct sockaddr_un addr={};
+	addr.sun_family=AF_UNIX;
+	if (strlen(path)>=sizeof(addr.sun_path)) return -1;
+	strcpy(addr.sun_path,path);
+	int fd=socket(AF_UNIX,SOCK_STREAM,0);
+	unlink(path);
+	if (fd<0 || bind(fd,reinterpret_cast<struct sockaddr*>(&addr),sizeof(addr))<0 || listen(fd,FASTCGI_LISTEN_QUEUE_LEN)<0) return -1;
+	return fd;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	int listen_fd=0;
+	int is_listening=0;
+	socklen_t len=sizeof(is_listening);
+	if (argc>1) listen_fd=listenOn(argv[1]);
+	else if (getsockopt(0,SOL_SOCKET,SO_ACCEPTCONN,&is_listening,&len)<0 || !is_listening) listen_fd=-1; //不是由服务启动的
+	if (listen_fd<0){
+		cerr << "Usage: " << argv[0] << " [socket_path]" << endl;
+		return 1;
+	}
+
+	signal(SIGPIPE,SIG_IGN); //服务断开连接时写失败，只关闭这个连接
+	vector<EchoConnection> connections;
+	vector<struct pollfd> pfds;
+	char buf[65536];
+	while (1){
+		pfds.assign(1,{listen_fd,POLLIN,0});
+		for (const auto& connection:connections) pfds.push_back({connection.fd,POLLIN,0});
+		if (poll(pfds.data(),pfds.size(),-1)<0){
+			if (EINTR==errno) continue;
+			return 1;
+		}
+		for (size_t i=connections.size();i>0;--i){ //倒着处理，删除连接不影响前面的下标
+			if (0==pfds[i].revents) continue;
+			EchoConnection& connection=connections[i-1];
+			ssize_t n=read(connection.fd,buf,sizeof(buf));
+			bool is_ok=n>0;
+			if (is_ok){
+				connection.in.append(buf,n);
+				try{
+					is_ok=handleInput(connection);
+				}
+				catch(const exception& e){
+					is_ok=false;
+				}
+			}
+			if (!is_ok){
+				close(connection.fd);
+				connections.erase(connections.begin()+(i-1));
+			}
+		}
+		if (pfds[0].revents&POLLIN){
+			int fd=accept(listen_fd,nullptr,nullptr);
+			if (fd>=0) connections.push_back(EchoConnection{fd,string(),{}});
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,222 @@
+#include "hitters.h"
+#include <algorithm>
+#include <functional>
+#include <cstring>
+#include <arpa/inet.h>
+
+
+namespace httpd
+{
+
+namespace hitters
+{
+
+uint64_t hash(const std::string_view& key){
+	return std::hash<std::string_view>()(key);
+}
+
+/*------------implement of CountMinSketch--------------*/
+CountMinSketch::CountMinSketch(){
+	this->clear();
+}
+
+void CountMinSketch::add(const uint64_t& hash){
+	uint64_t step=(hash>>32)|1; //双重散列：每行的位置是hash+i*step，不用算多个散列函数
+	for (size_t i=0;i<HITTERS_SKETCH_DEPTH;++i){
+		uint32_t& count=this->counts[i][(hash+i*step)%HITTERS_SKETCH_WIDTH];
+		if (UINT32_MAX!=count) ++count;
+	}
+}
+
+uint32_t CountMinSketch::estimate(const uint64_t& hash) const{
+	uint64_t step=(hash>>32)|1;
+	uint32_t res=UINT32_MAX;
+	for (size_t i=0;i<HITTERS_SKETCH_DEPTH;++i) res=std::min(res,this->counts[i][(hash+i*step)%HITTERS_SKETCH_WIDTH]); //每行都只会多算，取最小的
+	return res;
+}
+
+void CountMinSketch::clear(){
+	for (auto& row:this->counts) row.fill(0);
+}
+
+/*------------implement of SpaceSaving--------------*/
+std::string_view SpaceSaving::Entry::getKey() const{
+	return std::string_view(this->key,this->key_len);
+}
+
+SpaceSaving::SpaceSaving(){
+	this->entries.reserve(HITTERS_CAPACITY);
+}
+
+void SpaceSaving::add(const std::string_view& key, const uint64_t& hash){
+	for (auto& entry:this->entries){
+		if (entry.hash==hash && entry.getKey()==key.substr(0,HITTERS_KEY_LEN)){
+			++entry.count;
+			return;
+		}
+	}
+	Entry* p_entry=nullptr;
+	if (this->entries.size()<HITTERS_CAPACITY){
+		this->entries.emplace_back();
+		p_entry=&this->entries.back();
+		p_entry->count=1;
+		p_entry->error=0;
+	}
+	else{ //顶替计数最小的候选，继承它的计数，所以新名字的计数至多高估这么多
+		p_entry=&*std::min_element(this->entries.begin(),this->entries.end(),[](const Entry& a, const Entry& b){ return a.count<b.count; });
+		p_entry->error=p_entry->count;
+		++p_entry->count;
+	}
+	p_entry->hash=hash;
+	p_entry->key_len=std::min(key.size(),static_cast<size_t>(HITTERS_KEY_LEN));
+	memcpy(p_entry->key,key.data(),p_entry->key_len);
+}
+
+const std::vector<SpaceSaving::Entry>& SpaceSaving::getEntries() const{
+	return this->entries;
+}
+
+void SpaceSaving::clear(){
+	this->entries.clear();
+}
+
+/*------------implement of Window--------------*/
+Window::Window():slots(HITTERS_SLOTS){}
+
+uint32_t Window::add(const std::string_view& key, const int64_t& now_sec){
+	uint64_t h=hitters::hash(key);
+	std::lock_guard<std::mutex> lock(this->mtx);
+	Slot& slot=this->rotate(now_sec);
+	slot.sketch.add(h);
+	slot.top.add(key,h);
+	return this->sum(h,now_sec);
+}
+
+uint32_t Window::estimate(const std::string_view& key, const int64_t& now_sec){
+	uint64_t h=hitters::hash(key);
+	std::lock_guard<std::mutex> lock(this->mtx);
+	return this->sum(h,now_sec);
+}
+
+void Window::appendTop(const std::string& name, const int64_t& now_sec, std::string& out){
+	std::vector<std::pair<uint32_t,std::string>> top;
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		int64_t epoch=now_sec/HITTERS_SLOT_SEC;
+		std::vector<uint64_t> seen;
+		for (const auto& slot:this->slots){ //各个子窗口的候选合起来，用整个窗口的sketch估计
+			if (slot.epoch<=epoch-HITTERS_SLOTS) continue;
+			for (const auto& entry:slot.top.getEntries()){
+				if (seen.end()!=std::find(seen.begin(),seen.end(),entry.hash)) continue;
+				seen.push_back(entry.hash);
+				top.emplace_back(this->sum(entry.hash,now_sec),std::string(entry.getKey()));
+			}
+		}
+	}
+	size_t num=std::min(top.size(),static_cast<size_t>(HITTERS_TOP_K));
+	std::partial_sort(top.begin(),top.begin()+num,top.end(),[](const auto& a, const auto& b){ return a.first>b.first; });
+	for (size_t i=0;i<num;++i){
+		out+=name+"{key=\"";
+		for (char c:top[i].second){ //路径里可能有引号和反斜杠
+			if ('"'==c || '\\'==c) out.push_back('\\');
+			out.push_back(c);
+		}
+		out+="\"} "+std::to_string(top[i].first)+"\n";
+	}
+}
+
+Window::Slot& Window::rotate(const int64_t& now_sec){
+	int64_t epoch=now_sec/HITTERS_SLOT_SEC;
+	Slot& slot=this->slots[epoch%HITTERS_SLOTS];
+	if (slot.epoch!=epoch){ //上一次用这个位置是一整个窗口之前
+		slot.epoch=epoch;
+		slot.sketch.clear();
+		slot.top.clear();
+	}
+	return slot;
+}
+
+uint32_t Window::sum(const uint64_t& hash, const int64_t& now_sec) const{
+	int64_t epoch=now_sec/HITTERS_SLOT_SEC;
+	uint32_t res=0;
+	for (const auto& slot:this->slots){
+		if (slot.epoch>epoch-HITTERS_SLOTS) res+=slot.sketch.estimate(hash);
+	}
+	return res;
+}
+
+} // namespace hitters
+
+/*------------implement of HeavyHitters--------------*/
+HeavyHitters::HeavyHitters(const size_t& deny_threshold, const size_t& deny_sec):deny_threshold(deny_threshold),deny_sec(deny_sec),denied(0),rejected(0){
+	this->denies.fill(Deny{0,0});
+}
+
+bool HeavyHitters::addConnection(const uint32_t& ip){
+	if (0==ip) return true;
+	char buf[INET_ADDRSTRLEN];
+	this->connections.add(HeavyHitters::formatIp(ip,buf),HeavyHitters::nowSec()); //被禁止的IP的连接也照样计数
+	if (!this->isDenied(ip)) return true;
+	++this->rejected;
+	return false;
+}
+
+bool HeavyHitters::addRequest(const uint32_t& ip, const std::string_view& path){
+	if (0!=ip && this->isDenied(ip)){
+		++this->rejected;
+		return false;
+	}
+	int64_t now=HeavyHitters::nowSec();
+	this->paths.add(path,now);
+	if (0==ip) return true;
+	char buf[INET_ADDRSTRLEN];
+	uint32_t count=this->requests.add(HeavyHitters::formatIp(ip,buf),now);
+	if (0==this->deny_threshold || count<this->deny_threshold) return true;
+
+	std::lock_guard<std::mutex> lock(this->deny_mtx); //放在最早过期的位置，表满了就顶替最快解除的
+	Deny* p_deny=&*std::min_element(this->denies.begin(),this->denies.end(),[](const Deny& a, const Deny& b){ return a.until<b.until; });
+	*p_deny=Deny{ip,now+static_cast<int64_t>(this->deny_sec)};
+	++this->denied;
+	++this->rejected;
+	return false;
+}
+
+bool HeavyHitters::isDenied(const uint32_t& ip){
+	if (0==this->deny_threshold) return false;
+	int64_t now=HeavyHitters::nowSec();
+	std::lock_guard<std::mutex> lock(this->deny_mtx);
+	for (const auto& deny:this->denies){
+		if (deny.ip==ip && deny.until>now) return true;
+	}
+	return false;
+}
+
+void HeavyHitters::appendStats(std::string& out){
+	int64_t now=HeavyHitters::nowSec();
+	this->connections.appendTop("hitters_ip_connections",now,out);
+	this->requests.appendTop("hitters_ip_requests",now,out);
+	this->paths.appendTop("hitters_path_requests",now,out);
+	out+="hitters_memory_bytes "+std::to_string(sizeof(*this)+3*HITTERS_SLOTS*(sizeof(hitters::CountMinSketch)+HITTERS_CAPACITY*sizeof(hitters::SpaceSaving::Entry)))+"\n";
+	if (0==this->deny_threshold) return;
+	out+="hitters_denied_total "+std::to_string(this->denied)+"\n";
+	out+="hitters_rejected_total "+std::to_string(this->rejected)+"\n";
+	std::lock_guard<std::mutex> lock(this->deny_mtx);
+	for (const auto& deny:this->denies){
+		if (deny.until<=now) continue;
+		char buf[INET_ADDRSTRLEN];
+		out+="hitters_denied{key=\""+std::string(HeavyHitters::formatIp(deny.ip,buf))+"\"} "+std::to_string(deny.until-now)+"\n"; //还要禁止的秒数
+	}
+}
+
+int64_t HeavyHitters::nowSec(){
+	return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string_view HeavyHitters::formatIp(const uint32_t& ip, char* buf){
+	struct in_addr addr;
+	addr.s_addr=ip;
+	inet_ntop(AF_INET,&addr,buf,INET_ADDRSTRLEN);
+	return std::string_view(buf);
+}
+
+} // namespace httpd
@@ -0,0 +1,118 @@
+#ifndef HITTERS_H
+#define HITTERS_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+#define HITTERS_SKETCH_DEPTH 4 //count-min sketch的行数，估计值偏大的概率随行数指数下降
+#define HITTERS_SKETCH_WIDTH 2048 //每行的计数器个数，偏大的量约为总数的e/WIDTH
+#define HITTERS_CAPACITY 64 //每个子窗口space-saving跟踪的候选数
+#define HITTERS_KEY_LEN 64 //候选的名字（IP或者路径）最多保留的字节数
+#define HITTERS_SLOTS 6 //滑动窗口分成的子窗口数
+#define HITTERS_SLOT_SEC 10 //每个子窗口的长度，整个窗口是一分钟
+#define HITTERS_TOP_K 10 //统计页面上列出的个数
+#define HITTERS_DENY_MAX 64 //同时被临时禁止的IP数上限
+
+namespace httpd
+{
+
+namespace hitters
+{
+
+/*------------Definition of CountMinSketch--------------*/
+class CountMinSketch{ //任意多个名字的近似计数，只会高估不会低估，内存固定
+public:
+    CountMinSketch();
+    void add(const uint64_t& hash);
+    uint32_t estimate(const uint64_t& hash) const;
+    void clear();
+
+private:
+    std::array<std::array<uint32_t,HITTERS_SKETCH_WIDTH>,HITTERS_SKETCH_DEPTH> counts;
+};
+
+/*------------Definition of SpaceSaving--------------*/
+class SpaceSaving{ //Metwally等的space-saving：固定个数的候选，新名字顶替计数最小的候选，真正的高频名字一定在里面
+public:
+    struct Entry{
+        uint64_t hash;
+        uint32_t count; //可能高估，至多高估error
+        uint32_t error;
+        uint8_t key_len;
+        char key[HITTERS_KEY_LEN];
+        std::string_view getKey() const;
+    };
+
+    SpaceSaving();
+    void add(const std::string_view& key, const uint64_t& hash);
+    const std::vector<Entry>& getEntries() const;
+    void clear();
+
+private:
+    std::vector<Entry> entries; //容量固定为HITTERS_CAPACITY
+};
+
+/*------------Definition of Window--------------*/
+class Window{ //最近HITTERS_SLOTS*HITTERS_SLOT_SEC秒的计数，按子窗口滚动，过期的子窗口整体清零
+public:
+    Window();
+    uint32_t add(const std::string_view& key, const int64_t& now_sec); //返回加上这一次后窗口内的估计值
+    uint32_t estimate(const std::string_view& key, const int64_t& now_sec);
+    void appendTop(const std::string& name, const int64_t& now_sec, std::string& out); //按估计值从大到小输出前HITTERS_TOP_K个
+
+private:
+    struct Slot{
+        int64_t epoch=-1; //这个子窗口对应的时间段，now_sec/HITTERS_SLOT_SEC
+        CountMinSketch sketch;
+        SpaceSaving top;
+    };
+    Slot& rotate(const int64_t& now_sec); //找到当前的子窗口，已经过期的先清零
+    uint32_t sum(const uint64_t& hash, const int64_t& now_sec) const;
+
+private:
+    std::mutex mtx;
+    std::vector<Slot> slots;
+};
+
+uint64_t hash(const std::string_view& key);
+
+} // namespace hitters
+
+/*------------Definition of HeavyHitters--------------*/
+class HeavyHitters{ //找出最活跃的客户端IP和路径：连接数、请求数按IP计，请求数按路径计，内存和流量无关；可以自动临时禁止请求太多的IP
+public:
+    HeavyHitters(const size_t& deny_threshold, const size_t& deny_sec); //一分钟内请求数达到deny_threshold的IP禁止deny_sec秒，0表示不自动禁止
+    bool addConnection(const uint32_t& ip); //ip是网络字节序，0表示不是IPv4连接；返回false表示这个IP被临时禁止了
+    bool addRequest(const uint32_t& ip, const std::string_view& path); //被禁止之后一分钟内的请求数还达到阈值的话会再次被禁止
+    void appendStats(std::string& out);
+
+private:
+    bool isDenied(const uint32_t& ip);
+    static int64_t nowSec();
+    static std::string_view formatIp(const uint32_t& ip, char* buf); //buf至少INET_ADDRSTRLEN字节
+
+private:
+    struct Deny{
+        uint32_t ip;
+        int64_t until; //秒
+    };
+
+    size_t deny_threshold;
+    size_t deny_sec;
+    hitters::Window connections;
+    hitters::Window requests;
+    hitters::Window paths;
+    std::mutex deny_mtx;
+    std::array<Deny,HITTERS_DENY_MAX> denies; //ip为0的位置是空的
+    std::atomic<size_t> denied; //自动禁止的次数
+    std::atomic<size_t> rejected; //因为被禁止而拒绝的连接和请求数
+};
+
+} // namespace httpd
+
+#endif // HITTERS_H
@@ -0,0 +1,994 @@
+#include "http2.h"
+
+
+namespace httpd
+{
+
+namespace http2
+{
+
+namespace
+{
+
+struct StaticEntry{
+	std::string_view name;
+	std::string_view value;
+};
+
+const StaticEntry static_table[61]={ //静态表，下标从1开始，这里存放的是下标1~61
+	{":authority",""},
+	{":method","GET"},
+	{":method","POST"},
+	{":path","/"},
+	{":path","/index.html"},
+	{":scheme","http"},
+	{":scheme","https"},
+	{":status","200"},
+	{":status","204"},
+	{":status","206"},
+	{":status","304"},
+	{":status","400"},
+	{":status","404"},
+	{":status","500"},
+	{"accept-charset",""},
+	{"accept-encoding","gzip, deflate"},
+	{"accept-language",""},
+	{"accept-ranges",""},
+	{"accept",""},
+	{"access-control-allow-origin",""},
+	{"age",""},
+	{"allow",""},
+	{"authorization",""},
+	{"cache-control",""},
+	{"content-disposition",""},
+	{"content-encoding",""},
+	{"content-language",""},
+	{"content-length",""},
+	{"content-location",""},
+	{"content-range",""},
+	{"content-type",""},
+	{"cookie",""},
+	{"date",""},
+	{"etag",""},
+	{"expect",""},
+	{"expires",""},
+	{"from",""},
+	{"host",""},
+	{"if-match",""},
+	{"if-modified-since",""},
+	{"if-none-match",""},
+	{"if-range",""},
+	{"if-unmodified-since",""},
+	{"last-modified",""},
+	{"link",""},
+	{"location",""},
+	{"max-forwards",""},
+	{"proxy-authenticate",""},
+	{"proxy-authorization",""},
+	{"range",""},
+	{"referer",""},
+	{"refresh",""},
+	{"retry-after",""},
+	{"server",""},
+	{"set-cookie",""},
+	{"strict-transport-security",""},
+	{"transfer-encoding",""},
+	{"user-agent",""},
+	{"vary",""},
+	{"via",""},
+	{"www-authenticate",""},
+};
+//RFC 7541 附录B的Huffman编码表，下标为符号，256为EOS
+const uint32_t huffman_codes[257]={
+	0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+	0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+	0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+	0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+	0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+	0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+	0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+	0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+	0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+	0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+	0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+	0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+	0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+	0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+	0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+	0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+	0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+	0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+	0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+	0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+	0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+	0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+	0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+	0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+	0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+	0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+	0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+	0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+	0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+	0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+	0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+	0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+	0x3fffffff,
+};
+const uint8_t huffman_code_lens[257]={
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30,
+};
+const size_t STATIC_TABLE_SIZE=sizeof(static_table)/sizeof(static_table[0]);
+
+class HuffmanTree{ //由编码表构建的二叉树，解码时逐位向下走，走到叶子就得到一个符号
+public:
+	struct Node{
+		int children[2];
+		int symbol; //-1表示不是叶子
+	};
+
+	HuffmanTree(){
+		this->nodes.reserve(512);
+		this->nodes.push_back(Node{{-1,-1},-1});
+		for (int symbol=0;symbol<257;++symbol){
+			int current=0;
+			for (int i=huffman_code_lens[symbol]-1;i>=0;--i){
+				int bit=(huffman_codes[symbol]>>i)&1;
+				if (-1==this->nodes[current].children[bit]){
+					this->nodes[current].children[bit]=this->nodes.size();
+					this->nodes.push_back(Node{{-1,-1},-1});
+				}
+				current=this->nodes[current].children[bit];
+			}
+			this->nodes[current].symbol=symbol;
+		}
+	}
+	const Node& operator[](const size_t& index) const{
+		return this->nodes[index];
+	}
+
+private:
+	std::vector<Node> nodes;
+};
+
+const HuffmanTree huffman_tree;
+
+uint32_t readUint32(const char* p){
+	return (static_cast<uint32_t>(static_cast<uint8_t>(p[0]))<<24)|(static_cast<uint32_t>(static_cast<uint8_t>(p[1]))<<16)|
+		(static_cast<uint32_t>(static_cast<uint8_t>(p[2]))<<8)|static_cast<uint32_t>(static_cast<uint8_t>(p[3]));
+}
+
+void putUint32(char* p, const uint32_t& value){
+	p[0]=static_cast<char>(value>>24);
+	p[1]=static_cast<char>(value>>16);
+	p[2]=static_cast<char>(value>>8);
+	p[3]=static_cast<char>(value);
+}
+
+void putSetting(char* p, const uint16_t& id, const uint32_t& value){
+	p[0]=static_cast<char>(id>>8);
+	p[1]=static_cast<char>(id);
+	putUint32(p+2,value);
+}
+
+std::string base64UrlDecode(const std::string_view& input){ //HTTP2-Settings头部使用不带填充的base64url编码
+	std::string output;
+	uint32_t bits=0;
+	int bit_count=0;
+	for (char c:input){
+		int value;
+		if ('A'<=c && c<='Z') value=c-'A';
+		else if ('a'<=c && c<='z') value=c-'a'+26;
+		else if ('0'<=c && c<='9') value=c-'0'+52;
+		else if ('-'==c || '+'==c) value=62;
+		else if ('_'==c || '/'==c) value=63;
+		else if ('='==c) break;
+		else throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"invalid HTTP2-Settings in base64UrlDecode");
+		bits=(bits<<6)|value;
+		bit_count+=6;
+		if (bit_count>=8){
+			bit_count-=8;
+			output.push_back(static_cast<char>((bits>>bit_count)&0xff));
+		}
+	}
+	return output;
+}
+
+bool isConnectionSpecific(const std::string_view& key){ //HTTP/2禁止出现的连接相关头部
+	return "connection"==key || "keep-alive"==key || "proxy-connection"==key || "transfer-encoding"==key || "upgrade"==key;
+}
+
+const uint8_t FLAG_END_STREAM=0x1;
+const uint8_t FLAG_ACK=0x1;
+const uint8_t FLAG_END_HEADERS=0x4;
+const uint8_t FLAG_PADDED=0x8;
+const uint8_t FLAG_PRIORITY=0x20;
+
+const uint16_t SETTINGS_HEADER_TABLE_SIZE=0x1;
+const uint16_t SETTINGS_ENABLE_PUSH=0x2;
+const uint16_t SETTINGS_MAX_CONCURRENT_STREAMS=0x3;
+const uint16_t SETTINGS_INITIAL_WINDOW_SIZE=0x4;
+const uint16_t SETTINGS_MAX_FRAME_SIZE=0x5;
+
+const int64_t MAX_WINDOW_SIZE=0x7fffffff;
+const size_t FRAME_HEAD_LEN=9;
+
+} // namespace
+
+/*------------implement of ConnectionError--------------*/
+ConnectionError::ConnectionError(const ErrorCode& code, const std::string& what):std::runtime_error(what),code(code){}
+ErrorCode ConnectionError::getCode() const{
+	return this->code;
+}
+
+/*------------implement of StreamError--------------*/
+StreamError::StreamError(const uint32_t& stream_id, const ErrorCode& code, const std::string& what):std::runtime_error(what),stream_id(stream_id),code(code){}
+uint32_t StreamError::getStreamId() const{
+	return this->stream_id;
+}
+ErrorCode StreamError::getCode() const{
+	return this->code;
+}
+
+/*------------implement of HeaderTable--------------*/
+HeaderTable::HeaderTable(const size_t& max_size):size(0),max_size(max_size){}
+
+bool HeaderTable::get(const size_t& index, std::string_view& name, std::string_view& value) const{
+	if (0==index) return false;
+	if (index<=STATIC_TABLE_SIZE){
+		name=static_table[index-1].name;
+		value=static_table[index-1].value;
+		return true;
+	}
+	size_t dynamic_index=index-STATIC_TABLE_SIZE-1;
+	if (dynamic_index>=this->entries.size()) return false;
+	name=this->entries[dynamic_index].first;
+	value=this->entries[dynamic_index].second;
+	return true;
+}
+
+size_t HeaderTable::find(const std::string_view& name, const std::string_view& value, bool& is_full_match) const{
+	size_t name_index=0;
+	is_full_match=false;
+	for (size_t i=0;i<STATIC_TABLE_SIZE;++i){
+		if (static_table[i].name!=name) continue;
+		if (static_table[i].value==value){
+			is_full_match=true;
+			return i+1;
+		}
+		if (0==name_index) name_index=i+1;
+	}
+	for (size_t i=0;i<this->entries.size();++i){
+		if (this->entries[i].first!=name) continue;
+		if (this->entries[i].second==value){
+			is_full_match=true;
+			return STATIC_TABLE_SIZE+i+1;
+		}
+		if (0==name_index) name_index=STATIC_TABLE_SIZE+i+1;
+	}
+	return name_index;
+}
+
+void HeaderTable::add(const std::string_view& name, const std::string_view& value){
+	size_t entry_size=name.size()+value.size()+32;
+	if (entry_size>this->max_size){ //比整个表还大的表项会清空动态表
+		this->entries.clear();
+		this->size=0;
+		return;
+	}
+	std::pair<std::string,std::string> entry(name,value); //name可能引用着即将被淘汰的表项，先拷贝出来
+	this->evict(this->max_size-entry_size);
+	this->entries.emplace_front(std::move(entry));
+	this->size+=entry_size;
+}
+
+void HeaderTable::setMaxSize(const size_t& max_size){
+	this->max_size=max_size;
+	this->evict(max_size);
+}
+
+size_t HeaderTable::getMaxSize() const{
+	return this->max_size;
+}
+
+void HeaderTable::evict(const size_t& max_size){
+	while (this->size>max_size && !this->entries.empty()){
+		this->size-=this->entries.back().first.size()+this->entries.back().second.size()+32;
+		this->entries.pop_back();
+	}
+}
+
+/*------------implement of HpackDecoder--------------*/
+HpackDecoder::HpackDecoder():max_table_size(HTTP2_HEADER_TABLE_SIZE){}
+
+void HpackDecoder::decode(const std::string_view& block, ::utils::Arena& arena, const std::function<void(const std::string_view&,const std::string_view&)>& on_field){
+	size_t pos=0;
+	bool is_field_seen=false;
+	while (pos<block.size()){
+		uint8_t first_byte=block[pos];
+		std::string_view name,value;
+		if (first_byte&0x80){ //索引字段
+			if (!this->table.get(HpackDecoder::decodeInteger(block,pos,7),name,value)) throw ConnectionError(ErrorCode::COMPRESSION_ERROR,"invalid index in HpackDecoder::decode");
+			name=arena.copy(name); //动态表的表项之后可能被淘汰
+			value=arena.copy(value);
+		}
+		else if (0x20==(first_byte&0xe0)){ //动态表大小更新，只能出现在头部块的开头
+			if (is_field_seen) throw ConnectionError(ErrorCode::COMPRESSION_ERROR,"table size update after field in HpackDecoder::decode");
+			uint64_t max_size=HpackDecoder::decodeInteger(block,pos,5);
+			if (max_size>this->max_table_size) throw ConnectionError(ErrorCode::COMPRESSION_ERROR,"table size too large in HpackDecoder::decode");
+			this->table.setMaxSize(max_size);
+			continue;
+		}
+		else{ //字面量字段，01为带增量索引，0000为不索引，0001为永不索引
+			bool is_indexing=first_byte&0x40;
+			uint64_t index=HpackDecoder::decodeInteger(block,pos,is_indexing? 6:4);
+			if (0==index) name=HpackDecoder::decodeString(block,pos,arena);
+			else{
+				if (!this->table.get(index,name,value)) throw ConnectionError(ErrorCode::COMPRESSION_ERROR,"invalid index in HpackDecoder::decode");
+				name=arena.copy(name);
+			}
+			value=HpackDecoder::decodeString(block,pos,arena);
+			if (is_indexing) this->table.add(name,value);
+		}
+		is_field_seen=true;
+		on_field(name,value);
+	}
+}
+
+void HpackDecoder::setMaxTableSize(const size_t& max_size){
+	this->max_table_size=max_size;
+}
+
+uint64_t HpackDecoder::decodeInteger(const std::string_view& block, size_t& pos, const uint8_t& prefix_bits){
+	if (pos>=block.size()) throw ConnectionError(ErrorCode::COMPRESSION_ERROR,"truncated integer in HpackDecoder::decodeInteger");
+	uint64_t mask=(1u<<prefix_bits)-1;
+	uint64_t value=static_cast<uint8_t>(block[pos++])&mask;
+	if (value<mask) return value;
+	for (int shift=0;;shift+=7){ //RFC 7541 5.1，后续字节每个带7位
+		if (pos>=block.size() || shift>56) throw ConnectionError(ErrorCode::COMPRESSION_ERROR,"bad integer in HpackDecoder::decodeInteger");
+		uint8_t byte=block[pos++];
+		value+=static_cast<uint64_t>(byte&0x7f)<<shift;
+		if (!(byte&0x80)) return value;
+	}
+}
+
+std::string_view HpackDecoder::decodeString(const std::string_view& block, size_t& pos, ::utils::Arena& arena){
+	if (pos>=block.size()) throw ConnectionError(ErrorCode::COMPRESSION_ERROR,"truncated string in HpackDecoder::decodeString");
+	bool is_huffman=block[pos]&0x80;
+	uint64_t len=HpackDecoder::decodeInteger(block,pos,7);
+	if (len>block.size()-pos) throw ConnectionError(ErrorCode::COMPRESSION_ERROR,"truncated string in HpackDecoder::decodeString");
+	std::string_view data=block.substr(pos,len);
+	pos+=len;
+	if (is_huffman) return HpackDecoder::decodeHuffman(data,arena);
+	return arena.copy(data);
+}
+
+std::string_view HpackDecoder::decodeHuffman(const std::string_view& data, ::utils::Arena& arena){
+	char* decoded=arena.allocateChars(data.size()*8/5+1); //最短的编码是5位
+	size_t len=0;
+	int node=0;
+	int pending_bits=0; //当前符号已经读了多少位
+	bool is_all_ones=true; //当前符号读到的位是否都是1，结尾的填充必须是EOS的前缀
+	for (char c:data){
+		for (int i=7;i>=0;--i){
+			int bit=(static_cast<uint8_t>(c)>>i)&1;
+			node=huffman_tree[node].children[bit];
+			if (-1==node) throw ConnectionError(ErrorCode::COMPRESSION_ERROR,"invalid huffman code in HpackDecoder::decodeHuffman");
+			++pending_bits;
+			is_all_ones=is_all_ones && bit;
+			int symbol=huffman_tree[node].symbol;
+			if (-1==symbol) continue;
+			if (256==symbol) throw ConnectionError(ErrorCode::COMPRESSION_ERROR,"EOS in huffman string in HpackDecoder::decodeHuffman");
+			decoded[len++]=static_cast<char>(symbol);
+			node=0;
+			pending_bits=0;
+			is_all_ones=true;
+		}
+	}
+	if (pending_bits>7 || !is_all_ones) throw ConnectionError(ErrorCode::COMPRESSION_ERROR,"invalid huffman padding in HpackDecoder::decodeHuffman");
+	return std::string_view(decoded,len);
+}
+
+/*------------implement of HpackEncoder--------------*/
+HpackEncoder::HpackEncoder():is_size_changed(false){}
+
+void HpackEncoder::encode(const std::string_view& name, const std::string_view& value, std::string& out){
+	if (this->is_size_changed){ //动态表大小更新要放在头部块的开头
+		HpackEncoder::encodeInteger(this->table.getMaxSize(),5,0x20,out);
+		this->is_size_changed=false;
+	}
+	bool is_full_match;
+	size_t index=this->table.find(name,value,is_full_match);
+	if (is_full_match){
+		HpackEncoder::encodeInteger(index,7,0x80,out);
+		return;
+	}
+	bool is_indexing="content-length"!=name; //content-length几乎每次都不同，加入动态表只会挤掉有用的表项
+	if (is_indexing) HpackEncoder::encodeInteger(index,6,0x40,out);
+	else HpackEncoder::encodeInteger(index,4,0x00,out);
+	if (0==index) HpackEncoder::encodeString(name,out);
+	HpackEncoder::encodeString(value,out);
+	if (is_indexing) this->table.add(name,value);
+}
+
+void HpackEncoder::setMaxTableSize(const size_t& max_size){
+	size_t new_size=std::min(max_size,static_cast<size_t>(HTTP2_HEADER_TABLE_SIZE));
+	if (new_size==this->table.getMaxSize()) return;
+	this->table.setMaxSize(new_size);
+	this->is_size_changed=true;
+}
+
+void HpackEncoder::encodeInteger(uint64_t value, const uint8_t& prefix_bits, const uint8_t& first_byte, std::string& out){
+	uint64_t mask=(1u<<prefix_bits)-1;
+	if (value<mask){
+		out.push_back(static_cast<char>(first_byte|value));
+		return;
+	}
+	out.push_back(static_cast<char>(first_byte|mask));
+	value-=mask;
+	while (value>=0x80){
+		out.push_back(static_cast<char>((value&0x7f)|0x80));
+		value>>=7;
+	}
+	out.push_back(static_cast<char>(value));
+}
+
+void HpackEncoder::encodeString(const std::string_view& str, std::string& out){
+	HpackEncoder::encodeInteger(str.size(),7,0x00,out);
+	out.append(str);
+}
+
+/*------------implement of Connection--------------*/
+Connection::Connection(Channel& channel, Handler handler, const std::atomic_bool* p_draining):
+	channel(channel),
+	handler(std::move(handler)),
+	p_draining(p_draining),
+	last_stream_id(0),
+	send_window(HTTP2_DEFAULT_WINDOW_SIZE),
+	recv_window(HTTP2_DEFAULT_WINDOW_SIZE),
+	peer_initial_window_size(HTTP2_DEFAULT_WINDOW_SIZE),
+	peer_max_frame_size(HTTP2_DEFAULT_MAX_FRAME_SIZE),
+	header_block_stream_id(0),
+	header_block_end_stream(false),
+	is_goaway(false){}
+
+void Connection::run(const std::string_view& buffered, std::unique_ptr<Exchange> up_upgrade){
+	std::vector<char> buf_in(std::max(buffered.size(),static_cast<size_t>(2*(HTTP2_DEFAULT_MAX_FRAME_SIZE+FRAME_HEAD_LEN)))); //至少能放下一个最大的帧
+	memcpy(buf_in.data(),buffered.data(),buffered.size());
+	size_t buf_len=buffered.size();
+	bool is_preface_received=false;
+	try{
+		if (nullptr!=up_upgrade){ //先用HTTP/1.1回复101，之后的数据都是HTTP/2帧
+			static const std::string_view switching="HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+			this->append(switching.data(),switching.size());
+		}
+
+		//服务端的连接序言是一个SETTINGS帧，同时把连接级别的接收窗口调大
+		char settings[12];
+		putSetting(settings,SETTINGS_MAX_CONCURRENT_STREAMS,HTTP2_MAX_CONCURRENT_STREAMS);
+		putSetting(settings+6,SETTINGS_INITIAL_WINDOW_SIZE,HTTP2_RECV_WINDOW_SIZE);
+		this->writeFrame(FrameType::SETTINGS,0,0,std::string_view(settings,sizeof(settings)));
+		this->writeWindowUpdate(0,HTTP2_RECV_WINDOW_SIZE-HTTP2_DEFAULT_WINDOW_SIZE);
+		this->recv_window=HTTP2_RECV_WINDOW_SIZE;
+
+		if (nullptr!=up_upgrade){ //升级的请求作为流1，请求已经接收完整，HTTP2-Settings相当于对端的SETTINGS帧，101就是对它的确认
+			auto p_settings=up_upgrade->request.getHeader("http2-settings");
+			std::string payload=base64UrlDecode(nullptr==p_settings? std::string_view():*p_settings);
+			if (0!=payload.size()%6) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"bad HTTP2-Settings in Connection::run");
+			this->applySettings(payload);
+			this->last_stream_id=1;
+			Stream& stream=this->openStream(1);
+			this->free_exchanges.push_back(std::move(stream.up_exchange));
+			stream.up_exchange=std::move(up_upgrade);
+			stream.up_exchange->request.setVersion(Version::Type::HTTP_2);
+			stream.is_request_done=true;
+			this->finishRequest(stream);
+		}
+
+		while(1){
+			//处理缓冲区中所有完整的帧
+			size_t consumed=0;
+			if (!is_preface_received && buf_len>=HTTP2_PREFACE_LEN){
+				if (!Connection::isPreface(std::string_view(buf_in.data(),buf_len))) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"bad preface in Connection::run");
+				consumed=HTTP2_PREFACE_LEN;
+				is_preface_received=true;
+			}
+			while (is_preface_received && buf_len-consumed>=FRAME_HEAD_LEN){
+				const char* p=buf_in.data()+consumed;
+				size_t len=(static_cast<size_t>(static_cast<uint8_t>(p[0]))<<16)|(static_cast<size_t>(static_cast<uint8_t>(p[1]))<<8)|static_cast<uint8_t>(p[2]);
+				if (len>HTTP2_DEFAULT_MAX_FRAME_SIZE) throw ConnectionError(ErrorCode::FRAME_SIZE_ERROR,"frame too large in Connection::run");
+				if (buf_len-consumed<FRAME_HEAD_LEN+len) break; //帧还不完整
+				FrameType type=static_cast<FrameType>(p[3]);
+				uint8_t flags=p[4];
+				uint32_t stream_id=readUint32(p+5)&0x7fffffff;
+				try{
+					this->handleFrame(type,flags,stream_id,std::string_view(p+FRAME_HEAD_LEN,len));
+				}
+				catch(const StreamError& e){ //流错误只关闭这个流
+					std::cerr << e.what() << '\n';
+					this->writeRstStream(e.getStreamId(),e.getCode());
+					this->closeStream(e.getStreamId());
+				}
+				consumed+=FRAME_HEAD_LEN+len;
+			}
+			memmove(buf_in.data(),buf_in.data()+consumed,buf_len-consumed);
+			buf_len-=consumed;
+
+			bool is_more=false; //窗口内还有数据没有排队
+			if (is_preface_received){ //升级时等对端的连接序言到了再发DATA，有的客户端在101之后只能缓冲很少的数据
+				size_t queued=0;
+				while (queued<HTTP2_MAX_QUEUED_DATA){ //对端的窗口可能有几MB，不能等窗口用完才发
+					size_t len=this->scheduleData();
+					if (0==len) break;
+					queued+=len;
+				}
+				is_more=queued>=HTTP2_MAX_QUEUED_DATA;
+			}
+			if (this->isDraining()) this->writeGoaway(ErrorCode::NO_ERROR); //热重启，不再接收新的流，让客户端连接新进程
+			this->flush();
+			if (this->is_goaway && this->streams.empty()) break;
+
+			bool is_readable=false;
+			if (is_more){ //还有数据要发，只处理已经到达的帧（RST_STREAM、WINDOW_UPDATE等），没有就接着发
+				if (!this->channel.waitReadable(0)) continue;
+				is_readable=true;
+			}
+			for (int i=0;i<READ_TIMEOUT_SEC && !is_readable && !this->isDraining();++i) is_readable=this->channel.waitReadable(1); //每秒检查一次是否在热重启
+			if (!is_readable && this->isDraining()) continue;
+			if (!is_readable){ //空闲超时，告诉对端不再接收新的流
+				this->writeGoaway(ErrorCode::NO_ERROR);
+				this->flush();
+				break;
+			}
+			ssize_t len=this->channel.read(buf_in.data()+buf_len,buf_in.size()-buf_len);
+			if (len<=0) break; //客户端断开连接了
+			buf_len+=len;
+		}
+	}
+	catch(const ConnectionError& e){
+		std::cerr << e.what() << '\n';
+		try{
+			this->writeGoaway(e.getCode());
+			this->flush();
+		}
+		catch(const std::exception& e){
+			std::cerr << e.what() << '\n';
+		}
+	}
+	catch(const std::exception& e){
+		std::cerr << e.what() << '\n';
+	}
+}
+
+bool Connection::isPreface(const std::string_view& data){
+	return data.size()>=HTTP2_PREFACE_LEN && 0==memcmp(data.data(),HTTP2_PREFACE,HTTP2_PREFACE_LEN);
+}
+
+bool Connection::isUpgrade(const Request& request){
+	auto p_upgrade=request.getHeader("upgrade");
+	if (nullptr==p_upgrade || !utils::equalsIgnoreCase(*p_upgrade,"h2c")) return false;
+	if (nullptr==request.getHeader("http2-settings")) return false;
+	return nullptr==request.getBody(); //带body的请求升级后还要继续读body，不支持这种情况，按HTTP/1.1处理
+}
+
+void Connection::handleFrame(const FrameType& type, const uint8_t& flags, const uint32_t& stream_id, const std::string_view& payload){
+	if (0!=this->header_block_stream_id && (FrameType::CONTINUATION!=type || stream_id!=this->header_block_stream_id)){ //头部块中间不能插入其他帧
+		throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"expected CONTINUATION in Connection::handleFrame");
+	}
+	switch (type){
+	case FrameType::DATA:
+		this->handleData(flags,stream_id,payload);
+		break;
+	case FrameType::HEADERS:
+		this->handleHeaders(flags,stream_id,payload);
+		break;
+	case FrameType::PRIORITY: //不支持优先级，所有流轮流发送
+		if (0==stream_id) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"PRIORITY on stream 0 in Connection::handleFrame");
+		if (5!=payload.size()) throw StreamError(stream_id,ErrorCode::FRAME_SIZE_ERROR,"bad PRIORITY in Connection::handleFrame");
+		break;
+	case FrameType::RST_STREAM:
+		if (0==stream_id) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"RST_STREAM on stream 0 in Connection::handleFrame");
+		if (4!=payload.size()) throw ConnectionError(ErrorCode::FRAME_SIZE_ERROR,"bad RST_STREAM in Connection::handleFrame");
+		this->closeStream(stream_id);
+		break;
+	case FrameType::SETTINGS:
+		this->handleSettings(flags,stream_id,payload);
+		break;
+	case FrameType::PUSH_PROMISE: //客户端不能推送
+		throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"PUSH_PROMISE from client in Connection::handleFrame");
+	case FrameType::PING:
+		if (0!=stream_id) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"PING on stream in Connection::handleFrame");
+		if (8!=payload.size()) throw ConnectionError(ErrorCode::FRAME_SIZE_ERROR,"bad PING in Connection::handleFrame");
+		if (!(flags&FLAG_ACK)) this->writeFrame(FrameType::PING,FLAG_ACK,0,payload);
+		break;
+	case FrameType::GOAWAY:
+		this->is_goaway=true;
+		break;
+	case FrameType::WINDOW_UPDATE:
+		this->handleWindowUpdate(stream_id,payload);
+		break;
+	case FrameType::CONTINUATION:
+		if (0==this->header_block_stream_id) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"unexpected CONTINUATION in Connection::handleFrame");
+		if (this->header_block.size()+payload.size()>MAX_REQUEST_SIZE) throw ConnectionError(ErrorCode::ENHANCE_YOUR_CALM,"header block too large in Connection::handleFrame");
+		this->header_block.append(payload);
+		if (flags&FLAG_END_HEADERS){
+			this->header_block_stream_id=0;
+			this->handleHeaderBlock(stream_id,this->header_block_end_stream);
+		}
+		break;
+	default: //未知类型的帧直接忽略
+		break;
+	}
+}
+
+void Connection::handleHeaders(const uint8_t& flags, const uint32_t& stream_id, std::string_view payload){
+	if (0==stream_id || 0==stream_id%2) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"bad stream id in Connection::handleHeaders");
+	if (flags&FLAG_PADDED){
+		if (payload.empty() || static_cast<uint8_t>(payload[0])>=payload.size()) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"bad padding in Connection::handleHeaders");
+		payload.remove_suffix(static_cast<uint8_t>(payload[0]));
+		payload.remove_prefix(1);
+	}
+	if (flags&FLAG_PRIORITY){
+		if (payload.size()<5) throw ConnectionError(ErrorCode::FRAME_SIZE_ERROR,"bad priority in Connection::handleHeaders");
+		payload.remove_prefix(5);
+	}
+	auto it=this->streams.find(stream_id);
+	if (this->streams.end()==it){
+		if (stream_id<=this->last_stream_id) throw ConnectionError(ErrorCode::STREAM_CLOSED,"HEADERS on closed stream in Connection::handleHeaders");
+	}
+	else if (it->second.is_request_done){ //对端已经发送过END_STREAM
+		throw ConnectionError(ErrorCode::STREAM_CLOSED,"HEADERS on half closed stream in Connection::handleHeaders");
+	}
+	this->header_block.assign(payload.data(),payload.size());
+	this->header_block_end_stream=flags&FLAG_END_STREAM;
+	if (flags&FLAG_END_HEADERS) this->handleHeaderBlock(stream_id,this->header_block_end_stream);
+	else this->header_block_stream_id=stream_id;
+}
+
+void Connection::handleHeaderBlock(const uint32_t& stream_id, const bool& is_end_stream){
+	auto it=this->streams.find(stream_id);
+	bool is_new=this->streams.end()==it;
+	if (is_new) this->last_stream_id=stream_id;
+	Stream& stream=is_new? this->openStream(stream_id):it->second;
+	Request& request=stream.up_exchange->request;
+	//即使之后要拒绝这个流也必须先解码，否则HPACK的动态表会和对端不一致
+	this->decoder.decode(this->header_block,request.getArena(),[&](const std::string_view& name, const std::string_view& value){
+		if (!is_new) return; //忽略trailer
+		if (!name.empty() && ':'==name[0]){ //伪头部
+			if (":method"==name) stream.method=value;
+			else if (":path"==name) stream.path=value;
+			else if (":authority"==name && nullptr==request.getHeader("host")) request.setHeader("host",value);
+			return;
+		}
+		auto p_value=request.getHeader(name);
+		if (nullptr!=p_value && "host"!=name){ //重复的字段合并成一个：HTTP/2的cookie通常拆成多个字段，其他字段按列表用逗号连接
+			auto& arena=request.getArena();
+			request.setHeader(name,arena.concat(arena.concat(*p_value,"cookie"==name? "; ":", "),value));
+			return;
+		}
+		request.setHeader(name,value);
+	});
+	this->header_block.clear();
+	if (is_new && (this->is_goaway || this->streams.size()>HTTP2_MAX_CONCURRENT_STREAMS)){
+		throw StreamError(stream_id,ErrorCode::REFUSED_STREAM,"too many streams in Connection::handleHeaderBlock");
+	}
+	if (is_new) request.setVersion(Version::Type::HTTP_2);
+	if (is_end_stream){
+		stream.is_request_done=true;
+		this->finishRequest(stream);
+	}
+}
+
+void Connection::handleData(const uint8_t& flags, const uint32_t& stream_id, std::string_view payload){
+	if (0==stream_id) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"DATA on stream 0 in Connection::handleData");
+	//填充也计入流量控制
+	int64_t flow_len=payload.size();
+	this->recv_window-=flow_len;
+	if (this->recv_window<0) throw ConnectionError(ErrorCode::FLOW_CONTROL_ERROR,"connection window exceeded in Connection::handleData");
+	if (this->recv_window<HTTP2_RECV_WINDOW_SIZE/2){ //用掉一半就补满，避免对端等待
+		this->writeWindowUpdate(0,HTTP2_RECV_WINDOW_SIZE-this->recv_window);
+		this->recv_window=HTTP2_RECV_WINDOW_SIZE;
+	}
+	if (flags&FLAG_PADDED){
+		if (payload.empty() || static_cast<uint8_t>(payload[0])>=payload.size()) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"bad padding in Connection::handleData");
+		payload.remove_suffix(static_cast<uint8_t>(payload[0]));
+		payload.remove_prefix(1);
+	}
+	auto it=this->streams.find(stream_id);
+	if (this->streams.end()==it){
+		if (stream_id>this->last_stream_id) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"DATA on idle stream in Connection::handleData");
+		throw StreamError(stream_id,ErrorCode::STREAM_CLOSED,"DATA on closed stream in Connection::handleData");
+	}
+	Stream& stream=it->second;
+	if (stream.is_request_done) throw StreamError(stream_id,ErrorCode::STREAM_CLOSED,"DATA on half closed stream in Connection::handleData");
+	stream.recv_window-=flow_len;
+	if (stream.recv_window<0) throw StreamError(stream_id,ErrorCode::FLOW_CONTROL_ERROR,"stream window exceeded in Connection::handleData");
+	if (stream.body.size()+payload.size()>MAX_REQUEST_SIZE) throw StreamError(stream_id,ErrorCode::CANCEL,"request too large in Connection::handleData");
+	stream.body.append(payload.data(),payload.size());
+	if (flags&FLAG_END_STREAM){
+		stream.is_request_done=true;
+		this->finishRequest(stream);
+	}
+	else if (stream.recv_window<HTTP2_RECV_WINDOW_SIZE/2){
+		this->writeWindowUpdate(stream_id,HTTP2_RECV_WINDOW_SIZE-stream.recv_window);
+		stream.recv_window=HTTP2_RECV_WINDOW_SIZE;
+	}
+}
+
+void Connection::handleSettings(const uint8_t& flags, const uint32_t& stream_id, const std::string_view& payload){
+	if (0!=stream_id) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"SETTINGS on stream in Connection::handleSettings");
+	if (flags&FLAG_ACK){
+		if (!payload.empty()) throw ConnectionError(ErrorCode::FRAME_SIZE_ERROR,"SETTINGS ACK with payload in Connection::handleSettings");
+		return;
+	}
+	if (0!=payload.size()%6) throw ConnectionError(ErrorCode::FRAME_SIZE_ERROR,"bad SETTINGS in Connection::handleSettings");
+	this->applySettings(payload);
+	this->writeFrame(FrameType::SETTINGS,FLAG_ACK,0,std::string_view());
+}
+
+void Connection::handleWindowUpdate(const uint32_t& stream_id, const std::string_view& payload){
+	if (4!=payload.size()) throw ConnectionError(ErrorCode::FRAME_SIZE_ERROR,"bad WINDOW_UPDATE in Connection::handleWindowUpdate");
+	int64_t increment=readUint32(payload.data())&0x7fffffff;
+	if (0==stream_id){
+		if (0==increment) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"zero WINDOW_UPDATE in Connection::handleWindowUpdate");
+		this->send_window+=increment;
+		if (this->send_window>MAX_WINDOW_SIZE) throw ConnectionError(ErrorCode::FLOW_CONTROL_ERROR,"window overflow in Connection::handleWindowUpdate");
+		return;
+	}
+	if (0==increment) throw StreamError(stream_id,ErrorCode::PROTOCOL_ERROR,"zero WINDOW_UPDATE in Connection::handleWindowUpdate");
+	auto it=this->streams.find(stream_id);
+	if (this->streams.end()==it) return; //流可能刚刚关闭
+	it->second.send_window+=increment;
+	if (it->second.send_window>MAX_WINDOW_SIZE) throw StreamError(stream_id,ErrorCode::FLOW_CONTROL_ERROR,"window overflow in Connection::handleWindowUpdate");
+}
+
+void Connection::applySettings(const std::string_view& payload){
+	for (size_t i=0;i+6<=payload.size();i+=6){
+		uint16_t id=(static_cast<uint16_t>(static_cast<uint8_t>(payload[i]))<<8)|static_cast<uint8_t>(payload[i+1]);
+		uint32_t value=readUint32(payload.data()+i+2);
+		switch (id){
+		case SETTINGS_HEADER_TABLE_SIZE:
+			this->encoder.setMaxTableSize(value);
+			break;
+		case SETTINGS_ENABLE_PUSH:
+			if (value>1) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"bad ENABLE_PUSH in Connection::applySettings");
+			break;
+		case SETTINGS_INITIAL_WINDOW_SIZE:{ //调整所有已打开的流的发送窗口
+			if (value>MAX_WINDOW_SIZE) throw ConnectionError(ErrorCode::FLOW_CONTROL_ERROR,"bad INITIAL_WINDOW_SIZE in Connection::applySettings");
+			int64_t delta=static_cast<int64_t>(value)-this->peer_initial_window_size;
+			for (auto& item:this->streams){
+				item.second.send_window+=delta;
+				if (item.second.send_window>MAX_WINDOW_SIZE) throw ConnectionError(ErrorCode::FLOW_CONTROL_ERROR,"window overflow in Connection::applySettings");
+			}
+			this->peer_initial_window_size=value;
+			break;
+		}
+		case SETTINGS_MAX_FRAME_SIZE:
+			if (value<HTTP2_DEFAULT_MAX_FRAME_SIZE || value>0xffffff) throw ConnectionError(ErrorCode::PROTOCOL_ERROR,"bad MAX_FRAME_SIZE in Connection::applySettings");
+			this->peer_max_frame_size=value;
+			break;
+		default: //其他设置不影响服务端的行为
+			break;
+		}
+	}
+}
+
+Connection::Stream& Connection::openStream(const uint32_t& stream_id){
+	Stream stream;
+	stream.id=stream_id;
+	stream.send_window=this->peer_initial_window_size;
+	stream.recv_window=HTTP2_RECV_WINDOW_SIZE;
+	if (this->free_exchanges.empty()) stream.up_exchange=std::make_unique<Exchange>();
+	else{
+		stream.up_exchange=std::move(this->free_exchanges.back());
+		this->free_exchanges.pop_back();
+	}
+	stream.is_request_done=false;
+	stream.is_response_started=false;
+	stream.sent=0;
+	return this->streams.emplace(stream_id,std::move(stream)).first->second;
+}
+
+void Connection::closeStream(const uint32_t& stream_id){
+	auto it=this->streams.find(stream_id);
+	if (this->streams.end()==it) return;
+	this->closing_exchanges.push_back(std::move(it->second.up_exchange)); //待发送的DATA帧可能还引用着响应的body
+	this->streams.erase(it);
+}
+
+void Connection::finishRequest(Stream& stream){
+	Request& request=stream.up_exchange->request;
+	Response& response=stream.up_exchange->response;
+	try{
+		if (request.getPath().empty()){ //通过升级得到的请求已经解析过了
+			if (stream.method.empty() || stream.path.empty()) throw httpd::HttpException(httpd::StatusCodeAndMessage::Type::BadRequest); //缺少必须的伪头部
+			request.setMethod(Method(stream.method).getType());
+			request.setPath(utils::urlDecode(stream.path,request.getArena()));
+		}
+		if (!stream.body.empty()){ //body拷贝到arena中，回调可以直接引用它构造响应
+			auto p_type=request.getHeader("content-type");
+			request.setBody(Body(nullptr==p_type? std::string_view("application/octet-stream"):*p_type,request.getArena().copy(stream.body)));
+		}
+		this->handler(request,response);
+	}
+	catch(const httpd::HttpException& e){
+		std::cerr << e.what() << '\n';
+		response.clear();
+		response.quickBuild(e.getStatusCodeAndMessage());
+	}
+	this->sendHeaders(stream);
+	if (nullptr==response.getBody() || 0==response.getBody()->getSize()) this->closeStream(stream.id); //没有body，HEADERS帧已经带了END_STREAM
+}
+
+void Connection::sendHeaders(Stream& stream){
+	const Response& response=stream.up_exchange->response;
+	char status[4];
+	auto result=std::to_chars(status,status+sizeof(status),static_cast<int>(response.getStatusCodeAndMessage().getType()));
+	this->response_block.clear();
+	this->encoder.encode(":status",std::string_view(status,result.ptr-status),this->response_block);
+	for (const auto& field:response.getHeaders()){
+		if (isConnectionSpecific(field.key)) continue;
+		this->encoder.encode(field.key,field.value,this->response_block);
+	}
+	bool is_end_stream=nullptr==response.getBody() || 0==response.getBody()->getSize();
+
+	//头部块超过最大帧大小时拆成HEADERS+CONTINUATION
+	std::string_view block(this->response_block);
+	size_t len=std::min(block.size(),this->peer_max_frame_size);
+	uint8_t flags=(is_end_stream? FLAG_END_STREAM:0)|(len==block.size()? FLAG_END_HEADERS:0);
+	this->writeFrame(FrameType::HEADERS,flags,stream.id,block.substr(0,len));
+	block.remove_prefix(len);
+	while (!block.empty()){
+		len=std::min(block.size(),this->peer_max_frame_size);
+		this->writeFrame(FrameType::CONTINUATION,len==block.size()? FLAG_END_HEADERS:0,stream.id,block.substr(0,len));
+		block.remove_prefix(len);
+	}
+	stream.is_response_started=true;
+}
+
+size_t Connection::scheduleData(){
+	size_t queued=0;
+	for (auto it=this->streams.begin();it!=this->streams.end();){
+		Stream& stream=it->second;
+		if (!stream.is_response_started || this->send_window<=0){
+			++it;
+			continue;
+		}
+		const Body& body=*(stream.up_exchange->response.getBody());
+		size_t remaining=UNKNOWN_BODY_SIZE==body.getSize()? UNKNOWN_BODY_SIZE:body.getSize()-stream.sent;
+		int64_t window=std::min(this->send_window,stream.send_window);
+		if (window<=0){
+			++it;
+			continue;
+		}
+		size_t len=std::min({remaining,static_cast<size_t>(HTTP2_DATA_CHUNK_SIZE),this->peer_max_frame_size,static_cast<size_t>(window)});
+		bool is_end_stream=len==remaining;
+		if (body.isStream()){ //流式body读到多少发多少，长度未知时读到结尾再发END_STREAM
+			char buf[HTTP2_DATA_CHUNK_SIZE];
+			try{
+				len=body.getSource()->read(buf,len);
+				if (0==len && UNKNOWN_BODY_SIZE!=remaining) throw std::runtime_error("body shorter than content-length in Connection::scheduleData");
+			}
+			catch(const std::exception& e){ //响应已经开始了，只能重置这个流
+				std::cerr << e.what() << '\n';
+				this->writeRstStream(stream.id,ErrorCode::INTERNAL_ERROR);
+				++it;
+				this->closeStream(stream.id);
+				continue;
+			}
+			is_end_stream=0==len || len==remaining;
+			this->writeFrame(FrameType::DATA,is_end_stream? FLAG_END_STREAM:0,stream.id,std::string_view(buf,len));
+		}
+		else{
+			this->writeFrameHead(FrameType::DATA,is_end_stream? FLAG_END_STREAM:0,stream.id,len);
+			if (body.isFile()) this->segments.push_back(Segment{nullptr,stream.sent,len,body.getFileDescriptor()});
+			else this->segments.push_back(Segment{body.getContent().data()+stream.sent,0,len,-1}); //body直接引用，不拷贝
+		}
+		this->send_window-=len;
+		stream.send_window-=len;
+		stream.sent+=len;
+		queued+=FRAME_HEAD_LEN+len; //只有END_STREAM的空DATA帧也算，调用者据此判断是否还要继续
+		++it;
+		if (is_end_stream) this->closeStream(stream.id);
+	}
+	return queued;
+}
+
+void Connection::writeFrame(const FrameType& type, const uint8_t& flags, const uint32_t& stream_id, const std::string_view& payload){
+	this->writeFrameHead(type,flags,stream_id,payload.size());
+	this->append(payload.data(),payload.size());
+}
+
+void Connection::writeFrameHead(const FrameType& type, const uint8_t& flags, const uint32_t& stream_id, const size_t& len){
+	char head[FRAME_HEAD_LEN];
+	head[0]=static_cast<char>(len>>16);
+	head[1]=static_cast<char>(len>>8);
+	head[2]=static_cast<char>(len);
+	head[3]=static_cast<char>(type);
+	head[4]=static_cast<char>(flags);
+	putUint32(head+5,stream_id);
+	this->append(head,sizeof(head));
+}
+
+void Connection::writeRstStream(const uint32_t& stream_id, const ErrorCode& code){
+	char payload[4];
+	putUint32(payload,static_cast<uint32_t>(code));
+	this->writeFrame(FrameType::RST_STREAM,0,stream_id,std::string_view(payload,sizeof(payload)));
+}
+
+void Connection::writeWindowUpdate(const uint32_t& stream_id, const uint32_t& increment){
+	char payload[4];
+	putUint32(payload,increment);
+	this->writeFrame(FrameType::WINDOW_UPDATE,0,stream_id,std::string_view(payload,sizeof(payload)));
+}
+
+void Connection::writeGoaway(const ErrorCode& code){
+	char payload[8];
+	putUint32(payload,this->last_stream_id);
+	putUint32(payload+4,static_cast<uint32_t>(code));
+	this->writeFrame(FrameType::GOAWAY,0,0,std::string_view(payload,sizeof(payload)));
+	this->is_goaway=true;
+}
+
+void Connection::append(const char* p_data, const size_t& len){
+	if (0==len) return;
+	size_t offset=this->out.size();
+	this->out.append(p_data,len);
+	if (!this->segments.empty() && nullptr==this->segments.back().p_data && -1==this->segments.back().file_fd
+		&& this->segments.back().offset+this->segments.back().len==offset){ //和上一段连续就合并
+		this->segments.back().len+=len;
+		return;
+	}
+	this->segments.push_back(Segment{nullptr,offset,len,-1});
+}
+
+void Connection::flush(){
+	struct iovec iov[64];
+	size_t iovcnt=0;
+	for (const auto& segment:this->segments){
+		if (-1!=segment.file_fd){ //先把前面的数据写出去，再sendfile
+			if (iovcnt>0) this->channel.writeAll(iov,iovcnt,true);
+			iovcnt=0;
+			this->channel.sendFile(segment.file_fd,segment.offset,segment.len);
+			continue;
+		}
+		const char* p=nullptr==segment.p_data? this->out.data()+segment.offset:segment.p_data;
+		iov[iovcnt].iov_base=const_cast<char*>(p);
+		iov[iovcnt].iov_len=segment.len;
+		if (++iovcnt==sizeof(iov)/sizeof(iov[0])){
+			this->channel.writeAll(iov,iovcnt,true);
+			iovcnt=0;
+		}
+	}
+	if (iovcnt>0) this->channel.writeAll(iov,iovcnt);
+	this->out.clear();
+	this->segments.clear();
+	for (auto& up_exchange:this->closing_exchanges){ //数据发出去之后才能复用
+		up_exchange->clear();
+		this->free_exchanges.push_back(std::move(up_exchange));
+	}
+	this->closing_exchanges.clear();
+}
+
+bool Connection::isDraining() const{
+	return nullptr!=this->p_draining && this->p_draining->load() && !this->is_goaway;
+}
+
+} // namespace http2
+
+} // namespace httpd
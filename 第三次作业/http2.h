@@ -0,0 +1,221 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <functional>
+#include <stdexcept>
+#include "httpd.h"
+
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" //客户端连接序言
+#define HTTP2_PREFACE_LEN 24
+#define HTTP2_MAX_CONCURRENT_STREAMS 128 //一个连接最多同时打开的流
+#define HTTP2_DEFAULT_WINDOW_SIZE 65535 //流量控制窗口的初始大小
+#define HTTP2_RECV_WINDOW_SIZE (1<<20) //本端为每个流和整个连接提供的接收窗口
+#define HTTP2_DEFAULT_MAX_FRAME_SIZE 16384 //帧负载的默认最大大小
+#define HTTP2_HEADER_TABLE_SIZE 4096 //HPACK动态表的默认大小
+#define HTTP2_DATA_CHUNK_SIZE 16384 //每轮调度每个流最多发送的数据量，保证多个流交替发送
+#define HTTP2_MAX_QUEUED_DATA (4*HTTP2_DATA_CHUNK_SIZE) //排队的DATA超过这么多就先发出去，再回去处理对端的帧，流式body不会整个缓冲在内存里
+
+namespace httpd
+{
+
+namespace http2
+{
+
+/*------------Definition of ErrorCode--------------*/
+enum class ErrorCode : uint32_t{ //RFC 7540 7. Error Codes
+    NO_ERROR=0x0,
+    PROTOCOL_ERROR=0x1,
+    INTERNAL_ERROR=0x2,
+    FLOW_CONTROL_ERROR=0x3,
+    SETTINGS_TIMEOUT=0x4,
+    STREAM_CLOSED=0x5,
+    FRAME_SIZE_ERROR=0x6,
+    REFUSED_STREAM=0x7,
+    CANCEL=0x8,
+    COMPRESSION_ERROR=0x9,
+    CONNECT_ERROR=0xa,
+    ENHANCE_YOUR_CALM=0xb,
+    INADEQUATE_SECURITY=0xc,
+    HTTP_1_1_REQUIRED=0xd
+};
+
+/*------------Definition of ConnectionError--------------*/
+class ConnectionError : public std::runtime_error { //连接错误，需要发送GOAWAY并关闭连接
+public:
+    ConnectionError(const ErrorCode& code, const std::string& what);
+    ErrorCode getCode() const;
+
+private:
+    ErrorCode code;
+};
+
+/*------------Definition of StreamError--------------*/
+class StreamError : public std::runtime_error { //流错误，只需要对该流发送RST_STREAM
+public:
+    StreamError(const uint32_t& stream_id, const ErrorCode& code, const std::string& what);
+    uint32_t getStreamId() const;
+    ErrorCode getCode() const;
+
+private:
+    uint32_t stream_id;
+    ErrorCode code;
+};
+
+/*------------Definition of HeaderTable--------------*/
+class HeaderTable{ //HPACK的索引表，由静态表和动态表组成
+public:
+    HeaderTable(const size_t& max_size=HTTP2_HEADER_TABLE_SIZE);
+
+    bool get(const size_t& index, std::string_view& name, std::string_view& value) const; //按索引取出表项，索引不存在返回false
+    size_t find(const std::string_view& name, const std::string_view& value, bool& is_full_match) const; //查找表项，返回0表示没找到
+    void add(const std::string_view& name, const std::string_view& value); //加入动态表，必要时淘汰旧的表项
+    void setMaxSize(const size_t& max_size);
+    size_t getMaxSize() const;
+
+private:
+    void evict(const size_t& max_size);
+
+private:
+    std::deque<std::pair<std::string,std::string>> entries; //最新的表项在最前面
+    size_t size; //按RFC 7541 4.1计算的表大小
+    size_t max_size;
+};
+
+/*------------Definition of HpackDecoder--------------*/
+class HpackDecoder{ //HPACK解码器
+public:
+    HpackDecoder();
+
+    //解码一个完整的头部块，解码出的字符串存放在arena中，每解码出一个字段就调用一次on_field
+    void decode(const std::string_view& block, ::utils::Arena& arena, const std::function<void(const std::string_view&,const std::string_view&)>& on_field);
+    void setMaxTableSize(const size_t& max_size); //本端SETTINGS_HEADER_TABLE_SIZE的上限
+
+private:
+    static uint64_t decodeInteger(const std::string_view& block, size_t& pos, const uint8_t& prefix_bits);
+    static std::string_view decodeString(const std::string_view& block, size_t& pos, ::utils::Arena& arena);
+    static std::string_view decodeHuffman(const std::string_view& data, ::utils::Arena& arena);
+
+private:
+    HeaderTable table;
+    size_t max_table_size;
+};
+
+/*------------Definition of HpackEncoder--------------*/
+class HpackEncoder{ //HPACK编码器，不使用Huffman编码
+public:
+    HpackEncoder();
+
+    void encode(const std::string_view& name, const std::string_view& value, std::string& out); //编码一个字段，追加到out中
+    void setMaxTableSize(const size_t& max_size); //对端SETTINGS_HEADER_TABLE_SIZE改变时调用
+
+private:
+    static void encodeInteger(uint64_t value, const uint8_t& prefix_bits, const uint8_t& first_byte, std::string& out);
+    static void encodeString(const std::string_view& str, std::string& out);
+
+private:
+    HeaderTable table;
+    bool is_size_changed; //需要在下一个头部块开头发送动态表大小更新
+};
+
+/*------------Definition of Connection--------------*/
+class Connection{ //一个HTTP/2连接，在工作线程中阻塞运行，多个流交替发送
+public:
+    using Handler=std::function<void(Request&, Response&)>;
+
+    Connection(Channel& channel, Handler handler, const std::atomic_bool* p_draining=nullptr); //p_draining变为true时发送GOAWAY，处理完已有的流就结束
+
+    //buffered是已经从socket读出但还没有处理的数据；up_upgrade不为空时表示通过Upgrade: h2c升级，该请求作为流1处理
+    void run(const std::string_view& buffered, std::unique_ptr<Exchange> up_upgrade);
+
+    static bool isPreface(const std::string_view& data); //data是否以连接序言开头
+    static bool isUpgrade(const Request& request); //是否为Upgrade: h2c请求
+
+private:
+    enum class FrameType : uint8_t{
+        DATA=0x0,
+        HEADERS=0x1,
+        PRIORITY=0x2,
+        RST_STREAM=0x3,
+        SETTINGS=0x4,
+        PUSH_PROMISE=0x5,
+        PING=0x6,
+        GOAWAY=0x7,
+        WINDOW_UPDATE=0x8,
+        CONTINUATION=0x9
+    };
+    struct Stream{ //一个流
+        uint32_t id;
+        int64_t send_window; //对端给的发送窗口
+        int64_t recv_window; //本端给对端的接收窗口
+        std::unique_ptr<Exchange> up_exchange;
+        std::string body; //请求的body
+        std::string_view method; //伪头部:method
+        std::string_view path; //伪头部:path
+        bool is_request_done; //请求已经接收完（对端发送了END_STREAM）
+        bool is_response_started; //响应头已经发送
+        size_t sent; //响应body已经发送的字节数
+    };
+    struct Segment{ //待发送的数据，p_data为空表示数据在out中（偏移为offset），否则直接引用p_data
+        const char* p_data;
+        size_t offset;
+        size_t len;
+        int file_fd; //不为-1表示数据在文件中，offset是文件中的偏移，用sendfile发送
+    };
+
+    void handleFrame(const FrameType& type, const uint8_t& flags, const uint32_t& stream_id, const std::string_view& payload);
+    void handleHeaders(const uint8_t& flags, const uint32_t& stream_id, std::string_view payload);
+    void handleHeaderBlock(const uint32_t& stream_id, const bool& is_end_stream); //头部块接收完整后解码
+    void handleData(const uint8_t& flags, const uint32_t& stream_id, std::string_view payload);
+    void handleSettings(const uint8_t& flags, const uint32_t& stream_id, const std::string_view& payload);
+    void handleWindowUpdate(const uint32_t& stream_id, const std::string_view& payload);
+    void applySettings(const std::string_view& payload); //应用对端的SETTINGS
+
+    Stream& openStream(const uint32_t& stream_id);
+    void closeStream(const uint32_t& stream_id);
+    void finishRequest(Stream& stream); //请求接收完整，调用回调并发送响应头
+    void sendHeaders(Stream& stream);
+    size_t scheduleData(); //在流量控制允许的范围内，轮流为每个流发送DATA帧，返回排队的字节数（包括帧头），0表示没有可发的数据
+
+    void writeFrame(const FrameType& type, const uint8_t& flags, const uint32_t& stream_id, const std::string_view& payload);
+    void writeFrameHead(const FrameType& type, const uint8_t& flags, const uint32_t& stream_id, const size_t& len);
+    void writeRstStream(const uint32_t& stream_id, const ErrorCode& code);
+    void writeWindowUpdate(const uint32_t& stream_id, const uint32_t& increment);
+    void writeGoaway(const ErrorCode& code);
+    void append(const char* p_data, const size_t& len); //拷贝到out中等待发送
+    void flush();
+    bool isDraining() const; //服务正在热重启，还没有发送GOAWAY
+
+private:
+    Channel& channel;
+    Handler handler;
+    const std::atomic_bool* p_draining;
+    HpackDecoder decoder;
+    HpackEncoder encoder;
+    std::map<uint32_t,Stream> streams;
+    std::vector<std::unique_ptr<Exchange>> free_exchanges; //复用已经关闭的流的Exchange
+    std::vector<std::unique_ptr<Exchange>> closing_exchanges; //已经关闭的流，待发送的数据可能还引用着它，flush之后才能复用
+    uint32_t last_stream_id; //对端最后打开的流
+    int64_t send_window; //连接级别的发送窗口
+    int64_t recv_window; //连接级别的接收窗口
+    int64_t peer_initial_window_size;
+    size_t peer_max_frame_size;
+    std::string header_block; //正在接收的头部块（HEADERS+CONTINUATION）
+    uint32_t header_block_stream_id; //不为0表示正在等待CONTINUATION
+    bool header_block_end_stream;
+    bool is_goaway; //收到了GOAWAY，不再接收新的流
+    std::string out; //待发送的帧
+    std::vector<Segment> segments;
+    std::string response_block; //复用的响应头部块缓冲区
+};
+
+} // namespace http2
+
+} // namespace httpd
+
+#endif // HTTP2_H
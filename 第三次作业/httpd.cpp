@@ -1,4 +1,14 @@
 #include "httpd.h"
+#include "http2.h"
+#include "tls.h"
+#include "proxy.h"
+#include "restart.h"
+#include "scheduler.h"
+#include "fastcgi.h"
+#include "trace.h"
+#include "hitters.h"
+#include "profiler.h"
+#include "tables.h"
 
 
 namespace httpd
@@ -8,55 +18,160 @@ namespace httpd
 namespace utils
 {
 
-const std::string toLower(const std::string& str){
-	std::string res;
-	for (auto i:str){
-		res.push_back(std::tolower(i));
+std::string_view toLower(const std::string_view& str, ::utils::Arena& arena){
+	char* p=arena.allocateChars(str.size());
+	for (size_t i=0;i<str.size();++i){
+		p[i]=std::tolower(static_cast<unsigned char>(str[i]));
 	}
-	return res;
+	return std::string_view(p,str.size());
+}
+
+bool equalsIgnoreCase(const std::string_view& str1, const std::string_view& str2){
+	if (str1.size()!=str2.size()) return false;
+	for (size_t i=0;i<str1.size();++i){
+		if (std::tolower(static_cast<unsigned char>(str1[i]))!=std::tolower(static_cast<unsigned char>(str2[i]))) return false;
+	}
+	return true;
 }
 
-const std::shared_ptr<std::string> urlDecode(const std::shared_ptr<std::string> input) {
-    if (nullptr==input) return nullptr;
-    std::string decoded;
-    for (size_t i = 0; i < input->length(); ++i) {
-        if ((*input)[i] == '%' && i + 2 < input->length()) {
+std::string_view urlDecode(const std::string_view& input, ::utils::Arena& arena) {
+    char* decoded=arena.allocateChars(input.length()); //解码后的长度不会超过原来的长度
+    size_t len=0;
+    for (size_t i = 0; i < input.length(); ++i) {
+        if (input[i] == '%' && i + 2 < input.length() && isxdigit(static_cast<unsigned char>(input[i + 1])) && isxdigit(static_cast<unsigned char>(input[i + 2]))) {
             // 读取%后的两个字符，解析为16进制数，然后转换为字符
-            char hex1 = (*input)[i + 1];
-            char hex2 = (*input)[i + 2];
-            if (isxdigit(hex1) && isxdigit(hex2)) {
-                char decodedChar = static_cast<char>(std::stoi(input->substr(i + 1, 2), 0, 16));
-                decoded += decodedChar;
-                i += 2;
-            }
-        } else if ((*input)[i] == '+') {
+            unsigned int decodedChar = 0;
+            std::from_chars(input.data() + i + 1, input.data() + i + 3, decodedChar, 16);
+            decoded[len++] = static_cast<char>(decodedChar);
+            i += 2;
+        } else if (input[i] == '+') {
             // 将+号替换为空格
-            decoded += ' ';
+            decoded[len++] = ' ';
         } else {
             // 直接添加其他字符
-            decoded += (*input)[i];
+            decoded[len++] = input[i];
         }
     }
-    return std::make_shared<std::string>(decoded);
+    return std::string_view(decoded,len);
 }
 
-const std::shared_ptr<std::string> urlEncode(const std::shared_ptr<std::string> input){
-	//todo
-	return input;
+std::string_view urlEncode(const std::string_view& input, ::utils::Arena& arena){
+	static const char hex[]="0123456789ABCDEF";
+	char* encoded=arena.allocateChars(input.length()*3); //最坏情况每个字符都变成%XX
+	size_t len=0;
+	for (auto i:input){
+		unsigned char c=static_cast<unsigned char>(i);
+		if (isalnum(c) || ('\0'!=c && nullptr!=strchr("-_.~/?&=:@!$'()*,;",c))) encoded[len++]=i; //不需要编码的字符，保留查询字符串的分隔符；+要编码，urlDecode会把它当成空格
+		else {
+			encoded[len++]='%';
+			encoded[len++]=hex[c>>4];
+			encoded[len++]=hex[c&0x0F];
+		}
+	}
+	return std::string_view(encoded,len);
+}
+
+void writeAll(int fd, struct iovec* iov, size_t iovcnt, const int& flags){
+	struct msghdr msg = {};
+	msg.msg_iov=iov;
+	msg.msg_iovlen=iovcnt;
+	while (msg.msg_iovlen>0){
+		ssize_t len=sendmsg(fd,&msg,MSG_NOSIGNAL|flags); //客户端断开时不要触发SIGPIPE
+		if (len<0){
+			if (EINTR==errno) continue;
+			throw std::runtime_error("write failed in utils::writeAll");
+		}
+		while (msg.msg_iovlen>0 && static_cast<size_t>(len)>=msg.msg_iov->iov_len){ //跳过已经写完的部分
+			len-=msg.msg_iov->iov_len;
+			++msg.msg_iov;
+			--msg.msg_iovlen;
+		}
+		if (msg.msg_iovlen>0){
+			msg.msg_iov->iov_base=static_cast<char*>(msg.msg_iov->iov_base)+len;
+			msg.msg_iov->iov_len-=len;
+		}
+	}
 }
 
 
 } // namespace utils
 
+namespace
+{
+
+const std::string_view method_strings[]={"GET","POST"}; //与Method::Type一一对应
+const std::string_view version_strings[]={"HTTP/1.0","HTTP/1.1","HTTP/2.0"}; //与Version::Type一一对应
+
+class Writer{ //向预先分配好大小的内存中顺序写入字符串
+public:
+	Writer(char* p):p_begin(p),p_cur(p){}
+	void put(const std::string_view& str){
+		if (str.empty()) return;
+		memcpy(this->p_cur,str.data(),str.size());
+		this->p_cur+=str.size();
+	}
+	std::string_view view() const{
+		return std::string_view(this->p_begin,this->p_cur-this->p_begin);
+	}
+private:
+	char* p_begin;
+	char* p_cur;
+};
+
+size_t headersLength(const httpd::Headers& headers){ //编码所有头部需要的长度
+	size_t len=0;
+	for (const auto& field:headers){
+		len+=field.key.size()+2+field.value.size()+2; //key: value\r\n
+	}
+	return len;
+}
+
+void putHeaders(Writer& writer, const httpd::Headers& headers){
+	for (const auto& field:headers){
+		writer.put(field.key);
+		writer.put(": ");
+		writer.put(field.value);
+		writer.put("\r\n");
+	}
+}
+
+std::string_view textContentType(const std::string_view& type, ::utils::Arena& arena){ //文本类型加上charset，常见的类型直接用预先生成的
+	auto content_type=tables::findTextContentType(type);
+	return content_type.empty()? arena.concat(type,"; charset=utf-8"):content_type;
+}
+
+std::string_view uintToString(const size_t& value, ::utils::Arena& arena){ //整数转字符串，存放在arena中
+	char* p=arena.allocateChars(20);
+	auto res=std::to_chars(p,p+20,value);
+	return std::string_view(p,res.ptr-p);
+}
+
+std::string_view trimWhitespace(const std::string_view& str){ //消除前导和后导的空格和制表符
+	std::size_t pos1=str.find_first_not_of(" \t");
+	if (str.npos==pos1) return std::string_view();
+	std::size_t pos2=str.find_last_not_of(" \t");
+	return str.substr(pos1,pos2-pos1+1);
+}
+
+size_t headLength(const std::string_view& str){ //找到头部结束的空行，返回包括空行在内的长度，没找到返回0
+	for (size_t pos=str.find('\n'); str.npos!=pos; pos=str.find('\n',pos+1)){
+		if (pos+1<str.size() && '\n'==str[pos+1]) return pos+2;
+		if (pos+2<str.size() && '\r'==str[pos+1] && '\n'==str[pos+2]) return pos+3;
+	}
+	return 0;
+}
+
+} // namespace
+
 /*------------implement of Method--------------*/
 Method::Method(const Method::Type& type){
 	this->type=type;
 }
-Method::Method(const std::shared_ptr<std::string> str){
-	if ("GET"==*str){
+Method::Method(const std::string_view& str){
+	if ("GET"==str){
 		this->type=Method::Type::GET;
 	}
-	else if ("POST"==*str){
+	else if ("POST"==str){
 		this->type=Method::Type::POST;
 	}
 	else {
@@ -67,10 +182,8 @@ Method::Method(const std::shared_ptr<std::string> str){
 Method::Type Method::getType() const{
 	return this->type;
 }
-std::shared_ptr<std::string> Method::toString() const{
-	if (Method::Type::GET==this->type) return std::make_shared<std::string>("GET");
-	if (Method::Type::POST==this->type) return std::make_shared<std::string>("POST");
-	throw HttpException(StatusCodeAndMessage::Type::BadRequest);
+std::string_view Method::toString() const{
+	return method_strings[static_cast<size_t>(this->type)];
 }
 bool Method::operator==(const Method& cmp) const{
 	return this->type==cmp.type;
@@ -89,13 +202,16 @@ bool Method::operator!=(const Method::Type& cmp) const{
 Version::Version(const Version::Type& type){
 	this->type=type;
 }
-Version::Version(const std::shared_ptr<std::string> str){
-	if ("HTTP/1.0"==*str){
+Version::Version(const std::string_view& str){
+	if ("HTTP/1.0"==str){
 		this->type=Version::Type::HTTP_1_0;
 	}
-	else if ("HTTP/1.1"==*str){
+	else if ("HTTP/1.1"==str){
 		this->type=Version::Type::HTTP_1_1;
 	}
+	else if ("HTTP/2.0"==str){
+		this->type=Version::Type::HTTP_2;
+	}
 	else {
 		throw HttpException(StatusCodeAndMessage::Type::BadRequest);
 	}
@@ -104,10 +220,8 @@ Version::Version(const std::shared_ptr<std::string> str){
 Version::Type Version::getType() const{
 	return this->type;
 }
-std::shared_ptr<std::string> Version::toString() const{
-	if (Version::Type::HTTP_1_0==this->type) return std::make_shared<std::string>("HTTP/1.0");
-	if (Version::Type::HTTP_1_1==this->type) return std::make_shared<std::string>("HTTP/1.1");
-	throw HttpException(StatusCodeAndMessage::Type::BadRequest);
+std::string_view Version::toString() const{
+	return version_strings[static_cast<size_t>(this->type)];
 }
 bool Version::operator==(const Version& cmp) const{
 	return this->type==cmp.type;
@@ -126,19 +240,30 @@ bool Version::operator!=(const Version::Type& cmp) const{
 StatusCodeAndMessage::StatusCodeAndMessage(const StatusCodeAndMessage::Type& type){
 	this->type=type;
 }
+StatusCodeAndMessage::StatusCodeAndMessage(const std::string_view& str){
+	int code=0;
+	auto res=std::from_chars(str.data(),str.data()+str.size(),code);
+	if (std::errc()!=res.ec || str.data()+str.size()!=res.ptr || code<100 || code>599) throw HttpException(StatusCodeAndMessage::Type::BadGateway);
+	this->type=static_cast<StatusCodeAndMessage::Type>(code);
+}
 
 StatusCodeAndMessage::Type StatusCodeAndMessage::getType() const{
 	return this->type;
 }
-std::shared_ptr<std::string> StatusCodeAndMessage::toString() const{
-	if (StatusCodeAndMessage::Type::Continue==this->type) return std::make_shared<std::string>("100 Continue");
-	if (StatusCodeAndMessage::Type::OK==this->type) return std::make_shared<std::string>("200 OK");
-	if (StatusCodeAndMessage::Type::BadRequest==this->type) return std::make_shared<std::string>("400 BadRequest");
-	if (StatusCodeAndMessage::Type::Unauthorized==this->type) return std::make_shared<std::string>("401 Unauthorized");
-	if (StatusCodeAndMessage::Type::Forbidden==this->type) return std::make_shared<std::string>("403 Forbidden");
-	if (StatusCodeAndMessage::Type::NotFound==this->type) return std::make_shared<std::string>("404 NotFound");
-	if (StatusCodeAndMessage::Type::InternalServerError==this->type) return std::make_shared<std::string>("500 InternalServerError");
-	return std::make_shared<std::string>("0 UNKNOW");
+std::string_view StatusCodeAndMessage::toString() const{
+	int code=static_cast<int>(this->type);
+	auto text=tables::findStatusText(code); //有名字的状态码查表
+	if (!text.empty()) return text;
+	if (code<100 || code>599) return "0 UNKNOW";
+	static const auto unnamed=[]{ //其他状态码（例如上游返回的）没有原因短语，RFC 7230允许原因短语为空
+		std::array<char,500*4> strings;
+		for (int i=0;i<500;++i){
+			std::to_chars(strings.data()+i*4,strings.data()+i*4+3,i+100);
+			strings[i*4+3]=' ';
+		}
+		return strings;
+	}();
+	return std::string_view(unnamed.data()+(code-100)*4,4);
 }
 bool StatusCodeAndMessage::operator==(const StatusCodeAndMessage& cmp) const{
 	return this->type==cmp.type;
@@ -153,86 +278,212 @@ bool StatusCodeAndMessage::operator!=(const StatusCodeAndMessage::Type& cmp) con
 	return this->type!=cmp;
 }
 
-/*------------implement of Body--------------*/
-Body::Body(const std::shared_ptr<std::string> type, const std::shared_ptr<std::vector<unsigned char>> content){
-	this->sp_type=type;
-	if (type->find("text/")!=type->npos) { //Content-Type是文本类型就设置字符类型为utf-8
-		*(this->sp_type)+="; charset=utf-8";
-	}
-	this->sp_content=content;
+/*------------implement of FileDescriptor--------------*/
+FileDescriptor::FileDescriptor(int fd):fd(fd){}
+FileDescriptor::~FileDescriptor(){
+	if (this->fd>=0) close(this->fd);
+}
+int FileDescriptor::get() const{
+	return this->fd;
 }
 
-const std::shared_ptr<std::string> Body::getType() const{
-	return this->sp_type;
+/*------------implement of Body--------------*/
+BodySource::~BodySource(){}
+
+Body::Body():size(0){}
+Body::Body(const std::string_view& type, const std::string_view& content):type(type),content(content),size(0){}
+Body::Body(const std::string_view& type, const std::shared_ptr<const std::vector<unsigned char>> sp_content):
+	type(type),
+	content(reinterpret_cast<const char*>(sp_content->data()),sp_content->size()),
+	sp_owner(sp_content),
+	size(0){}
+Body::Body(const std::string_view& type, const std::shared_ptr<const FileDescriptor> sp_file, const size_t& size):
+	type(type),
+	sp_file(sp_file),
+	size(size){}
+Body::Body(const std::string_view& type, const std::shared_ptr<BodySource> sp_source, const size_t& size):
+	type(type),
+	sp_source(sp_source),
+	size(size){}
+
+std::string_view Body::getType() const{
+	return this->type;
+}
+bool Body::isText() const{ //Content-Type是文本类型且没有指定charset时，需要设置字符类型为utf-8
+	return this->type.npos!=this->type.find("text/") && this->type.npos==this->type.find("charset");
+}
+std::string_view Body::getContent() const{
+	return this->content;
+}
+bool Body::isFile() const{
+	return nullptr!=this->sp_file;
 }
-const std::shared_ptr<std::vector<unsigned char>> Body::getContent() const{
-	return this->sp_content;
+int Body::getFileDescriptor() const{
+	return nullptr==this->sp_file? -1:this->sp_file->get();
+}
+bool Body::isOwned() const{
+	return nullptr!=this->sp_owner || nullptr!=this->sp_file;
+}
+bool Body::isStream() const{
+	return nullptr!=this->sp_source;
+}
+BodySource* Body::getSource() const{
+	return this->sp_source.get();
+}
+size_t Body::getSize() const{
+	return nullptr==this->sp_file && nullptr==this->sp_source? this->content.size():this->size;
 }
 
 
 /*------------implement of HttpException--------------*/
-HttpException::HttpException(const StatusCodeAndMessage::Type& type):sp_status_code_and_msg(std::make_shared<StatusCodeAndMessage>(type)){}
+HttpException::HttpException(const StatusCodeAndMessage::Type& type):status_code_and_msg(type){}
 const char* HttpException::what() const throw() {
-	return this->sp_status_code_and_msg->toString()->c_str();
+	return this->status_code_and_msg.toString().data(); //toString返回的是字符串字面量，以'\0'结尾
 }
 
-const std::shared_ptr<StatusCodeAndMessage> HttpException::getStatusCodeAndMessage() const{
-	return this->sp_status_code_and_msg;
+const StatusCodeAndMessage& HttpException::getStatusCodeAndMessage() const{
+	return this->status_code_and_msg;
 }
 
-/*------------implement of Request--------------*/
-Request::Request(){
-	this->sp_version=std::make_shared<Version>(Version::Type::HTTP_1_1); // 默认使用HTTP/1.1
-	this->sp_headers=std::make_shared<std::unordered_map<std::string,std::shared_ptr<std::string>>>();
+/*------------implement of Headers--------------*/
+Headers::Headers(::utils::Arena& arena):fields(arena){}
+
+void Headers::set(const std::string_view& key, const std::string_view& value){
+	for (auto& field:this->fields){
+		if (field.key==key){
+			field.value=value;
+			return;
+		}
+	}
+	this->fields.push_back(Field{key,value});
+}
+void Headers::add(const std::string_view& key, const std::string_view& value){
+	this->fields.push_back(Field{key,value});
+}
+void Headers::remove(const std::string_view& key){
+	for (size_t i=this->fields.size();i>0;--i){ //从后往前删，删除时后面的元素会前移
+		if (this->fields[i-1].key==key) this->fields.erase(this->fields.begin()+(i-1));
+	}
+}
+const std::string_view* Headers::get(const std::string_view& key) const{
+	for (const auto& field:this->fields){
+		if (utils::equalsIgnoreCase(field.key,key)) return &(field.value); //key不需要事先转为小写
+	}
+	return nullptr;
+}
+void Headers::clear(){
+	this->fields.clear();
+}
+size_t Headers::size() const{
+	return this->fields.size();
+}
+const Headers::Field* Headers::begin() const{
+	return this->fields.begin();
+}
+const Headers::Field* Headers::end() const{
+	return this->fields.end();
+}
+
+/*------------implement of CancelToken--------------*/
+CancelToken::CancelToken():fd(-1),has_deadline(false),is_responding(false),is_peer_closed(false){}
+
+void CancelToken::start(const int& fd, const int64_t& timeout_ms){
+	this->fd=fd;
+	this->has_deadline=timeout_ms>0;
+	if (this->has_deadline) this->deadline=std::chrono::steady_clock::now()+std::chrono::milliseconds(timeout_ms);
+	this->is_responding=false;
+	this->is_peer_closed=false;
+}
+
+void CancelToken::startResponse(){
+	this->is_responding=true;
+}
+
+bool CancelToken::isPeerClosed() const{
+	if (this->is_peer_closed || this->fd<0) return this->is_peer_closed;
+	struct pollfd pfd={this->fd,this->pollEvents(),0}; //客户端发来的数据还没读完也能检查出对端关闭
+	while (poll(&pfd,1,0)<0 && EINTR==errno);
+	this->is_peer_closed=0!=(pfd.revents&(POLLRDHUP|POLLHUP|POLLERR));
+	return this->is_peer_closed;
+}
+
+short CancelToken::pollEvents() const{
+	return this->is_responding? 0:POLLRDHUP;
+}
+
+bool CancelToken::isExpired() const{
+	return this->has_deadline && std::chrono::steady_clock::now()>=this->deadline;
+}
+
+bool CancelToken::isCancelled() const{
+	return this->isExpired() || this->isPeerClosed();
+}
+
+void CancelToken::check() const{
+	if (this->isPeerClosed()) throw std::runtime_error("peer closed in CancelToken::check");
+	if (this->isExpired()) throw HttpException(StatusCodeAndMessage::Type::GatewayTimeout);
 }
 
+int CancelToken::getFd() const{
+	return this->fd;
+}
+
+int CancelToken::waitMs(const int& timeout_ms) const{
+	if (!this->has_deadline) return timeout_ms;
+	auto left=std::chrono::duration_cast<std::chrono::milliseconds>(this->deadline-std::chrono::steady_clock::now()).count();
+	return static_cast<int>(std::max<int64_t>(0,std::min<int64_t>(timeout_ms,left+1))); //多等1毫秒，醒来时一定已经过了截止时间
+}
+
+/*------------implement of Request--------------*/
+Request::Request(::utils::Arena& arena):
+	p_arena(&arena),
+	method(Method::Type::GET),
+	version(Version::Type::HTTP_1_1), // 默认使用HTTP/1.1
+	headers(arena),
+	has_body(false),
+	p_cancel(nullptr){}
+
 // 将字符串解析为Request对象
-void Request::decode(const std::shared_ptr<std::string> str){
+void Request::decode(const std::string_view& str){
 	try
 	{
-		std::string request_str=*(utils::urlDecode(str)); //需要先对request字符串进行url解码
+		std::string_view request_str=this->p_arena->copy(str); //拷贝一份到arena中，之后解析出来的字段都直接引用这份拷贝
 		std::size_t pos;
-		//解析初始行
-		pos=request_str.find_first_of("\r\n"); //找到\r\n中的任意一个
+		//解析初始行，和completeLength一样只以\n分行，单独的\r留在行内，否则两边对请求边界的理解会不一致
+		pos=request_str.find('\n');
+		if (request_str.npos==pos) throw HttpException(StatusCodeAndMessage::Type::BadRequest);
 		{
-			auto tmp=Request::parseInitiaLine(request_str.substr(0,pos));
-			this->sp_method=std::make_shared<Method>(std::make_shared<std::string>(std::get<0>(tmp)));
-			this->sp_path=std::make_shared<std::string>(std::get<1>(tmp));
-			this->sp_version=std::make_shared<Version>(std::make_shared<std::string>(std::get<2>(tmp)));
+			auto line=request_str.substr(0,pos);
+			if (!line.empty() && '\r'==line.back()) line.remove_suffix(1);
+			auto tmp=Request::parseInitiaLine(line);
+			this->method=Method(std::get<0>(tmp));
+			this->path=utils::urlDecode(std::get<1>(tmp),*(this->p_arena)); //只有path需要进行url解码
+			this->version=Version(std::get<2>(tmp));
 		}
 
-		//切换到下一行，需要处理以\r换行、\n换行或者\r\n换行这三种情况
-		if ('\n'==request_str[pos+1]||'\r'==request_str[pos+1]) request_str=request_str.substr(pos+2); 
-		else request_str=request_str.substr(pos+1);
+		//切换到下一行
+		request_str=request_str.substr(pos+1);
 
 		//解析headers
 		while(1){
-			pos=request_str.find("\r\n");
-			if (0==pos) break;
+			pos=request_str.find('\n');
 			if (request_str.npos==pos) throw HttpException(StatusCodeAndMessage::Type::BadRequest);
-			auto tmp=Request::parseKeyValuePairLine(request_str.substr(0,pos));
-			this->setHeader(std::make_shared<std::string>(tmp.first),std::make_shared<std::string>(tmp.second));
-			//切换到下一行
-			if ('\n'==request_str[pos+1]||'\r'==request_str[pos+1]) request_str=request_str.substr(pos+2);
-			else request_str=request_str.substr(pos+1);
+			auto line=request_str.substr(0,pos);
+			if (!line.empty() && '\r'==line.back()) line.remove_suffix(1);
+			request_str=request_str.substr(pos+1); //切换到下一行
+			if (line.empty()) break; //空行，headers结束
+			auto tmp=Request::parseKeyValuePairLine(line);
+			this->headers.set(utils::toLower(tmp.first,*(this->p_arena)),tmp.second);
 		}
 
 		//解析body
-		if ('\n'==request_str[pos+1]||'\r'==request_str[pos+1]) request_str=request_str.substr(pos+2);
-		else request_str=request_str.substr(pos+1);
 		if (0!=request_str.length()){
-			auto value=this->getHeader(std::make_shared<std::string>("content-type"));
+			auto value=this->getHeader("content-type");
 			if (nullptr==value){
-				this->setBody(std::make_shared<Body>(
-					std::make_shared<std::string>("text/plain"),
-					std::make_shared<std::vector<unsigned char>>(request_str.begin(),request_str.end())
-				));
+				this->setBody(Body("text/plain",request_str));
 			}
 			else {
-				this->setBody(std::make_shared<Body>(
-					value,
-					std::make_shared<std::vector<unsigned char>>(request_str.begin(),request_str.end())
-				));
+				this->setBody(Body(*value,request_str));
 			}
 		}
 	}
@@ -246,80 +497,161 @@ void Request::decode(const std::shared_ptr<std::string> str){
 		throw e;
 	}
 }
-const std::shared_ptr<std::string> Request::encode(){
+size_t Request::completeLength(const std::string_view& str){
+	//找到headers结束的空行
+	size_t head_len=headLength(str);
+	if (0==head_len) return 0; //headers还没有接收完
+
+	//根据content-length确定body的长度
+	size_t content_length=0;
+	bool has_content_length=false;
+	bool has_transfer_encoding=false;
+	std::string_view head=str.substr(0,head_len);
+	for (size_t begin=head.find('\n')+1; begin<head_len;){
+		size_t end=head.find('\n',begin);
+		auto line=head.substr(begin,end-begin);
+		begin=end+1;
+		auto pos=line.find(':');
+		if (line.npos==pos) continue;
+		auto key=Request::trimWhitespace(line.substr(0,pos));
+		if (utils::equalsIgnoreCase(key,"transfer-encoding")) has_transfer_encoding=true;
+		if (!utils::equalsIgnoreCase(key,"content-length")) continue;
+		auto value=Request::trimWhitespace(line.substr(pos+1));
+		if (!value.empty() && '\r'==value.back()) value.remove_suffix(1);
+		size_t length=0;
+		auto res=std::from_chars(value.data(),value.data()+value.size(),length);
+		if (std::errc()!=res.ec || value.data()+value.size()!=res.ptr) throw HttpException(StatusCodeAndMessage::Type::BadRequest);
+		if (has_content_length && length!=content_length) throw HttpException(StatusCodeAndMessage::Type::BadRequest); //多个不同的content-length，前端代理可能按另一个切分请求（请求走私）
+		content_length=length;
+		has_content_length=true;
+	}
+	//不支持分块的请求体，按content-length切分会把分块数据当成下一个请求（请求走私），只能拒绝后关闭连接
+	if (has_transfer_encoding) throw HttpException(has_content_length? StatusCodeAndMessage::Type::BadRequest:StatusCodeAndMessage::Type::NotImplemented);
+	if (content_length>MAX_REQUEST_SIZE) throw HttpException(StatusCodeAndMessage::Type::BadRequest);
+	if (str.size()<head_len+content_length) return 0; //body还没有接收完
+	return head_len+content_length;
+}
+std::string_view Request::encode() const{
+	auto head=this->encodeHead();
+	if (!this->has_body) return head;
+	return this->p_arena->concat(head,this->body.getContent());
+}
+std::string_view Request::encodeHead() const{
 	try
 	{
-		std::string str=*(this->sp_method->toString())+" "+*(utils::urlEncode(this->sp_path))+" "+*(this->sp_version->toString())+"\r\n";
-		for (auto i:*(this->sp_headers)){
-			str+=i.first+": "+*(i.second)+"\r\n";
-		}
-		str+="\r\n";
-		if (nullptr!=this->getBody()) str+=*(utils::urlEncode(std::make_shared<std::string>(std::string(this->sp_body->getContent()->begin(),this->sp_body->getContent()->end()))));
-		
-		return std::make_shared<std::string>(str);
+		auto path=utils::urlEncode(this->path,*(this->p_arena));
+		auto method=this->method.toString();
+		auto version=this->version.toString();
+
+		Writer writer(this->p_arena->allocateChars(method.size()+1+path.size()+1+version.size()+2+headersLength(this->headers)+2));
+		writer.put(method);
+		writer.put(" ");
+		writer.put(path);
+		writer.put(" ");
+		writer.put(version);
+		writer.put("\r\n");
+		putHeaders(writer,this->headers);
+		writer.put("\r\n");
+		return writer.view();
 	}
 	catch(const HttpException& e){
-		std::cerr << e.what() << "in Request::encode\n";
+		std::cerr << e.what() << "in Request::encodeHead\n";
 		throw e;
 	}
 	catch(const std::exception& e)
 	{
-		std::cerr << e.what() << "in Request::encode\n";
+		std::cerr << e.what() << "in Request::encodeHead\n";
 		throw e;
 	}
-	
+}
+void Request::clear(){
+	this->method=Method(Method::Type::GET);
+	this->path=std::string_view();
+	this->version=Version(Version::Type::HTTP_1_1);
+	this->headers.clear();
+	this->body=Body();
+	this->has_body=false;
 }
 
 void Request::setMethod(const Method::Type& type){
-	this->sp_method=std::make_shared<Method>(type);
+	this->method=Method(type);
 }
-const std::shared_ptr<Method> Request::getMethod() const{
-	return this->sp_method;
+const Method& Request::getMethod() const{
+	return this->method;
 }
-void Request::setPath(const std::shared_ptr<std::string> path){
-	this->sp_path=path;
+void Request::setPath(const std::string_view& path){
+	this->path=this->p_arena->copy(path);
 }
-const std::shared_ptr<std::string> Request::getPath() const{
-	return this->sp_path;
+std::string_view Request::getPath() const{
+	return this->path;
 }
 void Request::setVersion(const Version::Type& type){
-	this->sp_version=std::make_shared<Version>(type);
+	this->version=Version(type);
 }
-const std::shared_ptr<Version> Request::getVersion() const{
-	return this->sp_version;
+const Version& Request::getVersion() const{
+	return this->version;
 }
-void Request::setHeader(const std::shared_ptr<std::string> key,const std::shared_ptr<std::string> value){
-	(*(this->sp_headers))[utils::toLower(*key)]=value;
+void Request::setHeader(const std::string_view& key,const std::string_view& value){
+	this->headers.set(utils::toLower(key,*(this->p_arena)),this->p_arena->copy(value));
 }
-const std::shared_ptr<std::string> Request::getHeader(const std::shared_ptr<std::string> key) const{
-	if (0==this->sp_headers->count(utils::toLower(*key))) return nullptr; //使用count方法可以避免出现插入nullptr的情况
-	return (*(this->sp_headers))[utils::toLower(*key)];
+void Request::removeHeader(const std::string_view& key){
+	this->headers.remove(key);
 }
-void Request::setBody(const std::shared_ptr<Body> body){
-	this->sp_body=body;
-	this->setHeader(std::make_shared<std::string>("content-type"),body->getType());
-	this->setHeader(std::make_shared<std::string>("content-length"),std::make_shared<std::string>(std::to_string(body->getContent()->size())));
+const std::string_view* Request::getHeader(const std::string_view& key) const{
+	return this->headers.get(key);
+}
+const Headers& Request::getHeaders() const{
+	return this->headers;
+}
+void Request::setBody(const Body& body){
+	this->body=body;
+	this->has_body=true;
+	if (body.isText()) this->headers.set("content-type",textContentType(body.getType(),*(this->p_arena)));
+	else this->headers.set("content-type",body.getType());
+	if (UNKNOWN_BODY_SIZE==body.getSize()) this->headers.set("transfer-encoding","chunked");
+	else this->headers.set("content-length",uintToString(body.getSize(),*(this->p_arena)));
+}
+const Body* Request::getBody() const{
+	if (!this->has_body) return nullptr;
+	return &(this->body);
+}
+::utils::Arena& Request::getArena() const{
+	return *(this->p_arena);
+}
+
+void Request::setCancelToken(const CancelToken* p_cancel){
+	this->p_cancel=p_cancel;
 }
-const std::shared_ptr<Body> Request::getBody() const{
-	return this->sp_body;
+
+const CancelToken* Request::getCancelToken() const{
+	return this->p_cancel;
 }
 
-std::tuple<std::string,std::string,std::string> Request::parseInitiaLine(const std::string& line){
-	std::tuple<std::string,std::string,std::string> res;
-	std::istringstream line_stream(line);
-	line_stream>>std::get<0>(res)>>std::get<1>(res)>>std::get<2>(res);
+std::tuple<std::string_view,std::string_view,std::string_view> Request::parseInitiaLine(const std::string_view& line){
+	std::tuple<std::string_view,std::string_view,std::string_view> res;
+	std::string_view rest=line;
+	auto next_token=[&rest](){ //按空白分隔取出下一个token
+		auto begin=rest.find_first_not_of(" \t");
+		if (rest.npos==begin) return std::string_view();
+		rest=rest.substr(begin);
+		auto end=rest.find_first_of(" \t");
+		auto token=rest.substr(0,end);
+		rest=(rest.npos==end)?std::string_view():rest.substr(end);
+		return token;
+	};
+	std::get<0>(res)=next_token();
+	std::get<1>(res)=next_token();
+	std::get<2>(res)=next_token();
 	return res;
 }
 
-std::string Request::trimWhitespace(const std::string& str) {
-	std::size_t pos1=str.find_first_not_of(" \t");
-	std::size_t pos2=str.find_last_not_of(" \t");
-	return str.substr(pos1,pos2-pos1+1);
+std::string_view Request::trimWhitespace(const std::string_view& str) {
+	return ::httpd::trimWhitespace(str);
 }
 
-std::pair<std::string,std::string> Request::parseKeyValuePairLine(const std::string& line) {
-	std::pair<std::string,std::string> kv_pair;
-	std::string tmp=Request::trimWhitespace(line);
+std::pair<std::string_view,std::string_view> Request::parseKeyValuePairLine(const std::string_view& line) {
+	std::pair<std::string_view,std::string_view> kv_pair;
+	std::string_view tmp=Request::trimWhitespace(line);
 	auto pos=tmp.find(':');
 	if (tmp.npos==pos) throw HttpException(StatusCodeAndMessage::Type::BadRequest);
 	kv_pair.first=Request::trimWhitespace(tmp.substr(0,pos));
@@ -328,95 +660,274 @@ std::pair<std::string,std::string> Request::parseKeyValuePairLine(const std::str
 }
 
 /*------------implement of Response--------------*/
-Response::Response(){
-	// 默认使用HTTP/1.1
-	this->sp_version=std::make_shared<Version>(Version::Type::HTTP_1_1);
-	this->sp_status_code_and_msg=std::make_shared<httpd::StatusCodeAndMessage>(httpd::StatusCodeAndMessage::Type::OK);
-	this->sp_headers=std::make_shared<std::unordered_map<std::string,std::shared_ptr<std::string>>>();
-}
+Response::Response(::utils::Arena& arena):
+	p_arena(&arena),
+	version(Version::Type::HTTP_1_1), // 默认使用HTTP/1.1
+	status_code_and_msg(StatusCodeAndMessage::Type::OK),
+	headers(arena),
+	has_body(false){}
 
-const std::shared_ptr<std::string> Response::encode() {
+std::string_view Response::encodeHead() const {
+	// 将状态行和响应头转为文本内容，一次性在arena中分配好需要的空间
+	std::string_view line; //常见的状态行是编译期生成好的，一次拷贝
+	if (Version::Type::HTTP_2!=this->version.getType()) line=tables::findStatusLine(Version::Type::HTTP_1_0==this->version.getType(),static_cast<int>(this->status_code_and_msg.getType()));
+	auto version=this->version.toString();
+	auto status=this->status_code_and_msg.toString();
+	Writer writer(this->p_arena->allocateChars((line.empty()? version.size()+1+status.size()+2:line.size())+headersLength(this->headers)+2));
+	if (!line.empty()) writer.put(line);
+	else{
+		writer.put(version);
+		writer.put(" ");
+		writer.put(status);
+		writer.put("\r\n");
+	}
+	putHeaders(writer,this->headers);
+	writer.put("\r\n");
+	return writer.view();
+}
+std::string_view Response::encode() const {
 	// 将Response对象转为文本内容
-	std::string str=*(this->sp_version->toString())+" "+*(this->sp_status_code_and_msg->toString())+"\r\n";
-	for (auto i:*(this->sp_headers)){
-		str+=i.first+": "+*(i.second)+"\r\n";
+	auto head=this->encodeHead();
+	if (!this->has_body) return head;
+	if (this->body.isFile()){ //文件Body不在内存中，读到arena里
+		size_t size=this->body.getSize();
+		char* p=this->p_arena->allocateChars(head.size()+size);
+		memcpy(p,head.data(),head.size());
+		size_t len=0;
+		while (len<size){
+			ssize_t result=pread(this->body.getFileDescriptor(),p+head.size()+len,size-len,len);
+			if (result<0 && EINTR==errno) continue;
+			if (result<=0) throw std::runtime_error("pread failed in Response::encode");
+			len+=result;
+		}
+		return std::string_view(p,head.size()+size);
+	}
+	if (this->body.isStream()){ //流式Body全部读出来
+		std::string content;
+		char buf[STREAM_CHUNK_SIZE];
+		for (size_t len=this->body.getSource()->read(buf,sizeof(buf));len>0;len=this->body.getSource()->read(buf,sizeof(buf))) content.append(buf,len);
+		return this->p_arena->concat(head,content);
+	}
+	auto content=this->body.getContent();
+	return this->p_arena->concat(head,content);
+}
+void Response::decodeHead(const std::string_view& str){
+	std::string_view response_str=this->p_arena->copy(str);
+	//解析状态行，例如HTTP/1.1 200 OK
+	auto pos=response_str.find('\n');
+	if (response_str.npos==pos) throw HttpException(StatusCodeAndMessage::Type::BadGateway);
+	auto line=response_str.substr(0,pos);
+	if (!line.empty() && '\r'==line.back()) line.remove_suffix(1);
+	auto first_space=line.find(' ');
+	if (line.npos==first_space) throw HttpException(StatusCodeAndMessage::Type::BadGateway);
+	try{
+		this->version=Version(line.substr(0,first_space));
+	}
+	catch(const HttpException& e){
+		throw HttpException(StatusCodeAndMessage::Type::BadGateway);
 	}
-	str+="\r\n";
-	if (nullptr!=this->getBody()) str+=std::string(this->sp_body->getContent()->begin(),this->sp_body->getContent()->end());
-	return std::make_shared<std::string>(str);
+	this->status_code_and_msg=StatusCodeAndMessage(line.substr(first_space+1,3));
+	response_str=response_str.substr(pos+1);
+
+	//解析headers
+	while(1){
+		pos=response_str.find('\n');
+		if (response_str.npos==pos) throw HttpException(StatusCodeAndMessage::Type::BadGateway);
+		line=response_str.substr(0,pos);
+		if (!line.empty() && '\r'==line.back()) line.remove_suffix(1);
+		response_str=response_str.substr(pos+1);
+		if (line.empty()) break; //空行，headers结束
+		auto colon=line.find(':');
+		if (line.npos==colon) throw HttpException(StatusCodeAndMessage::Type::BadGateway);
+		this->headers.add(utils::toLower(trimWhitespace(line.substr(0,colon)),*(this->p_arena)),trimWhitespace(line.substr(colon+1))); //上游可能重复发送同名的头部（如set-cookie），都要保留
+	}
+}
+size_t Response::headLength(const std::string_view& str){
+	return ::httpd::headLength(str);
+}
+void Response::clear(){
+	this->version=Version(Version::Type::HTTP_1_1);
+	this->status_code_and_msg=StatusCodeAndMessage(StatusCodeAndMessage::Type::OK);
+	this->headers.clear();
+	this->body=Body();
+	this->has_body=false;
 }
 
 void Response::setVersion(const Version& version){
-	this->sp_version=std::make_shared<Version>(version.getType());
+	this->version=version;
+}
+const Version& Response::getVersion() const{
+	return this->version;
+}
+void Response::setStatusCodeAndMessage(const StatusCodeAndMessage& status_code_and_msg){
+	this->status_code_and_msg=status_code_and_msg;
 }
-const std::shared_ptr<Version> Response::getVersion() const{
-	return this->sp_version;
+const StatusCodeAndMessage& Response::getStatusCodeAndMessage() const{
+	return this->status_code_and_msg;
 }
-void Response::setStatusCodeAndMessage(const std::shared_ptr<StatusCodeAndMessage> status_code_and_msg){
-	this->sp_status_code_and_msg=status_code_and_msg;
+void Response::setHeader(const std::string_view& key,const std::string_view& value){
+	this->headers.set(utils::toLower(key,*(this->p_arena)),this->p_arena->copy(value));
 }
-const std::shared_ptr<StatusCodeAndMessage> Response::getStatusCodeAndMessage() const{
-	return this->sp_status_code_and_msg;
+void Response::addHeader(const std::string_view& key,const std::string_view& value){
+	this->headers.add(utils::toLower(key,*(this->p_arena)),this->p_arena->copy(value));
 }
-void Response::setHeader(const std::shared_ptr<std::string> key,const std::shared_ptr<std::string> value){
-	(*(this->sp_headers))[utils::toLower(*key)]=value;
+const std::string_view* Response::getHeader(const std::string_view& key) const{
+	return this->headers.get(key);
 }
-const std::shared_ptr<std::string> Response::getHeader(const std::shared_ptr<std::string> key) const{
-	if (0==this->sp_headers->count(utils::toLower(*key))) return nullptr;
-	return (*(this->sp_headers))[utils::toLower(*key)];
+const Headers& Response::getHeaders() const{
+	return this->headers;
 }
-void Response::setBody(const std::shared_ptr<Body> body){
-	this->sp_body=body;
-	this->setHeader(std::make_shared<std::string>("content-type"),body->getType());
-	this->setHeader(std::make_shared<std::string>("content-length"),std::make_shared<std::string>(std::to_string(body->getContent()->size())));
+void Response::setBody(const Body& body){
+	this->body=body;
+	this->has_body=true;
+	if (body.isText()) this->headers.set("content-type",textContentType(body.getType(),*(this->p_arena)));
+	else this->headers.set("content-type",body.getType());
+	if (UNKNOWN_BODY_SIZE==body.getSize()) this->headers.set("transfer-encoding","chunked");
+	else this->headers.set("content-length",uintToString(body.getSize(),*(this->p_arena)));
 }
-const std::shared_ptr<Body> Response::getBody() const{
-	return this->sp_body;
+const Body* Response::getBody() const{
+	if (!this->has_body) return nullptr;
+	return &(this->body);
 }
-std::shared_ptr<Response> Response::quickBuild(const std::shared_ptr<StatusCodeAndMessage> status_code_and_msg){
-	auto response=std::make_shared<Response>();
-	auto scm_str=status_code_and_msg->toString();
-	auto body=std::make_shared<httpd::Body>(
-		std::make_shared<std::string>("text/plain"),
-		std::make_shared<std::vector<unsigned char>>(scm_str->begin(),scm_str->end())
-	);
-	response->setStatusCodeAndMessage(status_code_and_msg);
-	response->setBody(body); //Response一定要有body
-	return response;
+::utils::Arena& Response::getArena() const{
+	return *(this->p_arena);
+}
+void Response::quickBuild(const StatusCodeAndMessage& status_code_and_msg){
+	this->setStatusCodeAndMessage(status_code_and_msg);
+	this->setBody(Body("text/plain",status_code_and_msg.toString())); //Response一定要有body
 }
 
-/*------------implement of FileSystem--------------*/
-FileSystem::FileSystem(const std::shared_ptr<std::string> file_root){
-	this->sp_file_root=std::make_shared<std::string>("./"+*file_root+"/"); //确保在程序运行目录下。多加几个'/'比较保险
+/*------------implement of MemoryBudget--------------*/
+MemoryBudget::MemoryBudget(const size_t& limit):
+	limit(limit),
+	small_reserved(limit/MEMORY_BUDGET_SMALL_SHARE),
+	used(0),
+	max_used(0),
+	reservations(0),
+	rejected(0){}
+
+bool MemoryBudget::reserve(const size_t& bytes){
+	size_t limit=bytes<=MEMORY_BUDGET_SMALL_SIZE? this->limit:this->limit-this->small_reserved;
+	size_t now_used=this->used;
+	do{
+		if (now_used+bytes>limit){
+			++this->rejected;
+			return false;
+		}
+	} while (!this->used.compare_exchange_weak(now_used,now_used+bytes));
+	now_used+=bytes;
+	++this->reservations;
+	size_t max_used=this->max_used;
+	while (now_used>max_used && !this->max_used.compare_exchange_weak(max_used,now_used));
+	return true;
+}
+
+void MemoryBudget::release(const size_t& bytes){
+	this->used-=bytes;
 }
 
-const std::shared_ptr<Body> FileSystem::read(const std::shared_ptr<std::string> file_name) {
+void MemoryBudget::appendStats(std::string& out) const{
+	out+="memory_budget_bytes "+std::to_string(this->limit)+"\n";
+	out+="memory_used_bytes "+std::to_string(this->used)+"\n";
+	out+="memory_used_bytes_max "+std::to_string(this->max_used)+"\n";
+	out+="memory_reservations "+std::to_string(this->reservations)+"\n";
+	out+="memory_budget_fallbacks "+std::to_string(this->rejected)+"\n"; //预算不够改成sendfile发送的响应数
+}
+
+/*------------implement of FileSystem--------------*/
+FileSystem::FileSystem(const std::string_view& file_root):
+	file_root("./"+std::string(file_root)+"/"), //确保在程序运行目录下。多加几个'/'比较保险
+	cache_size(0),
+	hits(0),
+	reads(0),
+	coalesced(0),
+	waiting(0),
+	max_waiting(0){}
+
+Body FileSystem::read(const std::string_view& file_name) {
+	trace::Span span(trace::Phase::FILE);
 	try
 	{
 		if (!this->isAccessPermitted(file_name)) { //访问路径escape了
 			std::cerr <<"Forbidden in FileSystem::read\n";
 			throw HttpException(StatusCodeAndMessage::Type::Forbidden);
 		}
-		std::ifstream file(*(this->sp_file_root)+*file_name, std::ios::binary);
-		if (!file.is_open()){
+		char path[PATH_MAX]; //在栈上拼接路径，避免分配内存
+		if (this->file_root.size()+file_name.size()>=sizeof(path)){
 			std::cerr <<"NotFound in FileSystem::read\n";
 			throw HttpException(StatusCodeAndMessage::Type::NotFound);
 		}
+		memcpy(path,this->file_root.data(),this->file_root.size());
+		memcpy(path+this->file_root.size(),file_name.data(),file_name.size());
+		path[this->file_root.size()+file_name.size()]='\0';
+
+		struct stat st;
+		if (0!=stat(path,&st) || !S_ISREG(st.st_mode)){
+			std::cerr <<"NotFound in FileSystem::read\n";
+			throw HttpException(StatusCodeAndMessage::Type::NotFound);
+		}
+		{ //先查缓存，文件的修改时间和大小都没变就直接使用缓存
+			std::shared_lock<std::shared_mutex> lock(this->cache_mtx);
+			auto it=this->cache.find(file_name);
+			if (this->cache.end()!=it && it->second.size==st.st_size
+				&& it->second.mtime.tv_sec==st.st_mtim.tv_sec && it->second.mtime.tv_nsec==st.st_mtim.tv_nsec){
+				++this->hits;
+				return Body(it->second.type,it->second.sp_content);
+			}
+		}
+
 		//处理文件类型
-		std::string type;
-		auto pos=file_name->find_last_of(".");
-		if (file_name->npos==pos) type="text/plain";
-		else {
-			auto ext=file_name->substr(pos+1);
-			if (0==this->mime_types.count(ext)) type="text/plain";
-			else type=(this->mime_types)[ext];
+		auto type=this->getMimeType(file_name);
+		if (st.st_size>FILE_CACHE_MAX_FILE_SIZE) return this->open(path,type,st.st_size); //大文件不缓存也不读入内存，发送时直接sendfile
+
+		//同一个文件同时只读一次，其他未命中的请求等它读完直接用结果
+		std::shared_ptr<Load> sp_load;
+		bool is_loader=false;
+		{
+			std::lock_guard<std::mutex> lock(this->loads_mtx);
+			auto it=this->loads.find(file_name);
+			if (this->loads.end()!=it) sp_load=it->second;
+			else{
+				sp_load=std::make_shared<Load>();
+				this->loads.emplace(std::string(file_name),sp_load);
+				is_loader=true;
+			}
+		}
+		if (!is_loader){
+			++this->coalesced;
+			size_t now_waiting=++this->waiting;
+			size_t max_waiting=this->max_waiting;
+			while (now_waiting>max_waiting && !this->max_waiting.compare_exchange_weak(max_waiting,now_waiting));
+			std::unique_lock<std::mutex> lock(sp_load->mtx);
+			sp_load->cv.wait(lock,[&sp_load](){ return sp_load->is_done; });
+			--this->waiting;
+			if (nullptr!=sp_load->error) std::rethrow_exception(sp_load->error);
+			if (nullptr==sp_load->sp_content) return this->open(path,type,st.st_size); //没有预算，读取的请求也改成了sendfile
+			return Body(type,sp_load->sp_content);
 		}
-		//读取文件内容
-		std::vector<unsigned char> content;
-		content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
 
-		file.close();
-		return std::make_shared<Body>(std::make_shared<std::string>(type),std::make_shared<std::vector<unsigned char>>(content));
+		std::shared_ptr<const std::vector<unsigned char>> sp_content;
+		std::exception_ptr error;
+		try{
+			sp_content=this->load(path,file_name,st,type);
+		}
+		catch(...){
+			error=std::current_exception();
+		}
+		{ //先从正在读取的表中去掉，之后再来的请求会命中缓存或者重新读取
+			std::lock_guard<std::mutex> lock(this->loads_mtx);
+			this->loads.erase(this->loads.find(file_name));
+		}
+		{
+			std::lock_guard<std::mutex> lock(sp_load->mtx);
+			sp_load->is_done=true;
+			sp_load->sp_content=sp_content;
+			sp_load->error=error;
+		}
+		sp_load->cv.notify_all();
+		if (nullptr!=error) std::rethrow_exception(error);
+		if (nullptr==sp_content) return this->open(path,type,st.st_size);
+		return Body(type,sp_content);
 	}
 	catch (const httpd::HttpException& e){
 		throw e;
@@ -427,8 +938,105 @@ const std::shared_ptr<Body> FileSystem::read(const std::shared_ptr<std::string>
 	}
 }
 
-bool FileSystem::isAccessPermitted(const std::shared_ptr<std::string> file_name) const{
-	return file_name->npos==file_name->find("../");
+size_t FileSystem::warm(){
+	size_t num=0;
+	std::error_code ec;
+	for (auto it=std::filesystem::recursive_directory_iterator(this->file_root,ec);std::filesystem::recursive_directory_iterator()!=it;it.increment(ec)){
+		if (ec) break;
+		if (!it->is_regular_file(ec) || it->file_size(ec)>FILE_CACHE_MAX_FILE_SIZE) continue;
+		{
+			std::shared_lock<std::shared_mutex> lock(this->cache_mtx);
+			if (this->cache_size>=FILE_CACHE_MAX_SIZE) break;
+		}
+		try{
+			this->read("/"+it->path().lexically_relative(this->file_root).generic_string()); //和请求的路径一样作为缓存的key
+			++num;
+		}
+		catch(const std::exception& e){
+			std::cerr << e.what() << '\n';
+		}
+	}
+	return num;
+}
+
+void FileSystem::appendStats(std::string& out) const{
+	size_t reads=this->reads;
+	size_t coalesced=this->coalesced;
+	out+="file_cache_hits "+std::to_string(this->hits)+"\n";
+	out+="file_reads "+std::to_string(reads)+"\n";
+	out+="file_reads_coalesced "+std::to_string(coalesced)+"\n";
+	out+="file_coalescing_ratio "+std::to_string(0==reads+coalesced? 0.0:static_cast<double>(coalesced)/(reads+coalesced))+"\n"; //未命中中被合并掉的比例
+	out+="file_waiters "+std::to_string(this->waiting)+"\n";
+	out+="file_waiters_max "+std::to_string(this->max_waiting)+"\n";
+}
+
+void FileSystem::setMemoryBudget(std::shared_ptr<MemoryBudget> sp_budget){
+	this->sp_budget=sp_budget;
+}
+
+std::shared_ptr<const std::vector<unsigned char>> FileSystem::load(const char* path, const std::string_view& file_name, const struct stat& st, const std::string_view& type){
+	bool is_charged=false; //放不进缓存的内容只属于这一个响应，要占用预算
+	if (nullptr!=this->sp_budget){
+		std::shared_lock<std::shared_mutex> lock(this->cache_mtx);
+		auto it=this->cache.find(file_name);
+		size_t stale=this->cache.end()!=it? it->second.sp_content->size():0;
+		is_charged=this->cache_size-stale+st.st_size>FILE_CACHE_MAX_SIZE;
+	}
+	std::shared_ptr<std::vector<unsigned char>> sp_content;
+	if (!is_charged) sp_content=std::make_shared<std::vector<unsigned char>>(st.st_size);
+	else if (this->sp_budget->reserve(st.st_size)){ //最后一个引用（响应发完）释放内存时归还预算
+		auto sp_budget=this->sp_budget;
+		size_t size=st.st_size;
+		sp_content=std::shared_ptr<std::vector<unsigned char>>(new std::vector<unsigned char>(size),[sp_budget,size](std::vector<unsigned char>* p_content){
+			delete p_content;
+			sp_budget->release(size);
+		});
+	}
+	else return nullptr;
+	++this->reads;
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()){
+		std::cerr <<"NotFound in FileSystem::load\n";
+		throw HttpException(StatusCodeAndMessage::Type::NotFound);
+	}
+	//读取文件内容
+	file.read(reinterpret_cast<char*>(sp_content->data()),st.st_size);
+	sp_content->resize(file.gcount()); //读取过程中文件可能被修改了
+	file.close();
+
+	if (sp_content->size()<=FILE_CACHE_MAX_FILE_SIZE){ //放入缓存
+		std::unique_lock<std::shared_mutex> lock(this->cache_mtx);
+		auto it=this->cache.find(file_name);
+		if (this->cache.end()!=it){ //旧的缓存已经过期
+			this->cache_size-=it->second.sp_content->size();
+			this->cache.erase(it);
+		}
+		if (!is_charged && this->cache_size+sp_content->size()<=FILE_CACHE_MAX_SIZE){ //占用预算的内容放进缓存就一直不会归还了
+			this->cache.emplace(std::string(file_name),File{type,sp_content,st.st_mtim,st.st_size});
+			this->cache_size+=sp_content->size();
+		}
+	}
+	return sp_content;
+}
+
+Body FileSystem::open(const char* path, const std::string_view& type, const off_t& size){
+	int fd=::open(path,O_RDONLY|O_CLOEXEC);
+	if (fd<0){
+		std::cerr <<"NotFound in FileSystem::open\n";
+		throw HttpException(StatusCodeAndMessage::Type::NotFound);
+	}
+	return Body(type,std::make_shared<const FileDescriptor>(fd),size);
+}
+
+bool FileSystem::isAccessPermitted(const std::string_view& file_name) const{
+	return file_name.npos==file_name.find("../");
+}
+
+std::string_view FileSystem::getMimeType(const std::string_view& file_name) const{
+	auto pos=file_name.find_last_of(".");
+	if (file_name.npos==pos) return "text/plain";
+	auto type=tables::findMimeType(file_name.substr(pos+1)); //编译期生成的完美哈希表
+	return type.empty()? "text/plain":type;
 }
 
 
@@ -441,6 +1049,15 @@ Rule::Rule(const std::shared_ptr<std::string> sp_rule_str){
 	if ("allow"==action) this->action=Action::ALLOW;
 	else if ("deny"==action) this->action=Action::DENY;
 	else throw std::runtime_error("wrong rule found in Rule::Rule");
+	this->type=Type::IP;
+	this->id=0;
+	if (0==ip.compare(0,4,"uid:") || 0==ip.compare(0,4,"gid:")){ //Unix socket对端进程的用户或者组
+		this->type='u'==ip[0]? Type::UID:Type::GID;
+		auto res=std::from_chars(ip.data()+4,ip.data()+ip.size(),this->id);
+		if (std::errc()!=res.ec || ip.data()+ip.size()!=res.ptr) throw std::runtime_error("wrong rule found in Rule::Rule");
+		this->network={0,0};
+		return;
+	}
 	
 	auto pos=ip.find("/");
 	if (ip.npos==pos) throw std::runtime_error("wrong rule found in Rule::Rule");
@@ -455,11 +1072,22 @@ Rule::Rule(const std::shared_ptr<std::string> sp_rule_str){
 	this->network.network=ntohl(addr.s_addr)&(this->network.mask); //计算子网
 }
 
+bool Rule::isCredential() const {
+	return Type::IP!=this->type;
+}
+
+bool Rule::isMatch(const struct ucred& cred) const {
+	if (Type::UID==this->type) return cred.uid==this->id;
+	if (Type::GID==this->type) return cred.gid==this->id;
+	return false;
+}
+
 bool Rule::isAllow() const {
 	return Action::ALLOW==this->action;
 }
 
 bool Rule::isMatch(const std::shared_ptr<std::string> sp_ip) const {
+	if (Type::IP!=this->type) return false;
 	struct in_addr addr;
 	if (inet_pton(AF_INET, sp_ip->c_str(), &addr)!=1) return false;
 	uint32_t ip_addr = ntohl(addr.s_addr);
@@ -467,7 +1095,7 @@ bool Rule::isMatch(const std::shared_ptr<std::string> sp_ip) const {
 }
 
 /*------------implement of IPAccessControl--------------*/
-IPAccessControl::IPAccessControl(const std::shared_ptr<std::string> sp_rule_file){
+IPAccessControl::IPAccessControl(const std::shared_ptr<std::string> sp_rule_file):has_credential_rules(false){
 	std::ifstream file(*sp_rule_file);
 	if (!file.is_open()) throw std::runtime_error("no rule file in IPAccessControl::IPAccessControl");
 	std::string line;
@@ -475,6 +1103,7 @@ IPAccessControl::IPAccessControl(const std::shared_ptr<std::string> sp_rule_file
 		try{
 			Rule rule(std::make_shared<decltype(line)>(line));
 			this->rules.push_back(rule);
+			if (rule.isCredential()) this->has_credential_rules=true;
 		}
 		catch(const std::exception& e){
 			std::cerr << e.what() << '\n';
@@ -490,18 +1119,180 @@ bool IPAccessControl::isAllow(const std::shared_ptr<std::string> sp_ip) const{
 	return false;
 }
 
+bool IPAccessControl::isAllow(const struct ucred& cred) const{
+	if (!this->has_credential_rules) return 0==cred.uid || geteuid()==cred.uid; //socket文件的权限之外再兜底
+	for (const auto& rule:this->rules) {
+		if (rule.isMatch(cred)) return rule.isAllow();
+	}
+	return false;
+}
+
+
+/*------------implement of SocketOptions--------------*/
+bool SocketOptions::set(const std::string_view& name, const std::string_view& value){
+	int number=0;
+	auto res=std::from_chars(value.data(),value.data()+value.size(),number);
+	if (std::errc()!=res.ec || number<0) return false;
+	if ("reuseaddr"==name) this->is_reuse_addr=0!=number;
+	else if ("defer_accept"==name) this->defer_accept_sec=number;
+	else if ("fastopen"==name) this->fastopen_queue_len=number;
+	else if ("nodelay"==name) this->is_nodelay=0!=number;
+	else if ("cork"==name) this->is_cork=0!=number;
+	else return false;
+	return true;
+}
+
+void SocketOptions::applyListener(int fd) const{ //都只是优化，内核不支持时照常工作
+	int on=1;
+	if (this->is_reuse_addr && setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&on,sizeof(on))<0) std::cerr << "SO_REUSEADDR failed in SocketOptions::applyListener\n";
+	if (this->defer_accept_sec>0 && setsockopt(fd,IPPROTO_TCP,TCP_DEFER_ACCEPT,&this->defer_accept_sec,sizeof(this->defer_accept_sec))<0) std::cerr << "TCP_DEFER_ACCEPT failed in SocketOptions::applyListener\n";
+	if (this->fastopen_queue_len>0 && setsockopt(fd,IPPROTO_TCP,TCP_FASTOPEN,&this->fastopen_queue_len,sizeof(this->fastopen_queue_len))<0) std::cerr << "TCP_FASTOPEN failed in SocketOptions::applyListener\n";
+}
+
+void SocketOptions::applyConnection(int fd) const{
+	int on=1;
+	if (this->is_nodelay) setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+}
+
+/*------------implement of Channel--------------*/
+Channel::Channel(int client_fd):client_fd(client_fd),is_cork_enabled(false),is_corked(false),peer_ip(0){}
+Channel::~Channel(){
+	close(this->client_fd);
+}
+
+int Channel::getFd() const{
+	return this->client_fd;
+}
+
+void Channel::setPeerAddress(const uint32_t& ip){
+	this->peer_ip=ip;
+}
+
+uint32_t Channel::getPeerAddress() const{
+	return this->peer_ip;
+}
+
+bool Channel::waitReadable(const int& timeout_sec){
+	fd_set read_set;
+	FD_ZERO(&read_set);
+	FD_SET(this->client_fd, &read_set); //利用select实现read超时
+	struct timeval timeout;
+	timeout.tv_sec = timeout_sec;
+	timeout.tv_usec = 0;
+	int select_result = select(this->client_fd + 1, &read_set, NULL, NULL, &timeout); //在timeout时间内监听是否可以read
+	while (-1==select_result && EINTR==errno){ //被采样信号打断了，Linux的select会把timeout改成剩余的时间
+		FD_SET(this->client_fd, &read_set);
+		select_result = select(this->client_fd + 1, &read_set, NULL, NULL, &timeout);
+	}
+	if (-1==select_result) throw std::runtime_error("select failed in Channel::waitReadable"); //select出错了
+	return 0!=select_result;
+}
+
+ssize_t Channel::read(char* buf, const size_t& len){
+	return ::read(this->client_fd,buf,len);
+}
+
+void Channel::writeAll(struct iovec* iov, const size_t& iovcnt, const bool& is_more){
+	utils::writeAll(this->client_fd,iov,iovcnt,is_more? MSG_MORE:0);
+}
+
+void Channel::enableCork(){
+	this->is_cork_enabled=true;
+}
+
+void Channel::cork(){
+	if (!this->is_cork_enabled || this->is_corked) return;
+	int on=1;
+	if (0==setsockopt(this->client_fd,IPPROTO_TCP,TCP_CORK,&on,sizeof(on))) this->is_corked=true;
+}
+
+void Channel::uncork(){
+	if (!this->is_corked) return;
+	int off=0;
+	setsockopt(this->client_fd,IPPROTO_TCP,TCP_CORK,&off,sizeof(off));
+	this->is_corked=false;
+}
+
+void Channel::sendFile(const int& file_fd, off_t offset, size_t len){
+	while (len>0){
+		ssize_t result=sendfile(this->client_fd,file_fd,&offset,len); //数据不经过用户态
+		if (result<0 && EINTR==errno) continue;
+		if (result<=0) throw std::runtime_error("sendfile failed in Channel::sendFile");
+		len-=result;
+	}
+}
+
+/*------------implement of AccessLog--------------*/
+AccessLog::AccessLog(const std::string& path):p_file(fopen(path.c_str(),"ae")),flushed_us(0){
+	if (nullptr==this->p_file) throw std::runtime_error("cant open "+path+" in AccessLog::AccessLog");
+}
+AccessLog::~AccessLog(){
+	fclose(this->p_file);
+}
+
+void AccessLog::write(const uint32_t& ip, const uint64_t& connection, const Request& request, const Response& response, const int64_t& start_us, const int64_t& end_us){
+	char host[INET_ADDRSTRLEN]="-"; //Unix域socket没有IP
+	if (0!=ip){
+		struct in_addr addr;
+		addr.s_addr=ip;
+		inet_ntop(AF_INET,&addr,host,sizeof(host));
+	}
+	time_t sec=start_us/1000000;
+	struct tm tm;
+	localtime_r(&sec,&tm);
+	char time_buf[32];
+	strftime(time_buf,sizeof(time_buf),"%d/%b/%Y:%H:%M:%S %z",&tm);
+	std::string bytes="-"; //CLF里没有body时写-
+	const Body* p_body=response.getBody();
+	if (nullptr!=p_body && p_body->getSize()>0 && UNKNOWN_BODY_SIZE!=p_body->getSize()) bytes=std::to_string(p_body->getSize());
+	std::string_view path=request.getPath();
+	std::string line;
+	line.reserve(128+path.size());
+	line+=host;
+	line+=" - - [";
+	line+=time_buf;
+	line+="] \"";
+	line+=request.getMethod().toString();
+	line+=" ";
+	for (char c:path) line+=('"'==c || static_cast<unsigned char>(c)<0x20)? '?':c; //引号会破坏字段的边界
+	line+=" ";
+	line+=request.getVersion().toString();
+	line+="\" "+std::to_string(static_cast<int>(response.getStatusCodeAndMessage().getType()))+" "+bytes;
+	line+=" "+std::to_string(connection)+" "+std::to_string(start_us)+" "+std::to_string(end_us-start_us)+"\n";
+	std::lock_guard<std::mutex> lock(this->mtx);
+	fwrite(line.data(),1,line.size(),this->p_file);
+	if (end_us-this->flushed_us>=1000000){
+		fflush(this->p_file);
+		this->flushed_us=end_us;
+	}
+}
+
+namespace
+{
+
+int64_t nowUs(){ //访问日志用的墙上时间
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+class ConnectionCounter{ //连接处理完时把活跃连接数减一，中途抛出异常也不会漏掉
+public:
+	ConnectionCounter(std::atomic<size_t>& count):count(count){}
+	~ConnectionCounter(){
+		--this->count;
+	}
+
+private:
+	std::atomic<size_t>& count;
+};
+
+} // namespace
 
 /*------------implement of Server--------------*/
-Server::Server(const int port, const size_t pool_size, const std::shared_ptr<std::string> sp_rule_file){
-	this->server_fd = socket(AF_INET,SOCK_STREAM,0);
-	struct sockaddr_in addr = {};
-	addr.sin_family = AF_INET;
-	addr.sin_port = htons(port);
-	addr.sin_addr.s_addr = INADDR_ANY;
-	socklen_t addrlen = sizeof(addr);
-	if(bind(this->server_fd,(sockaddr*)&addr,addrlen)) throw std::runtime_error("bind failed in Server::Server");
-	if(listen(this->server_fd,MAX_LISTEN_QUEUE_LEN)) throw std::runtime_error("listen failed in Server::Server");
+Server::Server(const int port, const size_t pool_size, const std::shared_ptr<std::string> sp_rule_file, const SocketOptions& socket_options):tls_fd(-1),unix_fd(-1),socket_options(socket_options),active_connections(0),is_draining(false),next_connection_id(0),request_timeout_ms(0),cancelled_requests(0){
+	this->up_hot_restart=std::make_unique<HotRestart>(); //要在线程池之前创建，工作线程才会继承对SIGUSR2的阻塞
+	this->server_fd = port>0? this->listenOrInherit(port):-1; //端口为0表示只监听Unix域socket
 	if (pool_size > 0) this->sp_pool=std::make_shared<::utils::ThreadPool>(pool_size); //开启线程池
+	this->up_transfer_loop=std::make_unique<TransferLoop>(std::bind(&Server::finishTransfer,this,std::placeholders::_1,std::placeholders::_2));
 	try{ //初始化IP访问控制对象
 		this->sp_ip_access_control=std::make_shared<IPAccessControl>(sp_rule_file);
 	}
@@ -511,91 +1302,608 @@ Server::Server(const int port, const size_t pool_size, const std::shared_ptr<std
 	}
 }
 Server::~Server(){
-	close(this->server_fd);
+	if (this->server_fd>=0) close(this->server_fd);
+	if (this->tls_fd>=0) close(this->tls_fd);
+	if (this->unix_fd>=0) close(this->unix_fd);
+	if (!this->unix_path.empty() && '@'!=this->unix_path[0] && !this->is_draining) unlink(this->unix_path.c_str()); //热重启时新进程还在用这个路径
 }
 
-void Server::setMessageCallback(std::function<std::shared_ptr<httpd::Response>(const std::shared_ptr<httpd::Request>)> callback){
+int Server::listenOn(const int port) const{
+	int fd = socket(AF_INET,SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK,0); //热重启exec新进程时不能把socket漏过去；非阻塞，poll之后连接被对端重置了accept也不会卡住
+	if (fd<0) throw std::runtime_error("socket failed in Server::listenOn");
+	this->socket_options.applyListener(fd);
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = INADDR_ANY;
+	socklen_t addrlen = sizeof(addr);
+	if(bind(fd,(sockaddr*)&addr,addrlen)) throw std::runtime_error("bind failed in Server::listenOn");
+	if(listen(fd,MAX_LISTEN_QUEUE_LEN)) throw std::runtime_error("listen failed in Server::listenOn");
+	return fd;
+}
+
+int Server::listenOrInherit(const int port){
+	int fd=this->up_hot_restart->takeListener(port);
+	if (fd>=0) return fd; //旧进程已经设置过选项
+	return this->listenOn(port);
+}
+
+void Server::setMessageCallback(MessageCallback callback){
 	this->message_callback=std::move(callback);
 }
 
+void Server::setStatsPath(const std::string& path){
+	this->stats_path=path;
+}
+
+void Server::addStatsCallback(StatsCallback callback){
+	this->stats_callbacks.push_back(std::move(callback));
+}
+
+void Server::setHeavyHitters(std::shared_ptr<HeavyHitters> sp_hitters){
+	this->sp_hitters=std::move(sp_hitters);
+}
+
+void Server::setProfiler(std::shared_ptr<Profiler> sp_profiler, const std::string& path){
+	this->sp_profiler=std::move(sp_profiler);
+	this->profile_path=path;
+}
+
+void Server::setAccessLog(std::shared_ptr<AccessLog> sp_access_log){
+	this->sp_access_log=std::move(sp_access_log);
+}
+
+void Server::setRequestTimeout(const size_t& timeout_ms){
+	this->request_timeout_ms=timeout_ms;
+}
+
+void Server::setPoolMaxSize(const size_t& num){
+	this->sp_pool->setMaxSize(num);
+}
+
+void Server::setTracer(std::shared_ptr<Tracer> sp_tracer, const std::string& path){
+	this->sp_tracer=std::move(sp_tracer);
+	this->trace_path=path;
+}
+
+void Server::listenTls(const int port, const std::shared_ptr<TlsContext> sp_tls_context){
+	this->tls_fd=this->listenOrInherit(port);
+	this->sp_tls_context=sp_tls_context;
+}
+
+void Server::listenUnix(const std::string& path){
+	this->unix_fd=this->up_hot_restart->takeUnixListener(path);
+	this->unix_path=path;
+	if (this->unix_fd>=0) return;
+	struct sockaddr_un addr={};
+	addr.sun_family=AF_UNIX;
+	if (path.size()<2 || path.size()>=sizeof(addr.sun_path)) throw std::runtime_error("bad unix socket path in Server::listenUnix: "+path);
+	memcpy(addr.sun_path,path.data(),path.size());
+	socklen_t addr_len=sizeof(addr);
+	if ('@'==path[0]){ //抽象命名空间：第一个字节是\0，名字的长度由地址长度决定
+		addr.sun_path[0]='\0';
+		addr_len=offsetof(struct sockaddr_un,sun_path)+path.size();
+	}
+	else unlink(path.c_str()); //上次没有正常退出留下的socket文件
+	int fd=socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC|SOCK_NONBLOCK,0);
+	if (fd<0) throw std::runtime_error("socket failed in Server::listenUnix");
+	if (bind(fd,reinterpret_cast<struct sockaddr*>(&addr),addr_len) || listen(fd,MAX_LISTEN_QUEUE_LEN)){
+		close(fd);
+		throw std::runtime_error("bind failed in Server::listenUnix: "+path);
+	}
+	this->unix_fd=fd;
+}
+
+void Server::setRateLimit(const size_t& rate, const size_t& rate_after, const size_t& global_rate){
+	this->up_transfer_loop->setRateLimit(rate,rate_after,global_rate);
+}
+
 void Server::run(){
-	struct sockaddr_in client_addr;
-	socklen_t ca_len = sizeof(client_addr);
+	this->up_hot_restart->notifyReady(); //旧进程看到后就停止accept
 	while(1){
-		int client_fd = accept(this->server_fd, (struct sockaddr*)&client_addr, &ca_len);
-		if (client_fd<0) throw std::runtime_error("accept failed in Server::run");
-		try{
-			this->sp_pool->addTask(std::bind(&Server::task,this,client_fd)); //添加任务到线程池中
+		//fd为-1时poll会忽略它
+		struct pollfd fds[5]={{this->server_fd,POLLIN,0},{this->tls_fd,POLLIN,0},{this->unix_fd,POLLIN,0},{this->up_hot_restart->getSignalFd(),POLLIN,0},{this->up_hot_restart->getChildFd(),POLLIN,0}};
+		if (poll(fds,5,-1)<0){
+			if (EINTR==errno) continue;
+			throw std::runtime_error("poll failed in Server::run");
 		}
-		catch(const std::exception& e){
-			std::cerr << e.what() << '\n';
+		if (fds[3].revents&POLLIN){ //收到SIGUSR2，启动新进程，在它准备好之前继续accept
+			try{
+				this->up_hot_restart->spawn({this->server_fd,this->tls_fd,this->unix_fd});
+			}
+			catch(const std::exception& e){
+				std::cerr << e.what() << '\n';
+			}
+		}
+		if ((fds[4].revents&(POLLIN|POLLHUP)) && this->up_hot_restart->waitChild()){
+			this->drain();
+			return;
+		}
+		const Listener listeners[3]={Listener::TCP,Listener::TLS,Listener::UNIX}; //与fds的前三个一一对应
+		for (int i=0;i<3;++i){
+			if (!(fds[i].revents&POLLIN)) continue;
+			int client_fd = accept4(fds[i].fd, nullptr, nullptr, SOCK_CLOEXEC); //对端地址在task中按需要取；连接本身是阻塞的，工作线程用poll/select做超时
+			if (client_fd<0){
+				if (EAGAIN==errno || EWOULDBLOCK==errno || ECONNABORTED==errno || EINTR==errno) continue; //连接在accept之前被对端关闭了
+				if (EMFILE==errno || ENFILE==errno || ENOBUFS==errno || ENOMEM==errno){ //资源暂时不够，不能让整个服务退出
+					std::cerr << "accept failed in Server::run: " << strerror(errno) << '\n';
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+					continue;
+				}
+				throw std::runtime_error("accept failed in Server::run");
+			}
+			++this->active_connections;
+			int64_t accepted=nullptr!=this->sp_tracer? trace::now():0;
+			try{
+				this->sp_pool->addTask(std::bind(&Server::task,this,client_fd,listeners[i],accepted)); //添加任务到线程池中
+			}
+			catch(const std::exception& e){
+				--this->active_connections;
+				close(client_fd);
+				std::cerr << e.what() << '\n';
+			}
 		}
 	}
 }
 
-void Server::task(int client_fd){
+void Server::drain(){
+	this->is_draining=true;
+	close(this->server_fd); //新进程持有同一个监听socket，还没accept的连接都会交给它
+	this->server_fd=-1;
+	if (this->tls_fd>=0) close(this->tls_fd);
+	this->tls_fd=-1;
+	if (this->unix_fd>=0) close(this->unix_fd);
+	this->unix_fd=-1;
+	std::cerr << "Hot restart: draining " << this->active_connections << " connections" << std::endl;
+	auto deadline=std::chrono::steady_clock::now()+std::chrono::seconds(HOT_RESTART_DRAIN_SEC);
+	while (this->active_connections>0 && std::chrono::steady_clock::now()<deadline) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	if (this->active_connections>0){ //工作线程还卡在连接上，没法join，直接退出
+		std::cerr << "Hot restart: drain timeout, dropping " << this->active_connections << " connections" << std::endl;
+		_exit(0);
+	}
+	std::cerr << "Hot restart: drained" << std::endl;
+}
+
+void Server::task(int client_fd, const Listener& listener, const int64_t& accepted){
+	int64_t started=accepted>0? trace::now():0;
+	bool is_tls=Listener::TLS==listener;
+	ConnectionCounter counter(this->active_connections);
+	if (Listener::UNIX!=listener) this->socket_options.applyConnection(client_fd); //在TLS握手之前设置，握手也不会等ACK
+	std::unique_ptr<Channel> up_channel;
+	try{
+		if (is_tls) up_channel=std::make_unique<TlsChannel>(client_fd,*(this->sp_tls_context)); //先完成握手，之后的读写都经过TLS
+		else up_channel=std::make_unique<Channel>(client_fd);
+		if (Listener::UNIX!=listener && this->socket_options.is_cork) up_channel->enableCork();
+	}
+	catch(const std::exception& e){
+		std::cerr << e.what() << '\n';
+		return;
+	}
 	try{
-		if (nullptr!=this->sp_ip_access_control){ //检查IP是否允许访问
+		if (nullptr!=this->sp_ip_access_control && Listener::UNIX==listener){ //Unix域socket没有IP，检查对端进程的凭据
+			struct ucred cred;
+			socklen_t cred_len=sizeof(cred);
+			if (getsockopt(client_fd,SOL_SOCKET,SO_PEERCRED,&cred,&cred_len)!=0) throw std::runtime_error("cant get peer credential in Server::task");
+			if (!this->sp_ip_access_control->isAllow(cred)) throw httpd::HttpException(StatusCodeAndMessage::Type::Forbidden);
+		}
+		else if (Listener::UNIX!=listener && (nullptr!=this->sp_ip_access_control || nullptr!=this->sp_hitters || nullptr!=this->sp_access_log)){ //检查IP是否允许访问
 			struct sockaddr_in client_addr;
 			socklen_t addr_len = sizeof(client_addr);
 			if (getpeername(client_fd, (struct sockaddr*)&client_addr, &addr_len) != 0) throw std::runtime_error("cant get ip in Server::task");
-			if (!(this->sp_ip_access_control->isAllow(std::make_shared<std::string>(inet_ntoa(client_addr.sin_addr))))) throw httpd::HttpException(StatusCodeAndMessage::Type::Forbidden);
-		}
-		char buf_in[4096] = {};
-		fd_set read_set;
-		FD_ZERO(&read_set);
-		FD_SET(client_fd, &read_set); //利用select实现read超时
-		struct timeval timeout;
-		timeout.tv_sec = READ_TIMEOUT_SEC;
-		timeout.tv_usec = 0;
+			if (AF_INET==client_addr.sin_family) up_channel->setPeerAddress(client_addr.sin_addr.s_addr);
+			if (nullptr!=this->sp_hitters && !this->sp_hitters->addConnection(up_channel->getPeerAddress())) throw httpd::HttpException(StatusCodeAndMessage::Type::Forbidden); //被自动禁止了
+			if (nullptr!=this->sp_ip_access_control && !(this->sp_ip_access_control->isAllow(std::make_shared<std::string>(inet_ntoa(client_addr.sin_addr))))) throw httpd::HttpException(StatusCodeAndMessage::Type::Forbidden);
+		}
+	}
+	catch(const httpd::HttpException& e){
+		std::cerr << e.what() << '\n';
+		try{
+			Exchange exchange;
+			exchange.response.quickBuild(e.getStatusCodeAndMessage());
+			exchange.response.setHeader("server","USER202334261359");
+			Server::sendResponse(*up_channel,exchange.response);
+		}
+		catch(const std::exception& e){
+			std::cerr << e.what() << '\n';
+		}
+		return;
+	}
+	catch(const std::exception& e){
+		std::cerr << e.what() << '\n';
+		return;
+	}
+	this->serve(std::move(up_channel),is_tls,std::vector<char>(READ_BUFFER_SIZE),0,accepted,started); //输入缓冲区，一次read可能读到多个请求，也可能只读到半个请求
+}
+
+void Server::resume(std::shared_ptr<Transfer> sp_transfer){
+	ConnectionCounter counter(this->active_connections);
+	this->serve(std::move(sp_transfer->up_channel),false,std::move(sp_transfer->buf_in),sp_transfer->buf_len,0,0);
+}
+
+void Server::finishTransfer(std::shared_ptr<Transfer> sp_transfer, const bool& is_ok){
+	if (!is_ok || sp_transfer->is_close){ //连接随着sp_transfer一起关闭
+		--this->active_connections;
+		return;
+	}
+	try{
+		this->sp_pool->addTask(std::bind(&Server::resume,this,sp_transfer));
+	}
+	catch(const std::exception& e){
+		--this->active_connections;
+		std::cerr << e.what() << '\n';
+	}
+}
+
+void Server::serve(std::unique_ptr<Channel> up_channel, const bool& is_tls, std::vector<char> buf_in, size_t buf_len, const int64_t& accepted, const int64_t& started){
+	std::vector<std::unique_ptr<Exchange>> exchanges; //流水线中的请求，按到达顺序排列
+	exchanges.reserve(MAX_PIPELINE_DEPTH);
+	exchanges.emplace_back(std::make_unique<Exchange>());
+	Channel& channel=*up_channel;
+
+	//跟踪：每个请求的各阶段时间记在records中，与exchanges一一对应
+	Tracer* p_tracer=this->sp_tracer.get();
+	std::vector<trace::Record> records(nullptr!=p_tracer? MAX_PIPELINE_DEPTH:0);
+	trace::Binding binding; //FileSystem::read等地方的Span记录到正在处理的请求上
+	bool is_first=accepted>0; //连接上的第一个请求从accept算起
+	int64_t arrived=0; //缓冲区中第一个字节到达的时间，0表示缓冲区是空的
+	if (nullptr!=p_tracer) arrived=is_first? started:(buf_len>0? trace::now():0);
+	auto beginTrace=[&](const size_t& num){
+		trace::Record& record=records[num];
+		p_tracer->begin(record,is_first? accepted:arrived);
+		if (is_first) record.mark(trace::Phase::QUEUE,accepted,started);
+		if (0==num) record.mark(trace::Phase::READ,arrived,trace::now()); //流水线中后面的请求和第一个一起读到
+		is_first=false;
+		binding.bind(record);
+	};
+	auto finishTrace=[&](const size_t& num, const int64_t& write_start){ //前num个请求的响应发完了
+		binding.unbind();
+		int64_t write_end=trace::now();
+		for (size_t i=0;i<num;++i){
+			records[i].mark(trace::Phase::WRITE,write_start,write_end);
+			p_tracer->finish(records[i],exchanges[i]->request.getPath(),static_cast<int>(exchanges[i]->response.getStatusCodeAndMessage().getType()));
+		}
+	};
+
+	//访问日志：每个请求开始的时间记在starts中，与exchanges一一对应
+	AccessLog* p_access_log=this->sp_access_log.get();
+	std::vector<int64_t> starts(nullptr!=p_access_log? MAX_PIPELINE_DEPTH:0);
+	uint64_t connection_id=nullptr!=p_access_log? ++this->next_connection_id:0;
+	auto writeLog=[&](const size_t& num){ //前num个请求的响应发完了，大响应是交给事件循环的时候
+		int64_t end=nowUs();
+		for (size_t i=0;i<num;++i) p_access_log->write(channel.getPeerAddress(),connection_id,exchanges[i]->request,exchanges[i]->response,starts[i],end);
+	};
+	try{
 		while(1){
 			try{
-				int select_result = select(client_fd + 1, &read_set, NULL, NULL, &timeout); //在timeout时间内监听是否可以read
-				if (-1==select_result) httpd::HttpException(httpd::StatusCodeAndMessage::Type::InternalServerError); //select出错了
-				if (0==select_result) throw std::runtime_error("timeout in Server::task"); //超时了
-				if (0==read(client_fd,buf_in,sizeof(buf_in))) throw std::runtime_error("disconnect in Server::task"); //客户端断开连接了
+				//跳过请求之间多余的空行
+				size_t consumed=0;
+				while (consumed<buf_len && ('\r'==buf_in[consumed] || '\n'==buf_in[consumed])) ++consumed;
 
-				auto request=std::make_shared<httpd::Request>();
-				request->decode(std::make_shared<std::string>(buf_in));
-				if (nullptr==request->getHeader(std::make_shared<std::string>("Host"))) throw httpd::HttpException(httpd::StatusCodeAndMessage::Type::BadRequest); //请求头中没有Host字段
+				//找出缓冲区中所有完整的请求，依次处理
+				size_t num=0;
+				bool is_close=false;
+				bool is_http2=false; //收到了HTTP/2的连接序言
+				bool is_upgrade=false; //收到了Upgrade: h2c请求，exchanges[num]就是这个请求
+				while (num<MAX_PIPELINE_DEPTH){
+					std::string_view rest(buf_in.data()+consumed,buf_len-consumed);
+					if (http2::Connection::isPreface(rest)){
+						is_http2=true;
+						break;
+					}
+					if (!rest.empty() && rest.size()<HTTP2_PREFACE_LEN && 0==memcmp(rest.data(),HTTP2_PREFACE,rest.size())) break; //可能是不完整的连接序言
+					size_t len=0;
+					try{
+						len=Request::completeLength(rest);
+					}
+					catch(const httpd::HttpException& e){ //请求的边界无法确定，之后的数据都没法解析了，回复错误后关闭连接
+						if (exchanges.size()==num) exchanges.emplace_back(std::make_unique<Exchange>());
+						if (nullptr!=p_tracer) beginTrace(num);
+						if (nullptr!=p_access_log) starts[num]=nowUs();
+						exchanges[num]->clear();
+						exchanges[num]->response.quickBuild(e.getStatusCodeAndMessage());
+						exchanges[num]->response.setHeader("server","USER202334261359");
+						++num;
+						is_close=true;
+						break;
+					}
+					if (0==len) break; //剩下的不是一个完整的请求
+					if (exchanges.size()==num) exchanges.emplace_back(std::make_unique<Exchange>());
+					if (nullptr!=p_tracer) beginTrace(num);
+					if (nullptr!=p_access_log) starts[num]=nowUs();
+					bool is_decoded=false;
+					{
+						trace::Span span(trace::Phase::PARSE);
+						is_decoded=this->decodeRequest(*exchanges[num],rest.substr(0,len));
+					}
+					if (is_decoded) exchanges[num]->cancel.start(channel.getFd(),this->requestTimeout(exchanges[num]->request)); //截止时间从解析完开始算，在流水线里排队的时间也算在内
+					if (is_decoded && nullptr!=this->sp_hitters && !this->sp_hitters->addRequest(channel.getPeerAddress(),exchanges[num]->request.getPath())){ //这个IP请求太多，被临时禁止了
+						exchanges[num]->response.quickBuild(StatusCodeAndMessage::Type::Forbidden);
+						exchanges[num]->response.setHeader("server","USER202334261359");
+						consumed+=len;
+						++num;
+						is_close=true;
+						break;
+					}
+					if (is_decoded){
+						if (http2::Connection::isUpgrade(exchanges[num]->request)){
+							consumed+=len;
+							is_upgrade=true;
+							break;
+						}
+						trace::Span span(trace::Phase::HANDLER);
+						this->dispatch(exchanges[num]->request,exchanges[num]->response);
+					}
+					consumed+=len;
+					++num;
 
-				if (nullptr==this->message_callback) httpd::HttpException(httpd::StatusCodeAndMessage::Type::InternalServerError);
-				auto response=(this->message_callback)(request); //调用消息处理回调
+					auto p_close=exchanges[num-1]->request.getHeader("connection");
+					if (nullptr!=p_close && *p_close=="close"){
+						is_close=true;
+						break;
+					}
+				}
 
-				response->setHeader(std::make_shared<std::string>("Server"),std::make_shared<std::string>("USER202334261359"));
-				auto str=response->encode();
-				write(client_fd,str->c_str(),str->length());
+				binding.unbind(); //HTTP/2的请求不跟踪
+				int64_t write_start=nullptr!=p_tracer? trace::now():0;
+				if (is_http2 || is_upgrade){ //之前的响应先发出去，剩下的数据交给HTTP/2处理
+					if (num>0) Server::sendResponses(channel,exchanges,num);
+					if (nullptr!=p_tracer) finishTrace(num,write_start);
+					if (nullptr!=p_access_log) writeLog(num);
+					std::unique_ptr<Exchange> up_upgrade;
+					if (is_upgrade) up_upgrade=std::move(exchanges[num]);
+					this->serveHttp2(channel,std::string_view(buf_in.data()+consumed,buf_len-consumed),std::move(up_upgrade));
+					break;
+				}
+				if (num>0 && this->is_draining && !is_close){ //旧进程正在退出，让客户端重新连接到新进程
+					exchanges[num-1]->response.setHeader("connection","close");
+					is_close=true;
+				}
+				if (num>0 && !is_tls && TransferLoop::isLarge(exchanges[num-1]->response)){ //大响应的body交给事件循环分块发送，工作线程去处理别的连接
+					Server::sendResponses(channel,exchanges,num,true);
+					if (nullptr!=p_tracer) finishTrace(num,write_start);
+					if (nullptr!=p_access_log) writeLog(num);
+					memmove(buf_in.data(),buf_in.data()+consumed,buf_len-consumed);
+					buf_len-=consumed;
+					auto sp_transfer=std::make_shared<Transfer>();
+					sp_transfer->body=*(exchanges[num-1]->response.getBody());
+					sp_transfer->is_close=is_close;
+					sp_transfer->buf_in=std::move(buf_in);
+					sp_transfer->buf_len=buf_len;
+					sp_transfer->up_channel=std::move(up_channel);
+					++this->active_connections; //发送完之前连接还没有处理完
+					this->up_transfer_loop->add(std::move(sp_transfer));
+					return;
+				}
+				if (num>0){ //按请求的顺序把所有响应一起发出去
+					Server::sendResponses(channel,exchanges,num);
+					if (nullptr!=p_access_log) writeLog(num);
+					memmove(buf_in.data(),buf_in.data()+consumed,buf_len-consumed);
+					buf_len-=consumed;
+					if (nullptr!=p_tracer){
+						finishTrace(num,write_start);
+						arrived=buf_len>0? trace::now():0; //剩下的半个请求从现在算起
+					}
+					if (is_close) throw std::runtime_error("disconnect in Server::task");
+					continue; //缓冲区中可能还有完整的请求
+				}
+				memmove(buf_in.data(),buf_in.data()+consumed,buf_len-consumed);
+				buf_len-=consumed;
 
-				auto sp_close=request->getHeader(std::make_shared<std::string>("connection"));
-				if (nullptr!=sp_close && *sp_close=="close") throw std::runtime_error("disconnect in Server::task");
+				if (buf_len==buf_in.size()){ //缓冲区满了还没有一个完整的请求
+					if (buf_in.size()>=MAX_REQUEST_SIZE) throw httpd::HttpException(httpd::StatusCodeAndMessage::Type::BadRequest);
+					buf_in.resize(std::min(buf_in.size()*2,static_cast<size_t>(MAX_REQUEST_SIZE)));
+				}
+
+				if (!this->waitRequest(channel,0==buf_len)) throw std::runtime_error("timeout in Server::task"); //超时了
+				if (nullptr!=p_tracer && 0==arrived) arrived=trace::now(); //空闲等待的时间不算在请求里
+				ssize_t len=channel.read(buf_in.data()+buf_len,buf_in.size()-buf_len);
+				if (len<=0) throw std::runtime_error("disconnect in Server::task"); //客户端断开连接了
+				buf_len+=len;
 			}
-			catch(const httpd::HttpException& e){
+			catch(const httpd::HttpException& e){ //请求过大，回复错误后关闭连接
 				std::cerr << e.what() << '\n';
-				auto response=Response::quickBuild(e.getStatusCodeAndMessage());
-				response->setHeader(std::make_shared<std::string>("Server"),std::make_shared<std::string>("USER202334261359"));
-				auto str=response->encode();
-				write(client_fd,str->c_str(),str->length());
+				exchanges[0]->clear();
+				exchanges[0]->response.quickBuild(e.getStatusCodeAndMessage());
+				exchanges[0]->response.setHeader("server","USER202334261359");
+				Server::sendResponse(channel,exchanges[0]->response);
+				break;
 			}
 			catch(const std::exception& e){
 				std::cerr << e.what() << '\n';
-				close(client_fd);
 				break;
 			}
 		}
 	}
 	catch(const httpd::HttpException& e){
 		std::cerr << e.what() << '\n';
-		auto response=Response::quickBuild(e.getStatusCodeAndMessage());
-		response->setHeader(std::make_shared<std::string>("Server"),std::make_shared<std::string>("USER202334261359"));
-		auto str=response->encode();
-		write(client_fd,str->c_str(),str->length());
-		close(client_fd);
+		exchanges[0]->clear();
+		exchanges[0]->response.quickBuild(e.getStatusCodeAndMessage());
+		exchanges[0]->response.setHeader("server","USER202334261359");
+		Server::sendResponse(channel,exchanges[0]->response);
 	}
 	catch(const std::exception& e){
 		std::cerr << e.what() << '\n';
-		close(client_fd);
 	}
-	
+}
+
+bool Server::waitRequest(Channel& channel, const bool& is_idle){
+	for (int i=0;i<READ_TIMEOUT_SEC;++i){ //每秒检查一次是否在热重启
+		if (is_idle && this->is_draining) return false;
+		if (channel.waitReadable(1)) return true;
+	}
+	return false;
+}
+
+bool Server::decodeRequest(Exchange& exchange, const std::string_view& raw){
+	exchange.clear(); //复用上一个请求的对象和arena
+	try{
+		exchange.request.decode(raw);
+	}
+	catch(const httpd::HttpException& e){
+		std::cerr << e.what() << '\n';
+		exchange.response.quickBuild(e.getStatusCodeAndMessage());
+		exchange.response.setHeader("server","USER202334261359");
+		return false;
+	}
+	return true;
+}
+
+int64_t Server::requestTimeout(const Request& request) const{
+	auto p_timeout=request.getHeader(REQUEST_TIMEOUT_HEADER);
+	if (nullptr!=p_timeout){
+		size_t timeout_ms=0;
+		auto res=std::from_chars(p_timeout->data(),p_timeout->data()+p_timeout->size(),timeout_ms);
+		if (std::errc()==res.ec && p_timeout->data()+p_timeout->size()==res.ptr && timeout_ms>0) return std::min<size_t>(timeout_ms,REQUEST_TIMEOUT_MAX_MS);
+	}
+	return this->request_timeout_ms;
+}
+
+void Server::dispatch(Request& request, Response& response){
+	const CancelToken* p_cancel=request.getCancelToken();
+	try{
+		if (nullptr==request.getHeader("host")) throw httpd::HttpException(httpd::StatusCodeAndMessage::Type::BadRequest); //请求头中没有Host字段
+
+		if (!this->stats_path.empty() && request.getPath()==this->stats_path){ //统计页面由服务自己处理
+			std::string stats="active_connections "+std::to_string(this->active_connections)+"\n";
+			stats+="cancelled_requests "+std::to_string(this->cancelled_requests)+"\n";
+			this->sp_pool->appendStats(stats);
+			if (nullptr!=this->sp_hitters) this->sp_hitters->appendStats(stats);
+			for (const auto& callback:this->stats_callbacks) callback(stats);
+			response.setStatusCodeAndMessage(StatusCodeAndMessage::Type::OK);
+			response.setBody(Body("text/plain",request.getArena().copy(stats)));
+			response.setHeader("cache-control","no-store");
+		}
+		else if (nullptr!=this->sp_tracer && request.getPath()==this->trace_path){ //导出trace，可以直接在Perfetto里打开
+			response.setStatusCodeAndMessage(StatusCodeAndMessage::Type::OK);
+			response.setBody(Body("application/json",request.getArena().copy(this->sp_tracer->dump())));
+			response.setHeader("cache-control","no-store");
+		}
+		else if (nullptr!=this->sp_profiler && 0==request.getPath().compare(0,this->profile_path.size(),this->profile_path)
+			&& (request.getPath().size()==this->profile_path.size() || '?'==request.getPath()[this->profile_path.size()])){ //采样期间占着这个工作线程，线程池会自动增长
+			std::string_view query=request.getPath().substr(std::min(request.getPath().size(),this->profile_path.size()+1));
+			response.setStatusCodeAndMessage(StatusCodeAndMessage::Type::OK);
+			response.setBody(Body("text/plain",request.getArena().copy(this->sp_profiler->profile(query))));
+			response.setHeader("cache-control","no-store");
+		}
+		else{
+			if (nullptr==this->message_callback) throw httpd::HttpException(httpd::StatusCodeAndMessage::Type::InternalServerError);
+			if (nullptr!=p_cancel && p_cancel->isExpired()) throw httpd::HttpException(httpd::StatusCodeAndMessage::Type::GatewayTimeout); //在流水线里排队就已经超时了
+			(this->message_callback)(request,response); //调用消息处理回调，等待上游时通过request.getCancelToken()检查是否被取消
+			if (nullptr!=p_cancel && nullptr!=response.getBody() && response.getBody()->isStream() && p_cancel->isPeerClosed()) throw std::runtime_error("peer closed in Server::dispatch"); //没人接收了，不再从上游读body
+		}
+	}
+	catch(const httpd::HttpException& e){
+		std::cerr << e.what() << '\n';
+		if (nullptr!=p_cancel && p_cancel->isPeerClosed()){ //处理函数把断开当成了别的错误，错误响应也没人收了
+			++this->cancelled_requests;
+			throw std::runtime_error("peer closed in Server::dispatch");
+		}
+		if (nullptr!=p_cancel && p_cancel->isExpired()) ++this->cancelled_requests;
+		response.clear();
+		response.quickBuild(e.getStatusCodeAndMessage());
+	}
+	catch(const std::exception& e){ //客户端断开了，连接由serve关闭
+		if (nullptr!=p_cancel && p_cancel->isPeerClosed()) ++this->cancelled_requests;
+		throw;
+	}
+	response.setHeader("server","USER202334261359");
+}
+
+namespace
+{
+
+void fillIovec(struct iovec* iov, const Response& response){ //响应头和body分开存放，body不需要再拷贝一次
+	auto head=response.encodeHead();
+	std::string_view content;
+	if (nullptr!=response.getBody()) content=response.getBody()->getContent();
+	iov[0].iov_base=const_cast<char*>(head.data());
+	iov[0].iov_len=head.size();
+	iov[1].iov_base=const_cast<char*>(content.data());
+	iov[1].iov_len=content.size();
+}
+
+bool isBodyInMemory(const Response& response){ //body是否已经放进iovec里了
+	return nullptr==response.getBody() || (!response.getBody()->isFile() && !response.getBody()->isStream());
+}
+
+void sendStream(Channel& channel, const Body& body, const CancelToken* p_cancel){ //边读边发，长度未知时用chunked编码
+	char buf[STREAM_CHUNK_SIZE];
+	bool is_chunked=UNKNOWN_BODY_SIZE==body.getSize();
+	size_t sent=0;
+	for (size_t len=body.getSource()->read(buf,sizeof(buf));len>0;len=body.getSource()->read(buf,sizeof(buf))){
+		if (nullptr!=p_cancel && p_cancel->isCancelled()) throw std::runtime_error("request cancelled in sendStream"); //响应头已经发出去了，只能断开连接
+		sent+=len;
+		if (!is_chunked && sent>body.getSize()) throw std::runtime_error("body longer than content-length in sendStream");
+		if (is_chunked){
+			char size_line[20];
+			auto res=std::to_chars(size_line,size_line+16,len,16);
+			memcpy(res.ptr,"\r\n",2);
+			struct iovec iov[3]={{size_line,static_cast<size_t>(res.ptr+2-size_line)},{buf,len},{const_cast<char*>("\r\n"),2}};
+			channel.writeAll(iov,3);
+		}
+		else{
+			struct iovec iov={buf,len};
+			channel.writeAll(&iov,1);
+		}
+	}
+	if (is_chunked){ //结尾和还没发出的数据攒成一个报文段，uncork时马上发出；是否还要等ACK由连接的nodelay选项决定，这里不改
+		struct iovec iov={const_cast<char*>("0\r\n\r\n"),5};
+		channel.cork();
+		channel.writeAll(&iov,1);
+		channel.uncork();
+	}
+	else if (sent!=body.getSize()) throw std::runtime_error("body shorter than content-length in sendStream"); //只能断开连接让客户端知道
+}
+
+void sendBody(Channel& channel, const Body& body, const CancelToken* p_cancel){ //发送不在内存中的body，响应头已经写过了
+	if (!body.isFile()) sendStream(channel,body,p_cancel);
+	else if (nullptr==p_cancel) channel.sendFile(body.getFileDescriptor(),0,body.getSize());
+	else{ //分段发送，每段之间检查客户端是否断开了连接
+		for (size_t offset=0;offset<body.getSize();offset+=CANCEL_FILE_CHUNK_SIZE){
+			if (offset>0 && p_cancel->isPeerClosed()) throw std::runtime_error("peer closed in sendBody");
+			channel.sendFile(body.getFileDescriptor(),offset,std::min<size_t>(CANCEL_FILE_CHUNK_SIZE,body.getSize()-offset));
+		}
+	}
+}
+
+} // namespace
+
+void Server::serveHttp2(Channel& channel, const std::string_view& buffered, std::unique_ptr<Exchange> up_upgrade){
+	http2::Connection connection(channel,std::bind(&Server::dispatch,this,std::placeholders::_1,std::placeholders::_2),&this->is_draining); //每个流都和HTTP/1.1一样经过dispatch
+	connection.run(buffered,std::move(up_upgrade));
+}
+
+void Server::sendResponses(Channel& channel, const std::vector<std::unique_ptr<Exchange>>& exchanges, const size_t& num, const bool& is_skip_last_body){
+	struct iovec iov[2*MAX_PIPELINE_DEPTH];
+	size_t iovcnt=0;
+	for (size_t i=0;i<num;++i){
+		const Response& response=exchanges[i]->response;
+		fillIovec(iov+iovcnt,response);
+		iovcnt+=2;
+		if (is_skip_last_body && num-1==i){ //最后一个body由调用者另外发送
+			iov[iovcnt-1].iov_len=0;
+			break;
+		}
+		if (!isBodyInMemory(response)){ //先把前面的数据写出去，文件用sendfile发送，流式body边读边发
+			if (response.getBody()->isFile()) channel.cork(); //响应头和文件拼成完整的报文段
+			else channel.uncork(); //流式body不知道下一段什么时候来，不能攒着
+			exchanges[i]->cancel.startResponse(); //响应已经开始了，客户端半关闭也要发完
+			channel.writeAll(iov,iovcnt,true);
+			iovcnt=0;
+			sendBody(channel,*(response.getBody()),exchanges[i]->request.getCancelToken());
+		}
+	}
+	if (iovcnt>0) channel.writeAll(iov,iovcnt);
+	channel.uncork();
+}
+
+void Server::sendResponse(Channel& channel, const Response& response){
+	struct iovec iov[2];
+	fillIovec(iov,response);
+	if (nullptr!=response.getBody() && response.getBody()->isFile()) channel.cork();
+	channel.writeAll(iov,2,!isBodyInMemory(response));
+	if (!isBodyInMemory(response)) sendBody(channel,*(response.getBody()),nullptr);
+	channel.uncork();
 }
 
 
@@ -604,27 +1912,114 @@ void Server::task(int client_fd){
 
 
 //消息处理回调
-std::shared_ptr<httpd::Response> onMessage(const std::shared_ptr<httpd::Request> request, const std::shared_ptr<std::string> doc_root){
-	std::cout<<*(request->getPath())<<std::endl;
+void onMessage(httpd::Request& request, httpd::Response& response, const std::shared_ptr<httpd::FileSystem> sp_fs, const std::shared_ptr<httpd::Proxy> sp_proxy, const std::shared_ptr<httpd::FastCgi> sp_fastcgi){
+	std::cout<<request.getPath()<<std::endl;
 
-    if (*(request->getMethod())==httpd::Method::Type::POST) throw httpd::HttpException(httpd::StatusCodeAndMessage::Type::InternalServerError); //暂时不能处理POST方法
+    if (nullptr!=sp_proxy && sp_proxy->handle(request,response)) return; //匹配反向代理的路径前缀，转发给上游
+    if (nullptr!=sp_fastcgi && sp_fastcgi->handle(request,response)) return; //匹配FastCGI的路径前缀，交给worker处理（包括POST）
 
-	httpd::FileSystem fs(doc_root);
-	if ("/"==*(request->getPath())) request->setPath(std::make_shared<std::string>("/index.html")); //将/路径设置为/index.html
-    auto body=fs.read(request->getPath());
+    if (request.getMethod()==httpd::Method::Type::POST) throw httpd::HttpException(httpd::StatusCodeAndMessage::Type::InternalServerError); //暂时不能处理POST方法
 
-    auto response=std::make_shared<httpd::Response>();
-    response->setStatusCodeAndMessage(std::make_shared<httpd::StatusCodeAndMessage>(httpd::StatusCodeAndMessage::Type::OK));
-    response->setBody(body);
+	if ("/"==request.getPath()) request.setPath("/index.html"); //将/路径设置为/index.html
+    auto body=sp_fs->read(request.getPath());
 
-    return response;
+    response.setStatusCodeAndMessage(httpd::StatusCodeAndMessage::Type::OK);
+    response.setBody(body);
 }
 
 void start_httpd(unsigned short port, std::string doc_root, size_t pool_size){
-	std::cerr << "Starting server (port: " << port <<
-		", doc_root: " << doc_root << ")" << std::endl;
+	httpd::Options options;
+	options.port=port;
+	options.doc_root=doc_root;
+	options.pool_size=pool_size;
+	start_httpd(options);
+}
+
+void start_httpd(const httpd::Options& options){
+	std::cerr << "Starting server (port: " << options.port <<
+		", doc_root: " << options.doc_root << ")" << std::endl;
 	
-    httpd::Server server(port,pool_size,std::make_shared<std::string>("./"+doc_root+"/.htaccess"));
-    server.setMessageCallback(std::bind(onMessage,std::placeholders::_1,std::make_shared<decltype(doc_root)>(doc_root)));
+    std::shared_ptr<httpd::Tracer> sp_tracer;
+    if (!options.trace_path.empty()){ //要在线程池之前创建，工作线程才会继承对导出信号的阻塞
+        std::string dump_path="/tmp/httpd-trace."+std::to_string(getpid())+".json";
+        std::cerr << "Tracing " << options.trace_sample_rate << " of requests (kill -USR1 " << getpid() << " writes " << dump_path << ")" << std::endl;
+        sp_tracer=std::make_shared<httpd::Tracer>(options.trace_sample_rate,dump_path);
+    }
+    httpd::Server server(options.port,options.pool_size,std::make_shared<std::string>("./"+options.doc_root+"/.htaccess"),options.socket_options);
+    if (0!=options.tls_port){ //同一个服务再监听一个HTTPS端口
+        std::cerr << "Starting TLS (port: " << options.tls_port << ")" << std::endl;
+        server.listenTls(options.tls_port,std::make_shared<httpd::TlsContext>(options.cert_file,options.key_file));
+    }
+    if (!options.unix_path.empty()){ //同一台机器上的前端不经过TCP协议栈
+        std::cerr << "Starting Unix socket (path: " << options.unix_path << ")" << std::endl;
+        server.listenUnix(options.unix_path);
+    }
+    auto sp_fs=std::make_shared<httpd::FileSystem>(options.doc_root); //所有请求共用一个文件系统，这样文件缓存才能生效
+    std::shared_ptr<httpd::MemoryBudget> sp_budget;
+    if (options.memory_budget>0){
+        sp_budget=std::make_shared<httpd::MemoryBudget>(options.memory_budget);
+        sp_fs->setMemoryBudget(sp_budget);
+    }
+    if (options.is_warm_cache) std::cerr << "Warmed " << sp_fs->warm() << " files" << std::endl;
+    std::shared_ptr<httpd::Proxy> sp_proxy;
+    for (const auto& route:options.proxy_routes){
+        if (nullptr==sp_proxy) sp_proxy=std::make_shared<httpd::Proxy>();
+        std::vector<std::string> addresses;
+        size_t begin=0;
+        while (begin<=route.second.size()){ //多个上游地址用逗号分隔
+            size_t end=route.second.find(',',begin);
+            if (route.second.npos==end) end=route.second.size();
+            if (end>begin) addresses.push_back(route.second.substr(begin,end-begin));
+            begin=end+1;
+        }
+        std::cerr << "Proxy " << route.first << " -> " << route.second << std::endl;
+        sp_proxy->addRoute(route.first,addresses);
+    }
+    std::shared_ptr<httpd::FastCgi> sp_fastcgi;
+    if (!options.fastcgi_routes.empty() || !options.fastcgi_spawns.empty()) sp_fastcgi=std::make_shared<httpd::FastCgi>();
+    for (const auto& route:options.fastcgi_routes){
+        std::cerr << "FastCGI " << route.first << " -> " << route.second << std::endl;
+        sp_fastcgi->addRoute(route.first,std::make_unique<httpd::fastcgi::Application>(route.second));
+    }
+    for (const auto& spawn:options.fastcgi_spawns){
+        std::cerr << "FastCGI " << std::get<0>(spawn) << " -> " << std::get<2>(spawn) << " x " << std::get<1>(spawn) << std::endl;
+        sp_fastcgi->addRoute(std::get<0>(spawn),std::make_unique<httpd::fastcgi::Application>(std::get<1>(spawn),std::get<2>(spawn)));
+    }
+    if (options.limit_rate>0 || options.limit_rate_global>0){
+        std::cerr << "Rate limit: " << options.limit_rate << " B/s per connection after " << options.limit_rate_after << " bytes, " << options.limit_rate_global << " B/s global" << std::endl;
+        server.setRateLimit(options.limit_rate,options.limit_rate_after,options.limit_rate_global);
+    }
+    if (options.pool_max_size>options.pool_size){
+        std::cerr << "Thread pool: " << options.pool_size << " to " << options.pool_max_size << " threads" << std::endl;
+        server.setPoolMaxSize(options.pool_max_size);
+    }
+    if (options.is_hitters || options.auto_deny_requests>0){
+        if (options.auto_deny_requests>0) std::cerr << "Auto deny: " << options.auto_deny_requests << " requests per minute, for " << options.auto_deny_sec << " seconds" << std::endl;
+        server.setHeavyHitters(std::make_shared<httpd::HeavyHitters>(options.auto_deny_requests,options.auto_deny_sec));
+    }
+    if (nullptr!=sp_tracer) server.setTracer(sp_tracer,options.trace_path);
+    if (options.request_timeout_ms>0){
+        std::cerr << "Request timeout: " << options.request_timeout_ms << " ms" << std::endl;
+        server.setRequestTimeout(options.request_timeout_ms);
+    }
+    if (!options.access_log_path.empty()){
+        std::cerr << "Access log: " << options.access_log_path << std::endl;
+        server.setAccessLog(std::make_shared<httpd::AccessLog>(options.access_log_path));
+    }
+    std::shared_ptr<httpd::Profiler> sp_profiler;
+    if (!options.profile_path.empty()){
+        std::cerr << "Profiler at " << options.profile_path << "?seconds=N&mode=cpu|wall" << std::endl;
+        sp_profiler=std::make_shared<httpd::Profiler>();
+        server.setProfiler(sp_profiler,options.profile_path);
+    }
+    if (!options.stats_path.empty()){
+        server.setStatsPath(options.stats_path);
+        if (nullptr!=sp_tracer) server.addStatsCallback(std::bind(&httpd::Tracer::appendStats,sp_tracer,std::placeholders::_1));
+        if (nullptr!=sp_profiler) server.addStatsCallback(std::bind(&httpd::Profiler::appendStats,sp_profiler,std::placeholders::_1));
+        server.addStatsCallback(std::bind(&httpd::FileSystem::appendStats,sp_fs,std::placeholders::_1));
+        if (nullptr!=sp_budget) server.addStatsCallback(std::bind(&httpd::MemoryBudget::appendStats,sp_budget,std::placeholders::_1));
+        if (nullptr!=sp_fastcgi) server.addStatsCallback(std::bind(&httpd::FastCgi::appendStats,sp_fastcgi,std::placeholders::_1));
+    }
+    server.setMessageCallback(std::bind(onMessage,std::placeholders::_1,std::placeholders::_2,sp_fs,sp_proxy,sp_fastcgi));
     server.run();
 }
@@ -18,31 +18,66 @@
 #include <type_traits>
 #include <atomic>
 #include <chrono>
+#include <charconv>
+#include <string_view>
+#include <array>
+#include <shared_mutex>
+#include <condition_variable>
 #include <semaphore.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <filesystem>
 #include "utils.h"
 
 #define MAX_LISTEN_QUEUE_LEN 6
 #define READ_TIMEOUT_SEC 5
+#define READ_BUFFER_SIZE 8192 //连接输入缓冲区的初始大小
+#define MAX_REQUEST_SIZE (1<<20) //单个请求（包括body）的最大大小
+#define MAX_PIPELINE_DEPTH 16 //一个连接一次最多处理的流水线请求数
+#define UNKNOWN_BODY_SIZE SIZE_MAX //流式Body事先不知道长度，HTTP/1.1用chunked发送
+#define STREAM_CHUNK_SIZE 16384 //流式Body每次读出的最大长度
+#define FILE_CACHE_MAX_FILE_SIZE (1<<20) //超过该大小的文件不缓存
+#define FILE_CACHE_MAX_SIZE (64<<20) //文件缓存的总大小
+#define MEMORY_BUDGET_DEFAULT (256<<20) //缓冲在内存里还没发完的响应数据的总预算，不包括文件缓存
+#define MEMORY_BUDGET_SMALL_SIZE (64<<10) //不超过这个大小的算小响应
+#define MEMORY_BUDGET_SMALL_SHARE 8 //预算的1/8只留给小响应，大响应用光了预算小文件也还能从内存发
+#define TCP_FASTOPEN_QUEUE_LEN 256 //还没完成握手的TFO连接数上限
+#define REQUEST_TIMEOUT_HEADER "x-request-timeout-ms" //客户端用这个请求头给自己的请求指定截止时间（毫秒）
+#define REQUEST_TIMEOUT_MAX_MS 300000 //请求头指定的截止时间的上限
+#define CANCEL_CHECK_MS 100 //等待上游时每隔这么久检查一次请求是否被取消
+#define CANCEL_FILE_CHUNK_SIZE (1<<20) //阻塞发送文件时每发这么多检查一次客户端是否断开
 
 namespace httpd
 {
 
 namespace utils
 {
-// 字符串转小写
-const std::string toLower(const std::string& str);
+// 字符串转小写（结果存放在arena中）
+std::string_view toLower(const std::string_view& str, ::utils::Arena& arena);
 
-// URL解码
-const std::shared_ptr<std::string> urlDecode(const std::shared_ptr<std::string> input);
+// 忽略大小写比较两个字符串
+bool equalsIgnoreCase(const std::string_view& str1, const std::string_view& str2);
 
-// URL编码
-const std::shared_ptr<std::string> urlEncode(const std::shared_ptr<std::string> input);
+// URL解码（结果存放在arena中）
+std::string_view urlDecode(const std::string_view& input, ::utils::Arena& arena);
+
+// URL编码（结果存放在arena中）
+std::string_view urlEncode(const std::string_view& input, ::utils::Arena& arena);
+
+// 把所有iovec都写到fd中，出错（例如对方断开连接）时抛出异常。flags会传给sendmsg，例如后面还有数据时传MSG_MORE
+void writeAll(int fd, struct iovec* iov, size_t iovcnt, const int& flags=0);
 
 } // namespace utils
 
@@ -55,10 +90,10 @@ public:
         POST
     };
     Method(const Method::Type& type);
-    Method(const std::shared_ptr<std::string> str);
+    Method(const std::string_view& str);
 
     Method::Type getType() const;
-    std::shared_ptr<std::string> toString() const;
+    std::string_view toString() const; //返回静态字符串，不分配内存
     bool operator==(const Method& cmp) const;
     bool operator==(const Method::Type& cmp) const;
     bool operator!=(const Method& cmp) const;
@@ -70,15 +105,16 @@ private:
 /*------------Definition of Version--------------*/
 class Version{ //版本类
 public:
-    enum class Type{ //两个Http版本
+    enum class Type{ //Http版本
         HTTP_1_0,
-        HTTP_1_1
+        HTTP_1_1,
+        HTTP_2
     };
     Version(const Version::Type& type);
-    Version(const std::shared_ptr<std::string> str);
+    Version(const std::string_view& str);
 
     Version::Type getType() const;
-    std::shared_ptr<std::string> toString() const;
+    std::string_view toString() const; //返回静态字符串，不分配内存
     bool operator==(const Version& cmp) const;
     bool operator==(const Version::Type& cmp) const;
     bool operator!=(const Version& cmp) const;
@@ -93,17 +129,23 @@ public:
     enum class Type{ //状态码
         UNKNOW=0,
         Continue = 100,
+        SwitchingProtocols = 101,
         OK = 200,
         BadRequest = 400,
         Unauthorized = 401,
         Forbidden = 403,
         NotFound = 404,
-        InternalServerError = 500
+        InternalServerError = 500,
+        NotImplemented = 501,
+        BadGateway = 502,
+        ServiceUnavailable = 503,
+        GatewayTimeout = 504
     };
     StatusCodeAndMessage(const StatusCodeAndMessage::Type& type);
+    StatusCodeAndMessage(const std::string_view& str); //解析三位数字的状态码，不在Type中的状态码也保留原值
 
     StatusCodeAndMessage::Type getType() const;
-    std::shared_ptr<std::string> toString() const;
+    std::string_view toString() const; //返回静态字符串，不分配内存
     bool operator==(const StatusCodeAndMessage& cmp) const;
     bool operator==(const StatusCodeAndMessage::Type& cmp) const;
     bool operator!=(const StatusCodeAndMessage& cmp) const;
@@ -113,16 +155,51 @@ private:
     StatusCodeAndMessage::Type type;
 };
 
+/*------------Definition of FileDescriptor--------------*/
+class FileDescriptor{ //打开的文件，析构时关闭
+public:
+    explicit FileDescriptor(int fd);
+    ~FileDescriptor();
+    FileDescriptor(const FileDescriptor&)=delete;
+    FileDescriptor& operator=(const FileDescriptor&)=delete;
+    int get() const;
+
+private:
+    int fd;
+};
+
+/*------------Definition of BodySource--------------*/
+class BodySource{ //边读边发的Body数据来源，例如反向代理的上游响应
+public:
+    virtual ~BodySource();
+    virtual size_t read(char* buf, const size_t& len)=0; //读出不超过len字节，返回0表示读完了，出错抛出异常
+};
+
 /*------------Definition of Body--------------*/
-class Body{ //请求体类
+class Body{ //请求体类，本身不持有数据（除非数据来自文件缓存），拷贝开销很小
 public:
-    Body(const std::shared_ptr<std::string> type, const std::shared_ptr<std::vector<unsigned char>> content);
-    const std::shared_ptr<std::string> getType() const; //获取内容的Content-Type
-    const std::shared_ptr<std::vector<unsigned char>> getContent() const; //获取Body的数据
+    Body();
+    Body(const std::string_view& type, const std::string_view& content); //content需要在arena中或者是静态数据
+    Body(const std::string_view& type, const std::shared_ptr<const std::vector<unsigned char>> sp_content); //共享文件缓存中的数据
+    Body(const std::string_view& type, const std::shared_ptr<const FileDescriptor> sp_file, const size_t& size); //不缓存的大文件，发送时用sendfile
+    Body(const std::string_view& type, const std::shared_ptr<BodySource> sp_source, const size_t& size=UNKNOWN_BODY_SIZE); //发送时才从sp_source中读出数据
+    std::string_view getType() const; //获取内容的Content-Type（不含charset）
+    bool isText() const; //Content-Type是否为文本类型
+    std::string_view getContent() const; //获取Body的数据，文件Body返回空
+    bool isFile() const; //数据是否在文件中而不在内存中
+    bool isOwned() const; //数据是否由Body自己持有（文件缓存或者文件），拷贝后可以脱离请求单独使用
+    int getFileDescriptor() const; //不是文件Body返回-1
+    bool isStream() const; //数据是否要从BodySource中读出
+    BodySource* getSource() const; //不是流式Body返回nullptr
+    size_t getSize() const; //数据的字节数，流式Body可能是UNKNOWN_BODY_SIZE
 
 private:
-    std::shared_ptr<std::string> sp_type;
-    std::shared_ptr<std::vector<unsigned char>> sp_content;
+    std::string_view type;
+    std::string_view content;
+    std::shared_ptr<const std::vector<unsigned char>> sp_owner; //保证文件缓存被替换后数据依然有效
+    std::shared_ptr<const FileDescriptor> sp_file;
+    std::shared_ptr<BodySource> sp_source;
+    size_t size; //文件和流式Body的长度
 };
 
 /*------------Definition of HttpException--------------*/
@@ -131,143 +208,228 @@ public:
     HttpException(const StatusCodeAndMessage::Type& type);
     virtual const char* what() const throw();
 
-    const std::shared_ptr<StatusCodeAndMessage> getStatusCodeAndMessage() const;
+    const StatusCodeAndMessage& getStatusCodeAndMessage() const;
 
 private:
-    const std::shared_ptr<StatusCodeAndMessage> sp_status_code_and_msg;
+    StatusCodeAndMessage status_code_and_msg;
+};
+
+/*------------Definition of Headers--------------*/
+class Headers{ //请求头和响应头，扁平存储，键统一为小写
+public:
+    struct Field{
+        std::string_view key;
+        std::string_view value;
+    };
+    Headers(::utils::Arena& arena);
+
+    void set(const std::string_view& key, const std::string_view& value); //key必须是小写，key和value必须在arena中或者是静态字符串
+    void add(const std::string_view& key, const std::string_view& value); //和set一样，但不替换同名的头部，用于可以重复的头部（如set-cookie）
+    void remove(const std::string_view& key); //删除所有同名的头部，key必须是小写
+    const std::string_view* get(const std::string_view& key) const; //不存在返回nullptr，返回的指针在下一次set前有效
+    void clear();
+    size_t size() const;
+    const Field* begin() const;
+    const Field* end() const;
+
+private:
+    ::utils::SmallVector<Field,24> fields;
+};
+
+/*------------Definition of CancelToken--------------*/
+class CancelToken{ //一个请求的取消信号：客户端断开了连接或者超过了截止时间，处理函数和发送body时检查，被取消的请求马上放弃，工作线程去处理别的连接
+public:
+    CancelToken();
+
+    void start(const int& fd, const int64_t& timeout_ms); //开始处理一个新请求，fd是客户端连接（-1表示不检查），timeout_ms为0表示没有截止时间
+    void startResponse(); //响应头要写出去了，之后客户端只关闭写方向（shutdown(SHUT_WR)，HTTP/1.1允许）不再算取消，只有连接断开才算
+    bool isPeerClosed() const; //检查一次不等待：响应开始前用POLLRDHUP检查客户端是否关闭了连接，开始后只检查POLLHUP和POLLERR
+    short pollEvents() const; //和客户端连接一起poll时要监听的事件，POLLHUP和POLLERR不用监听也会报告
+    bool isExpired() const;
+    bool isCancelled() const;
+    void check() const; //客户端断开抛出runtime_error（连接直接关闭），超时抛出504
+    int getFd() const;
+    int waitMs(const int& timeout_ms) const; //等待上游时最多等多久：不超过timeout_ms和剩下的时间
+
+private:
+    int fd;
+    std::chrono::steady_clock::time_point deadline;
+    bool has_deadline;
+    bool is_responding;
+    mutable bool is_peer_closed; //断开了就不会再恢复，不用再检查
 };
 
 /*------------Definition of Request--------------*/
-class Request { //请求类用于表示HTTP请求
+class Request { //请求类用于表示HTTP请求，所有字符串都存放在arena中
 public:
-    Request();
+    Request(::utils::Arena& arena);
 
-    void decode(const std::shared_ptr<std::string> str); // 将字符串解析为Request对象
-    const std::shared_ptr<std::string> encode(); //将Request对象编码为字符串
+    void decode(const std::string_view& str); // 将字符串解析为Request对象
+    static size_t completeLength(const std::string_view& str); //str开头第一个完整请求的长度，不完整返回0，边界无法确定（如带transfer-encoding）时抛出异常
+    std::string_view encode() const; //将Request对象编码为字符串
+    std::string_view encodeHead() const; //只编码请求行和请求头，body另外发送可以避免拷贝
+    void clear(); //复用该对象前调用，之后arena才可以reset
 
     void setMethod(const Method::Type& type);
-    const std::shared_ptr<Method> getMethod() const;
-    void setPath(const std::shared_ptr<std::string> path);
-    const std::shared_ptr<std::string> getPath() const;
+    const Method& getMethod() const;
+    void setPath(const std::string_view& path);
+    std::string_view getPath() const;
     void setVersion(const Version::Type& type);
-    const std::shared_ptr<Version> getVersion() const;
-    void setHeader(const std::shared_ptr<std::string> key,const std::shared_ptr<std::string> value);
-    const std::shared_ptr<std::string> getHeader(const std::shared_ptr<std::string> key) const;
-    void setBody(const std::shared_ptr<Body> body);
-    const std::shared_ptr<Body> getBody() const;
+    const Version& getVersion() const;
+    void setHeader(const std::string_view& key,const std::string_view& value);
+    void removeHeader(const std::string_view& key); //key必须是小写
+    const std::string_view* getHeader(const std::string_view& key) const;
+    const Headers& getHeaders() const;
+    void setBody(const Body& body);
+    const Body* getBody() const;
+    ::utils::Arena& getArena() const;
+    void setCancelToken(const CancelToken* p_cancel);
+    const CancelToken* getCancelToken() const; //可能是nullptr（例如HTTP/2的请求），调用者要检查
 
 private:
-    static std::tuple<std::string,std::string,std::string> parseInitiaLine(const std::string& line); //解析http请求的初始化
-    static std::string trimWhitespace(const std::string& str); //消除前导和后导不可见字符
-    static std::pair<std::string,std::string> parseKeyValuePairLine(const std::string& line); //解析一行键值对
+    static std::tuple<std::string_view,std::string_view,std::string_view> parseInitiaLine(const std::string_view& line); //解析http请求的初始化
+    static std::string_view trimWhitespace(const std::string_view& str); //消除前导和后导不可见字符
+    static std::pair<std::string_view,std::string_view> parseKeyValuePairLine(const std::string_view& line); //解析一行键值对
 
 private:
-    std::shared_ptr<Method> sp_method;
-    std::shared_ptr<std::string> sp_path;
-    std::shared_ptr<Version> sp_version;
-    std::shared_ptr<std::unordered_map<std::string,std::shared_ptr<std::string>>> sp_headers;
-    std::shared_ptr<Body> sp_body;
-
+    ::utils::Arena* p_arena;
+    Method method;
+    std::string_view path;
+    Version version;
+    Headers headers;
+    Body body;
+    bool has_body;
+    const CancelToken* p_cancel;
 };
 
 /*------------Definition of Response--------------*/
-class Response { //响应类用于表示HTTP响应
+class Response { //响应类用于表示HTTP响应，所有字符串都存放在arena中
 public:
-    Response();
+    Response(::utils::Arena& arena);
 
-    const std::shared_ptr<std::string> encode(); //将Response对象编码为字符串
+    std::string_view encodeHead() const; //将状态行和响应头编码为字符串，body另外发送可以避免拷贝
+    std::string_view encode() const; //将Response对象编码为字符串
+    void decodeHead(const std::string_view& str); //解析状态行和响应头，body由调用者根据头部自己读取
+    static size_t headLength(const std::string_view& str); //str开头的状态行和响应头（包括空行）的长度，不完整返回0
+    void clear(); //复用该对象前调用，之后arena才可以reset
 
     void setVersion(const Version& version);
-    const std::shared_ptr<Version> getVersion() const;
-    void setStatusCodeAndMessage(const std::shared_ptr<StatusCodeAndMessage> status_code_and_msg);
-    const std::shared_ptr<StatusCodeAndMessage> getStatusCodeAndMessage() const;
-    void setHeader(const std::shared_ptr<std::string> key,const std::shared_ptr<std::string> value);
-    const std::shared_ptr<std::string> getHeader(const std::shared_ptr<std::string> key) const;
-    void setBody(const std::shared_ptr<Body> body);
-    const std::shared_ptr<Body> getBody() const;
+    const Version& getVersion() const;
+    void setStatusCodeAndMessage(const StatusCodeAndMessage& status_code_and_msg);
+    const StatusCodeAndMessage& getStatusCodeAndMessage() const;
+    void setHeader(const std::string_view& key,const std::string_view& value);
+    void addHeader(const std::string_view& key,const std::string_view& value); //不替换同名的头部
+    const std::string_view* getHeader(const std::string_view& key) const;
+    const Headers& getHeaders() const;
+    void setBody(const Body& body);
+    const Body* getBody() const;
+    ::utils::Arena& getArena() const;
+
+    void quickBuild(const StatusCodeAndMessage& status_code_and_msg); //用状态码快速构建Response
+
+private:
+    ::utils::Arena* p_arena;
+    Version version;
+    StatusCodeAndMessage status_code_and_msg;
+    Headers headers;
+    Body body;
+    bool has_body;
+};
+
+/*------------Definition of Exchange--------------*/
+struct Exchange{ //一次请求响应，每个请求都有自己的arena，响应发送完之前都要保留
+    ::utils::Arena arena;
+    Request request;
+    Response response;
+    CancelToken cancel; //每个请求开始处理时由serve设置
+    Exchange():request(arena),response(arena){
+        this->request.setCancelToken(&this->cancel);
+    }
+    void clear(){
+        this->request.clear();
+        this->response.clear();
+        this->arena.reset();
+    }
+};
 
+/*------------Definition of MemoryBudget--------------*/
+class MemoryBudget{ //缓冲的响应数据共用的字节预算，每个响应在分配之前先预留，内存释放时归还
 public:
-    static std::shared_ptr<Response> quickBuild(const std::shared_ptr<StatusCodeAndMessage> status_code_and_msg); //用状态码快速构建一个Response对象
+    MemoryBudget(const size_t& limit);
+
+    bool reserve(const size_t& bytes); //预算不够返回false，调用者改为不经过内存的发送方式；大响应不能用留给小响应的那一份
+    void release(const size_t& bytes);
+    void appendStats(std::string& out) const;
 
 private:
-    std::shared_ptr<Version> sp_version;
-    std::shared_ptr<StatusCodeAndMessage> sp_status_code_and_msg;
-    std::shared_ptr<std::unordered_map<std::string,std::shared_ptr<std::string>>> sp_headers;
-    std::shared_ptr<Body> sp_body;
-    
+    const size_t limit;
+    const size_t small_reserved; //只有小响应能用的部分
+    std::atomic<size_t> used;
+    std::atomic<size_t> max_used; //高水位
+    std::atomic<size_t> reservations;
+    std::atomic<size_t> rejected; //预算不够改为流式发送的次数
 };
 
 /*------------Definition of FileSystem--------------*/
-class FileSystem{ //文件系统
+class FileSystem{ //文件系统，带有线程安全的文件缓存，整个服务共用一个
 public:
-    FileSystem(const std::shared_ptr<std::string> file_root);
+    FileSystem(const std::string_view& file_root);
     
-    const std::shared_ptr<Body> read(const std::shared_ptr<std::string> file_name); //读取文件的内容包装成一个Body
+    Body read(const std::string_view& file_name); //读取文件的内容包装成一个Body
+    size_t warm(); //把目录下的小文件预先读入缓存，直到缓存满为止，返回读入的文件数
+    void appendStats(std::string& out) const; //缓存和合并读取的统计，每行一个"名字 值"
+    std::string_view getMimeType(const std::string_view& file_name) const; //根据后缀获取Content-Type
+    void setMemoryBudget(std::shared_ptr<MemoryBudget> sp_budget); //不进缓存的文件读入内存前要先预留，预算不够时和大文件一样用sendfile发送
 
 private:
-    bool isAccessPermitted(const std::shared_ptr<std::string> file_name) const; //判断是否escape文件目录
+    struct File{ //缓存的文件
+        std::string_view type;
+        std::shared_ptr<const std::vector<unsigned char>> sp_content;
+        struct timespec mtime; //用于判断文件是否被修改
+        off_t size;
+    };
+    struct Load{ //正在进行的一次文件读取，同一个文件并发的缓存未命中都等它的结果
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool is_done=false;
+        std::shared_ptr<const std::vector<unsigned char>> sp_content;
+        std::exception_ptr error; //读取失败时等待者抛出同样的异常
+    };
+    std::shared_ptr<const std::vector<unsigned char>> load(const char* path, const std::string_view& file_name, const struct stat& st, const std::string_view& type); //读入文件并放入缓存，放不进缓存又没有预算时返回nullptr
+    Body open(const char* path, const std::string_view& type, const off_t& size); //不读入内存，发送时sendfile
+    bool isAccessPermitted(const std::string_view& file_name) const; //判断是否escape文件目录
 
 private:
-    std::shared_ptr<std::string> sp_file_root;
-    std::unordered_map<std::string,std::string> mime_types{
-        {"css", "text/css"},
-        {"csv", "text/csv"},
-        {"txt", "text/plain"},
-        {"vtt", "text/vtt"},
-        {"html", "text/html"},
-        {"htm", "text/html"},
-        {"apng", "image/apng"},
-        {"avif", "image/avif"},
-        {"bmp", "image/bmp"},
-        {"gif", "image/gif"},
-        {"png", "image/png"},
-        {"svg", "image/svg+xml"},
-        {"webp", "image/webp"},
-        {"ico", "image/x-icon"},
-        {"tif", "image/tiff"},
-        {"tiff", "image/tiff"},
-        {"jpeg", "image/jpeg"},
-        {"jpg", "image/jpeg"},
-        {"mp4", "video/mp4"},
-        {"mpeg", "video/mpeg"},
-        {"webm", "video/webm"},
-        {"mp3", "audio/mp3"},
-        {"mpga", "audio/mpeg"},
-        {"weba", "audio/webm"},
-        {"wav", "audio/wave"},
-        {"otf", "font/otf"},
-        {"ttf", "font/ttf"},
-        {"woff", "font/woff"},
-        {"woff2", "font/woff2"},
-        {"7z", "application/x-7z-compressed"},
-        {"atom", "application/atom+xml"},
-        {"pdf", "application/pdf"},
-        {"mjs", "application/javascript"},
-        {"js", "application/javascript"},
-        {"json", "application/json"},
-        {"rss", "application/rss+xml"},
-        {"tar", "application/x-tar"},
-        {"xhtml", "application/xhtml+xml"},
-        {"xht", "application/xhtml+xml"},
-        {"xslt", "application/xslt+xml"},
-        {"xml", "application/xml"},
-        {"gz", "application/gzip"},
-        {"zip", "application/zip"},
-        {"wasm", "application/wasm"}
-    };
+    std::string file_root;
+    std::shared_mutex cache_mtx;
+    std::map<std::string,File,std::less<>> cache; //std::less<>使得可以直接用string_view查找
+    size_t cache_size; //缓存的总字节数
+    std::mutex loads_mtx;
+    std::map<std::string,std::shared_ptr<Load>,std::less<>> loads; //正在读取的文件
+    std::atomic<size_t> hits; //缓存命中次数
+    std::atomic<size_t> reads; //实际读文件的次数
+    std::atomic<size_t> coalesced; //等待别人读取而没有自己读文件的次数
+    std::atomic<size_t> waiting; //正在等待的请求数
+    std::atomic<size_t> max_waiting;
+    std::shared_ptr<MemoryBudget> sp_budget;
 };
 
 /*------------Definition of Rule--------------*/
 class Rule{ //规则类
 public:
-    Rule(const std::shared_ptr<std::string> sp_rule_str);
+    Rule(const std::shared_ptr<std::string> sp_rule_str); //"allow from 192.168.0.0/16"，或者用于Unix socket的"allow from uid:1000"、"deny from gid:33"
     bool isAllow() const; //判断基于该规则是否允许访问
     bool isMatch(const std::shared_ptr<std::string> sp_ip) const; //判断该IP是否匹配到该规则
+    bool isMatch(const struct ucred& cred) const; //判断Unix socket对端进程的凭据是否匹配到该规则
+    bool isCredential() const; //是否是uid/gid规则
 
 private:
     enum class Action{
         ALLOW,DENY
     };
+    enum class Type{
+        IP,UID,GID
+    };
     struct IPNetwork {
         uint32_t network;
         uint32_t mask;
@@ -275,6 +437,8 @@ private:
 
     IPNetwork network;
     Action action;
+    Type type;
+    uint32_t id; //uid或者gid
 };
 
 /*------------Definition of IPAccessControl--------------*/
@@ -282,33 +446,182 @@ class IPAccessControl { //IP访问控制类
 public:
     IPAccessControl(const std::shared_ptr<std::string> sp_rule_file);
     bool isAllow(const std::shared_ptr<std::string> sp_ip) const; //判断该IP是否可以访问
+    bool isAllow(const struct ucred& cred) const; //判断Unix socket的对端是否可以访问，IP规则对它不起作用
 
 private:
     std::vector<Rule> rules;
+    bool has_credential_rules; //没有uid/gid规则时只允许和服务同一个用户以及root
+};
+
+/*------------Definition of Channel--------------*/
+class Channel{ //客户端连接的读写，明文连接直接读写socket，析构时关闭连接
+public:
+    explicit Channel(int client_fd);
+    virtual ~Channel();
+    Channel(const Channel&)=delete;
+    Channel& operator=(const Channel&)=delete;
+
+    int getFd() const;
+    void setPeerAddress(const uint32_t& ip);
+    uint32_t getPeerAddress() const; //对端的IPv4地址，网络字节序，不知道或者是Unix域socket时为0
+    virtual bool waitReadable(const int& timeout_sec); //等待数据可读，超时返回false
+    virtual ssize_t read(char* buf, const size_t& len); //返回值和read一样，0表示对端关闭
+    virtual void writeAll(struct iovec* iov, const size_t& iovcnt, const bool& is_more=false); //is_more表示后面马上还有数据要写
+    virtual void sendFile(const int& file_fd, off_t offset, size_t len); //把文件的一段写到连接中
+    void enableCork(); //之后cork/uncork才生效，只用于TCP连接
+    void cork(); //之后写的数据攒成完整的报文段再发，例如响应头和sendfile发送的文件
+    void uncork(); //把攒着的数据发出去
+
+protected:
+    int client_fd;
+    bool is_cork_enabled;
+    bool is_corked;
+    uint32_t peer_ip;
+};
+
+class TlsContext;
+class HotRestart;
+class TransferLoop;
+class Tracer;
+class HeavyHitters;
+class Profiler;
+struct Transfer;
+
+/*------------Definition of SocketOptions--------------*/
+struct SocketOptions{ //监听socket和TCP连接的选项，每一项都可以单独关掉，用来对比效果
+    bool is_reuse_addr=true; //SO_REUSEADDR：重启时不用等TIME_WAIT的连接消失就能bind
+    int defer_accept_sec=READ_TIMEOUT_SEC; //TCP_DEFER_ACCEPT：收到请求数据才唤醒accept，0表示不开启
+    int fastopen_queue_len=TCP_FASTOPEN_QUEUE_LEN; //TCP_FASTOPEN：请求可以跟着SYN一起到达，0表示不开启，还需要sysctl net.ipv4.tcp_fastopen打开服务端
+    bool is_nodelay=true; //TCP_NODELAY：小响应不等前一个报文段的ACK
+    bool is_cork=true; //TCP_CORK：响应头和文件拼成完整的报文段，文件的最后一段也不单独发
+
+    bool set(const std::string_view& name, const std::string_view& value); //按名字（reuseaddr、defer_accept、fastopen、nodelay、cork）设置，不认识返回false
+    void applyListener(int fd) const; //bind之前调用
+    void applyConnection(int fd) const; //accept之后调用
+};
+
+/*------------Definition of AccessLog--------------*/
+class AccessLog{ //Common Log Format，行尾再加连接编号、请求开始的微秒时间戳和处理耗时（微秒），replay按这些回放原来的节奏和连接复用
+public:
+    explicit AccessLog(const std::string& path); //追加写，打不开抛出异常
+    ~AccessLog();
+    AccessLog(const AccessLog&)=delete;
+    AccessLog& operator=(const AccessLog&)=delete;
+
+    void write(const uint32_t& ip, const uint64_t& connection, const Request& request, const Response& response, const int64_t& start_us, const int64_t& end_us);
+
+private:
+    std::mutex mtx;
+    FILE* p_file;
+    int64_t flushed_us; //上次刷到文件的时间，距离上次超过一秒才刷，空闲时最后几行留在缓冲区里，直到下一个请求或者退出
+};
+
+/*------------Definition of Options--------------*/
+struct Options{ //服务的启动参数
+    unsigned short port=0;
+    std::string doc_root;
+    size_t pool_size=6; //线程池最少的线程数
+    size_t pool_max_size=0; //排队太久时线程池最多增长到的线程数，不大于pool_size表示线程数固定
+    unsigned short tls_port=0; //HTTPS端口，0表示不开启
+    std::string cert_file; //PEM格式的证书链
+    std::string key_file; //PEM格式的私钥
+    std::vector<std::pair<std::string,std::string>> proxy_routes; //反向代理的路径前缀和上游地址（多个用逗号分隔）
+    bool is_warm_cache=false; //开始accept之前预先读入文件缓存，热重启时新进程不会从冷缓存开始
+    size_t limit_rate=0; //每个连接发送大响应的速率（字节每秒），0表示不限
+    size_t limit_rate_after=0; //每个大响应先不限速发送的字节数
+    size_t limit_rate_global=0; //所有大响应加起来的速率
+    std::string stats_path; //统计页面的路径，空表示不开启
+    std::string unix_path; //Unix域socket的路径，@开头表示抽象命名空间，空表示不开启
+    std::vector<std::pair<std::string,std::string>> fastcgi_routes; //FastCGI的路径前缀和外部worker的地址（host:port或unix:path）
+    std::vector<std::tuple<std::string,std::string,size_t>> fastcgi_spawns; //FastCGI的路径前缀、由服务启动并监管的worker程序和进程数
+    SocketOptions socket_options;
+    std::string trace_path; //导出trace的路径，空表示不开启跟踪
+    double trace_sample_rate=0; //采样的请求比例，最慢的请求不论是否采样都会保留
+    bool is_hitters=false; //统计最活跃的IP和路径，显示在统计页面上
+    size_t auto_deny_requests=0; //一分钟内请求数达到这么多的IP自动禁止一段时间，0表示不开启
+    size_t auto_deny_sec=0;
+    std::string profile_path; //按需采样调用栈的路径，空表示不开启
+    std::string access_log_path; //访问日志的文件，空表示不记录
+    size_t request_timeout_ms=0; //请求的默认截止时间，0表示没有，请求头可以另外指定
+    size_t memory_budget=MEMORY_BUDGET_DEFAULT; //缓冲的响应数据的总字节数，0表示不限
 };
 
 /*------------Definition of Server--------------*/
+using MessageCallback=std::function<void(httpd::Request&, httpd::Response&)>; //消息回调，填充response即可
+using StatsCallback=std::function<void(std::string&)>; //把统计信息按"名字 值"每行一个追加到字符串后面
+
 class Server{ //服务类
 public:
-    Server(const int port, const size_t pool_size ,const std::shared_ptr<std::string> sp_rule_file);
+    Server(const int port, const size_t pool_size ,const std::shared_ptr<std::string> sp_rule_file, const SocketOptions& socket_options=SocketOptions());
     ~Server();
 
-    void setMessageCallback(std::function<std::shared_ptr<httpd::Response>(const std::shared_ptr<httpd::Request>)> callback); //设置一个消息回调函数
-    void run(); //服务运行
+    void setMessageCallback(MessageCallback callback); //设置一个消息回调函数
+    void setStatsPath(const std::string& path); //访问这个路径返回统计信息，空表示不开启
+    void addStatsCallback(StatsCallback callback); //统计页面的一部分
+    void setTracer(std::shared_ptr<Tracer> sp_tracer, const std::string& path); //记录每个请求各阶段的耗时，访问path导出trace
+    void listenTls(const int port, const std::shared_ptr<TlsContext> sp_tls_context); //再监听一个HTTPS端口
+    void listenUnix(const std::string& path); //再监听一个Unix域socket，@开头表示抽象命名空间，访问控制按对端进程的uid/gid
+    void setRateLimit(const size_t& rate, const size_t& rate_after, const size_t& global_rate); //大响应的限速，每秒字节数，0表示不限
+    void setHeavyHitters(std::shared_ptr<HeavyHitters> sp_hitters); //每个连接和请求都计数，被它临时禁止的IP和访问控制规则禁止的一样回复403
+    void setProfiler(std::shared_ptr<Profiler> sp_profiler, const std::string& path); //访问"path?seconds=N&mode=cpu|wall"采样N秒，返回折叠栈
+    void setAccessLog(std::shared_ptr<AccessLog> sp_access_log); //HTTP/1.x的每个请求在响应发出后记一行，HTTP/2的请求不记
+    void setRequestTimeout(const size_t& timeout_ms); //请求的默认截止时间，超过时正在等的上游被放弃，回复504
+    void setPoolMaxSize(const size_t& num); //线程池可以增长到num个线程，请求在线程池里排队太久或者线程都卡住时自动增加，空闲时再减回来
+    void run(); //服务运行，热重启时等已有的连接处理完后返回
 
 private:
-    void task(int client_fd);
+    enum class Listener{ //连接是从哪个监听socket来的
+        TCP,
+        TLS,
+        UNIX
+    };
+
+    int listenOn(const int port) const;
+    int listenOrInherit(const int port); //热重启启动的进程优先使用旧进程交过来的监听socket
+    void drain(); //新进程已经接手，停止accept，等待已有的连接处理完
+    void task(int client_fd, const Listener& listener, const int64_t& accepted); //accepted是accept的时间，不跟踪时为0
+    void serve(std::unique_ptr<Channel> up_channel, const bool& is_tls, std::vector<char> buf_in, size_t buf_len, const int64_t& accepted, const int64_t& started); //处理连接上的请求，buf_in中是已经读到的数据；started是工作线程开始处理连接的时间
+    void resume(std::shared_ptr<Transfer> sp_transfer); //大响应发送完了，继续处理这个连接
+    void finishTransfer(std::shared_ptr<Transfer> sp_transfer, const bool& is_ok); //在事件循环线程中调用
+    bool waitRequest(Channel& channel, const bool& is_idle); //等待连接上的数据，超时或者热重启时连接空闲返回false
+    bool decodeRequest(Exchange& exchange, const std::string_view& raw); //解析请求，出错时构建错误响应并返回false
+    int64_t requestTimeout(const Request& request) const; //请求头指定的截止时间优先，否则用默认的
+    void dispatch(Request& request, Response& response); //调用回调处理已经解析好的请求，出错时构建错误响应
+    void serveHttp2(Channel& channel, const std::string_view& buffered, std::unique_ptr<Exchange> up_upgrade); //把连接交给HTTP/2处理
+    static void sendResponses(Channel& channel, const std::vector<std::unique_ptr<Exchange>>& exchanges, const size_t& num, const bool& is_skip_last_body=false); //用一次writev把所有响应头和body发出去，文件body用sendfile
+    static void sendResponse(Channel& channel, const Response& response);
 
 private:
     int server_fd;
+    int tls_fd; //HTTPS监听的socket，-1表示没有
+    int unix_fd; //Unix域socket，-1表示没有
+    std::string unix_path;
+    SocketOptions socket_options;
+    std::unique_ptr<HotRestart> up_hot_restart;
+    std::atomic<size_t> active_connections; //已经accept还没有处理完的连接数
+    std::atomic_bool is_draining; //新进程已经接手，空闲的连接直接关闭
+    std::shared_ptr<TlsContext> sp_tls_context;
     std::shared_ptr<IPAccessControl> sp_ip_access_control;
     std::shared_ptr<::utils::ThreadPool> sp_pool;
-    std::function<std::shared_ptr<httpd::Response>(const std::shared_ptr<httpd::Request>)> message_callback;
+    std::unique_ptr<TransferLoop> up_transfer_loop; //发送大响应，要在线程池之前析构
+    MessageCallback message_callback;
+    std::string stats_path;
+    std::vector<StatsCallback> stats_callbacks;
+    std::shared_ptr<Tracer> sp_tracer;
+    std::string trace_path;
+    std::shared_ptr<HeavyHitters> sp_hitters;
+    std::shared_ptr<Profiler> sp_profiler;
+    std::string profile_path;
+    std::shared_ptr<AccessLog> sp_access_log;
+    std::atomic<uint64_t> next_connection_id; //访问日志里区分连接
+    size_t request_timeout_ms;
+    std::atomic<size_t> cancelled_requests; //客户端断开或者超时而放弃的请求数
 };
 
 
 } // namespace httpd
 
 void start_httpd(unsigned short port, std::string doc_root, size_t pool_size=6);
+void start_httpd(const httpd::Options& options);
 
 #endif // HTTPD_H
\ No newline at end of file
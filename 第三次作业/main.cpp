@@ -9,7 +9,20 @@ using namespace std;
 
 void usage(char * argv0)
 {
-	cerr << "Usage: " << argv0 << " listen_port docroot_dir" << endl;
+	cerr << "Usage: " << argv0 << " listen_port docroot_dir [pool pool_size] [pool_max pool_max_size] [tls tls_port cert_file key_file] [unix socket_path] [tcp option value] [proxy path_prefix upstream[,upstream...]] [fastcgi path_prefix address] [fastcgi_spawn path_prefix program workers] [warm] [limit_rate rate] [limit_rate_after size] [limit_rate_global rate] [stats path] [trace path sample_rate] [hitters] [auto_deny requests_per_minute seconds] [profile path] [access_log file] [memory_budget size] [request_timeout ms]" << endl;
+}
+
+//解析带k/m/g后缀的字节数，比如512k、10m
+size_t parse_size(const char * str)
+{
+	char * end = NULL;
+	size_t size = strtoull(str, &end, 10);
+	switch (*end) {
+	case 'k': case 'K': return size << 10;
+	case 'm': case 'M': return size << 20;
+	case 'g': case 'G': return size << 30;
+	default: return size;
+	}
 }
 
 int main(int argc, char *argv[])
@@ -26,22 +39,124 @@ int main(int argc, char *argv[])
 		return 2;
 	}
 
-	if (port <= 0 || port > USHRT_MAX) {
+	if (port < 0 || port > USHRT_MAX) { //0表示不监听TCP端口，只用Unix域socket
 		cerr << "Invalid port: " << port << endl;
 		return 3;
 	}
 
-	string doc_root = argv[2];
+	httpd::Options options;
+	options.port = port;
+	options.doc_root = argv[2];
 
-	if (argc==5) {
-		std::string is_pool=argv[3];
-		if ("pool"==is_pool) {
-			size_t pool_size=strtol(argv[4],NULL,10);
-			start_httpd(port, doc_root, pool_size);
+	//可选参数：pool 线程数；pool_max 线程池自动增长的上限；tls 端口 证书文件 私钥文件；proxy 路径前缀 上游地址（host:port或unix:path），可以有多个；fastcgi 路径前缀 外部worker地址；fastcgi_spawn 路径前缀 worker程序 进程数；unix 路径（@开头为抽象命名空间）；tcp 选项名 值（reuseaddr、defer_accept、fastopen、nodelay、cork，0表示关闭）；warm 启动时预读文件缓存；limit_rate系列 大响应的限速；stats 统计页面的路径；trace 导出trace的路径 采样比例（0到1，最慢的请求总是保留）；hitters 在统计页面上列出最活跃的IP和路径；auto_deny 一分钟内的请求数 禁止的秒数；profile 按需采样调用栈的路径；access_log 访问日志文件，可以用replay回放；memory_budget 缓冲的响应数据的总大小（0表示不限），超过时改为流式发送；request_timeout 请求的默认截止时间（毫秒），请求头x-request-timeout-ms可以另外指定
+	for (int i = 3; i < argc; ) {
+		string option = argv[i];
+		if ("pool" == option && i + 1 < argc) {
+			options.pool_size = strtol(argv[i + 1], NULL, 10);
+			i += 2;
+		}
+		else if ("pool_max" == option && i + 1 < argc) {
+			options.pool_max_size = strtol(argv[i + 1], NULL, 10);
+			i += 2;
+		}
+		else if ("tls" == option && i + 3 < argc) {
+			long int tls_port = strtol(argv[i + 1], NULL, 10);
+			if (tls_port <= 0 || tls_port > USHRT_MAX) {
+				cerr << "Invalid port: " << tls_port << endl;
+				return 3;
+			}
+			options.tls_port = tls_port;
+			options.cert_file = argv[i + 2];
+			options.key_file = argv[i + 3];
+			i += 4;
+		}
+		else if ("proxy" == option && i + 2 < argc) {
+			options.proxy_routes.emplace_back(argv[i + 1], argv[i + 2]);
+			i += 3;
+		}
+		else if ("fastcgi" == option && i + 2 < argc) {
+			options.fastcgi_routes.emplace_back(argv[i + 1], argv[i + 2]);
+			i += 3;
+		}
+		else if ("fastcgi_spawn" == option && i + 3 < argc) {
+			options.fastcgi_spawns.emplace_back(argv[i + 1], argv[i + 2], strtol(argv[i + 3], NULL, 10));
+			i += 4;
+		}
+		else if ("unix" == option && i + 1 < argc) {
+			options.unix_path = argv[i + 1];
+			i += 2;
+		}
+		else if ("tcp" == option && i + 2 < argc) {
+			if (!options.socket_options.set(argv[i + 1], argv[i + 2])) {
+				usage(argv[0]);
+				return 1;
+			}
+			i += 3;
+		}
+		else if ("warm" == option) {
+			options.is_warm_cache = true;
+			i += 1;
+		}
+		else if ("hitters" == option) {
+			options.is_hitters = true;
+			i += 1;
+		}
+		else if ("auto_deny" == option && i + 2 < argc) {
+			options.auto_deny_requests = strtol(argv[i + 1], NULL, 10);
+			options.auto_deny_sec = strtol(argv[i + 2], NULL, 10);
+			i += 3;
 		}
-		else start_httpd(port, doc_root);
+		else if ("access_log" == option && i + 1 < argc) {
+			options.access_log_path = argv[i + 1];
+			i += 2;
+		}
+		else if ("profile" == option && i + 1 < argc) {
+			options.profile_path = argv[i + 1];
+			i += 2;
+		}
+		else if ("stats" == option && i + 1 < argc) {
+			options.stats_path = argv[i + 1];
+			i += 2;
+		}
+		else if ("trace" == option && i + 2 < argc) {
+			options.trace_path = argv[i + 1];
+			options.trace_sample_rate = strtod(argv[i + 2], NULL);
+			if (options.trace_sample_rate < 0 || options.trace_sample_rate > 1) {
+				usage(argv[0]);
+				return 1;
+			}
+			i += 3;
+		}
+		else if ("request_timeout" == option && i + 1 < argc) {
+			options.request_timeout_ms = strtoul(argv[i + 1], NULL, 10);
+			i += 2;
+		}
+		else if ("memory_budget" == option && i + 1 < argc) {
+			options.memory_budget = parse_size(argv[i + 1]);
+			i += 2;
+		}
+		else if ("limit_rate" == option && i + 1 < argc) {
+			options.limit_rate = parse_size(argv[i + 1]);
+			i += 2;
+		}
+		else if ("limit_rate_after" == option && i + 1 < argc) {
+			options.limit_rate_after = parse_size(argv[i + 1]);
+			i += 2;
+		}
+		else if ("limit_rate_global" == option && i + 1 < argc) {
+			options.limit_rate_global = parse_size(argv[i + 1]);
+			i += 2;
+		}
+		else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (0 == port && options.unix_path.empty()) {
+		cerr << "Invalid port: " << port << endl;
+		return 3;
 	}
-	else start_httpd(port, doc_root);
+	start_httpd(options);
 
 	return 0;
 }
@@ -0,0 +1,216 @@
+#include "profiler.h"
+#include "httpd.h"
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <dirent.h>
+#include <execinfo.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+
+
+namespace httpd
+{
+
+namespace
+{
+
+struct Sample{ //信号处理函数里写，采样结束后才读
+	bool is_off_cpu;
+	uint8_t depth;
+	void* pcs[PROFILER_MAX_DEPTH]; //pcs[0]是被打断的位置，后面是返回地址
+};
+
+//信号处理函数只能用这些全局变量：缓冲区在采样开始前分配好，处理函数里不分配内存、不加锁
+Sample* p_samples=nullptr;
+std::atomic<bool> is_sampling(false);
+std::atomic<size_t> next_sample(0);
+std::atomic<int> in_handler(0); //正在处理函数里的线程数，降到0之后才能读缓冲区
+
+void onSignal(int /*signo*/, siginfo_t* p_info, void* /*p_context*/){
+	int saved_errno=errno;
+	++in_handler;
+	if (is_sampling.load()){
+		size_t i=next_sample.fetch_add(1);
+		if (i<PROFILER_MAX_SAMPLES){
+			void* pcs[PROFILER_MAX_DEPTH+PROFILER_SKIP_FRAMES];
+			int depth=backtrace(pcs,PROFILER_MAX_DEPTH+PROFILER_SKIP_FRAMES); //libgcc的展开器，构造时已经预先加载了
+			Sample& sample=p_samples[i];
+			sample.depth=std::max(0,depth-PROFILER_SKIP_FRAMES);
+			memcpy(sample.pcs,pcs+PROFILER_SKIP_FRAMES,sample.depth*sizeof(void*));
+			sample.is_off_cpu=SI_QUEUE==p_info->si_code && 0!=p_info->si_value.sival_int; //WALL模式发信号时带上了线程状态
+		}
+	}
+	--in_handler;
+	errno=saved_errno;
+}
+
+std::string symbolize(void* pc){ //优先用动态符号表里的函数名（需要-rdynamic），没有的话输出"模块+偏移"，可以用addr2line再查
+	Dl_info info;
+	if (0==dladdr(pc,&info) || nullptr==info.dli_fname) return "[unknown]";
+	if (nullptr!=info.dli_sname){
+		int status=0;
+		char* p_demangled=abi::__cxa_demangle(info.dli_sname,nullptr,nullptr,&status);
+		std::string name=0==status? p_demangled:info.dli_sname;
+		free(p_demangled);
+		size_t end=name.size(); //去掉参数列表，模板参数里的括号不动
+		if (name.size()>6 && 0==name.compare(name.size()-6,6," const")) end-=6;
+		if (end>0 && ')'==name[end-1]){
+			int depth=0;
+			for (size_t i=end;i>0;--i){
+				if (')'==name[i-1]) ++depth;
+				else if ('('==name[i-1] && 0==--depth){
+					name.resize(i-1);
+					break;
+				}
+			}
+		}
+		std::replace(name.begin(),name.end(),';',':'); //分号是折叠栈的分隔符
+		return name;
+	}
+	const char* p_module=strrchr(info.dli_fname,'/');
+	char buf[32];
+	snprintf(buf,sizeof(buf),"+0x%lx",static_cast<unsigned long>(static_cast<char*>(pc)-static_cast<char*>(info.dli_fbase)));
+	return std::string("[")+(nullptr!=p_module? p_module+1:info.dli_fname)+buf+"]";
+}
+
+bool isRunning(const pid_t& tid){ //从/proc读线程状态，R表示在CPU上或者等CPU
+	char path[64];
+	snprintf(path,sizeof(path),"/proc/self/task/%d/stat",tid);
+	int fd=open(path,O_RDONLY|O_CLOEXEC);
+	if (fd<0) return false;
+	char buf[512];
+	ssize_t len=::read(fd,buf,sizeof(buf)-1);
+	close(fd);
+	if (len<=0) return false;
+	buf[len]='\0';
+	const char* p=strrchr(buf,')'); //线程名里可能有空格和括号
+	return nullptr!=p && ' '==p[1] && 'R'==p[2];
+}
+
+} // namespace
+
+/*------------implement of Profiler--------------*/
+Profiler::Profiler():runs(0),samples(0),dropped(0){
+	void* pcs[1];
+	backtrace(pcs,1); //第一次调用会dlopen libgcc_s，不能发生在信号处理函数里
+	struct sigaction action;
+	memset(&action,0,sizeof(action));
+	action.sa_sigaction=onSignal;
+	action.sa_flags=SA_SIGINFO|SA_RESTART; //被打断的read、write自动重新开始；select、poll返回EINTR，调用处都要处理
+	sigemptyset(&action.sa_mask);
+	if (0!=sigaction(PROFILER_SIGNAL,&action,nullptr)) throw std::runtime_error("sigaction failed in Profiler::Profiler"); //处理函数一直保留，采样结束后迟到的信号也不会终止进程
+}
+
+std::string Profiler::profile(const Mode& mode, const size_t& seconds){
+	std::unique_lock<std::mutex> lock(this->mtx,std::try_to_lock);
+	if (!lock.owns_lock()) throw HttpException(StatusCodeAndMessage::Type::ServiceUnavailable); //已经有一个采样在进行了
+	std::vector<Sample> buffer(PROFILER_MAX_SAMPLES); //只在采样期间占用内存
+	p_samples=buffer.data();
+	next_sample=0;
+	is_sampling=true;
+	if (Mode::CPU==mode){
+		struct itimerval timer;
+		timer.it_interval.tv_sec=0;
+		timer.it_interval.tv_usec=1000000/PROFILER_HZ;
+		timer.it_value=timer.it_interval;
+		setitimer(ITIMER_PROF,&timer,nullptr);
+		std::this_thread::sleep_for(std::chrono::seconds(seconds)); //调用线程睡眠，不消耗CPU，不会被采到
+		timer.it_interval.tv_usec=0;
+		timer.it_value=timer.it_interval;
+		setitimer(ITIMER_PROF,&timer,nullptr);
+	}
+	else this->sampleWall(seconds);
+	is_sampling=false;
+	while (in_handler>0) std::this_thread::yield(); //等还在处理函数里的线程写完
+	p_samples=nullptr;
+	size_t num=std::min(next_sample.load(),static_cast<size_t>(PROFILER_MAX_SAMPLES));
+	++this->runs;
+	this->samples+=num;
+	this->dropped+=next_sample-num;
+
+	//符号化不在采样路径上：先按返回地址合并相同的栈，每个地址只查一次
+	std::map<std::pair<bool,std::vector<void*>>,size_t> stacks;
+	for (size_t i=0;i<num;++i){
+		const Sample& sample=buffer[i];
+		++stacks[std::make_pair(sample.is_off_cpu,std::vector<void*>(sample.pcs,sample.pcs+sample.depth))];
+	}
+	std::map<void*,std::string> names;
+	std::vector<std::pair<size_t,std::string>> lines;
+	for (const auto& stack:stacks){
+		std::string line=stack.first.first? "off-cpu":"on-cpu";
+		const auto& pcs=stack.first.second;
+		if (PROFILER_MAX_DEPTH==pcs.size()) line+=";[truncated]"; //根部的栈帧丢了，不要和完整的栈混在一起
+		for (size_t i=pcs.size();i>0;--i){ //折叠栈从根开始
+			void* pc=0==i-1? pcs[0]:static_cast<char*>(pcs[i-1])-1; //返回地址减一才落在调用指令上
+			auto it=names.find(pc);
+			if (names.end()==it) it=names.emplace(pc,symbolize(pc)).first;
+			line+=";"+it->second;
+		}
+		lines.emplace_back(stack.second,std::move(line));
+	}
+	std::map<std::string,size_t> folded; //不同地址可能对应同一个函数，按名字再合并一次
+	for (const auto& line:lines) folded[line.second]+=line.first;
+	lines.clear();
+	for (const auto& line:folded) lines.emplace_back(line.second,line.first);
+	std::sort(lines.begin(),lines.end(),[](const auto& a, const auto& b){ return a.first>b.first; });
+	std::string out;
+	for (const auto& line:lines) out+=line.second+" "+std::to_string(line.first)+"\n";
+	return out;
+}
+
+std::string Profiler::profile(const std::string_view& query){
+	Mode mode=Mode::CPU;
+	size_t seconds=PROFILER_DEFAULT_SEC;
+	size_t begin=0;
+	while (begin<query.size()){
+		size_t end=query.find('&',begin);
+		if (query.npos==end) end=query.size();
+		std::string_view param=query.substr(begin,end-begin);
+		begin=end+1;
+		if ("mode=cpu"==param) mode=Mode::CPU;
+		else if ("mode=wall"==param) mode=Mode::WALL;
+		else if (0==param.compare(0,8,"seconds=")){
+			auto res=std::from_chars(param.data()+8,param.data()+param.size(),seconds);
+			if (std::errc()!=res.ec || param.data()+param.size()!=res.ptr || 0==seconds || seconds>PROFILER_MAX_SEC) throw HttpException(StatusCodeAndMessage::Type::BadRequest);
+		}
+		else if (!param.empty()) throw HttpException(StatusCodeAndMessage::Type::BadRequest);
+	}
+	return this->profile(mode,seconds);
+}
+
+void Profiler::appendStats(std::string& out) const{
+	out+="profiler_runs "+std::to_string(this->runs)+"\n";
+	out+="profiler_samples "+std::to_string(this->samples)+"\n";
+	out+="profiler_dropped "+std::to_string(this->dropped)+"\n";
+}
+
+void Profiler::sampleWall(const size_t& seconds){
+	pid_t pid=getpid();
+	pid_t self=static_cast<pid_t>(syscall(SYS_gettid));
+	auto interval=std::chrono::microseconds(1000000/PROFILER_HZ);
+	auto deadline=std::chrono::steady_clock::now()+std::chrono::seconds(seconds);
+	for (auto next=std::chrono::steady_clock::now();next<deadline;next+=interval){
+		std::this_thread::sleep_until(next);
+		DIR* p_dir=opendir("/proc/self/task"); //每次重新列出线程，线程池会增长和收缩
+		if (nullptr==p_dir) continue;
+		for (struct dirent* p_entry=readdir(p_dir);nullptr!=p_entry;p_entry=readdir(p_dir)){
+			pid_t tid=static_cast<pid_t>(strtol(p_entry->d_name,nullptr,10));
+			if (tid<=0 || self==tid) continue;
+			siginfo_t info; //和sigqueue一样带一个值，处理函数据此区分线程是不是阻塞着
+			memset(&info,0,sizeof(info));
+			info.si_signo=PROFILER_SIGNAL;
+			info.si_code=SI_QUEUE;
+			info.si_pid=pid;
+			info.si_uid=getuid();
+			info.si_value.sival_int=isRunning(tid)? 0:1;
+			syscall(SYS_rt_tgsigqueueinfo,pid,tid,PROFILER_SIGNAL,&info); //线程可能刚刚退出，失败了也没关系
+		}
+		closedir(p_dir);
+	}
+}
+
+} // namespace httpd
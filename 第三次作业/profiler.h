@@ -0,0 +1,49 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+#include <string_view>
+#include <mutex>
+#include <atomic>
+#include <signal.h>
+
+#define PROFILER_SIGNAL SIGPROF //采样信号，处理函数里只记录返回地址
+#define PROFILER_HZ 99 //每秒采样次数，避开和定时任务同频
+#define PROFILER_MAX_DEPTH 64 //每个样本最多保留的栈帧数，超过的从根部截断
+#define PROFILER_MAX_SAMPLES 32768 //一次采样最多保留的样本数，更多的丢弃并计数
+#define PROFILER_MAX_SEC 60 //一次最多采样的秒数
+#define PROFILER_DEFAULT_SEC 10
+#define PROFILER_SKIP_FRAMES 2 //信号处理函数自己和内核插入的信号返回帧
+
+namespace httpd
+{
+
+/*------------Definition of Profiler--------------*/
+class Profiler{ //按需采样所有线程的调用栈，输出flamegraph.pl和speedscope都能读的折叠栈（每行"根;...;叶 次数"）
+public:
+    enum class Mode{
+        CPU, //ITIMER_PROF按进程的CPU时间发信号，只采到正在运行的线程
+        WALL //定时给每个线程发信号，阻塞在select、write等系统调用里的线程也会采到，栈根标成off-cpu
+    };
+
+    Profiler(); //安装信号处理函数
+    Profiler(const Profiler&)=delete;
+    Profiler& operator=(const Profiler&)=delete;
+
+    std::string profile(const Mode& mode, const size_t& seconds); //阻塞seconds秒采样，然后在调用线程里符号化；另一个采样在进行时抛出503
+    std::string profile(const std::string_view& query); //query是"seconds=N&mode=cpu|wall"，参数不对抛出400
+    void appendStats(std::string& out) const;
+
+private:
+    void sampleWall(const size_t& seconds); //在调用线程里按PROFILER_HZ给其他线程发信号
+
+private:
+    std::mutex mtx; //同时只能有一个采样
+    std::atomic<size_t> runs;
+    std::atomic<size_t> samples;
+    std::atomic<size_t> dropped; //缓冲区满了丢掉的样本数
+};
+
+} // namespace httpd
+
+#endif // PROFILER_H
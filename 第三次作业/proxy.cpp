@@ -0,0 +1,360 @@
+#include "proxy.h"
+
+
+namespace httpd
+{
+
+namespace
+{
+
+bool isHopByHop(const std::string_view& key){ //逐跳头部只对一个连接有意义，不能转发给客户端
+	return "connection"==key || "keep-alive"==key || "proxy-connection"==key || "transfer-encoding"==key
+		|| "te"==key || "trailer"==key || "upgrade"==key;
+}
+
+void waitReadable(int fd, const CancelToken* p_cancel){ //等待上游的数据，超时抛出异常；同时等客户端断开，请求被取消时马上放弃
+	struct pollfd pfds[2]={{fd,POLLIN,0},{nullptr!=p_cancel? p_cancel->getFd():-1,nullptr!=p_cancel? p_cancel->pollEvents():static_cast<short>(0),0}}; //fd为-1的项poll会忽略
+	while (1){
+		int result=poll(pfds,2,nullptr!=p_cancel? p_cancel->waitMs(PROXY_TIMEOUT_SEC*1000):PROXY_TIMEOUT_SEC*1000);
+		if (result<0 && EINTR==errno) continue;
+		if (result<0) throw std::runtime_error("poll failed in waitReadable");
+		if (0!=pfds[0].revents) return;
+		if (nullptr!=p_cancel) p_cancel->check(); //客户端断开或者到了请求的截止时间
+		if (0==result) throw HttpException(StatusCodeAndMessage::Type::GatewayTimeout);
+	}
+}
+
+ssize_t readSome(int fd, char* buf, const size_t& len, const CancelToken* p_cancel){
+	waitReadable(fd,p_cancel);
+	while (1){
+		ssize_t result=::read(fd,buf,len);
+		if (result<0 && EINTR==errno) continue;
+		if (result<0) throw std::runtime_error("read failed in readSome");
+		return result;
+	}
+}
+
+/*------------Definition of UpstreamStream--------------*/
+class UpstreamStream : public BodySource { //一次转发占用的上游连接，先读响应头，之后作为流式Body把响应体边读边交给客户端
+public:
+	enum class Mode{
+		LENGTH, //content-length
+		CHUNKED, //transfer-encoding: chunked
+		CLOSE //读到上游关闭连接为止
+	};
+
+	UpstreamStream(Upstream& upstream, int fd, const CancelToken* p_cancel):upstream(upstream),fd(fd),p_cancel(p_cancel),begin(0),end(0),mode(Mode::LENGTH),remaining(0),is_done(false),is_reusable(true){
+		this->buf.resize(STREAM_CHUNK_SIZE);
+	}
+	~UpstreamStream() override{
+		if (this->fd>=0) this->upstream.release(this->fd,false); //没有读完，连接上还有残留的数据，不能复用
+	}
+
+	std::string_view readHead(){ //读出一个完整的响应头，在下一次读之前有效；上游在发送任何数据之前就关闭了连接返回空
+		while (1){
+			size_t len=Response::headLength(std::string_view(this->buf.data()+this->begin,this->end-this->begin));
+			if (len>0){
+				std::string_view head(this->buf.data()+this->begin,len);
+				this->begin+=len;
+				return head;
+			}
+			if (!this->fill()){
+				if (this->begin==this->end) return std::string_view();
+				throw HttpException(StatusCodeAndMessage::Type::BadGateway);
+			}
+		}
+	}
+	void startBody(const Mode& mode, const size_t& length){
+		this->mode=mode;
+		this->remaining=length;
+		if (Mode::LENGTH==mode && 0==length) this->finish();
+	}
+	void setReusable(const bool& is_reusable){
+		this->is_reusable=is_reusable;
+	}
+
+	size_t read(char* out, const size_t& len) override{
+		if (this->is_done || 0==len) return 0;
+		if (Mode::CHUNKED==this->mode && 0==this->remaining){ //读下一个块的长度
+			auto line=this->readLine();
+			size_t size=0;
+			auto res=std::from_chars(line.data(),line.data()+line.size(),size,16);
+			if (std::errc()!=res.ec) throw std::runtime_error("bad chunk size in UpstreamStream::read");
+			if (0==size){ //最后一块，跳过trailer
+				while (!this->readLine().empty());
+				this->finish();
+				return 0;
+			}
+			this->remaining=size;
+		}
+		size_t n=Mode::CLOSE==this->mode? len:std::min(len,this->remaining);
+		if (this->begin<this->end){ //先用缓冲区里剩下的数据
+			n=std::min(n,this->end-this->begin);
+			memcpy(out,this->buf.data()+this->begin,n);
+			this->begin+=n;
+		}
+		else{ //缓冲区空了就直接读到调用者的内存里，不多拷贝一次
+			ssize_t result=readSome(this->fd,out,n,this->p_cancel);
+			if (0==result){
+				if (Mode::CLOSE!=this->mode) throw std::runtime_error("upstream closed early in UpstreamStream::read");
+				this->is_reusable=false;
+				this->finish();
+				return 0;
+			}
+			n=result;
+		}
+		if (Mode::CLOSE==this->mode) return n;
+		this->remaining-=n;
+		if (0==this->remaining){
+			if (Mode::LENGTH==this->mode) this->finish();
+			else if (!this->readLine().empty()) throw std::runtime_error("bad chunk in UpstreamStream::read"); //块数据后面的\r\n
+		}
+		return n;
+	}
+
+private:
+	bool fill(){ //从上游读更多数据到缓冲区，上游关闭返回false
+		if (this->begin==this->end) this->begin=this->end=0;
+		if (this->end==this->buf.size()){
+			if (this->begin>0){ //前面已经用掉的空间挪出来
+				memmove(this->buf.data(),this->buf.data()+this->begin,this->end-this->begin);
+				this->end-=this->begin;
+				this->begin=0;
+			}
+			else if (this->buf.size()<PROXY_MAX_HEAD_SIZE) this->buf.resize(this->buf.size()*2);
+			else throw HttpException(StatusCodeAndMessage::Type::BadGateway); //一行或者响应头太长了
+		}
+		ssize_t result=readSome(this->fd,this->buf.data()+this->end,this->buf.size()-this->end,this->p_cancel);
+		this->end+=result;
+		return result>0;
+	}
+	std::string_view readLine(){ //读出一行，不含换行符
+		while (1){
+			auto data=std::string_view(this->buf.data()+this->begin,this->end-this->begin);
+			auto pos=data.find('\n');
+			if (data.npos!=pos){
+				this->begin+=pos+1;
+				auto line=data.substr(0,pos);
+				if (!line.empty() && '\r'==line.back()) line.remove_suffix(1);
+				return line;
+			}
+			if (!this->fill()) throw std::runtime_error("upstream closed early in UpstreamStream::readLine");
+		}
+	}
+	void finish(){ //响应读完了，连接还给上游的连接池
+		this->is_done=true;
+		this->upstream.release(this->fd,this->is_reusable && this->begin==this->end);
+		this->fd=-1;
+	}
+
+private:
+	Upstream& upstream;
+	int fd;
+	const CancelToken* p_cancel; //转发的客户端请求的取消信号，可能是nullptr
+	std::vector<char> buf;
+	size_t begin; //buf中还没有用掉的数据的起点
+	size_t end;
+	Mode mode;
+	size_t remaining; //LENGTH模式下还没读的字节数，CHUNKED模式下当前块还没读的字节数
+	bool is_done;
+	bool is_reusable;
+};
+
+} // namespace
+
+/*------------implement of Upstream--------------*/
+Upstream::Upstream(const std::string& address):address(address),addr(),addr_len(0),outstanding(0){
+	if (0==address.compare(0,5,"unix:")){ //Unix域socket
+		struct sockaddr_un un={};
+		un.sun_family=AF_UNIX;
+		std::string path=address.substr(5);
+		if (path.empty() || path.size()>=sizeof(un.sun_path)) throw std::runtime_error("bad unix socket path in Upstream::Upstream: "+address);
+		memcpy(un.sun_path,path.data(),path.size());
+		memcpy(&this->addr,&un,sizeof(un));
+		this->addr_len=sizeof(un);
+		return;
+	}
+	auto pos=address.rfind(':');
+	if (address.npos==pos) throw std::runtime_error("upstream should be host:port or unix:path in Upstream::Upstream: "+address);
+	struct addrinfo hints={};
+	hints.ai_family=AF_UNSPEC;
+	hints.ai_socktype=SOCK_STREAM;
+	struct addrinfo* p_result=nullptr;
+	if (0!=getaddrinfo(address.substr(0,pos).c_str(),address.substr(pos+1).c_str(),&hints,&p_result)) throw std::runtime_error("cant resolve in Upstream::Upstream: "+address);
+	memcpy(&this->addr,p_result->ai_addr,p_result->ai_addrlen); //启动时解析一次
+	this->addr_len=p_result->ai_addrlen;
+	freeaddrinfo(p_result);
+}
+
+int Upstream::acquire(bool& is_pooled){
+	++this->outstanding;
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		if (!this->idle_fds.empty()){
+			int fd=this->idle_fds.back(); //最近用过的连接最不可能被上游超时关闭
+			this->idle_fds.pop_back();
+			is_pooled=true;
+			return fd;
+		}
+	}
+	is_pooled=false;
+	try{
+		return this->connectTo();
+	}
+	catch(const std::exception& e){
+		--this->outstanding;
+		throw;
+	}
+}
+
+void Upstream::release(int fd, const bool& is_reusable){
+	--this->outstanding;
+	if (is_reusable){
+		std::lock_guard<std::mutex> lock(this->mtx);
+		if (this->idle_fds.size()<PROXY_MAX_IDLE_CONNECTIONS){
+			this->idle_fds.push_back(fd);
+			return;
+		}
+	}
+	close(fd);
+}
+
+size_t Upstream::getOutstanding() const{
+	return this->outstanding;
+}
+
+const std::string& Upstream::getAddress() const{
+	return this->address;
+}
+
+int Upstream::connectTo() const{
+	int fd=socket(this->addr.ss_family,SOCK_STREAM|SOCK_CLOEXEC,0);
+	if (fd<0) throw std::runtime_error("socket failed in Upstream::connectTo");
+	if (::connect(fd,reinterpret_cast<const struct sockaddr*>(&this->addr),this->addr_len)<0){
+		close(fd);
+		throw std::runtime_error("connect failed in Upstream::connectTo: "+this->address);
+	}
+	if (AF_UNIX!=this->addr.ss_family){ //请求头和body分开写，不要等待ACK
+		int on=1;
+		setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+	}
+	return fd;
+}
+
+/*------------implement of Proxy--------------*/
+void Proxy::addRoute(const std::string& prefix, const std::vector<std::string>& addresses){
+	if (addresses.empty()) throw std::runtime_error("no upstream in Proxy::addRoute: "+prefix);
+	auto up_route=std::make_unique<Route>();
+	up_route->prefix=prefix;
+	for (const auto& address:addresses) up_route->upstreams.push_back(std::make_unique<Upstream>(address));
+	up_route->next=0;
+	auto it=this->routes.begin();
+	while (this->routes.end()!=it && (*it)->prefix.size()>=prefix.size()) ++it;
+	this->routes.insert(it,std::move(up_route));
+}
+
+bool Proxy::handle(Request& request, Response& response){
+	Route* p_route=nullptr;
+	for (auto& up_route:this->routes){
+		if (0==request.getPath().compare(0,up_route->prefix.size(),up_route->prefix)){
+			p_route=up_route.get();
+			break;
+		}
+	}
+	if (nullptr==p_route) return false;
+
+	//转发的请求复用Request::encodeHead，body直接引用客户端请求中的数据
+	while (1){ //客户端的逐跳头部只对客户端的连接有意义，不能转发给上游
+		auto it=std::find_if(request.getHeaders().begin(),request.getHeaders().end(),[](const Headers::Field& field){ return isHopByHop(field.key); });
+		if (request.getHeaders().end()==it) break;
+		std::string_view key=it->key; //删除时数组会移动，先把key取出来
+		request.removeHeader(key);
+	}
+	request.setVersion(Version::Type::HTTP_1_1);
+	request.setHeader("connection","keep-alive");
+	auto head=request.encodeHead();
+	std::string_view content;
+	if (nullptr!=request.getBody()) content=request.getBody()->getContent();
+
+	Upstream& upstream=this->pick(*p_route);
+	while (1){
+		bool is_pooled=false;
+		int fd;
+		try{
+			fd=upstream.acquire(is_pooled);
+		}
+		catch(const std::exception& e){
+			std::cerr << e.what() << '\n';
+			throw HttpException(StatusCodeAndMessage::Type::BadGateway);
+		}
+		auto sp_stream=std::make_shared<UpstreamStream>(upstream,fd,request.getCancelToken());
+		std::string_view response_head;
+		try{
+			struct iovec iov[2]={{const_cast<char*>(head.data()),head.size()},{const_cast<char*>(content.data()),content.size()}};
+			utils::writeAll(fd,iov,2);
+			response_head=sp_stream->readHead();
+			while (response_head.size()>9 && '1'==response_head[9] && 0!=response_head.compare(9,3,"101")) response_head=sp_stream->readHead(); //跳过100 Continue之类的临时响应
+		}
+		catch(const HttpException& e){
+			throw;
+		}
+		catch(const std::exception& e){ //写失败，复用的连接可能已经被上游关闭了
+			if (nullptr!=request.getCancelToken() && request.getCancelToken()->isPeerClosed()) throw; //是客户端断开了，不用重试
+			std::cerr << e.what() << '\n';
+			response_head=std::string_view();
+		}
+		if (response_head.empty()){ //还没收到任何响应连接就断了，复用的连接换一个重试，新建的连接就是上游出错了
+			if (is_pooled) continue;
+			throw HttpException(StatusCodeAndMessage::Type::BadGateway);
+		}
+
+		Response upstream_response(request.getArena());
+		upstream_response.decodeHead(response_head);
+		int code=static_cast<int>(upstream_response.getStatusCodeAndMessage().getType());
+		if (101==code) throw HttpException(StatusCodeAndMessage::Type::BadGateway); //不支持转发协议升级
+		response.setStatusCodeAndMessage(upstream_response.getStatusCodeAndMessage());
+		for (const auto& field:upstream_response.getHeaders()){
+			if (!isHopByHop(field.key) && "content-length"!=field.key) response.addHeader(field.key,field.value);
+		}
+
+		auto p_connection=upstream_response.getHeader("connection");
+		if ((nullptr!=p_connection && utils::equalsIgnoreCase(*p_connection,"close"))
+			|| (Version::Type::HTTP_1_0==upstream_response.getVersion().getType() && (nullptr==p_connection || !utils::equalsIgnoreCase(*p_connection,"keep-alive")))){
+			sp_stream->setReusable(false);
+		}
+
+		//按RFC 7230 3.3.3确定响应体的长度
+		if (204==code || 304==code){
+			sp_stream->startBody(UpstreamStream::Mode::LENGTH,0);
+			return true;
+		}
+		auto p_type=upstream_response.getHeader("content-type");
+		std::string_view type=nullptr==p_type? std::string_view("application/octet-stream"):*p_type;
+		auto p_encoding=upstream_response.getHeader("transfer-encoding");
+		auto p_length=upstream_response.getHeader("content-length");
+		size_t size=UNKNOWN_BODY_SIZE;
+		if (nullptr!=p_encoding && p_encoding->npos!=p_encoding->find("chunked")) sp_stream->startBody(UpstreamStream::Mode::CHUNKED,0);
+		else if (nullptr!=p_length){
+			auto res=std::from_chars(p_length->data(),p_length->data()+p_length->size(),size);
+			if (std::errc()!=res.ec) throw HttpException(StatusCodeAndMessage::Type::BadGateway);
+			sp_stream->startBody(UpstreamStream::Mode::LENGTH,size);
+		}
+		else sp_stream->startBody(UpstreamStream::Mode::CLOSE,0);
+		response.setBody(Body(type,sp_stream,size));
+		if (nullptr!=p_type) response.setHeader("content-type",*p_type); //保留上游原本的Content-Type，setBody会给文本类型加上charset
+		return true;
+	}
+}
+
+Upstream& Proxy::pick(Route& route){
+	size_t num=route.upstreams.size();
+	size_t start=route.next++%num;
+	size_t best=start;
+	for (size_t i=1;i<num;++i){
+		size_t index=(start+i)%num;
+		if (route.upstreams[index]->getOutstanding()<route.upstreams[best]->getOutstanding()) best=index;
+	}
+	return *(route.upstreams[best]);
+}
+
+} // namespace httpd
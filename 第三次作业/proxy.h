@@ -0,0 +1,61 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include "httpd.h"
+
+#define PROXY_MAX_IDLE_CONNECTIONS 32 //每个上游最多保留的空闲长连接
+#define PROXY_TIMEOUT_SEC 30 //等待上游数据的超时
+#define PROXY_MAX_HEAD_SIZE (64<<10) //上游响应头的最大长度
+
+namespace httpd
+{
+
+/*------------Definition of Upstream--------------*/
+class Upstream{ //一个上游服务器，维护到它的空闲长连接池，线程安全
+public:
+    Upstream(const std::string& address); //host:port或者unix:/path/to/socket
+
+    int acquire(bool& is_pooled); //取一个连接，优先复用空闲连接；is_pooled表示是否是复用的
+    void release(int fd, const bool& is_reusable); //用完归还，不能复用的直接关闭
+    size_t getOutstanding() const; //还没有完成的请求数
+    const std::string& getAddress() const;
+    int connectTo() const; //新建一个连接，不经过连接池
+
+private:
+    std::string address;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    std::mutex mtx;
+    std::vector<int> idle_fds;
+    std::atomic<size_t> outstanding;
+};
+
+/*------------Definition of Proxy--------------*/
+class Proxy{ //反向代理，按路径前缀把请求转发给上游，同一路由的多个上游之间选未完成请求最少的
+public:
+    void addRoute(const std::string& prefix, const std::vector<std::string>& addresses);
+    bool handle(Request& request, Response& response); //没有匹配的路由返回false，转发失败抛出HttpException
+
+private:
+    struct Route{
+        std::string prefix;
+        std::vector<std::unique_ptr<Upstream>> upstreams;
+        std::atomic<size_t> next; //负载相同时轮流选择
+    };
+    Upstream& pick(Route& route); //选未完成请求最少的上游
+
+private:
+    std::vector<std::unique_ptr<Route>> routes; //按前缀长度从长到短排列，先匹配最长的
+};
+
+} // namespace httpd
+
+#endif // PROXY_H
@@ -0,0 +1,665 @@
+// 回放访问日志：按原来的到达间隔（可以整体加速）向httpd重新发出请求，日志里同一个连接上的请求仍然在一个连接上按顺序发送，统计每个URL的延迟分布，可以保存结果并和之前保存的基线对比
+// 用法：./replay host:port|unix:path log_file [speed 倍数] [clients 个数] [top 行数] [save 结果文件] [baseline 基线文件]
+// 日志格式按行自动识别：
+//   httpd的access_log：Common Log Format后面是连接编号、请求开始的微秒时间戳和耗时，按连接编号复用连接，时间精确到微秒
+//   普通的Common/Combined Log Format：时间只到秒，同一个客户端IP的请求在一个连接上按顺序发送
+//   httpd打印到标准输出的只有路径的行：没有时间和客户端，轮流分给clients个虚拟客户端，每个客户端一个接一个地发送
+// speed 0表示不管原来的间隔，每个虚拟客户端收到响应就发下一个；只回放GET和HEAD，其他方法的请求体不在日志里
+// 单线程epoll，可以同时有上万个虚拟客户端；回放跟不上原来的节奏时，输出里的late（实际发送比计划晚多少）会变大
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <queue>
+#include <algorithm>
+#include <chrono>
+#include <charconv>
+#include <cstddef>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define REPLAY_MAX_EVENTS 256
+#define REPLAY_DEFAULT_CLIENTS 16
+#define REPLAY_DEFAULT_TOP 20
+#define REPLAY_READ_SIZE 65536
+
+using namespace std;
+
+namespace
+{
+
+struct Entry{ //日志里的一个请求
+	int64_t time_us; //原来的开始时间，回放前减去第一个请求的时间
+	string method;
+	string path;
+};
+
+enum class State{
+	IDLE, //没有请求在进行，连接可能还开着
+	CONNECTING,
+	SENDING,
+	RECEIVING,
+	DONE //所有请求都发完了
+};
+
+enum class Chunk{ //chunked响应体的解析位置
+	SIZE,
+	DATA,
+	DATA_END, //数据后面的CRLF
+	TRAILER
+};
+
+struct Session{ //一个虚拟客户端：按顺序在一个连接上发送日志里属于它的请求
+	vector<size_t> entries;
+	size_t next=0; //正在发送或者下一个要发送的请求
+	int fd=-1;
+	State state=State::IDLE;
+	size_t served=0; //当前连接上已经完成的请求数，大于0时连接被服务端关掉了可以重连再发一次
+	bool is_retried=false;
+	int64_t due_us=0; //计划的发送时间
+	int64_t start_us=0; //实际开始发送（包括建立连接）的时间
+	string out;
+	size_t sent=0;
+	string in; //还没有解析的响应数据
+	bool is_head_done=false;
+	bool has_bytes=false; //当前请求收到过响应数据
+	int status=0;
+	bool is_chunked=false;
+	bool is_until_close=false; //没有长度，读到连接关闭为止
+	bool is_close=false;
+	size_t remaining=0; //Content-Length或者当前chunk剩下的字节数
+	Chunk chunk=Chunk::SIZE;
+};
+
+struct Stat{ //一个URL的结果
+	vector<int64_t> latencies_us;
+	size_t errors=0; //连接失败或者5xx
+};
+
+struct Summary{ //保存和对比用的一行
+	size_t count=0;
+	size_t errors=0;
+	double p50=0;
+	double p90=0;
+	double p99=0;
+	double max=0;
+};
+
+int64_t nowUs(){
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool parseUint(const string_view& str, int64_t& value){
+	auto res=from_chars(str.data(),str.data()+str.size(),value);
+	return errc()==res.ec && str.data()+str.size()==res.ptr;
+}
+
+string_view nextToken(string_view& rest){ //按空格切出下一个字段
+	size_t begin=rest.find_first_not_of(' ');
+	if (rest.npos==begin){
+		rest=string_view();
+		return rest;
+	}
+	size_t end=rest.find(' ',begin);
+	if (rest.npos==end) end=rest.size();
+	string_view token=rest.substr(begin,end-begin);
+	rest=rest.substr(end);
+	return token;
+}
+
+bool parseLine(const string& line, size_t& line_no, const size_t& clients, Entry& entry, string& key){ //解析一行日志，得到请求和它属于的虚拟客户端
+	if (!line.empty() && '/'==line[0]){ //httpd打印到标准输出的路径
+		entry.time_us=0;
+		entry.method="GET";
+		entry.path=line;
+		key="#"+to_string(line_no++%clients);
+		return true;
+	}
+	size_t time_begin=line.find('[');
+	size_t time_end=line.find(']',time_begin);
+	size_t request_begin=line.find('"',time_end);
+	size_t request_end=line.find('"',request_begin+1);
+	if (line.npos==time_begin || line.npos==time_end || line.npos==request_begin || line.npos==request_end) return false;
+	string_view request(line.data()+request_begin+1,request_end-request_begin-1);
+	entry.method=string(nextToken(request));
+	entry.path=string(nextToken(request));
+	if (entry.path.empty() || '/'!=entry.path[0]) return false;
+	string_view rest(line.data()+request_end+1,line.size()-request_end-1);
+	nextToken(rest); //状态码
+	nextToken(rest); //字节数
+	for (int i=0;i<2;++i){ //Combined Log Format的Referer和User-Agent
+		size_t begin=rest.find_first_not_of(' ');
+		if (rest.npos==begin || '"'!=rest[begin]) break;
+		size_t end=rest.find('"',begin+1);
+		if (rest.npos==end) return false;
+		rest=rest.substr(end+1);
+	}
+	int64_t connection=0;
+	int64_t start_us=0;
+	if (parseUint(nextToken(rest),connection) && parseUint(nextToken(rest),start_us)){ //httpd的access_log
+		entry.time_us=start_us;
+		key="c"+to_string(connection);
+		return true;
+	}
+	struct tm tm={};
+	string time(line,time_begin+1,time_end-time_begin-1);
+	if (nullptr==strptime(time.c_str(),"%d/%b/%Y:%H:%M:%S %z",&tm)) return false;
+	entry.time_us=(timegm(&tm)-tm.tm_gmtoff)*1000000LL;
+	key=line.substr(0,line.find(' ')); //客户端IP
+	return true;
+}
+
+double percentile(const vector<int64_t>& sorted, const double& p){ //毫秒
+	if (sorted.empty()) return 0;
+	return sorted[min(sorted.size()-1,static_cast<size_t>(sorted.size()*p))]/1000.0;
+}
+
+Summary summarize(Stat& stat){
+	sort(stat.latencies_us.begin(),stat.latencies_us.end());
+	Summary summary;
+	summary.count=stat.latencies_us.size()+stat.errors;
+	summary.errors=stat.errors;
+	summary.p50=percentile(stat.latencies_us,0.5);
+	summary.p90=percentile(stat.latencies_us,0.9);
+	summary.p99=percentile(stat.latencies_us,0.99);
+	summary.max=stat.latencies_us.empty()? 0:stat.latencies_us.back()/1000.0;
+	return summary;
+}
+
+string diff(const double& base, const double& now){
+	char buf[64];
+	if (base>0) snprintf(buf,sizeof(buf),"%8.3f -> %8.3f (%+6.1f%%)",base,now,(now-base)*100/base);
+	else snprintf(buf,sizeof(buf),"%8.3f -> %8.3f         ",base,now);
+	return buf;
+}
+
+class Replayer{
+public:
+	Replayer(const string& address, const double& speed);
+	void add(const Entry& entry, const string& key);
+	void run();
+	map<string,Stat>& getStats();
+	size_t getSessionNum() const;
+	const vector<int64_t>& getLates() const;
+
+private:
+	void schedule(const size_t& id);
+	void start(const size_t& id);
+	void handle(const size_t& id, const uint32_t& events);
+	bool send(Session& session);
+	bool receive(Session& session); //返回true表示当前请求的响应收完了
+	bool parseHead(Session& session);
+	bool consumeBody(Session& session);
+	void finish(const size_t& id, const bool& is_ok);
+	void lost(const size_t& id); //连接断了
+	void closeConnection(Session& session);
+	void watch(Session& session, const uint32_t& events, const size_t& id);
+
+private:
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	string host;
+	double speed;
+	int epoll_fd;
+	int64_t begin_us; //回放开始的时间
+	int64_t first_us; //日志里第一个请求的时间
+	vector<Entry> entries;
+	vector<Session> sessions;
+	unordered_map<string,size_t> session_ids;
+	priority_queue<pair<int64_t,size_t>,vector<pair<int64_t,size_t>>,greater<pair<int64_t,size_t>>> due; //等着发送下一个请求的虚拟客户端，按计划时间排列
+	size_t done;
+	map<string,Stat> stats;
+	vector<int64_t> lates_us;
+};
+
+Replayer::Replayer(const string& address, const double& speed):addr_len(0),speed(speed),epoll_fd(-1),begin_us(0),first_us(INT64_MAX),done(0){
+	memset(&this->addr,0,sizeof(this->addr));
+	if (0==address.compare(0,5,"unix:")){
+		struct sockaddr_un* p_addr=reinterpret_cast<struct sockaddr_un*>(&this->addr);
+		p_addr->sun_family=AF_UNIX;
+		string path=address.substr(5);
+		if (path.size()>=sizeof(p_addr->sun_path)) throw runtime_error("socket path too long in Replayer::Replayer");
+		memcpy(p_addr->sun_path,path.data(),path.size());
+		if ('@'==path[0]) p_addr->sun_path[0]='\0'; //抽象命名空间
+		this->addr_len=offsetof(struct sockaddr_un,sun_path)+path.size()+('@'==path[0]? 0:1);
+		this->host="localhost";
+		return;
+	}
+	size_t colon=address.rfind(':');
+	if (address.npos==colon) throw runtime_error("bad address in Replayer::Replayer");
+	this->host=address.substr(0,colon);
+	struct addrinfo hints={};
+	hints.ai_family=AF_UNSPEC;
+	hints.ai_socktype=SOCK_STREAM;
+	struct addrinfo* p_result=nullptr;
+	if (0!=getaddrinfo(this->host.c_str(),address.c_str()+colon+1,&hints,&p_result)) throw runtime_error("cant resolve "+address+" in Replayer::Replayer");
+	memcpy(&this->addr,p_result->ai_addr,p_result->ai_addrlen);
+	this->addr_len=p_result->ai_addrlen;
+	freeaddrinfo(p_result);
+}
+
+void Replayer::add(const Entry& entry, const string& key){
+	auto it=this->session_ids.find(key);
+	if (this->session_ids.end()==it){
+		it=this->session_ids.emplace(key,this->sessions.size()).first;
+		this->sessions.emplace_back();
+	}
+	this->sessions[it->second].entries.push_back(this->entries.size());
+	this->entries.push_back(entry);
+	this->first_us=min(this->first_us,entry.time_us);
+}
+
+void Replayer::run(){
+	this->epoll_fd=epoll_create1(EPOLL_CLOEXEC);
+	if (this->epoll_fd<0) throw runtime_error("epoll_create1 failed in Replayer::run");
+	this->begin_us=nowUs();
+	for (size_t id=0;id<this->sessions.size();++id) this->schedule(id);
+	struct epoll_event events[REPLAY_MAX_EVENTS];
+	while (this->done<this->sessions.size()){
+		int64_t now=nowUs();
+		while (!this->due.empty() && this->due.top().first<=now){
+			size_t id=this->due.top().second;
+			this->due.pop();
+			this->start(id);
+		}
+		int timeout_ms=this->due.empty()? 1000:static_cast<int>((this->due.top().first-now+999)/1000);
+		int num=epoll_wait(this->epoll_fd,events,REPLAY_MAX_EVENTS,timeout_ms);
+		if (num<0 && EINTR==errno) continue;
+		if (num<0) throw runtime_error("epoll_wait failed in Replayer::run");
+		for (int i=0;i<num;++i) this->handle(events[i].data.u64,events[i].events);
+	}
+	close(this->epoll_fd);
+}
+
+map<string,Stat>& Replayer::getStats(){
+	return this->stats;
+}
+
+size_t Replayer::getSessionNum() const{
+	return this->sessions.size();
+}
+
+const vector<int64_t>& Replayer::getLates() const{
+	return this->lates_us;
+}
+
+void Replayer::schedule(const size_t& id){ //安排下一个请求，所有请求都完成了就关闭连接
+	Session& session=this->sessions[id];
+	if (session.next==session.entries.size()){
+		this->closeConnection(session);
+		session.state=State::DONE;
+		++this->done;
+		return;
+	}
+	session.state=State::IDLE;
+	const Entry& entry=this->entries[session.entries[session.next]];
+	session.due_us=this->speed>0? this->begin_us+static_cast<int64_t>((entry.time_us-this->first_us)/this->speed):nowUs();
+	if (session.fd>=0) this->watch(session,EPOLLIN|EPOLLRDHUP,id); //空闲时服务端关掉连接就马上知道
+	this->due.emplace(session.due_us,id);
+}
+
+void Replayer::start(const size_t& id){
+	Session& session=this->sessions[id];
+	const Entry& entry=this->entries[session.entries[session.next]];
+	session.start_us=nowUs();
+	if (this->speed>0) this->lates_us.push_back(session.start_us-session.due_us);
+	session.out=entry.method+" "+entry.path+" HTTP/1.1\r\nHost: "+this->host+"\r\nUser-Agent: replay\r\n\r\n";
+	session.sent=0;
+	session.in.clear();
+	session.is_head_done=false;
+	session.has_bytes=false;
+	if (session.fd>=0){
+		session.state=State::SENDING;
+		if (this->send(session)) this->watch(session,EPOLLIN,id);
+		else if (session.fd<0) this->lost(id);
+		else this->watch(session,EPOLLOUT,id);
+		return;
+	}
+	session.fd=socket(this->addr.ss_family,SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC,0);
+	if (session.fd<0){
+		this->finish(id,false);
+		return;
+	}
+	if (AF_UNIX!=this->addr.ss_family){
+		int on=1;
+		setsockopt(session.fd,IPPROTO_TCP,TCP_NODELAY,&on,sizeof(on));
+	}
+	session.served=0;
+	if (connect(session.fd,reinterpret_cast<struct sockaddr*>(&this->addr),this->addr_len)<0 && EINPROGRESS!=errno && EAGAIN!=errno){
+		this->finish(id,false);
+		return;
+	}
+	session.state=State::CONNECTING;
+	this->watch(session,EPOLLOUT,id);
+}
+
+void Replayer::handle(const size_t& id, const uint32_t& events){
+	Session& session=this->sessions[id];
+	switch (session.state){
+		case State::IDLE:{ //服务端关掉了空闲的连接
+			this->closeConnection(session);
+			return;
+		}
+		case State::CONNECTING:{
+			int error=0;
+			socklen_t len=sizeof(error);
+			if (getsockopt(session.fd,SOL_SOCKET,SO_ERROR,&error,&len)<0 || 0!=error){
+				this->finish(id,false);
+				return;
+			}
+			session.state=State::SENDING;
+		}
+		[[fallthrough]];
+		case State::SENDING:{
+			if (!this->send(session)){
+				if (session.fd<0) this->lost(id);
+				return;
+			}
+			this->watch(session,EPOLLIN,id);
+			return;
+		}
+		case State::RECEIVING:{
+			if (this->receive(session)) this->finish(id,true);
+			else if (session.fd<0) this->lost(id);
+			return;
+		}
+		default:
+			(void)events;
+			return;
+	}
+}
+
+bool Replayer::send(Session& session){ //返回true表示请求发完了，出错时关闭连接
+	while (session.sent<session.out.size()){
+		ssize_t len=::send(session.fd,session.out.data()+session.sent,session.out.size()-session.sent,MSG_NOSIGNAL);
+		if (len<0 && EINTR==errno) continue;
+		if (len<0 && EAGAIN==errno) return false;
+		if (len<=0){
+			this->closeConnection(session);
+			return false;
+		}
+		session.sent+=len;
+	}
+	session.state=State::RECEIVING;
+	return true;
+}
+
+bool Replayer::receive(Session& session){
+	char buf[REPLAY_READ_SIZE];
+	while (1){
+		ssize_t len=read(session.fd,buf,sizeof(buf));
+		if (len<0 && EINTR==errno) continue;
+		if (len<0 && EAGAIN==errno) return false;
+		if (len<=0){ //连接关闭了
+			if (session.is_head_done && session.is_until_close){
+				session.is_close=true;
+				return true;
+			}
+			this->closeConnection(session);
+			return false;
+		}
+		session.has_bytes=true;
+		session.in.append(buf,len);
+		if (!session.is_head_done && !this->parseHead(session)) continue;
+		if (this->consumeBody(session)) return true;
+	}
+}
+
+bool Replayer::parseHead(Session& session){ //返回false表示响应头还不完整
+	size_t end=session.in.find("\r\n\r\n");
+	if (session.in.npos==end) return false;
+	string_view head(session.in.data(),end+2);
+	session.is_head_done=true;
+	session.status=0;
+	if (head.size()>12) from_chars(head.data()+9,head.data()+12,session.status);
+	session.is_chunked=false;
+	session.is_close=0==head.compare(0,8,"HTTP/1.0"); //HTTP/1.0默认不保持连接
+	session.is_until_close=true;
+	session.remaining=0;
+	session.chunk=Chunk::SIZE;
+	for (size_t begin=head.find("\r\n")+2;begin<head.size();){
+		size_t line_end=head.find("\r\n",begin);
+		string line(head.substr(begin,line_end-begin));
+		begin=line_end+2;
+		transform(line.begin(),line.end(),line.begin(),::tolower);
+		if (0==line.compare(0,15,"content-length:")){
+			session.remaining=strtoull(line.c_str()+15,nullptr,10);
+			session.is_until_close=false;
+		}
+		else if (0==line.compare(0,18,"transfer-encoding:") && line.npos!=line.find("chunked")){
+			session.is_chunked=true;
+			session.is_until_close=false;
+		}
+		else if (0==line.compare(0,11,"connection:")) session.is_close=line.npos!=line.find("close") || (session.is_close && line.npos==line.find("keep-alive"));
+	}
+	const Entry& entry=this->entries[session.entries[session.next]];
+	if ("HEAD"==entry.method || 204==session.status || 304==session.status || session.status<200){ //没有响应体
+		session.is_chunked=false;
+		session.is_until_close=false;
+		session.remaining=0;
+	}
+	session.in.erase(0,end+4);
+	return true;
+}
+
+bool Replayer::consumeBody(Session& session){ //把收到的响应体丢掉，返回true表示响应体完整了
+	if (session.is_until_close){
+		session.in.clear();
+		return false;
+	}
+	if (!session.is_chunked){
+		size_t len=min(session.remaining,session.in.size());
+		session.remaining-=len;
+		session.in.erase(0,len);
+		return 0==session.remaining;
+	}
+	while (1){
+		switch (session.chunk){
+			case Chunk::SIZE:{
+				size_t end=session.in.find("\r\n");
+				if (session.in.npos==end) return false;
+				session.remaining=strtoull(session.in.c_str(),nullptr,16);
+				session.in.erase(0,end+2);
+				session.chunk=0==session.remaining? Chunk::TRAILER:Chunk::DATA;
+				break;
+			}
+			case Chunk::DATA:{
+				size_t len=min(session.remaining,session.in.size());
+				session.remaining-=len;
+				session.in.erase(0,len);
+				if (session.remaining>0) return false;
+				session.chunk=Chunk::DATA_END;
+				break;
+			}
+			case Chunk::DATA_END:{
+				if (session.in.size()<2) return false;
+				session.in.erase(0,2);
+				session.chunk=Chunk::SIZE;
+				break;
+			}
+			case Chunk::TRAILER:{
+				size_t end=session.in.find("\r\n");
+				if (session.in.npos==end) return false;
+				session.in.erase(0,end+2);
+				if (0==end) return true; //空行，响应结束了
+				break;
+			}
+		}
+	}
+}
+
+void Replayer::finish(const size_t& id, const bool& is_ok){ //记录当前请求的结果，安排下一个
+	Session& session=this->sessions[id];
+	Stat& stat=this->stats[this->entries[session.entries[session.next]].path];
+	if (is_ok) stat.latencies_us.push_back(nowUs()-session.start_us);
+	if (!is_ok || session.status>=500) ++stat.errors;
+	if (!is_ok || session.is_close){
+		this->closeConnection(session);
+		session.served=0;
+	}
+	else ++session.served;
+	session.is_retried=false;
+	++session.next;
+	this->schedule(id);
+}
+
+void Replayer::lost(const size_t& id){
+	Session& session=this->sessions[id];
+	if (!session.has_bytes && session.served>0 && !session.is_retried){ //复用的连接在空闲时被服务端关掉了，换一个新连接再发一次
+		session.is_retried=true;
+		int64_t start=session.start_us;
+		this->start(id);
+		session.start_us=start; //重连的时间也算在延迟里
+		if (this->speed>0) this->lates_us.pop_back();
+		return;
+	}
+	this->finish(id,false);
+}
+
+void Replayer::closeConnection(Session& session){
+	if (session.fd<0) return;
+	close(session.fd); //关闭时自动从epoll中删除
+	session.fd=-1;
+}
+
+void Replayer::watch(Session& session, const uint32_t& events, const size_t& id){
+	struct epoll_event event={};
+	event.events=events;
+	event.data.u64=id;
+	if (epoll_ctl(this->epoll_fd,EPOLL_CTL_MOD,session.fd,&event)<0 && ENOENT==errno) epoll_ctl(this->epoll_fd,EPOLL_CTL_ADD,session.fd,&event);
+}
+
+map<string,Summary> loadSummaries(const string& path){ //save保存的文件：每行 路径 次数 错误数 p50 p90 p99 max，用制表符分隔
+	map<string,Summary> summaries;
+	ifstream file(path);
+	if (!file) throw runtime_error("cant open "+path+" in loadSummaries");
+	string line;
+	while (getline(file,line)){
+		size_t tab=line.find('\t');
+		if (line.npos==tab) continue;
+		Summary summary;
+		if (6==sscanf(line.c_str()+tab+1,"%zu %zu %lf %lf %lf %lf",&summary.count,&summary.errors,&summary.p50,&summary.p90,&summary.p99,&summary.max)) summaries[line.substr(0,tab)]=summary;
+	}
+	return summaries;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	if (argc<3 || 0!=(argc-3)%2){
+		cerr << "Usage: " << argv[0] << " host:port|unix:path log_file [speed factor] [clients num] [top num] [save file] [baseline file]" << endl;
+		return 1;
+	}
+	double speed=1;
+	size_t clients=REPLAY_DEFAULT_CLIENTS;
+	size_t top=REPLAY_DEFAULT_TOP;
+	string save_path;
+	string baseline_path;
+	for (int i=3;i<argc;i+=2){
+		string option=argv[i];
+		if ("speed"==option) speed=strtod(argv[i+1],NULL);
+		else if ("clients"==option) clients=max(1L,strtol(argv[i+1],NULL,10));
+		else if ("top"==option) top=strtol(argv[i+1],NULL,10);
+		else if ("save"==option) save_path=argv[i+1];
+		else if ("baseline"==option) baseline_path=argv[i+1];
+		else{
+			cerr << "Unknown option: " << option << endl;
+			return 1;
+		}
+	}
+	signal(SIGPIPE,SIG_IGN);
+	struct rlimit limit; //每个同时进行的虚拟客户端一个连接
+	if (0==getrlimit(RLIMIT_NOFILE,&limit)){
+		limit.rlim_cur=limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE,&limit);
+	}
+
+	try{
+		Replayer replayer(argv[1],speed);
+		ifstream file(argv[2]);
+		if (!file){
+			cerr << "cant open " << argv[2] << endl;
+			return 1;
+		}
+		size_t requests=0, skipped=0, line_no=0;
+		string line, key;
+		Entry entry;
+		while (getline(file,line)){
+			if (!line.empty() && '\r'==line.back()) line.pop_back();
+			if (line.empty()) continue;
+			if (!parseLine(line,line_no,clients,entry,key) || ("GET"!=entry.method && "HEAD"!=entry.method)){
+				++skipped;
+				continue;
+			}
+			replayer.add(entry,key);
+			++requests;
+		}
+		cerr << "Replaying " << requests << " requests on " << replayer.getSessionNum() << " virtual clients (" << skipped << " lines skipped)" << endl;
+		int64_t begin=nowUs();
+		replayer.run();
+		double elapsed=(nowUs()-begin)/1e6;
+
+		map<string,Stat>& stats=replayer.getStats();
+		Stat all;
+		for (const auto& item:stats){
+			all.latencies_us.insert(all.latencies_us.end(),item.second.latencies_us.begin(),item.second.latencies_us.end());
+			all.errors+=item.second.errors;
+		}
+		vector<pair<string,Summary>> summaries;
+		summaries.emplace_back("ALL",summarize(all));
+		for (auto& item:stats) summaries.emplace_back(item.first,summarize(item.second));
+		sort(summaries.begin()+1,summaries.end(),[](const auto& a, const auto& b){ return a.second.count>b.second.count; });
+
+		printf("== %zu requests in %.2f s (%.1f req/s), speed %g, %zu errors\n",summaries[0].second.count,elapsed,summaries[0].second.count/elapsed,speed,all.errors);
+		if (!replayer.getLates().empty()){
+			vector<int64_t> lates=replayer.getLates();
+			sort(lates.begin(),lates.end());
+			printf("late p50 %.3f ms  p99 %.3f ms  max %.3f ms\n",percentile(lates,0.5),percentile(lates,0.99),lates.back()/1000.0);
+		}
+		printf("%-40s %8s %6s %9s %9s %9s %9s\n","path","count","errors","p50 ms","p90 ms","p99 ms","max ms");
+		for (size_t i=0;i<summaries.size() && i<=top;++i){
+			const Summary& summary=summaries[i].second;
+			printf("%-40s %8zu %6zu %9.3f %9.3f %9.3f %9.3f\n",summaries[i].first.c_str(),summary.count,summary.errors,summary.p50,summary.p90,summary.p99,summary.max);
+		}
+
+		if (!baseline_path.empty()){
+			map<string,Summary> baseline=loadSummaries(baseline_path);
+			printf("\n== diff against %s (p50 and p99 in ms, baseline -> now)\n",baseline_path.c_str());
+			for (size_t i=0,shown=0;i<summaries.size() && shown<=top;++i){
+				auto it=baseline.find(summaries[i].first);
+				if (baseline.end()==it) continue;
+				++shown;
+				printf("%-40s p50 %s  p99 %s  errors %zu -> %zu\n",summaries[i].first.c_str(),diff(it->second.p50,summaries[i].second.p50).c_str(),
+					diff(it->second.p99,summaries[i].second.p99).c_str(),it->second.errors,summaries[i].second.errors);
+			}
+		}
+		if (!save_path.empty()){
+			ofstream out(save_path,ios::trunc);
+			for (const auto& item:summaries){
+				const Summary& summary=item.second;
+				out << item.first << '\t' << summary.count << ' ' << summary.errors << ' ' << summary.p50 << ' ' << summary.p90 << ' ' << summary.p99 << ' ' << summary.max << '\n';
+			}
+			if (!out) cerr << "cant write " << save_path << endl;
+		}
+	}
+	catch(const exception& e){
+		cerr << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,198 @@
+#include "restart.h"
+#include <fstream>
+#include <iterator>
+
+
+extern char** environ;
+
+namespace httpd
+{
+
+/*------------implement of HotRestart--------------*/
+HotRestart::HotRestart():parent_fd(-1),signal_fd(-1),child_fd(-1),child_pid(-1){
+	//在创建线程池之前阻塞SIGUSR2，之后的线程都会继承，信号只从signalfd读出，不会打断工作线程
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask,SIGUSR2);
+	if (0!=pthread_sigmask(SIG_BLOCK,&mask,nullptr)) throw std::runtime_error("pthread_sigmask failed in HotRestart::HotRestart");
+	this->signal_fd=signalfd(-1,&mask,SFD_CLOEXEC|SFD_NONBLOCK);
+	if (this->signal_fd<0) throw std::runtime_error("signalfd failed in HotRestart::HotRestart");
+
+	const char* p_env=getenv(HOT_RESTART_ENV);
+	if (nullptr==p_env) return;
+	this->parent_fd=atoi(p_env);
+	unsetenv(HOT_RESTART_ENV);
+	fcntl(this->parent_fd,F_SETFD,FD_CLOEXEC);
+
+	//旧进程在一条消息里交过来所有的监听socket
+	char data;
+	struct iovec iov={&data,1};
+	alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int)*HOT_RESTART_MAX_FDS)];
+	struct msghdr msg={};
+	msg.msg_iov=&iov;
+	msg.msg_iovlen=1;
+	msg.msg_control=control;
+	msg.msg_controllen=sizeof(control);
+	ssize_t len;
+	do{
+		len=recvmsg(this->parent_fd,&msg,MSG_CMSG_CLOEXEC);
+	}while (len<0 && EINTR==errno);
+	if (len<=0) throw std::runtime_error("recvmsg failed in HotRestart::HotRestart");
+	for (struct cmsghdr* p_cmsg=CMSG_FIRSTHDR(&msg);nullptr!=p_cmsg;p_cmsg=CMSG_NXTHDR(&msg,p_cmsg)){
+		if (SOL_SOCKET!=p_cmsg->cmsg_level || SCM_RIGHTS!=p_cmsg->cmsg_type) continue;
+		size_t num=(p_cmsg->cmsg_len-CMSG_LEN(0))/sizeof(int);
+		const int* p_fds=reinterpret_cast<const int*>(CMSG_DATA(p_cmsg));
+		this->inherited_fds.insert(this->inherited_fds.end(),p_fds,p_fds+num);
+	}
+	std::cerr << "Inherited " << this->inherited_fds.size() << " listening sockets" << std::endl;
+}
+
+HotRestart::~HotRestart(){
+	for (int fd:this->inherited_fds) close(fd);
+	if (this->parent_fd>=0) close(this->parent_fd);
+	if (this->child_fd>=0) close(this->child_fd);
+	if (this->signal_fd>=0) close(this->signal_fd);
+}
+
+int HotRestart::takeListener(const int& port){
+	for (auto it=this->inherited_fds.begin();it!=this->inherited_fds.end();++it){
+		struct sockaddr_in addr;
+		socklen_t addr_len=sizeof(addr);
+		if (0!=getsockname(*it,reinterpret_cast<struct sockaddr*>(&addr),&addr_len) || AF_INET!=addr.sin_family) continue;
+		if (ntohs(addr.sin_port)!=port) continue;
+		int fd=*it;
+		this->inherited_fds.erase(it);
+		return fd;
+	}
+	return -1;
+}
+
+int HotRestart::takeUnixListener(const std::string& path){
+	for (auto it=this->inherited_fds.begin();it!=this->inherited_fds.end();++it){
+		struct sockaddr_un addr={};
+		socklen_t addr_len=sizeof(addr);
+		if (0!=getsockname(*it,reinterpret_cast<struct sockaddr*>(&addr),&addr_len) || AF_UNIX!=addr.sun_family) continue;
+		std::string name;
+		size_t name_len=addr_len-offsetof(struct sockaddr_un,sun_path);
+		if (name_len>0 && '\0'==addr.sun_path[0]) name="@"+std::string(addr.sun_path+1,name_len-1); //抽象命名空间的名字不以\0结尾
+		else name=addr.sun_path;
+		if (name!=path) continue;
+		int fd=*it;
+		this->inherited_fds.erase(it);
+		return fd;
+	}
+	return -1;
+}
+
+void HotRestart::notifyReady(){
+	for (int fd:this->inherited_fds) close(fd); //新的配置里已经不监听这些端口了
+	this->inherited_fds.clear();
+	if (this->parent_fd<0) return;
+	char ready='R';
+	if (write(this->parent_fd,&ready,1)<0) std::cerr << "write failed in HotRestart::notifyReady\n";
+	close(this->parent_fd);
+	this->parent_fd=-1;
+}
+
+void HotRestart::spawn(const std::vector<int>& listen_fds){
+	struct signalfd_siginfo info;
+	while (read(this->signal_fd,&info,sizeof(info))>0); //读掉所有待处理的信号
+	if (this->child_fd>=0){
+		std::cerr << "Hot restart already in progress\n";
+		return;
+	}
+
+	//exec之前准备好参数和环境变量，fork之后的子进程里只调用async-signal-safe的函数
+	auto args=HotRestart::readCmdline();
+	if (args.empty()) throw std::runtime_error("cant read cmdline in HotRestart::spawn");
+	std::vector<char*> argv;
+	for (auto& arg:args) argv.push_back(arg.data());
+	argv.push_back(nullptr);
+	int fds[2];
+	if (0!=socketpair(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0,fds)) throw std::runtime_error("socketpair failed in HotRestart::spawn");
+	std::string env=std::string(HOT_RESTART_ENV)+"="+std::to_string(fds[1]);
+	std::vector<char*> envp;
+	for (char** p=environ;nullptr!=*p;++p){
+		if (0!=strncmp(*p,HOT_RESTART_ENV "=",sizeof(HOT_RESTART_ENV))) envp.push_back(*p);
+	}
+	envp.push_back(env.data());
+	envp.push_back(nullptr);
+
+	pid_t pid=fork();
+	if (pid<0){
+		close(fds[0]);
+		close(fds[1]);
+		throw std::runtime_error("fork failed in HotRestart::spawn");
+	}
+	if (0==pid){ //子进程：恢复信号掩码，只让交接用的socket跨过exec
+		sigset_t mask;
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK,&mask,nullptr);
+		fcntl(fds[1],F_SETFD,0);
+		execvpe(argv[0],argv.data(),envp.data());
+		_exit(127);
+	}
+	close(fds[1]);
+	this->child_fd=fds[0];
+	this->child_pid=pid;
+
+	//所有监听socket放在一条消息里发过去
+	std::vector<int> fds_to_send;
+	for (int fd:listen_fds){
+		if (fd>=0) fds_to_send.push_back(fd);
+	}
+	char data='L';
+	struct iovec iov={&data,1};
+	alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int)*HOT_RESTART_MAX_FDS)]={};
+	struct msghdr msg={};
+	msg.msg_iov=&iov;
+	msg.msg_iovlen=1;
+	msg.msg_control=control;
+	msg.msg_controllen=CMSG_SPACE(sizeof(int)*fds_to_send.size());
+	struct cmsghdr* p_cmsg=CMSG_FIRSTHDR(&msg);
+	p_cmsg->cmsg_level=SOL_SOCKET;
+	p_cmsg->cmsg_type=SCM_RIGHTS;
+	p_cmsg->cmsg_len=CMSG_LEN(sizeof(int)*fds_to_send.size());
+	memcpy(CMSG_DATA(p_cmsg),fds_to_send.data(),sizeof(int)*fds_to_send.size());
+	if (sendmsg(this->child_fd,&msg,MSG_NOSIGNAL)<0) std::cerr << "sendmsg failed in HotRestart::spawn\n"; //新进程已经退出了，waitChild会处理
+	std::cerr << "Hot restart: started pid " << pid << std::endl;
+}
+
+bool HotRestart::waitChild(){
+	char ready;
+	ssize_t len;
+	do{
+		len=read(this->child_fd,&ready,1);
+	}while (len<0 && EINTR==errno);
+	close(this->child_fd);
+	this->child_fd=-1;
+	if (1==len) return true;
+	std::cerr << "Hot restart: pid " << this->child_pid << " exited before ready\n"; //新进程启动失败，继续服务
+	waitpid(this->child_pid,nullptr,0);
+	this->child_pid=-1;
+	return false;
+}
+
+int HotRestart::getSignalFd() const{
+	return this->signal_fd;
+}
+
+int HotRestart::getChildFd() const{
+	return this->child_fd;
+}
+
+std::vector<std::string> HotRestart::readCmdline(){
+	std::ifstream file("/proc/self/cmdline",std::ios::binary);
+	std::string cmdline((std::istreambuf_iterator<char>(file)),std::istreambuf_iterator<char>());
+	std::vector<std::string> args;
+	size_t begin=0;
+	while (begin<cmdline.size()){ //参数之间用'\0'分隔
+		size_t end=cmdline.find('\0',begin);
+		if (cmdline.npos==end) end=cmdline.size();
+		args.emplace_back(cmdline.substr(begin,end-begin));
+		begin=end+1;
+	}
+	return args;
+}
+
+} // namespace httpd
@@ -0,0 +1,46 @@
+#ifndef RESTART_H
+#define RESTART_H
+
+#include <vector>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include "httpd.h"
+
+#define HOT_RESTART_ENV "HTTPD_HANDOFF_FD" //新进程从这个环境变量得到和旧进程通信的Unix socket
+#define HOT_RESTART_DRAIN_SEC 30 //旧进程等待已有连接处理完的最长时间，超时直接退出
+#define HOT_RESTART_MAX_FDS 8 //一次最多交接的监听socket数
+
+namespace httpd
+{
+
+/*------------Definition of HotRestart--------------*/
+class HotRestart{ //热重启：收到SIGUSR2时启动新的可执行文件，通过SCM_RIGHTS把监听socket交给它
+public:
+    HotRestart(); //改用signalfd接收SIGUSR2；如果本进程是旧进程启动的，接收它交过来的监听socket
+    ~HotRestart();
+    HotRestart(const HotRestart&)=delete;
+    HotRestart& operator=(const HotRestart&)=delete;
+
+    int takeListener(const int& port); //取出继承来的监听port的socket，没有返回-1
+    int takeUnixListener(const std::string& path); //取出继承来的Unix域监听socket，path以@开头表示抽象命名空间
+    void notifyReady(); //开始accept之前调用，通知旧进程停止accept，关闭没有用上的继承socket
+    void spawn(const std::vector<int>& listen_fds); //signalfd可读时调用，启动新进程并把监听socket交给它
+    bool waitChild(); //新进程的socket可读时调用，新进程准备好了返回true，启动失败返回false
+    int getSignalFd() const;
+    int getChildFd() const; //-1表示没有正在启动的新进程
+
+private:
+    static std::vector<std::string> readCmdline(); //本进程的启动参数，新进程用同样的参数启动
+
+private:
+    std::vector<int> inherited_fds; //旧进程交过来的监听socket
+    int parent_fd; //和旧进程通信的socket，-1表示不是热重启启动的
+    int signal_fd;
+    int child_fd; //和新进程通信的socket
+    pid_t child_pid;
+};
+
+} // namespace httpd
+
+#endif // RESTART_H
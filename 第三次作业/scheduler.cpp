@@ -0,0 +1,235 @@
+#include "scheduler.h"
+#include <algorithm>
+
+
+namespace httpd
+{
+
+/*------------implement of TokenBucket--------------*/
+TokenBucket::TokenBucket(const size_t& rate):
+	rate(rate),
+	burst(std::max(rate/10.0,static_cast<double>(TRANSFER_PACING_QUANTUM))),
+	tokens(0),
+	last(std::chrono::steady_clock::now()){}
+
+size_t TokenBucket::available(const std::chrono::steady_clock::time_point& now){
+	if (!this->isLimited()) return SIZE_MAX;
+	this->tokens=std::min(this->burst,this->tokens+std::chrono::duration<double>(now-this->last).count()*this->rate);
+	this->last=now;
+	return this->tokens<TRANSFER_PACING_QUANTUM? 0:static_cast<size_t>(this->tokens);
+}
+
+void TokenBucket::consume(const size_t& len){
+	if (this->isLimited()) this->tokens-=len;
+}
+
+std::chrono::steady_clock::time_point TokenBucket::readyAt(const std::chrono::steady_clock::time_point& now, const size_t& len) const{
+	if (!this->isLimited() || this->tokens>=len) return now;
+	return now+std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>((len-this->tokens)/this->rate));
+}
+
+bool TokenBucket::isLimited() const{
+	return this->rate>0;
+}
+
+/*------------implement of TransferLoop--------------*/
+TransferLoop::TransferLoop(Callback callback):callback(std::move(callback)),rate(0),rate_after(0),is_pacing_supported(true),stop(false){
+	signal(SIGPIPE,SIG_IGN); //sendfile不能带MSG_NOSIGNAL，客户端断开时不能让进程退出
+	this->epoll_fd=epoll_create1(EPOLL_CLOEXEC);
+	if (this->epoll_fd<0) throw std::runtime_error("epoll_create1 failed in TransferLoop::TransferLoop");
+	this->event_fd=eventfd(0,EFD_CLOEXEC|EFD_NONBLOCK);
+	if (this->event_fd<0) throw std::runtime_error("eventfd failed in TransferLoop::TransferLoop");
+	struct epoll_event event={};
+	event.events=EPOLLIN;
+	event.data.fd=this->event_fd;
+	epoll_ctl(this->epoll_fd,EPOLL_CTL_ADD,this->event_fd,&event);
+	this->thread=std::thread(&TransferLoop::loop,this);
+}
+
+TransferLoop::~TransferLoop(){
+	this->stop.store(true);
+	uint64_t one=1;
+	if (write(this->event_fd,&one,sizeof(one))<0) std::cerr << "write failed in TransferLoop::~TransferLoop\n";
+	this->thread.join();
+	close(this->event_fd);
+	close(this->epoll_fd);
+}
+
+void TransferLoop::add(std::shared_ptr<Transfer> sp_transfer){
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		this->pending.push_back(std::move(sp_transfer));
+	}
+	uint64_t one=1;
+	if (write(this->event_fd,&one,sizeof(one))<0) throw std::runtime_error("write failed in TransferLoop::add");
+}
+
+void TransferLoop::setRateLimit(const size_t& rate, const size_t& rate_after, const size_t& global_rate){
+	this->rate=rate;
+	this->rate_after=rate_after;
+	this->global_bucket=TokenBucket(global_rate);
+}
+
+bool TransferLoop::isLarge(const Response& response){
+	const Body* p_body=response.getBody();
+	if (nullptr==p_body || p_body->isStream() || !p_body->isOwned()) return false; //数据要在请求结束后依然有效
+	return p_body->getSize()>=TRANSFER_MIN_SIZE;
+}
+
+void TransferLoop::loop(){
+	struct epoll_event events[TRANSFER_MAX_EVENTS];
+	auto last_sweep=std::chrono::steady_clock::now();
+	while (!this->stop.load()){
+		int timeout_ms=1000;
+		if (!this->sleeping.empty()){ //最早被限速的连接到时间就要醒来
+			auto wait=std::chrono::ceil<std::chrono::milliseconds>(this->sleeping.begin()->first-std::chrono::steady_clock::now()).count();
+			timeout_ms=std::clamp(static_cast<int>(wait),0,timeout_ms);
+		}
+		int num=epoll_wait(this->epoll_fd,events,TRANSFER_MAX_EVENTS,timeout_ms);
+		if (num<0 && EINTR==errno) continue;
+		if (num<0){
+			std::cerr << "epoll_wait failed in TransferLoop::loop\n";
+			break;
+		}
+		auto now=std::chrono::steady_clock::now();
+		std::vector<std::pair<size_t,int>> ready; //可写的连接和它们剩下的字节数
+		while (!this->sleeping.empty() && this->sleeping.begin()->first<=now){ //限速到时间了，重新监听可写事件，这一轮就先试着发一次
+			int fd=this->sleeping.begin()->second;
+			this->sleeping.erase(this->sleeping.begin());
+			auto it=this->transfers.find(fd);
+			if (this->transfers.end()==it) continue;
+			struct epoll_event event={};
+			event.events=EPOLLOUT;
+			event.data.fd=fd;
+			epoll_ctl(this->epoll_fd,EPOLL_CTL_MOD,fd,&event);
+			ready.emplace_back(it->second->body.getSize()-it->second->sent,fd);
+		}
+		for (int i=0;i<num;++i){
+			int fd=events[i].data.fd;
+			if (this->event_fd==fd){ //加入新的Transfer
+				uint64_t count;
+				while (read(this->event_fd,&count,sizeof(count))>0);
+				std::vector<std::shared_ptr<Transfer>> added;
+				{
+					std::lock_guard<std::mutex> lock(this->mtx);
+					added.swap(this->pending);
+				}
+				for (auto& sp_transfer:added){
+					int client_fd=sp_transfer->up_channel->getFd();
+					fcntl(client_fd,F_SETFL,fcntl(client_fd,F_GETFL)|O_NONBLOCK);
+					sp_transfer->last_active=now;
+					sp_transfer->bucket=TokenBucket(this->rate);
+					struct epoll_event event={};
+					event.events=EPOLLOUT; //水平触发，只要还可写每一轮都会出现；不监听EPOLLRDHUP，客户端只关闭写方向（HTTP/1.1允许）时还要把响应发完
+					event.data.fd=client_fd;
+					this->transfers.emplace(client_fd,std::move(sp_transfer));
+					if (epoll_ctl(this->epoll_fd,EPOLL_CTL_ADD,client_fd,&event)<0) this->finish(client_fd,false);
+				}
+				continue;
+			}
+			if (events[i].events&(EPOLLERR|EPOLLHUP)){ //客户端断开了，被限速的连接也会收到
+				this->finish(fd,false);
+				continue;
+			}
+			auto it=this->transfers.find(fd);
+			if (this->transfers.end()==it) continue;
+			ready.emplace_back(it->second->body.getSize()-it->second->sent,fd);
+		}
+
+		//剩余字节少的先发（近似SRPT），快要发完的下载尽快结束，把连接交还给工作线程
+		std::sort(ready.begin(),ready.end());
+		ready.erase(std::unique(ready.begin(),ready.end()),ready.end());
+		for (const auto& item:ready){
+			auto it=this->transfers.find(item.second);
+			if (this->transfers.end()==it) continue;
+			Transfer& transfer=*(it->second);
+			if (!this->step(transfer,now)) this->finish(item.second,false);
+			else if (transfer.sent==transfer.body.getSize()) this->finish(item.second,true);
+			else if (transfer.wake_time>now){ //被限速了，到时间之前不再监听可写事件，否则水平触发会一直空转
+				struct epoll_event event={};
+				event.events=0; //不监听可写，EPOLLERR和EPOLLHUP总会报告，客户端断开还能知道
+				event.data.fd=item.second;
+				epoll_ctl(this->epoll_fd,EPOLL_CTL_MOD,item.second,&event);
+				this->sleeping.emplace(transfer.wake_time,item.second);
+			}
+		}
+
+		if (now-last_sweep>=std::chrono::seconds(1)){ //断开长时间不可写的连接
+			last_sweep=now;
+			std::vector<int> expired;
+			for (const auto& item:this->transfers){
+				if (now-item.second->last_active>=std::chrono::seconds(TRANSFER_TIMEOUT_SEC)) expired.push_back(item.first);
+			}
+			for (int fd:expired) this->finish(fd,false);
+		}
+	}
+}
+
+bool TransferLoop::step(Transfer& transfer, const std::chrono::steady_clock::time_point& now){
+	int client_fd=transfer.up_channel->getFd();
+	size_t budget=this->limit(transfer,now,std::min(static_cast<size_t>(TRANSFER_CHUNK_SIZE),transfer.body.getSize()-transfer.sent));
+	if (0==budget) return true;
+	size_t total=budget;
+	bool is_bucket_limited=transfer.sent>=this->rate_after; //前rate_after字节不消耗这个连接的令牌
+	while (budget>0){
+		ssize_t result;
+		if (transfer.body.isFile()){
+			off_t offset=transfer.sent;
+			result=sendfile(client_fd,transfer.body.getFileDescriptor(),&offset,budget);
+		}
+		else result=send(client_fd,transfer.body.getContent().data()+transfer.sent,budget,MSG_NOSIGNAL);
+		if (result<0 && EINTR==errno) continue;
+		if (result<0 && (EAGAIN==errno || EWOULDBLOCK==errno)) break; //发送缓冲区满了，等下一轮
+		if (result<=0) return false;
+		transfer.sent+=result;
+		budget-=result;
+		transfer.last_active=now;
+	}
+	if (is_bucket_limited) transfer.bucket.consume(total-budget);
+	this->global_bucket.consume(total-budget);
+	return true;
+}
+
+size_t TransferLoop::limit(Transfer& transfer, const std::chrono::steady_clock::time_point& now, const size_t& len){
+	size_t allowed=len;
+	if (this->rate>0){
+		if (transfer.sent<this->rate_after) allowed=std::min(allowed,this->rate_after-transfer.sent); //前rate_after字节不限速
+		else{
+			if (!transfer.is_paced && this->is_pacing_supported){ //内核在两次发送之间均匀地发包，令牌桶只保证平均速率，每次醒来会有一个突发
+				int client_fd=transfer.up_channel->getFd();
+				unsigned int pacing_rate=std::min(this->rate,static_cast<size_t>(UINT_MAX-1));
+				if (0==setsockopt(client_fd,SOL_SOCKET,SO_MAX_PACING_RATE,&pacing_rate,sizeof(pacing_rate))) transfer.is_paced=true;
+				else this->is_pacing_supported=false; //内核不支持，只靠用户态分块发送
+			}
+			allowed=std::min(allowed,transfer.bucket.available(now));
+		}
+	}
+	allowed=std::min(allowed,this->global_bucket.available(now));
+	if (0==allowed){ //两个桶都攒够了才醒来
+		size_t quantum=std::min(static_cast<size_t>(TRANSFER_PACING_QUANTUM),len);
+		transfer.wake_time=std::max(this->global_bucket.readyAt(now,quantum),transfer.bucket.readyAt(now,quantum));
+		if (transfer.wake_time<=now) transfer.wake_time=now+std::chrono::milliseconds(1);
+	}
+	return allowed;
+}
+
+void TransferLoop::finish(const int& fd, const bool& is_ok){
+	auto it=this->transfers.find(fd);
+	if (this->transfers.end()==it) return;
+	auto sp_transfer=std::move(it->second);
+	this->transfers.erase(it);
+	epoll_ctl(this->epoll_fd,EPOLL_CTL_DEL,fd,nullptr);
+	fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)&~O_NONBLOCK); //工作线程里的读写都是阻塞的
+	if (sp_transfer->is_paced){ //连接上后面的响应不限速
+		unsigned int pacing_rate=UINT_MAX;
+		setsockopt(fd,SOL_SOCKET,SO_MAX_PACING_RATE,&pacing_rate,sizeof(pacing_rate));
+	}
+	try{
+		this->callback(std::move(sp_transfer),is_ok);
+	}
+	catch(const std::exception& e){
+		std::cerr << e.what() << '\n';
+	}
+}
+
+} // namespace httpd
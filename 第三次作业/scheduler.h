@@ -0,0 +1,98 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "httpd.h"
+
+#define TRANSFER_MIN_SIZE (256<<10) //不小于这个大小的响应交给事件循环发送，工作线程只处理小请求
+#define TRANSFER_CHUNK_SIZE (256<<10) //每个连接每轮最多发送的数据量，保证多个下载交替进行
+#define TRANSFER_TIMEOUT_SEC 30 //连接一直不可写就断开
+#define TRANSFER_MAX_EVENTS 64
+#define TRANSFER_PACING_QUANTUM 16384 //限速时令牌攒够这么多才发送，避免每次只发几个字节
+
+#ifndef SO_MAX_PACING_RATE
+#define SO_MAX_PACING_RATE 47
+#endif
+
+namespace httpd
+{
+
+/*------------Definition of TokenBucket--------------*/
+class TokenBucket{ //令牌桶，一个令牌就是一个字节，每秒补充rate个，最多攒100ms的量
+public:
+    TokenBucket(const size_t& rate=0);
+
+    size_t available(const std::chrono::steady_clock::time_point& now); //先补充令牌，返回现在能发送的字节数，rate为0表示不限速
+    void consume(const size_t& len);
+    std::chrono::steady_clock::time_point readyAt(const std::chrono::steady_clock::time_point& now, const size_t& len) const; //攒够len个令牌的时间
+    bool isLimited() const;
+
+private:
+    double rate;
+    double burst;
+    double tokens;
+    std::chrono::steady_clock::time_point last; //上一次补充令牌的时间
+};
+
+/*------------Definition of Transfer--------------*/
+struct Transfer{ //交给事件循环发送的大响应，响应头已经发过了，发送完后连接交回线程池继续处理后面的请求
+    std::unique_ptr<Channel> up_channel;
+    std::vector<char> buf_in; //连接上已经读到但还没有处理的数据
+    size_t buf_len=0;
+    Body body;
+    size_t sent=0;
+    bool is_close=false; //发送完就关闭连接
+    std::chrono::steady_clock::time_point last_active; //最后一次发送成功的时间
+    TokenBucket bucket; //这个连接的限速
+    bool is_paced=false; //设置了SO_MAX_PACING_RATE，发送完要恢复
+    std::chrono::steady_clock::time_point wake_time; //被限速时下一次可以发送的时间
+};
+
+/*------------Definition of TransferLoop--------------*/
+class TransferLoop{ //单独的事件循环线程，用非阻塞socket分块发送大响应，慢客户端不会占住工作线程
+public:
+    using Callback=std::function<void(std::shared_ptr<Transfer>, const bool&)>; //发送完成或者失败时调用，第二个参数表示是否成功
+
+    TransferLoop(Callback callback);
+    ~TransferLoop();
+    TransferLoop(const TransferLoop&)=delete;
+    TransferLoop& operator=(const TransferLoop&)=delete;
+
+    void add(std::shared_ptr<Transfer> sp_transfer); //线程安全
+    void setRateLimit(const size_t& rate, const size_t& rate_after, const size_t& global_rate); //每秒字节数，0表示不限；要在add之前调用
+    static bool isLarge(const Response& response); //是否应该交给事件循环发送，只看响应头就能知道的大小
+
+private:
+    void loop();
+    bool step(Transfer& transfer, const std::chrono::steady_clock::time_point& now); //发送一块，返回false表示出错；被限速时设置wake_time
+    size_t limit(Transfer& transfer, const std::chrono::steady_clock::time_point& now, const size_t& len); //限速允许发送的字节数
+    void finish(const int& fd, const bool& is_ok);
+
+private:
+    Callback callback;
+    int epoll_fd;
+    int event_fd; //有新的Transfer时唤醒事件循环
+    std::mutex mtx;
+    std::vector<std::shared_ptr<Transfer>> pending; //还没有加入事件循环的Transfer
+    std::map<int,std::shared_ptr<Transfer>> transfers; //只在事件循环线程中访问
+    std::multimap<std::chrono::steady_clock::time_point,int> sleeping; //被限速的连接，到时间之前不监听可写事件
+    size_t rate; //每个连接的限速
+    size_t rate_after; //每个响应先不限速发送的字节数
+    TokenBucket global_bucket; //所有连接共用的限速
+    bool is_pacing_supported; //内核是否支持SO_MAX_PACING_RATE
+    std::atomic_bool stop;
+    std::thread thread;
+};
+
+} // namespace httpd
+
+#endif // SCHEDULER_H
@@ -0,0 +1,203 @@
+#ifndef TABLES_H
+#define TABLES_H
+
+#include <string_view>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+#define MIME_TABLE_SIZE 256 //完美哈希表的槽数，2的幂；装载率低一些，编译期很快就能找到没有冲突的种子
+#define STATUS_LINE_MAX_LEN 48 //预先生成的状态行的最大长度
+
+namespace httpd
+{
+
+namespace tables //编译期生成的查找表，运行时只有数组下标和memcpy
+{
+
+/*------------Definition of FixedString--------------*/
+template<size_t N>
+struct FixedString{ //编译期拼接出来的字符串，和表一起放在只读数据段里
+    char data[N]={};
+    size_t size=0;
+
+    constexpr void append(const std::string_view& str){
+        for (char c:str) this->data[this->size++]=c;
+    }
+    constexpr std::string_view view() const{
+        return std::string_view(this->data,this->size);
+    }
+};
+
+/*------------Definition of MIME table--------------*/
+struct Mime{
+    std::string_view extension;
+    std::string_view type;
+};
+
+constexpr std::array<Mime,44> mime_types{{ //文件后缀对应的Content-Type
+    {"css", "text/css"},
+    {"csv", "text/csv"},
+    {"txt", "text/plain"},
+    {"vtt", "text/vtt"},
+    {"html", "text/html"},
+    {"htm", "text/html"},
+    {"apng", "image/apng"},
+    {"avif", "image/avif"},
+    {"bmp", "image/bmp"},
+    {"gif", "image/gif"},
+    {"png", "image/png"},
+    {"svg", "image/svg+xml"},
+    {"webp", "image/webp"},
+    {"ico", "image/x-icon"},
+    {"tif", "image/tiff"},
+    {"tiff", "image/tiff"},
+    {"jpeg", "image/jpeg"},
+    {"jpg", "image/jpeg"},
+    {"mp4", "video/mp4"},
+    {"mpeg", "video/mpeg"},
+    {"webm", "video/webm"},
+    {"mp3", "audio/mp3"},
+    {"mpga", "audio/mpeg"},
+    {"weba", "audio/webm"},
+    {"wav", "audio/wave"},
+    {"otf", "font/otf"},
+    {"ttf", "font/ttf"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"7z", "application/x-7z-compressed"},
+    {"atom", "application/atom+xml"},
+    {"pdf", "application/pdf"},
+    {"mjs", "application/javascript"},
+    {"js", "application/javascript"},
+    {"json", "application/json"},
+    {"rss", "application/rss+xml"},
+    {"tar", "application/x-tar"},
+    {"xhtml", "application/xhtml+xml"},
+    {"xht", "application/xhtml+xml"},
+    {"xslt", "application/xslt+xml"},
+    {"xml", "application/xml"},
+    {"gz", "application/gzip"},
+    {"zip", "application/zip"},
+    {"wasm", "application/wasm"}
+}};
+
+constexpr uint32_t hash(const std::string_view& str, const uint32_t& seed){ //FNV-1a，种子混进初始值
+    uint32_t h=2166136261u^seed;
+    for (char c:str){
+        h^=static_cast<uint8_t>(c);
+        h*=16777619u;
+    }
+    return h;
+}
+
+struct MimeTable{
+    uint32_t seed;
+    std::array<uint8_t,MIME_TABLE_SIZE> slots; //0表示空，否则是mime_types的下标加一
+};
+
+constexpr MimeTable buildMimeTable(){ //逐个试种子，直到所有后缀都落在不同的槽里
+    for (uint32_t seed=0;;++seed){
+        MimeTable table{seed,{}};
+        bool is_perfect=true;
+        for (size_t i=0;i<mime_types.size() && is_perfect;++i){
+            uint8_t& slot=table.slots[hash(mime_types[i].extension,seed)&(MIME_TABLE_SIZE-1)];
+            if (0!=slot) is_perfect=false;
+            else slot=static_cast<uint8_t>(i+1);
+        }
+        if (is_perfect) return table;
+    }
+}
+
+constexpr MimeTable mime_table=buildMimeTable();
+
+constexpr std::string_view findMimeType(const std::string_view& extension){ //一次哈希一次比较，没有这个后缀返回空
+    uint8_t slot=mime_table.slots[hash(extension,mime_table.seed)&(MIME_TABLE_SIZE-1)];
+    if (0==slot || mime_types[slot-1].extension!=extension) return std::string_view();
+    return mime_types[slot-1].type;
+}
+
+static_assert("text/html"==findMimeType("html") && "font/woff2"==findMimeType("woff2") && findMimeType("exe").empty());
+
+/*------------Definition of text types--------------*/
+constexpr std::array<std::pair<std::string_view,std::string_view>,8> text_content_types{{ //文本类型加上charset之后的Content-Type，不用每个响应拼接一次
+    {"text/plain", "text/plain; charset=utf-8"},
+    {"text/html", "text/html; charset=utf-8"},
+    {"text/css", "text/css; charset=utf-8"},
+    {"text/csv", "text/csv; charset=utf-8"},
+    {"text/vtt", "text/vtt; charset=utf-8"},
+    {"text/javascript", "text/javascript; charset=utf-8"},
+    {"text/xml", "text/xml; charset=utf-8"},
+    {"text/markdown", "text/markdown; charset=utf-8"}
+}};
+
+constexpr std::string_view findTextContentType(const std::string_view& type){ //不在表里返回空，调用者自己拼接
+    for (const auto& item:text_content_types){
+        if (item.first==type) return item.second;
+    }
+    return std::string_view();
+}
+
+/*------------Definition of status table--------------*/
+struct Status{
+    int code;
+    std::string_view text; //状态码和原因短语
+};
+
+constexpr std::array<Status,13> statuses{{ //与StatusCodeAndMessage::Type中有名字的状态码对应
+    {100, "100 Continue"},
+    {101, "101 Switching Protocols"},
+    {200, "200 OK"},
+    {400, "400 BadRequest"},
+    {401, "401 Unauthorized"},
+    {403, "403 Forbidden"},
+    {404, "404 NotFound"},
+    {500, "500 InternalServerError"},
+    {501, "501 NotImplemented"},
+    {502, "502 BadGateway"},
+    {503, "503 ServiceUnavailable"},
+    {504, "504 GatewayTimeout"},
+    {0, "0 UNKNOW"}
+}};
+
+constexpr std::array<uint8_t,600> buildStatusIndex(){ //状态码直接作为下标，0表示没有原因短语
+    std::array<uint8_t,600> index{};
+    for (size_t i=0;i<statuses.size();++i) index[statuses[i].code]=static_cast<uint8_t>(i+1);
+    return index;
+}
+
+constexpr std::array<uint8_t,600> status_index=buildStatusIndex();
+
+using StatusLine=FixedString<STATUS_LINE_MAX_LEN>;
+
+constexpr std::array<StatusLine,statuses.size()> buildStatusLines(const std::string_view& version){ //"HTTP/1.1 200 OK\r\n"
+    std::array<StatusLine,statuses.size()> lines{};
+    for (size_t i=0;i<statuses.size();++i){
+        lines[i].append(version);
+        lines[i].append(" ");
+        lines[i].append(statuses[i].text);
+        lines[i].append("\r\n");
+    }
+    return lines;
+}
+
+constexpr std::array<StatusLine,statuses.size()> status_lines_1_0=buildStatusLines("HTTP/1.0");
+constexpr std::array<StatusLine,statuses.size()> status_lines_1_1=buildStatusLines("HTTP/1.1");
+
+constexpr std::string_view findStatusText(const int& code){ //没有原因短语的状态码返回空
+    if (code<0 || code>=static_cast<int>(status_index.size()) || 0==status_index[code]) return std::string_view();
+    return statuses[status_index[code]-1].text;
+}
+
+constexpr std::string_view findStatusLine(const bool& is_http_1_0, const int& code){ //预先生成的完整状态行，没有的返回空
+    if (code<0 || code>=static_cast<int>(status_index.size()) || 0==status_index[code]) return std::string_view();
+    return (is_http_1_0? status_lines_1_0:status_lines_1_1)[status_index[code]-1].view();
+}
+
+static_assert("HTTP/1.1 404 NotFound\r\n"==findStatusLine(false,404) && findStatusLine(true,299).empty());
+
+} // namespace tables
+
+} // namespace httpd
+
+#endif // TABLES_H
@@ -0,0 +1,161 @@
+#include "tls.h"
+
+
+namespace httpd
+{
+
+namespace
+{
+
+const unsigned char alpn_protocols[]="\x02h2\x08http/1.1"; //服务端支持的协议，按优先级排列
+
+std::string lastSslError(){
+	char buf[256];
+	ERR_error_string_n(ERR_get_error(),buf,sizeof(buf));
+	return buf;
+}
+
+void setTimeout(int fd, const int& timeout_sec){ //握手期间的读写超时，0表示不超时
+	struct timeval timeout;
+	timeout.tv_sec=timeout_sec;
+	timeout.tv_usec=0;
+	setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+	setsockopt(fd,SOL_SOCKET,SO_SNDTIMEO,&timeout,sizeof(timeout));
+}
+
+} // namespace
+
+/*------------implement of TlsContext--------------*/
+TlsContext::TlsContext(const std::string& cert_file, const std::string& key_file){
+	signal(SIGPIPE,SIG_IGN); //OpenSSL用write写socket，没法带MSG_NOSIGNAL，客户端断开时不能让进程退出
+	this->p_ctx=SSL_CTX_new(TLS_server_method());
+	if (nullptr==this->p_ctx) throw std::runtime_error("SSL_CTX_new failed in TlsContext::TlsContext: "+lastSslError());
+	SSL_CTX_set_min_proto_version(this->p_ctx,TLS1_2_VERSION);
+	if (1!=SSL_CTX_use_certificate_chain_file(this->p_ctx,cert_file.c_str()) || 1!=SSL_CTX_use_PrivateKey_file(this->p_ctx,key_file.c_str(),SSL_FILETYPE_PEM)
+		|| 1!=SSL_CTX_check_private_key(this->p_ctx)){
+		std::string error=lastSslError();
+		SSL_CTX_free(this->p_ctx);
+		throw std::runtime_error("bad certificate or key in TlsContext::TlsContext: "+error);
+	}
+	//会话复用：TLS1.3和带ticket的TLS1.2用session ticket，密钥属于这个SSL_CTX；不带ticket的TLS1.2用服务端会话缓存
+	SSL_CTX_set_session_cache_mode(this->p_ctx,SSL_SESS_CACHE_SERVER);
+	SSL_CTX_set_session_id_context(this->p_ctx,reinterpret_cast<const unsigned char*>("httpd"),5);
+	SSL_CTX_set_options(this->p_ctx,SSL_OP_ENABLE_KTLS); //握手完成后OpenSSL会设置TCP_ULP "tls"，把密钥交给内核
+	SSL_CTX_set_mode(this->p_ctx,SSL_MODE_AUTO_RETRY);
+	SSL_CTX_set_alpn_select_cb(this->p_ctx,TlsContext::selectAlpn,nullptr);
+}
+TlsContext::~TlsContext(){
+	SSL_CTX_free(this->p_ctx);
+}
+
+SSL* TlsContext::newSsl() const{
+	SSL* p_ssl=SSL_new(this->p_ctx);
+	if (nullptr==p_ssl) throw std::runtime_error("SSL_new failed in TlsContext::newSsl: "+lastSslError());
+	return p_ssl;
+}
+
+int TlsContext::selectAlpn(SSL* /*p_ssl*/, const unsigned char** p_out, unsigned char* p_outlen, const unsigned char* p_in, unsigned int inlen, void* /*p_arg*/){
+	unsigned char* p_selected=nullptr;
+	if (OPENSSL_NPN_NEGOTIATED!=SSL_select_next_proto(&p_selected,p_outlen,alpn_protocols,sizeof(alpn_protocols)-1,p_in,inlen)) return SSL_TLSEXT_ERR_NOACK;
+	*p_out=p_selected;
+	return SSL_TLSEXT_ERR_OK;
+}
+
+/*------------implement of TlsChannel--------------*/
+TlsChannel::TlsChannel(int client_fd, const TlsContext& context):Channel(client_fd),p_ssl(context.newSsl()),is_ktls(false),is_failed(false){
+	SSL_set_fd(this->p_ssl,client_fd);
+	setTimeout(client_fd,READ_TIMEOUT_SEC); //防止客户端握手到一半就不动了
+	int result=SSL_accept(this->p_ssl);
+	while (1!=result && EINTR==errno){ //带超时的socket被信号打断不会自动重启，OpenSSL把它当作WANT_READ/WANT_WRITE
+		int error=SSL_get_error(this->p_ssl,result);
+		if (SSL_ERROR_WANT_READ!=error && SSL_ERROR_WANT_WRITE!=error) break;
+		result=SSL_accept(this->p_ssl);
+	}
+	if (1!=result){
+		std::string error=lastSslError();
+		SSL_free(this->p_ssl);
+		throw std::runtime_error("handshake failed in TlsChannel::TlsChannel: "+error);
+	}
+	setTimeout(client_fd,0);
+	this->is_ktls=BIO_get_ktls_send(SSL_get_wbio(this->p_ssl));
+	this->write_buffer.reserve(TLS_RECORD_SIZE);
+}
+TlsChannel::~TlsChannel(){
+	if (!this->is_failed) SSL_shutdown(this->p_ssl); //发送close_notify，不等待对端回复
+	SSL_free(this->p_ssl);
+}
+
+bool TlsChannel::waitReadable(const int& timeout_sec){
+	if (SSL_has_pending(this->p_ssl)) return true; //OpenSSL里还有没读出来的数据，select看不到
+	return Channel::waitReadable(timeout_sec);
+}
+
+ssize_t TlsChannel::read(char* buf, const size_t& len){
+	int result=SSL_read(this->p_ssl,buf,static_cast<int>(std::min(len,static_cast<size_t>(INT_MAX))));
+	if (result>0) return result;
+	if (SSL_ERROR_ZERO_RETURN==SSL_get_error(this->p_ssl,result)) return 0; //对端发送了close_notify
+	ERR_clear_error();
+	this->is_failed=true;
+	return -1;
+}
+
+void TlsChannel::writeAll(struct iovec* iov, const size_t& iovcnt, const bool& is_more){
+	for (size_t i=0;i<iovcnt;++i){
+		this->write_buffer.append(static_cast<const char*>(iov[i].iov_base),iov[i].iov_len);
+		if (this->write_buffer.size()>=TLS_RECORD_SIZE) this->flushBuffer();
+	}
+	if (!is_more) this->flushBuffer();
+}
+
+void TlsChannel::sendFile(const int& file_fd, off_t offset, size_t len){
+	if (this->is_ktls){ //内核加密，文件数据不经过用户态
+		this->flushBuffer();
+		while (len>0){
+			ossl_ssize_t result=SSL_sendfile(this->p_ssl,file_fd,offset,len,0);
+			if (result<=0){
+				ERR_clear_error();
+				this->is_failed=true;
+				throw std::runtime_error("SSL_sendfile failed in TlsChannel::sendFile");
+			}
+			offset+=result;
+			len-=result;
+		}
+		return;
+	}
+	char buf[TLS_RECORD_SIZE]; //用户态加密只能先读出来
+	while (len>0){
+		ssize_t result=pread(file_fd,buf,std::min(len,sizeof(buf)),offset);
+		if (result<0 && EINTR==errno) continue;
+		if (result<=0) throw std::runtime_error("pread failed in TlsChannel::sendFile");
+		this->write_buffer.append(buf,result);
+		if (this->write_buffer.size()>=TLS_RECORD_SIZE) this->flushBuffer();
+		offset+=result;
+		len-=result;
+	}
+	this->flushBuffer();
+}
+
+bool TlsChannel::isKtls() const{
+	return this->is_ktls;
+}
+
+void TlsChannel::write(const char* p_data, const size_t& len){
+	size_t written=0;
+	while (written<len){
+		int result=SSL_write(this->p_ssl,p_data+written,static_cast<int>(std::min(len-written,static_cast<size_t>(INT_MAX))));
+		if (result<=0){
+			ERR_clear_error();
+			this->is_failed=true;
+			throw std::runtime_error("SSL_write failed in TlsChannel::write");
+		}
+		written+=result;
+	}
+}
+
+void TlsChannel::flushBuffer(){
+	if (this->write_buffer.empty()) return;
+	this->write(this->write_buffer.data(),this->write_buffer.size());
+	this->write_buffer.clear();
+}
+
+} // namespace httpd
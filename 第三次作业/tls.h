@@ -0,0 +1,57 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <string>
+#include <signal.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include "httpd.h"
+
+#define TLS_RECORD_SIZE 16384 //TLS记录的最大明文长度，用户态加密时攒够这么多再写
+
+namespace httpd
+{
+
+/*------------Definition of TlsContext--------------*/
+class TlsContext{ //整个服务共用一个SSL_CTX，会话缓存和session ticket的密钥因此在所有工作线程间共享
+public:
+    TlsContext(const std::string& cert_file, const std::string& key_file);
+    ~TlsContext();
+    TlsContext(const TlsContext&)=delete;
+    TlsContext& operator=(const TlsContext&)=delete;
+
+    SSL* newSsl() const; //为一个连接创建SSL对象
+
+private:
+    static int selectAlpn(SSL* p_ssl, const unsigned char** p_out, unsigned char* p_outlen, const unsigned char* p_in, unsigned int inlen, void* p_arg); //客户端支持的话优先选h2
+
+private:
+    SSL_CTX* p_ctx;
+};
+
+/*------------Definition of TlsChannel--------------*/
+class TlsChannel : public Channel { //TLS连接，握手后尽量启用内核TLS，这样文件依然可以sendfile；内核不支持时退回SSL_write
+public:
+    TlsChannel(int client_fd, const TlsContext& context); //构造时完成握手，失败抛出异常
+    ~TlsChannel() override;
+
+    bool waitReadable(const int& timeout_sec) override;
+    ssize_t read(char* buf, const size_t& len) override;
+    void writeAll(struct iovec* iov, const size_t& iovcnt, const bool& is_more=false) override;
+    void sendFile(const int& file_fd, off_t offset, size_t len) override;
+    bool isKtls() const; //发送方向是否由内核加密
+
+private:
+    void write(const char* p_data, const size_t& len); //SSL_write直到全部写完
+    void flushBuffer();
+
+private:
+    SSL* p_ssl;
+    bool is_ktls;
+    bool is_failed; //出现过致命错误，之后不能再SSL_shutdown
+    std::string write_buffer; //小块数据攒成完整的TLS记录再写，减少记录数和系统调用
+};
+
+} // namespace httpd
+
+#endif // TLS_H
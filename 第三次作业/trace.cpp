@@ -0,0 +1,250 @@
+#include "trace.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+
+
+namespace httpd
+{
+
+namespace trace
+{
+
+namespace
+{
+
+thread_local Record* p_current=nullptr; //当前线程正在处理的请求
+
+} // namespace
+
+const char* toString(const Phase& phase){
+	switch (phase){
+		case Phase::QUEUE: return "queue";
+		case Phase::READ: return "read";
+		case Phase::PARSE: return "parse";
+		case Phase::HANDLER: return "handler";
+		case Phase::FILE: return "file";
+		case Phase::WRITE: return "write";
+		default: return "unknown";
+	}
+}
+
+void Record::mark(const Phase& phase, const int64_t& begin, const int64_t& end){
+	this->phases[static_cast<size_t>(phase)][0]=begin;
+	this->phases[static_cast<size_t>(phase)][1]=end;
+}
+
+int64_t now(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*------------implement of Span--------------*/
+Span::Span(const Phase& phase):p_record(p_current),phase(phase),begin(nullptr!=p_current? now():0){}
+
+Span::~Span(){
+	if (nullptr!=this->p_record) this->p_record->mark(this->phase,this->begin,now());
+}
+
+/*------------implement of Binding--------------*/
+Binding::~Binding(){
+	this->unbind();
+}
+
+void Binding::bind(Record& record){
+	p_current=&record;
+}
+
+void Binding::unbind(){
+	p_current=nullptr;
+}
+
+} // namespace trace
+
+namespace
+{
+
+void appendEvent(std::string& out, const char* name, const int64_t& begin, const int64_t& end, const int64_t& epoch, const int& pid, const uint32_t& tid){ //一个"X"（complete）事件，时间单位是微秒
+	char buf[160];
+	snprintf(buf,sizeof(buf),",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u",(begin-epoch)/1000.0,(end-begin)/1000.0,pid,tid);
+	out+="{\"name\":\"";
+	out+=name;
+	out+="\"";
+	out+=buf;
+}
+
+void appendRecord(std::string& out, const trace::Record& record, const int64_t& epoch, const int& pid){ //请求本身一个事件，各阶段嵌套在里面
+	std::string path;
+	for (size_t i=0;i<record.path_len;++i){ //路径里可能有引号、反斜杠和控制字符
+		char c=record.path[i];
+		if ('"'==c || '\\'==c) path.push_back('\\');
+		if (static_cast<unsigned char>(c)<0x20) c='?';
+		path.push_back(c);
+	}
+	out+=",\n";
+	appendEvent(out,path.c_str(),record.start,record.end,epoch,pid,record.tid);
+	out+=",\"cat\":\"request\",\"args\":{\"id\":"+std::to_string(record.id)+",\"status\":"+std::to_string(record.status)+"}}";
+	for (size_t i=0;i<static_cast<size_t>(trace::Phase::NUM);++i){
+		if (0==record.phases[i][0]) continue;
+		out+=",\n";
+		appendEvent(out,trace::toString(static_cast<trace::Phase>(i)),record.phases[i][0],record.phases[i][1],epoch,pid,record.tid);
+		out+=",\"cat\":\"phase\"}";
+	}
+}
+
+} // namespace
+
+/*------------implement of Tracer--------------*/
+Tracer::Tracer(const double& sample_rate, const std::string& dump_path):
+	sample_interval(sample_rate>0? std::max<uint64_t>(1,std::llround(1/sample_rate)):0),
+	dump_path(dump_path),
+	epoch(trace::now()),
+	slowest_threshold(0),
+	next_id(0),
+	sampled(0),
+	signal_fd(-1),
+	event_fd(-1){
+	//和热重启一样，在创建线程池之前阻塞信号，之后的线程都会继承，信号只从signalfd读出
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask,TRACE_DUMP_SIGNAL);
+	if (0!=pthread_sigmask(SIG_BLOCK,&mask,nullptr)) throw std::runtime_error("pthread_sigmask failed in Tracer::Tracer");
+	this->signal_fd=signalfd(-1,&mask,SFD_CLOEXEC|SFD_NONBLOCK);
+	if (this->signal_fd<0) throw std::runtime_error("signalfd failed in Tracer::Tracer");
+	this->event_fd=eventfd(0,EFD_CLOEXEC|EFD_NONBLOCK);
+	if (this->event_fd<0){
+		close(this->signal_fd);
+		throw std::runtime_error("eventfd failed in Tracer::Tracer");
+	}
+	this->slowest.reserve(TRACE_SLOWEST_NUM+1);
+	this->thread=std::thread(&Tracer::waitSignal,this);
+}
+
+Tracer::~Tracer(){
+	uint64_t one=1;
+	if (write(this->event_fd,&one,sizeof(one))<0) std::cerr << "write failed in Tracer::~Tracer\n";
+	this->thread.join();
+	close(this->event_fd);
+	close(this->signal_fd);
+}
+
+void Tracer::begin(trace::Record& record, const int64_t& start){
+	record.start=start;
+	record.end=0;
+	memset(record.phases,0,sizeof(record.phases));
+	record.id=this->next_id++;
+	record.is_sampled=this->sample_interval>0 && 0==record.id%this->sample_interval;
+}
+
+void Tracer::finish(trace::Record& record, const std::string_view& path, const int& status){
+	record.end=trace::now();
+	record.status=status;
+	record.path_len=std::min(path.size(),static_cast<size_t>(TRACE_PATH_LEN));
+	memcpy(record.path,path.data(),record.path_len);
+	Ring& ring=this->getRing();
+	record.tid=ring.tid;
+	if (record.is_sampled){
+		std::lock_guard<std::mutex> lock(ring.mtx);
+		ring.records[ring.next]=record;
+		ring.next=(ring.next+1)%TRACE_RING_SIZE;
+		ring.count=std::min(ring.count+1,static_cast<size_t>(TRACE_RING_SIZE));
+		++this->sampled;
+	}
+	if (record.end-record.start>this->slowest_threshold.load(std::memory_order_relaxed)) this->keepIfSlow(record); //大多数请求在这里就返回了，不用加锁
+}
+
+thread_local Tracer::RingSlot Tracer::ring_slot;
+
+Tracer::RingSlot::~RingSlot(){
+	if (nullptr!=this->sp_ring) this->sp_ring->is_idle.store(true,std::memory_order_release); //缓冲区中的采样保留，新线程接着往后写
+}
+
+Tracer::Ring& Tracer::getRing(){
+	if (this==ring_slot.p_owner) return *ring_slot.sp_ring;
+	if (nullptr!=ring_slot.sp_ring) ring_slot.sp_ring->is_idle.store(true,std::memory_order_release); //换了一个Tracer，之前的缓冲区不再使用
+	std::lock_guard<std::mutex> lock(this->mtx);
+	std::shared_ptr<Ring> sp_ring;
+	for (const auto& sp_idle:this->rings){
+		bool expected=true;
+		if (sp_idle->is_idle.compare_exchange_strong(expected,false,std::memory_order_acquire)){
+			sp_ring=sp_idle;
+			break;
+		}
+	}
+	if (nullptr==sp_ring){
+		sp_ring=std::make_shared<Ring>();
+		sp_ring->records.resize(TRACE_RING_SIZE);
+		sp_ring->tid=this->rings.size()+1;
+		this->rings.push_back(sp_ring);
+	}
+	ring_slot.p_owner=this;
+	ring_slot.sp_ring=std::move(sp_ring);
+	return *ring_slot.sp_ring;
+}
+
+void Tracer::keepIfSlow(const trace::Record& record){
+	std::lock_guard<std::mutex> lock(this->mtx);
+	int64_t duration=record.end-record.start;
+	auto it=std::find_if(this->slowest.begin(),this->slowest.end(),[duration](const trace::Record& cmp){ return cmp.end-cmp.start<duration; });
+	this->slowest.insert(it,record);
+	if (this->slowest.size()>TRACE_SLOWEST_NUM) this->slowest.pop_back();
+	if (this->slowest.size()==TRACE_SLOWEST_NUM) this->slowest_threshold=this->slowest.back().end-this->slowest.back().start;
+}
+
+std::string Tracer::dump() const{
+	std::vector<trace::Record> records;
+	std::vector<trace::Record> slowest;
+	size_t threads=0;
+	{
+		std::lock_guard<std::mutex> lock(this->mtx);
+		slowest=this->slowest;
+		threads=this->rings.size();
+		for (const auto& up_ring:this->rings){
+			std::lock_guard<std::mutex> ring_lock(up_ring->mtx);
+			for (size_t i=0;i<up_ring->count;++i) records.push_back(up_ring->records[(up_ring->next+TRACE_RING_SIZE-up_ring->count+i)%TRACE_RING_SIZE]);
+		}
+	}
+	//pid 1是采样的请求，pid 2是最慢的请求，每个工作线程一行
+	std::string out="{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	out+="{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"sampled\"}},\n";
+	out+="{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"slowest\"}}";
+	for (size_t tid=1;tid<=threads;++tid){
+		for (int pid=1;pid<=2;++pid) out+=",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":"+std::to_string(pid)+",\"tid\":"+std::to_string(tid)+",\"args\":{\"name\":\"worker "+std::to_string(tid)+"\"}}";
+	}
+	for (const auto& record:records) appendRecord(out,record,this->epoch,1);
+	for (const auto& record:slowest) appendRecord(out,record,this->epoch,2);
+	out+="\n]}\n";
+	return out;
+}
+
+void Tracer::appendStats(std::string& out) const{
+	std::lock_guard<std::mutex> lock(this->mtx);
+	out+="trace_requests "+std::to_string(this->next_id)+"\n";
+	out+="trace_sampled "+std::to_string(this->sampled)+"\n";
+	out+="trace_rings "+std::to_string(this->rings.size())+"\n";
+	if (!this->slowest.empty()) out+="trace_slowest_ms "+std::to_string((this->slowest.front().end-this->slowest.front().start)/1e6)+"\n";
+}
+
+void Tracer::waitSignal(){
+	struct pollfd fds[2]={{this->signal_fd,POLLIN,0},{this->event_fd,POLLIN,0}};
+	while (1){
+		if (poll(fds,2,-1)<0){
+			if (EINTR==errno) continue;
+			std::cerr << "poll failed in Tracer::waitSignal\n";
+			return;
+		}
+		if (fds[1].revents&POLLIN) return;
+		if (!(fds[0].revents&POLLIN)) continue;
+		struct signalfd_siginfo info;
+		while (read(this->signal_fd,&info,sizeof(info))>0); //读掉所有待处理的信号
+		std::ofstream file(this->dump_path,std::ios::trunc);
+		file << this->dump();
+		if (file) std::cerr << "Trace written to " << this->dump_path << std::endl;
+		else std::cerr << "cant write " << this->dump_path << " in Tracer::waitSignal\n";
+	}
+}
+
+} // namespace httpd
@@ -0,0 +1,133 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+
+#define TRACE_RING_SIZE 1024 //每个线程保留最近采样到的请求数
+#define TRACE_SLOWEST_NUM 16 //不论是否采样，自动保留最慢的请求数
+#define TRACE_PATH_LEN 64 //记录的请求路径最多保留的字节数
+#define TRACE_DUMP_SIGNAL SIGUSR1 //收到这个信号时把trace写到文件
+
+namespace httpd
+{
+
+namespace trace
+{
+
+enum class Phase : uint8_t{ //一个请求经过的阶段
+    QUEUE, //accept之后在线程池队列里等待，只有连接上的第一个请求有
+    READ, //从请求的第一个字节到达（第一个请求从工作线程开始处理连接，包括TLS握手）到读完整个请求
+    PARSE,
+    HANDLER, //消息回调，包括下面的FILE
+    FILE, //FileSystem::read
+    WRITE, //发送响应，流水线中一起发送的请求共用一段；大响应只算响应头，body由事件循环发送
+    NUM
+};
+
+const char* toString(const Phase& phase);
+
+struct Record{ //一个请求各阶段的时间，都是单调时钟的纳秒数，0表示没有经过这个阶段
+    int64_t start;
+    int64_t end;
+    int64_t phases[static_cast<size_t>(Phase::NUM)][2]; //每个阶段的开始和结束
+    uint64_t id;
+    uint32_t tid; //记录它的工作线程的编号
+    uint16_t status;
+    bool is_sampled;
+    uint8_t path_len;
+    char path[TRACE_PATH_LEN];
+
+    void mark(const Phase& phase, const int64_t& begin, const int64_t& end);
+};
+
+int64_t now(); //单调时钟，纳秒
+
+/*------------Definition of Span--------------*/
+class Span{ //作用域内的时间记为当前线程正在处理的请求的一个阶段，没有请求时什么都不做
+public:
+    Span(const Phase& phase);
+    ~Span();
+    Span(const Span&)=delete;
+    Span& operator=(const Span&)=delete;
+
+private:
+    Record* p_record;
+    Phase phase;
+    int64_t begin;
+};
+
+/*------------Definition of Binding--------------*/
+class Binding{ //把当前线程和正在处理的请求关联起来，Span记录到这个请求上；离开作用域时解除，记录不会被悬空引用
+public:
+    Binding()=default;
+    ~Binding();
+    Binding(const Binding&)=delete;
+    Binding& operator=(const Binding&)=delete;
+
+    void bind(Record& record);
+    void unbind();
+};
+
+} // namespace trace
+
+/*------------Definition of Tracer--------------*/
+class Tracer{ //按阶段记录请求的耗时：采样的请求放在每个线程自己的环形缓冲区里，最慢的N个请求总是保留，导出为Chrome trace-event JSON
+public:
+    Tracer(const double& sample_rate, const std::string& dump_path); //要在创建其他线程之前构造，收到TRACE_DUMP_SIGNAL时把trace写到dump_path
+    ~Tracer();
+    Tracer(const Tracer&)=delete;
+    Tracer& operator=(const Tracer&)=delete;
+
+    void begin(trace::Record& record, const int64_t& start); //开始记录一个请求，决定是否采样
+    void finish(trace::Record& record, const std::string_view& path, const int& status); //请求的响应发完了
+    std::string dump() const; //chrome://tracing和Perfetto都能打开
+    void appendStats(std::string& out) const;
+
+private:
+    struct Ring{ //一个工作线程的最近采样，只有导出时才会和别的线程竞争锁
+        std::mutex mtx;
+        std::vector<trace::Record> records;
+        size_t next=0; //下一个要写的位置
+        size_t count=0;
+        uint32_t tid;
+        std::atomic<bool> is_idle{false}; //使用它的线程已经退出，可以交给新线程
+    };
+    struct RingSlot{ //当前线程在用的环形缓冲区，线程退出时析构，把缓冲区还回去
+        const Tracer* p_owner=nullptr;
+        std::shared_ptr<Ring> sp_ring; //Tracer先析构时缓冲区也还有效
+        ~RingSlot();
+    };
+
+    Ring& getRing(); //当前线程的环形缓冲区，第一次调用时优先复用已退出线程的，没有才创建
+    void keepIfSlow(const trace::Record& record);
+    void waitSignal();
+
+private:
+    uint64_t sample_interval; //每隔多少个请求采样一个
+    std::string dump_path;
+    int64_t epoch; //导出的时间戳从这里算起
+    mutable std::mutex mtx;
+    std::vector<std::shared_ptr<Ring>> rings; //线程池伸缩时线程会退出和新建，缓冲区个数只等于同时存在的线程数的峰值
+    std::vector<trace::Record> slowest; //按总耗时从大到小
+    std::atomic<int64_t> slowest_threshold; //慢过这个耗时才需要加锁更新slowest
+    std::atomic<uint64_t> next_id;
+    std::atomic<size_t> sampled;
+    int signal_fd;
+    int event_fd; //析构时唤醒等待信号的线程
+    std::thread thread;
+    static thread_local RingSlot ring_slot;
+};
+
+} // namespace httpd
+
+#endif // TRACE_H
@@ -11,6 +11,21 @@
 #include <atomic>
 #include <semaphore.h>
 #include <iostream>
+#include <vector>
+#include <string_view>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <list>
+#include <chrono>
+#include <string>
+#include <condition_variable>
+
+#define POOL_ADJUST_INTERVAL_MS 50 //线程池测量和调整的周期
+#define POOL_GROW_WAIT_MS 2 //一个周期里有任务排队超过这么久就增加线程
+#define POOL_SHRINK_UTILIZATION 0.25 //利用率低于这个值算空闲
+#define POOL_SHRINK_TICKS 100 //连续空闲这么多个周期之后才开始每个周期减少一个线程，增加快减少慢，负载波动时线程数不会忽增忽减
+#define POOL_STUCK_MS 1000 //一个任务执行超过这么久就认为线程卡在阻塞调用里
 
 namespace utils
 {
@@ -91,17 +106,21 @@ private:
 };
 
 /*------------Definition of ThreadPool--------------*/
-class ThreadPool{
+class ThreadPool{ //线程数在[min_size,max_size]之间按任务排队时间自动伸缩，两者相等时线程数固定
 public:
-    ThreadPool(const size_t& num=5):stop(false){
-        for (size_t i=0;i<num;++i){
-            this->workers.emplace_back(std::bind(&ThreadPool::workerThread,this));
-        }
+    ThreadPool(const size_t& num=5):min_size(num),max_size(num),size(0),pending(0),stop(false){
+        for (size_t i=0;i<num;++i) this->addWorker();
+        this->controller=std::thread(std::bind(&ThreadPool::controlThread,this));
     }
     ~ThreadPool(){
-        this->stop.store(true);
-        for (std::thread& worker:this->workers){
-            worker.join();
+        {
+            std::lock_guard<std::mutex> lock(this->control_mtx);
+            this->stop.store(true);
+        }
+        this->control_cv.notify_all();
+        this->controller.join();
+        for (auto& up_worker:this->workers){
+            up_worker->thread.join();
         }
     }
 
@@ -113,30 +132,300 @@ public:
 
         std::future<decltype(func(args...))> result = sp_task->get_future(); //延时存放函数的返回结果
 
-        this->sp_tasks.push(std::make_shared<std::function<void()>>([sp_task]() { (*sp_task)(); }));
+        ++this->pending;
+        this->sp_tasks.push(Task{std::make_shared<std::function<void()>>([sp_task]() { (*sp_task)(); }),std::chrono::steady_clock::now()});
 
         return result;
     }
 
+    void setMaxSize(const size_t& num){ //允许线程数增长到num，不小于构造时的线程数
+        this->max_size=std::max(num,this->min_size);
+    }
+
+    void appendStats(std::string& out) const{ //把最近一个周期的测量值和调整次数按"名字 值"追加到out
+        std::lock_guard<std::mutex> lock(this->control_mtx);
+        out+="pool_threads "+std::to_string(this->size)+"\n";
+        out+="pool_threads_min "+std::to_string(this->min_size)+"\n";
+        out+="pool_threads_max "+std::to_string(this->max_size)+"\n";
+        out+="pool_busy "+std::to_string(this->metrics.busy)+"\n";
+        out+="pool_stuck "+std::to_string(this->metrics.stuck)+"\n";
+        out+="pool_queue_length "+std::to_string(this->pending)+"\n";
+        out+="pool_queue_wait_avg_ms "+std::to_string(this->metrics.wait_avg_ms)+"\n";
+        out+="pool_queue_wait_max_ms "+std::to_string(this->metrics.wait_max_ms)+"\n";
+        out+="pool_utilization "+std::to_string(this->metrics.utilization)+"\n";
+        out+="pool_grow_total "+std::to_string(this->metrics.grown)+"\n";
+        out+="pool_shrink_total "+std::to_string(this->metrics.shrunk)+"\n";
+        out+="pool_compensate_total "+std::to_string(this->metrics.compensated)+"\n"; //因为有线程卡住而超过max_size的次数
+    }
+
 private:
-    void workerThread(){
+    struct Task{
+        std::shared_ptr<std::function<void()>> sp_func; //空表示让取到它的线程退出
+        std::chrono::steady_clock::time_point enqueued; //用来计算排队时间
+    };
+
+    struct Worker{
+        std::thread thread;
+        std::atomic<int64_t> task_start{0}; //当前任务开始执行的时间（纳秒），0表示空闲
+        std::atomic<int64_t> busy_ns{0}; //已经执行完的任务的总耗时
+        std::atomic_bool is_exited{false};
+    };
+
+    struct Metrics{ //控制线程每个周期更新
+        size_t busy=0;
+        size_t stuck=0;
+        double wait_avg_ms=0;
+        double wait_max_ms=0;
+        double utilization=0; //上一个周期里工作线程忙碌的时间占比
+        size_t grown=0;
+        size_t shrunk=0;
+        size_t compensated=0;
+    };
+
+    static int64_t nowNs(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void addWorker(){ //只在构造函数和控制线程中调用
+        auto up_worker=std::make_unique<Worker>();
+        up_worker->thread=std::thread(std::bind(&ThreadPool::workerThread,this,up_worker.get()));
+        this->workers.push_back(std::move(up_worker));
+        ++this->size;
+    }
+
+    void workerThread(Worker* p_worker){
         while(false==this->stop.load()){
             try{
-                std::shared_ptr<std::function<void()>> sp_task;
-                if (this->sp_tasks.pull(sp_task,5)) (*sp_task)(); //拉取任务并执行
+                Task task;
+                if (!this->sp_tasks.pull(task,5)) continue;
+                --this->pending;
+                if (nullptr==task.sp_func) break; //线程太多了，退出
+                int64_t start=nowNs();
+                int64_t wait=start-std::chrono::duration_cast<std::chrono::nanoseconds>(task.enqueued.time_since_epoch()).count();
+                this->wait_sum+=wait;
+                ++this->dequeued;
+                int64_t max_wait=this->wait_max.load();
+                while (wait>max_wait && !this->wait_max.compare_exchange_weak(max_wait,wait));
+                p_worker->task_start=start;
+                (*task.sp_func)(); //执行任务，异常由packaged_task交给future
+                p_worker->busy_ns+=nowNs()-start;
+                p_worker->task_start=0;
             }
             catch(const std::exception& e){
                 std::cerr << e.what() << " in ThreadPool::workerThread\n";
             }
         }
+        p_worker->is_exited=true;
+    }
+
+    void controlThread(){ //每个周期测量一次排队时间和利用率，决定是否增减线程
+        int64_t last=nowNs();
+        int64_t last_busy=0;
+        size_t idle_ticks=0;
+        std::unique_lock<std::mutex> lock(this->control_mtx);
+        while (!this->control_cv.wait_for(lock,std::chrono::milliseconds(POOL_ADJUST_INTERVAL_MS),[this]{ return this->stop.load(); })){
+            int64_t now=nowNs();
+            size_t busy=0;
+            size_t stuck=0;
+            int64_t total_busy=0;
+            for (auto it=this->workers.begin();it!=this->workers.end();){
+                Worker& worker=**it;
+                if (worker.is_exited){ //退出的线程在这里回收
+                    worker.thread.join();
+                    this->retired_busy+=worker.busy_ns;
+                    it=this->workers.erase(it);
+                    continue;
+                }
+                int64_t task_start=worker.task_start;
+                total_busy+=worker.busy_ns;
+                if (task_start>0){
+                    ++busy;
+                    total_busy+=now-task_start;
+                    if (now-task_start>=POOL_STUCK_MS*1000000LL) ++stuck; //可能阻塞在读写或者上游上，不占CPU
+                }
+                ++it;
+            }
+            total_busy+=this->retired_busy;
+            size_t dequeued=this->dequeued.exchange(0);
+            int64_t wait_sum=this->wait_sum.exchange(0);
+            int64_t wait_max=this->wait_max.exchange(0);
+            size_t pending=this->pending;
+            size_t threads=this->workers.size();
+            this->metrics.busy=busy;
+            this->metrics.stuck=stuck;
+            this->metrics.wait_avg_ms=0==dequeued? 0:wait_sum/1e6/dequeued;
+            this->metrics.wait_max_ms=wait_max/1e6;
+            this->metrics.utilization=0==threads? 0:std::min(1.0,static_cast<double>(total_busy-last_busy)/(now-last)/threads);
+            last=now;
+            last_busy=total_busy;
+            if (this->max_size==this->min_size) continue; //固定大小，只测量
+
+            //排队太久，或者有任务在排队但整个周期里一个都没取走（所有线程都被占住了）
+            bool is_waiting=pending>0 && (wait_max>=POOL_GROW_WAIT_MS*1000000LL || 0==dequeued);
+            if (is_waiting){
+                idle_ticks=0;
+                size_t limit=this->max_size+std::min(stuck,this->max_size.load()); //卡住的线程不算在上限里
+                if (this->size<limit){
+                    size_t num=std::min(std::max({static_cast<size_t>(1),this->size/4,pending}),limit-this->size); //每个排队的任务一个线程，至少按比例增长，很快就能追上突发
+                    for (size_t i=0;i<num;++i) this->addWorker();
+                    ++this->metrics.grown;
+                    if (this->size>this->max_size) ++this->metrics.compensated;
+                }
+            }
+            else if (0==pending && this->metrics.utilization<POOL_SHRINK_UTILIZATION && this->size>this->min_size){
+                if (++idle_ticks>=POOL_SHRINK_TICKS || this->size>this->max_size+stuck){ //补偿出来的线程在卡住的线程恢复后马上减掉
+                    --this->size;
+                    ++this->pending;
+                    this->sp_tasks.push(Task{nullptr,std::chrono::steady_clock::now()}); //让一个空闲的线程退出
+                    ++this->metrics.shrunk;
+                }
+            }
+            else idle_ticks=0;
+        }
     }
 
 private:
-    std::vector<std::thread> workers;
-    MessageQueue<std::shared_ptr<std::function<void()>>> sp_tasks;
+    std::list<std::unique_ptr<Worker>> workers; //只在构造、析构和控制线程中访问
+    MessageQueue<Task> sp_tasks;
+    size_t min_size;
+    std::atomic<size_t> max_size;
+    std::atomic<size_t> size; //没有被要求退出的线程数
+    std::atomic<size_t> pending; //排队中的任务数
+    std::atomic<size_t> dequeued{0}; //这个周期取走的任务数
+    std::atomic<int64_t> wait_sum{0}; //这个周期取走的任务的排队时间之和
+    std::atomic<int64_t> wait_max{0};
+    int64_t retired_busy=0;
+    Metrics metrics;
+    mutable std::mutex control_mtx;
+    std::condition_variable control_cv;
+    std::thread controller;
     std::atomic_bool stop;
 };
 
+/*------------Definition of Arena--------------*/
+class Arena{ //单调内存分配器，只分配不释放，reset后整体复用，避免每个请求都去堆上分配
+public:
+    Arena(const size_t& block_size=8192):block_size(block_size),current(0){
+        this->blocks.reserve(8);
+        this->addBlock(block_size);
+    }
+    ~Arena(){
+        for (auto& block:this->blocks) ::operator delete(block.data);
+    }
+    Arena(const Arena&)=delete;
+    Arena& operator=(const Arena&)=delete;
+
+    void* allocate(const size_t& size, const size_t& align=alignof(std::max_align_t)){
+        while (this->current<this->blocks.size()){
+            Block& block=this->blocks[this->current];
+            size_t offset=(block.used+align-1)&~(align-1); //按align对齐
+            if (offset+size<=block.size){
+                block.used=offset+size;
+                return block.data+offset;
+            }
+            ++this->current; //当前块放不下，尝试下一块
+        }
+        this->addBlock(std::max(this->block_size,size+align)); //所有块都放不下，新增一块
+        return this->allocate(size,align);
+    }
+    char* allocateChars(const size_t& size){
+        return static_cast<char*>(this->allocate(size,1));
+    }
+    std::string_view copy(const std::string_view& str){ //将字符串拷贝到arena中
+        if (str.empty()) return std::string_view();
+        char* p=this->allocateChars(str.size());
+        memcpy(p,str.data(),str.size());
+        return std::string_view(p,str.size());
+    }
+    std::string_view concat(const std::string_view& str1, const std::string_view& str2){ //拼接两个字符串并存放到arena中
+        char* p=this->allocateChars(str1.size()+str2.size());
+        memcpy(p,str1.data(),str1.size());
+        memcpy(p+str1.size(),str2.data(),str2.size());
+        return std::string_view(p,str1.size()+str2.size());
+    }
+    void reset(){ //释放超大的块，保留普通块以便复用
+        size_t kept=0;
+        for (size_t i=0;i<this->blocks.size();++i){
+            if (this->blocks[i].size>this->block_size && kept>0) ::operator delete(this->blocks[i].data);
+            else {
+                this->blocks[kept]=this->blocks[i];
+                this->blocks[kept].used=0;
+                ++kept;
+            }
+        }
+        this->blocks.resize(kept);
+        this->current=0;
+    }
+    size_t used() const{ //已经分配出去的字节数
+        size_t res=0;
+        for (const auto& block:this->blocks) res+=block.used;
+        return res;
+    }
+
+private:
+    struct Block{
+        char* data;
+        size_t size;
+        size_t used;
+    };
+    void addBlock(const size_t& size){
+        this->blocks.push_back(Block{static_cast<char*>(::operator new(size)),size,0});
+        this->current=this->blocks.size()-1;
+    }
+
+private:
+    size_t block_size;
+    size_t current; //当前正在分配的块
+    std::vector<Block> blocks;
+};
+
+/*------------Definition of SmallVector--------------*/
+template<class T, size_t N>
+class SmallVector{ //先使用内联存储，放不下时在Arena中扩容，只适用于可平凡拷贝的类型
+    static_assert(std::is_trivially_copyable<T>::value, "SmallVector only supports trivially copyable types");
+public:
+    SmallVector(Arena& arena):p_arena(&arena),p_data(inline_data),len(0),cap(N){}
+    SmallVector(const SmallVector&)=delete;
+    SmallVector& operator=(const SmallVector&)=delete;
+
+    void push_back(const T& value){
+        if (this->len==this->cap) this->grow();
+        this->p_data[this->len++]=value;
+    }
+    void erase(T* pos){
+        memmove(pos,pos+1,(this->end()-pos-1)*sizeof(T));
+        --this->len;
+    }
+    void clear(){ //arena reset前必须先clear
+        this->p_data=this->inline_data;
+        this->len=0;
+        this->cap=N;
+    }
+    size_t size() const{ return this->len; }
+    bool empty() const{ return 0==this->len; }
+    T& operator[](const size_t& i){ return this->p_data[i]; }
+    const T& operator[](const size_t& i) const{ return this->p_data[i]; }
+    T* begin(){ return this->p_data; }
+    T* end(){ return this->p_data+this->len; }
+    const T* begin() const{ return this->p_data; }
+    const T* end() const{ return this->p_data+this->len; }
+
+private:
+    void grow(){
+        T* p=static_cast<T*>(this->p_arena->allocate(sizeof(T)*this->cap*2,alignof(T)));
+        memcpy(p,this->p_data,sizeof(T)*this->len);
+        this->p_data=p;
+        this->cap*=2;
+    }
+
+private:
+    Arena* p_arena;
+    T inline_data[N];
+    T* p_data;
+    size_t len;
+    size_t cap;
+};
+
 } // namespace utils
 
 
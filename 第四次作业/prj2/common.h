@@ -30,6 +30,7 @@ struct SysConfig_t
     float corrupt_prob;
     unsigned char automated;
     char automated_file[AUTOMATED_FILENAME];
+    unsigned char unicast; //为1时帧只交给目的地址对应的站，否则广播给所有站
 };
 typedef struct SysConfig_t  SysConfig;
 
@@ -49,11 +50,11 @@ struct Receiver_t
     //DO NOT CHANGE:
     // 1) buffer_mutex
     // 2) buffer_cv
-    // 3) input_framelist_head
+    // 3) input_framelist
     // 4) recv_id
     pthread_mutex_t buffer_mutex;
     pthread_cond_t buffer_cv;
-    LLnode * input_framelist_head;
+    LLqueue input_framelist;
 
     int recv_id;
 
@@ -66,13 +67,13 @@ struct Sender_t
     //DO NOT CHANGE:
     // 1) buffer_mutex
     // 2) buffer_cv
-    // 3) input_cmdlist_head
-    // 4) input_framelist_head
+    // 3) input_cmdlist
+    // 4) input_framelist
     // 5) send_id
     pthread_mutex_t buffer_mutex;
     pthread_cond_t buffer_cv;    
-    LLnode * input_cmdlist_head;
-    LLnode * input_framelist_head;
+    LLqueue input_cmdlist;
+    LLqueue input_framelist;
     int send_id;
 
     int num_swp; //要维护的滑动窗口个数
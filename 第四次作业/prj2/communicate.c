@@ -7,15 +7,13 @@
 void send_frame(char * char_buffer,
                 enum SendFrame_DstType dst_type)
 {
-    int i = 0, j;
-    char * per_recv_char_buffer;
+    int i = 0;
 
     //Multiply out the probabilities to some degree of precision
     int prob_prec = 1000;
     int drop_prob = (int) prob_prec * glb_sysconfig.drop_prob;
     int corrupt_prob = (int) prob_prec * glb_sysconfig.corrupt_prob;
     int num_corrupt_bits = CORRUPTION_BITS;
-    int corrupt_indices[num_corrupt_bits];
 
     //Pick a random number
     int random_num = rand() % prob_prec;
@@ -24,7 +22,7 @@ void send_frame(char * char_buffer,
     //Drop the packet on the floor
     if (random_num < drop_prob)
     {
-        free(char_buffer);
+        pool_free(char_buffer);
         return;
     }
     
@@ -32,13 +30,15 @@ void send_frame(char * char_buffer,
     random_num = rand() % prob_prec;
     if (random_num < corrupt_prob)
     {
-        //Pick random indices to corrupt
+        //Every destination sees the same corrupted bits, so corrupt one private copy
+        //(copy-on-write, free when the caller holds the only reference) and share it
+        char_buffer = (char *) pool_unshare(char_buffer);
         for (i=0;
              i < num_corrupt_bits;
              i++)
         {
             random_index = rand() % MAX_FRAME_SIZE;
-            corrupt_indices[i] = random_index;
+            char_buffer[random_index] = ~char_buffer[random_index];
         }
     }
 
@@ -53,36 +53,37 @@ void send_frame(char * char_buffer,
         array_length = glb_senders_array_length;
     }
 
-    //Go through the dst array and add the packet to their receive queues
-    for (i=0;
-         i < array_length;
-         i++)
+    //Broadcast to the whole dst array, or deliver only to the station named in the dst field
+    int first_dst = 0;
+    int last_dst = array_length;
+    if (glb_sysconfig.unicast)
     {
-        //Allocate a per receiver char buffer for the message
-        per_recv_char_buffer = (char *) malloc(sizeof(char) * MAX_FRAME_SIZE);
-        memcpy(per_recv_char_buffer,
-               char_buffer,
-               MAX_FRAME_SIZE);
-        
-        //Corrupt the bits (inefficient, should just corrupt one copy and memcpy it
-        if (random_num < corrupt_prob)
+        first_dst = ((Frame *) char_buffer)->dst;
+        last_dst = first_dst + 1;
+        if (first_dst >= array_length)
         {
-            //Corrupt bits at the chosen random indices
-            for (j=0;
-                 j < num_corrupt_bits;
-                 j++)
-            {
-                random_index = corrupt_indices[j];
-                per_recv_char_buffer[random_index] = ~per_recv_char_buffer[random_index];
-            }            
+            //No such station (the address itself may have been corrupted)
+            pool_free(char_buffer);
+            return;
         }
+    }
+
+    //All destinations share the one immutable buffer and each frees it when done:
+    //the caller's reference goes to one of them, every other one gets a new reference
+    pool_retain(char_buffer,
+                last_dst - first_dst - 1);
 
+    //Go through the dst array and add the packet to their receive queues
+    for (i=first_dst;
+         i < last_dst;
+         i++)
+    {
         if (dst_type == ReceiverDst)
         {
             Receiver * dst = &glb_receivers_array[i];
             pthread_mutex_lock(&dst->buffer_mutex);
-            ll_append_node(&dst->input_framelist_head,
-                           (void *) per_recv_char_buffer);
+            ll_queue_push(&dst->input_framelist,
+                          (void *) char_buffer);
             pthread_cond_signal(&dst->buffer_cv);
             pthread_mutex_unlock(&dst->buffer_mutex);
         }
@@ -90,14 +91,12 @@ void send_frame(char * char_buffer,
         {
             Sender * dst = &glb_senders_array[i];
             pthread_mutex_lock(&dst->buffer_mutex);
-            ll_append_node(&dst->input_framelist_head,
-                           (void *) per_recv_char_buffer);
+            ll_queue_push(&dst->input_framelist,
+                          (void *) char_buffer);
             pthread_cond_signal(&dst->buffer_cv);
             pthread_mutex_unlock(&dst->buffer_mutex);
         }
     }
-    
-    free(char_buffer);
     return;
 }
 
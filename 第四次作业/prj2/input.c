@@ -208,8 +208,8 @@ void * run_stdinthread(void *threadid)
                         
                         //Lock the buffer, add to the input list, and signal the thread
                         pthread_mutex_lock(&sender->buffer_mutex);
-                        ll_append_node(&sender->input_cmdlist_head,
-                                       (void *) outgoing_cmd);
+                        ll_queue_push(&sender->input_cmdlist,
+                                      (void *) outgoing_cmd);
                         pthread_cond_signal(&sender->buffer_cv);
                         pthread_mutex_unlock(&sender->buffer_mutex);
                     }
@@ -1,99 +1,82 @@
 #include "list.h"
+#include "pool.h"
 
 //Linked list functions
-int ll_get_length(LLnode * head)
+void ll_queue_init(LLqueue * queue)
 {
-    LLnode * tmp;
-    int count = 1;
-    if (head == NULL)
-        return 0;
-    else
-    {
-        tmp = head->next;
-        while (tmp != head)
-        {
-            count++;
-            tmp = tmp->next;
-        }
-        return count;
-    }
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->count = 0;
+}
+
+int ll_queue_length(LLqueue * queue)
+{
+    return queue->count;
 }
 
-void ll_append_node(LLnode ** head_ptr, 
-                    void * value)
+void ll_queue_push(LLqueue * queue,
+                   void * value)
 {
-    LLnode * prev_last_node;
     LLnode * new_node;
-    LLnode * head;
 
-    if (head_ptr == NULL)
-    {
-        return;
-    }
-    
-    //Init the value pntr
-    head = (*head_ptr);
-    new_node = (LLnode *) malloc(sizeof(LLnode));
+    new_node = (LLnode *) pool_alloc(pool_node);
     new_node->value = value;
+    new_node->next = NULL;
 
-    //The list is empty, no node is currently present
-    if (head == NULL)
+    //The queue is empty, the new node is both head and tail
+    if (queue->tail == NULL)
     {
-        (*head_ptr) = new_node;
-        new_node->prev = new_node;
-        new_node->next = new_node;
+        queue->head = new_node;
     }
     else
     {
-        //Node exists by itself
-        prev_last_node = head->prev;
-        head->prev = new_node;
-        prev_last_node->next = new_node;
-        new_node->next = head;
-        new_node->prev = prev_last_node;
+        queue->tail->next = new_node;
     }
+    queue->tail = new_node;
+    queue->count++;
 }
 
-
-LLnode * ll_pop_node(LLnode ** head_ptr)
+void * ll_queue_pop(LLqueue * queue)
 {
-    LLnode * last_node;
-    LLnode * new_head;
     LLnode * prev_head;
+    void * value;
 
-    prev_head = (*head_ptr);
+    prev_head = queue->head;
     if (prev_head == NULL)
     {
         return NULL;
     }
-    last_node = prev_head->prev;
-    new_head = prev_head->next;
 
-    //We are about to set the head ptr to nothing because there is only one thing in list
-    if (last_node == prev_head)
+    queue->head = prev_head->next;
+    if (queue->head == NULL)
     {
-        (*head_ptr) = NULL;
-        prev_head->next = NULL;
-        prev_head->prev = NULL;
-        return prev_head;
+        queue->tail = NULL;
     }
-    else
-    {
-        (*head_ptr) = new_head;
-        last_node->next = new_head;
-        new_head->prev = last_node;
+    queue->count--;
 
-        prev_head->next = NULL;
-        prev_head->prev = NULL;
-        return prev_head;
-    }
+    value = prev_head->value;
+    pool_free(prev_head);
+    return value;
 }
 
-void ll_destroy_node(LLnode * node)
+void ll_queue_splice(LLqueue * dst,
+                     LLqueue * src)
 {
-    if (node->type == llt_string)
+    if (src->head == NULL)
+    {
+        return;
+    }
+
+    if (dst->tail == NULL)
     {
-        free((char *) node->value);
+        dst->head = src->head;
     }
-    free(node);
+    else
+    {
+        dst->tail->next = src->head;
+    }
+    dst->tail = src->tail;
+    dst->count += src->count;
+
+    ll_queue_init(src);
 }
@@ -5,29 +5,62 @@
 #include <stdint.h>
 
 //Linked list information
-enum LLtype 
-{
-    llt_string,
-    llt_frame,
-    llt_integer,
-    llt_head
-} LLtype;
-
 struct LLnode_t
 {
-    struct LLnode_t * prev;
     struct LLnode_t * next;
-    enum LLtype type;
 
     void * value;
 };
 typedef struct LLnode_t LLnode;
 
-//Linked list functions
-int ll_get_length(LLnode *);
-void ll_append_node(LLnode **, void *);
-LLnode * ll_pop_node(LLnode **);
-void ll_destroy_node(LLnode *);
+struct LLqueue_t
+{
+    LLnode * head; //队首，出队的位置
+    LLnode * tail; //队尾，入队的位置
+    int count; //结点个数，取长度不用遍历
+};
+typedef struct LLqueue_t LLqueue; //记录首尾和长度的单链表队列，入队、出队、取长度、整体拼接都是O(1)
+
+/**
+ * @brief 初始化一个空队列。
+ *
+ * @param queue 指向队列的指针。
+ */
+void ll_queue_init(LLqueue * queue);
+
+/**
+ * @brief 取队列的长度。
+ *
+ * @param queue 指向队列的指针。
+ * @return 队列中结点的个数。
+ */
+int ll_queue_length(LLqueue * queue);
+
+/**
+ * @brief 将一个值追加到队尾。
+ *
+ * @param queue 指向队列的指针。
+ * @param value 要追加的值，不能为NULL。
+ */
+void ll_queue_push(LLqueue * queue, void * value);
+
+/**
+ * @brief 从队首取出一个值，结点由队列释放。
+ *
+ * @param queue 指向队列的指针。
+ * @return 队首的值，队列为空时返回NULL。
+ */
+void * ll_queue_pop(LLqueue * queue);
+
+/**
+ * @brief 将src中的所有结点按顺序接到dst的队尾，src变为空队列。
+ *
+ * 不拷贝也不分配结点，持锁时用它把共享队列整体取到线程自己的队列里，之后不持锁慢慢处理。
+ *
+ * @param dst 指向目的队列的指针。
+ * @param src 指向源队列的指针。
+ */
+void ll_queue_splice(LLqueue * dst, LLqueue * src);
 
 
-#endif
\ No newline at end of file
+#endif
@@ -15,6 +15,7 @@
 #include "communicate.h"
 #include "receiver.h"
 #include "sender.h"
+#include "pool.h"
 
 int main(int argc, char *argv[])
 {
@@ -36,6 +37,7 @@ int main(int argc, char *argv[])
     memset(glb_sysconfig.automated_file,
            0,
            AUTOMATED_FILENAME);
+    glb_sysconfig.unicast = 0;
 
     //DO NOT CHANGE THIS
     //Prepare other variables and seed the psuedo random number generator
@@ -86,6 +88,11 @@ int main(int argc, char *argv[])
           }
           i += 2;
       }     
+      else if(strcmp(argv[i], "-u") == 0) 
+      {
+          glb_sysconfig.unicast = 1;
+          i++;
+      }     
       else if(strcmp(argv[i], "-h") == 0) 
       {
           print_usage=1;
@@ -104,7 +111,7 @@ int main(int argc, char *argv[])
         (glb_sysconfig.corrupt_prob < 0 || glb_sysconfig.corrupt_prob > 1) ||
         print_usage)
     {
-        fprintf(stderr, "USAGE: etherchat \n   -r int [# of receivers] \n   -s int [# of senders] \n   -c float [0 <= corruption prob <= 1] \n   -d float [0 <= drop prob <= 1]\n");
+        fprintf(stderr, "USAGE: etherchat \n   -r int [# of receivers] \n   -s int [# of senders] \n   -c float [0 <= corruption prob <= 1] \n   -d float [0 <= drop prob <= 1] \n   -u [deliver frames only to their dst instead of broadcasting]\n");
         exit(1);
     }
         
@@ -132,6 +139,7 @@ int main(int argc, char *argv[])
     
     fprintf(stderr, "Messages will be dropped with probability=%f\n", glb_sysconfig.drop_prob);
     fprintf(stderr, "Messages will be corrupted with probability=%f\n", glb_sysconfig.corrupt_prob);
+    fprintf(stderr, "Messages will be %s\n", glb_sysconfig.unicast ? "delivered only to their dst" : "broadcast to all stations");
     fprintf(stderr, "Available sender id(s):\n");
 
     //Init sender objects, assign ids
@@ -203,6 +211,8 @@ int main(int argc, char *argv[])
         pthread_join(receiver_threads[i], NULL);
     }
 
+    pool_print_stats(stderr);
+
     free(sender_threads);
     free(receiver_threads);
     free(glb_senders_array);
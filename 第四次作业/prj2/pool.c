@@ -0,0 +1,205 @@
+#include "pool.h"
+#include <stdatomic.h>
+#include <pthread.h>
+#include <string.h>
+#include "list.h"
+
+typedef struct PoolHeap_t PoolHeap;
+
+struct PoolSlab_t
+{
+    PoolHeap * owner; //切出这个slab的线程的堆，释放时据此找到块的归属
+    atomic_uint refs[]; //有引用计数的池才有，下标是块在slab中的序号，块本身不用留出放计数的地方
+};
+typedef struct PoolSlab_t PoolSlab; //slab头，放在slab开头的几个块里
+
+struct PoolHeap_t
+{
+    //只有所属线程访问
+    enum PoolType type;
+    void * free_list; //本线程的空闲块，块的前8个字节是下一个空闲块
+    char * bump; //当前slab中还没切出去的位置
+    char * bump_end; //当前slab的结尾
+    atomic_long allocs; //分配次数
+    atomic_long unshares; //写时复制的次数
+    atomic_long slabs; //向系统申请的slab个数
+    PoolHeap * next; //所有堆串成一个链表，打印统计信息时遍历
+
+    //别的线程并发访问，放在另一条缓存行上
+    _Alignas(64) _Atomic(void *) remote_free; //别的线程还回来的块，无锁栈：其他线程只压入，所属线程整体取走，不会有ABA问题
+    atomic_long remote_frees; //跨线程释放次数
+};
+
+static const size_t pool_block_sizes[pool_type_count] = {POOL_FRAME_BLOCK_SIZE, sizeof(LLnode)}; //每种池的块大小
+static const int pool_refcounted[pool_type_count] = {1, 0}; //帧会被多个接收者共享，结点只有一个持有者
+static const char * pool_names[pool_type_count] = {"frame", "node"};
+
+static __thread PoolHeap * thread_heaps[pool_type_count]; //本线程在每种池中的堆，第一次分配时创建
+static PoolHeap * all_heaps = NULL; //所有线程的堆，线程退出后堆也保留，别的线程可能还拿着它的块
+static pthread_mutex_t all_heaps_mutex = PTHREAD_MUTEX_INITIALIZER; //只在创建堆和打印统计信息时加锁
+
+/**
+ * @brief 为本线程创建指定池的堆。
+ *
+ * @param type 池的类型。
+ * @return 新的堆，内存不足时返回NULL。
+ */
+static PoolHeap * create_heap(enum PoolType type){
+    PoolHeap * heap;
+    if (0!=posix_memalign((void **)&heap,64,sizeof(PoolHeap))) return NULL;
+    heap->type=type;
+    heap->free_list=NULL;
+    heap->bump=NULL;
+    heap->bump_end=NULL;
+    atomic_init(&heap->allocs,0);
+    atomic_init(&heap->unshares,0);
+    atomic_init(&heap->slabs,0);
+    atomic_init(&heap->remote_free,NULL);
+    atomic_init(&heap->remote_frees,0);
+
+    pthread_mutex_lock(&all_heaps_mutex);
+    heap->next=all_heaps;
+    all_heaps=heap;
+    pthread_mutex_unlock(&all_heaps_mutex);
+    return heap;
+}
+
+/**
+ * @brief 找到块所在的slab。
+ *
+ * @param p 由pool_alloc分配的块。
+ * @return slab头。
+ */
+static PoolSlab * slab_of(void * p){
+    return (PoolSlab *)((uintptr_t)p&~(uintptr_t)(POOL_SLAB_SIZE-1));
+}
+
+/**
+ * @brief 找到块的引用计数。
+ *
+ * @param slab 块所在的slab，必须属于有引用计数的池。
+ * @param p 由pool_alloc分配的块。
+ * @return 指向引用计数的指针。
+ */
+static atomic_uint * refs_of(PoolSlab * slab, void * p){
+    return &slab->refs[((char *)p-(char *)slab)/pool_block_sizes[slab->owner->type]];
+}
+
+/**
+ * @brief 为堆申请一个新的slab，开头的块留给slab头（和引用计数数组），其余的块从bump开始切。
+ *
+ * @param heap 指向堆的指针。
+ * @return 成功返回0，内存不足返回-1。
+ */
+static int new_slab(PoolHeap * heap){
+    PoolSlab * slab;
+    size_t block_size=pool_block_sizes[heap->type];
+    size_t header_size=sizeof(PoolSlab);
+    if (pool_refcounted[heap->type]) header_size+=POOL_SLAB_SIZE/block_size*sizeof(atomic_uint);
+    if (0!=posix_memalign((void **)&slab,POOL_SLAB_SIZE,POOL_SLAB_SIZE)) return -1; //按slab大小对齐，块地址向下取整就能找到slab头
+    slab->owner=heap;
+    heap->bump=(char *)slab+(header_size+block_size-1)/block_size*block_size;
+    heap->bump_end=(char *)slab+POOL_SLAB_SIZE/pool_block_sizes[heap->type]*pool_block_sizes[heap->type];
+    atomic_fetch_add_explicit(&heap->slabs,1,memory_order_relaxed);
+    return 0;
+}
+
+/**
+ * @param type 池的类型。
+ * @return 指向块的指针，块的内容未初始化；系统内存不足时返回NULL。
+ */
+void * pool_alloc(enum PoolType type){
+    PoolHeap * heap=thread_heaps[type];
+    if (NULL==heap){
+        heap=create_heap(type);
+        if (NULL==heap) return NULL;
+        thread_heaps[type]=heap;
+    }
+
+    void * p=heap->free_list;
+    if (NULL==p) p=atomic_exchange_explicit(&heap->remote_free,NULL,memory_order_acquire); //本线程的空了，把别的线程还回来的整体取回
+    if (NULL!=p){
+        heap->free_list=*(void **)p;
+    }
+    else {
+        if (heap->bump==heap->bump_end && 0!=new_slab(heap)) return NULL;
+        p=heap->bump;
+        heap->bump+=pool_block_sizes[type];
+    }
+    if (pool_refcounted[type]) atomic_store_explicit(refs_of(slab_of(p),p),1,memory_order_relaxed); //块交给别的线程时会经过加锁的队列，不需要更强的顺序
+    atomic_fetch_add_explicit(&heap->allocs,1,memory_order_relaxed);
+    return p;
+}
+
+/**
+ * @param p 由pool_alloc分配的块，NULL时什么都不做。
+ */
+void pool_free(void * p){
+    if (NULL==p) return;
+    PoolSlab * slab=slab_of(p);
+    PoolHeap * heap=slab->owner;
+    if (pool_refcounted[heap->type]){
+        atomic_uint * refs=refs_of(slab,p);
+        if (1!=atomic_load_explicit(refs,memory_order_acquire) && 1!=atomic_fetch_sub_explicit(refs,1,memory_order_acq_rel)) return; //还有别的持有者
+    }
+    if (heap==thread_heaps[heap->type]){ //本线程的块
+        *(void **)p=heap->free_list;
+        heap->free_list=p;
+        return;
+    }
+
+    void * head=atomic_load_explicit(&heap->remote_free,memory_order_relaxed); //别的线程的块，压入它的远程空闲栈
+    do {
+        *(void **)p=head;
+    } while (!atomic_compare_exchange_weak_explicit(&heap->remote_free,&head,p,memory_order_release,memory_order_relaxed));
+    atomic_fetch_add_explicit(&heap->remote_frees,1,memory_order_relaxed);
+}
+
+/**
+ * @param p 帧池中的块。
+ * @param n 增加的引用个数。
+ */
+void pool_retain(void * p, int n){
+    if (n<=0) return;
+    atomic_fetch_add_explicit(refs_of(slab_of(p),p),n,memory_order_relaxed);
+}
+
+/**
+ * @param p 由pool_alloc分配的块。
+ * @return 可以写的块，系统内存不足时返回NULL。
+ */
+void * pool_unshare(void * p){
+    PoolSlab * slab=slab_of(p);
+    enum PoolType type=slab->owner->type;
+    if (!pool_refcounted[type] || 1==atomic_load_explicit(refs_of(slab,p),memory_order_acquire)) return p; //独占的块，直接写
+
+    void * copy=pool_alloc(type);
+    if (NULL==copy) return NULL;
+    memcpy(copy,p,pool_block_sizes[type]);
+    pool_free(p);
+    atomic_fetch_add_explicit(&thread_heaps[type]->unshares,1,memory_order_relaxed);
+    return copy;
+}
+
+/**
+ * @param out 输出的文件。
+ */
+void pool_print_stats(FILE * out){
+    long allocs[pool_type_count]={0};
+    long unshares[pool_type_count]={0};
+    long remote_frees[pool_type_count]={0};
+    long slabs[pool_type_count]={0};
+
+    pthread_mutex_lock(&all_heaps_mutex);
+    for (PoolHeap * heap=all_heaps;NULL!=heap;heap=heap->next){
+        allocs[heap->type]+=atomic_load_explicit(&heap->allocs,memory_order_relaxed);
+        unshares[heap->type]+=atomic_load_explicit(&heap->unshares,memory_order_relaxed);
+        remote_frees[heap->type]+=atomic_load_explicit(&heap->remote_frees,memory_order_relaxed);
+        slabs[heap->type]+=atomic_load_explicit(&heap->slabs,memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&all_heaps_mutex);
+
+    for (int i=0;i<pool_type_count;++i){
+        fprintf(out, "Pool %s: allocs=%ld remote_frees=%ld unshares=%ld slabs=%ld\n", pool_names[i], allocs[i], remote_frees[i], unshares[i], slabs[i]);
+    }
+}
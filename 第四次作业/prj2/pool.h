@@ -0,0 +1,71 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define POOL_SLAB_SIZE 65536 //每个slab的大小（单位字节），slab按这个大小对齐，块的地址向下取整就是slab头
+#define POOL_FRAME_BLOCK_SIZE 64 //帧池的块大小，等于MAX_FRAME_SIZE
+
+//定长块的池，每种块一个
+enum PoolType
+{
+    pool_frame, //64字节的帧
+    pool_node, //队列结点
+    pool_type_count
+};
+
+/**
+ * @brief 从指定的池中分配一个定长块。
+ *
+ * 每个线程在每个池中有自己的堆：先用本线程的空闲链表，空了就把别的线程还回来的块整体取回，
+ * 还不够就从本线程的slab中切一块，slab用完了才向系统申请新的slab。分配路径上没有锁。
+ *
+ * @param type 池的类型。
+ * @return 指向块的指针，块的内容未初始化；系统内存不足时返回NULL。
+ */
+void * pool_alloc(enum PoolType type);
+
+/**
+ * @brief 释放块的一个引用，最后一个引用释放时将块还给分配它的线程的池。
+ *
+ * 块属于本线程时直接放回本线程的空闲链表；属于别的线程时无锁地压入那个线程的远程空闲栈，
+ * 由那个线程下次分配时整体取回（帧在发送者线程分配、在接收者线程释放）。
+ * 只有一个引用时不做原子的减法。
+ *
+ * @param p 由pool_alloc分配的块，NULL时什么都不做。
+ */
+void pool_free(void * p);
+
+/**
+ * @brief 为块增加引用，只有帧池的块有引用计数。
+ *
+ * 分配出来的块有一个引用，每增加一个持有者就增加一个引用，每个持有者用完后各自调用pool_free，
+ * 持有者之间共享同一块内存，都只能读不能写。
+ *
+ * @param p 帧池中的块。
+ * @param n 增加的引用个数。
+ */
+void pool_retain(void * p, int n);
+
+/**
+ * @brief 写之前调用，取得块的独占版本（写时复制）。
+ *
+ * 只有一个引用时直接返回原来的块；否则从本线程的池中分配一个新块，拷贝内容，释放原来的块的一个引用。
+ *
+ * @param p 由pool_alloc分配的块。
+ * @return 可以写的块，系统内存不足时返回NULL。
+ */
+void * pool_unshare(void * p);
+
+/**
+ * @brief 打印每个池的统计信息。
+ *
+ * 包括分配次数、跨线程释放次数、写时复制的次数以及向系统申请的slab个数，向系统申请内存的次数只有slab个数那么多。
+ *
+ * @param out 输出的文件。
+ */
+void pool_print_stats(FILE * out);
+
+#endif
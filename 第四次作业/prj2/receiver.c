@@ -7,7 +7,7 @@ void init_receiver(Receiver * receiver,
                    int id)
 {
     receiver->recv_id = id;
-    receiver->input_framelist_head = NULL;
+    ll_queue_init(&receiver->input_framelist);
     receiver->num_swp=glb_senders_array_length;
     receiver->swp=(RSWP*)malloc(receiver->num_swp*sizeof(RSWP));
     for (int i=0;i<receiver->num_swp;++i){ //初始化每个滑动窗口
@@ -17,19 +17,20 @@ void init_receiver(Receiver * receiver,
 
 
 void handle_incoming_msgs(Receiver * receiver,
-                          LLnode ** outgoing_frames_head_ptr)
+                          LLqueue * incoming_msgs,
+                          LLqueue * outgoing_frames)
 {
     //TODO(SOLVED): Suggested steps for handling incoming frames
-    //    1) Dequeue the Frame from the sender->input_framelist_head
+    //    1) Dequeue the Frame from the incoming_msgs (taken from receiver->input_framelist)
     //    2) Convert the char * buffer to a Frame data type
     //    3) Check whether the frame is corrupted
     //    4) Check whether the frame is for this receiver
     //    5) Do sliding window protocol for sender/receiver pair
 
-    while (ll_get_length(receiver->input_framelist_head) > 0)
+    while (ll_queue_length(incoming_msgs) > 0)
     {
-        //Pop a node off the front of the link list and update the count
-        LLnode * ll_inmsg_node = ll_pop_node(&receiver->input_framelist_head);
+        //Pop a frame off the front of the queue and update the count
+        Frame* frame=(Frame*)ll_queue_pop(incoming_msgs);
 
         //DUMMY CODE: Print the raw_char_buf
         //NOTE: You should not blindly print messages!
@@ -37,21 +38,18 @@ void handle_incoming_msgs(Receiver * receiver,
         //                    Is this message corrupted?
         //                    Is this an old, retransmitted message?
 
-        Frame* frame=(Frame*)ll_inmsg_node->value;
-        
         if (!is_corrupted(frame)&&frame->dst==receiver->recv_id){ //frame没损坏以及是发送给该接收者的
             put_frame_in_receiver_slide_window(&(receiver->swp[frame->src]),frame); //将帧加入到滑动窗口中
             
-            //利用原frame重新组装一个ack frame
+            //利用原frame重新组装一个ack frame，广播时frame和其他接收者共享，先取得独占的版本
+            frame=pool_unshare(frame);
             frame->dst=frame->src;
             frame->src=receiver->recv_id;
             frame->ack=frame->seq;
             set_fcs_frame(frame);
-            ll_append_node(outgoing_frames_head_ptr,frame); //发送应答帧
+            ll_queue_push(outgoing_frames,frame); //发送应答帧
         }
-        else free(frame);
-
-        free(ll_inmsg_node);
+        else pool_free(frame);
     }
 }
 
@@ -62,23 +60,26 @@ void * run_receiver(void * input_receiver)
     const int WAIT_SEC_TIME = 0;
     const long WAIT_USEC_TIME = 100000;
     Receiver * receiver = (Receiver *) input_receiver;
-    LLnode * outgoing_frames_head;
+    LLqueue outgoing_frames;
+    LLqueue incoming_msgs;
 
 
     //This incomplete receiver thread, at a high level, loops as follows:
     //1. Determine the next time the thread should wake up if there is nothing in the incoming queue(s)
     //2. Grab the mutex protecting the input_msg queue
-    //3. Dequeues messages from the input_msg queue and prints them
+    //3. Takes the whole input_msg queue at once (splice, O(1))
     //4. Releases the lock
-    //5. Sends out any outgoing messages
+    //5. Handles the taken messages and prints them
+    //6. Sends out any outgoing messages
 
     pthread_cond_init(&receiver->buffer_cv, NULL);
     pthread_mutex_init(&receiver->buffer_mutex, NULL);
 
     while(1)
     {    
-        //NOTE: Add outgoing messages to the outgoing_frames_head pointer
-        outgoing_frames_head = NULL;
+        //NOTE: Add outgoing messages to the outgoing_frames queue
+        ll_queue_init(&outgoing_frames);
+        ll_queue_init(&incoming_msgs);
         gettimeofday(&curr_timeval, 
                      NULL);
 
@@ -101,7 +102,7 @@ void * run_receiver(void * input_receiver)
         pthread_mutex_lock(&receiver->buffer_mutex);
 
         //Check whether anything arrived
-        int incoming_msgs_length = ll_get_length(receiver->input_framelist_head);
+        int incoming_msgs_length = ll_queue_length(&receiver->input_framelist);
         if (incoming_msgs_length == 0)
         {
             //Nothing has arrived, do a timed wait on the condition variable (which releases the mutex). Again, you don't really need to do the timed wait.
@@ -111,26 +112,24 @@ void * run_receiver(void * input_receiver)
                                    &time_spec);
         }
 
-        handle_incoming_msgs(receiver,
-                             &outgoing_frames_head);
+        //整体取走输入队列，解锁之后再校验和交付，发送者入队时不用等
+        ll_queue_splice(&incoming_msgs,
+                        &receiver->input_framelist);
 
         pthread_mutex_unlock(&receiver->buffer_mutex);
+
+        handle_incoming_msgs(receiver,
+                             &incoming_msgs,
+                             &outgoing_frames);
         
         //CHANGE THIS AT YOUR OWN RISK!
         //Send out all the frames user has appended to the outgoing_frames list
-        int ll_outgoing_frame_length = ll_get_length(outgoing_frames_head);
-        while(ll_outgoing_frame_length > 0)
+        while(ll_queue_length(&outgoing_frames) > 0)
         {
-            LLnode * ll_outframe_node = ll_pop_node(&outgoing_frames_head);
-            char * char_buf = (char *) ll_outframe_node->value;
+            char * char_buf = (char *) ll_queue_pop(&outgoing_frames);
             
             //The following function frees the memory for the char_buf object
             send_msg_to_senders(char_buf);
-
-            //Free up the ll_outframe_node
-            free(ll_outframe_node);
-
-            ll_outgoing_frame_length = ll_get_length(outgoing_frames_head);
         }
     }
     pthread_exit(NULL);
@@ -4,16 +4,16 @@
  * @brief 初始化发送方滑动窗口（Sender Slide Window）结构体。
  *
  * 用于初始化发送方滑动窗口结构体（SSWP），包括设置左边界、初始化帧数据、确认标志、超时时间等相关字段，
- * 并将输出帧列表头指针和第一个空闲帧索引初始化为空和零。
+ * 并将输出帧队列和第一个空闲帧索引初始化为空和零。
  *
  * @param swp 指向发送方滑动窗口结构体的指针。
  */
 void init_sender_slide_window(SSWP* swp){
     swp->left=0;
     memset(swp->frame,0,sizeof(swp->frame));
-    memset(swp->is_ack,0,sizeof(swp->is_ack));
+    swp->is_ack=0;
     memset(swp->expiring_timeval,0,sizeof(swp->expiring_timeval));
-    swp->output_framelist_head=NULL;
+    ll_queue_init(&(swp->output_framelist));
     swp->first_empty_frame_index=0;
 }
 
@@ -27,35 +27,28 @@ void init_sender_slide_window(SSWP* swp){
  */
 void ack_frame_in_sender_slide_window(SSWP* swp,uint8_t ack){
     uint8_t index=(ack - swp->left + FRAME_MAX_SEQ ) % FRAME_MAX_SEQ; //将ack号映射到滑动窗口中
-    if (index >= SWP_WINDOW_SIZE) return; //ack号不在窗口内
-    swp->is_ack[index]=1; //将is_ack设置为1
+    if (index >= swp->first_empty_frame_index) return; //ack号不在已发送的帧中
+    swp->is_ack|=(uint64_t)1<<index; //记录该帧已确认
     
-    uint8_t offset=0;
-    for (uint8_t i=0;i<swp->first_empty_frame_index;++i){ //计算滑动窗口的滑动量offset
-        if (0==swp->is_ack[i]) break;
-        ++offset;
-    }
+    uint8_t offset=__builtin_ctzll(~swp->is_ack); //从left开始连续确认的帧数（末尾连续的1），就是滑动窗口的滑动量
     if (0==offset) return; //不需要移动滑动窗口
 
     swp->left=(swp->left+offset)%FRAME_MAX_SEQ; //更新left的值
-
-    logical_left_shift_memory((uint8_t*)swp->frame,sizeof(swp->frame),offset*sizeof(Frame)); //将frame数组左移offset个单位
-    logical_left_shift_memory((uint8_t*)swp->is_ack,sizeof(swp->is_ack),offset*sizeof(uint8_t)); //将is_ack数组左移offset个单位
-    logical_left_shift_memory((uint8_t*)swp->expiring_timeval,sizeof(swp->expiring_timeval),offset*sizeof(struct timeval)); //将expiring_timeval数组左移offset个单位
+    swp->is_ack>>=offset; //位图跟着left移动；帧和计时器留在原来的位置，空出来的位置之后直接覆盖
 
     swp->first_empty_frame_index-=offset; //更新first_empty_frame_index的值
 }
 
 /**
- * @brief 将输出帧追加到发送方滑动窗口（Sender Slide Window）的输出帧列表中。
+ * @brief 将输出帧追加到发送方滑动窗口（Sender Slide Window）的输出帧队列中。
  *
- * 用于将一个输出帧追加到发送方滑动窗口的输出帧列表中。
+ * 用于将一个输出帧追加到发送方滑动窗口的输出帧队列中。
  *
  * @param swp 指向发送方滑动窗口结构体的指针。
  * @param frame 指向要追加的输出帧的指针。
  */
 void append_output_frame_to_sender_slide_window(SSWP* swp,Frame* frame){
-    ll_append_node(&(swp->output_framelist_head),frame);
+    ll_queue_push(&(swp->output_framelist),frame);
 }
 
 
@@ -65,23 +58,20 @@ void append_output_frame_to_sender_slide_window(SSWP* swp,Frame* frame){
  * 用于发送帧。
  *
  * @param swp 指向发送方滑动窗口结构体的指针。
- * @param outgoing_frames_head_ptr 输出帧列表的头指针的地址。
+ * @param outgoing_frames 输出帧队列。
  */
-void send_output_frame_from_sender_slide_window(SSWP* swp,LLnode ** outgoing_frames_head_ptr){
+void send_output_frame_from_sender_slide_window(SSWP* swp,LLqueue* outgoing_frames){
     while(swp->first_empty_frame_index<SWP_WINDOW_SIZE){ //把滑动窗口的空位都用掉
-        if (!ll_get_length(swp->output_framelist_head)) break; //该滑动窗口待发送帧链表是空的，break
-        LLnode* ll_output_frame_node=ll_pop_node(&(swp->output_framelist_head));
-        Frame* frame=ll_output_frame_node->value;
+        if (0==ll_queue_length(&(swp->output_framelist))) break; //该滑动窗口待发送帧队列是空的，break
+        Frame* frame=ll_queue_pop(&(swp->output_framelist));
 
         frame->seq=(swp->left+swp->first_empty_frame_index)%FRAME_MAX_SEQ; //通过left取得frame的seq
         set_fcs_frame(frame); //计算frame的fcs
-        memcpy(&(swp->frame[swp->first_empty_frame_index]),frame,sizeof(Frame)); //将frame拷贝到滑动窗口中
-        swp->is_ack[swp->first_empty_frame_index]=0; //设置is_ack为0
-        calculate_timeout(&(swp->expiring_timeval[swp->first_empty_frame_index])); //为该frame设置超时时间
+        uint8_t slot=SWP_SLOT(frame->seq);
+        memcpy(&(swp->frame[slot]),frame,sizeof(Frame)); //将frame拷贝到滑动窗口中，窗口滑动时移进来的is_ack位已经是0
+        calculate_timeout(&(swp->expiring_timeval[slot])); //为该frame设置超时时间
         ++swp->first_empty_frame_index; //记录新的空位
-        ll_append_node(outgoing_frames_head_ptr,frame); //发送该帧
-
-        free(ll_output_frame_node);
+        ll_queue_push(outgoing_frames,frame); //发送该帧
     }
 }
 
@@ -92,22 +82,41 @@ void send_output_frame_from_sender_slide_window(SSWP* swp,LLnode ** outgoing_fra
  * 它检查每个帧的超时状态，如果发现某个帧已经超时，则将该帧重新发送，并重新设置计时器。
  *
  * @param swp 指向发送方滑动窗口结构体的指针。
- * @param outgoing_frames_head_ptr 传输层输出帧列表的头指针的地址。
+ * @param outgoing_frames 传输层输出帧队列。
  */
-void resend_timeout_frame_from_sender_slide_window(SSWP* swp,LLnode ** outgoing_frames_head_ptr){
+void resend_timeout_frame_from_sender_slide_window(SSWP* swp,LLqueue* outgoing_frames){
     struct timeval curr_time; //当前时间
     for (int i=0;i<swp->first_empty_frame_index;++i){ //在已发送的且未被确认的帧中找到超时的帧
-        if (swp->is_ack[i]) continue; //已确认
+        if ((swp->is_ack>>i)&1) continue; //已确认
+        uint8_t slot=SWP_SLOT(swp->left+i);
         gettimeofday(&curr_time, NULL); //获取当前时间
-        if (timeval_usecdiff(&curr_time,&(swp->expiring_timeval[i]))>0) continue; //未超时
+        if (timeval_usecdiff(&curr_time,&(swp->expiring_timeval[slot]))>0) continue; //未超时
 
         //将超时的帧重新发送
-        Frame* frame=(Frame*)malloc(sizeof(Frame));
-        memcpy(frame,&(swp->frame[i]),sizeof(Frame));
-        ll_append_node(outgoing_frames_head_ptr,frame);
+        Frame* frame=(Frame*)pool_alloc(pool_frame);
+        memcpy(frame,&(swp->frame[slot]),sizeof(Frame));
+        ll_queue_push(outgoing_frames,frame);
 
-        calculate_timeout(&(swp->expiring_timeval[i])); //重新设置计时器
+        calculate_timeout(&(swp->expiring_timeval[slot])); //重新设置计时器
+    }
+}
+
+/**
+ * @brief 找出发送方滑动窗口（Sender Slide Window）中最早超时的计时器。
+ *
+ * 只看已发送但尚未被确认的帧，已确认的帧和空位上残留的计时器不算。
+ *
+ * @param swp 指向发送方滑动窗口结构体的指针。
+ * @return 最早超时的时间，没有在计时的帧时返回NULL。
+ */
+struct timeval * next_expiring_timeval_in_sender_slide_window(SSWP* swp){
+    struct timeval * next=NULL;
+    for (int i=0;i<swp->first_empty_frame_index;++i){
+        if ((swp->is_ack>>i)&1) continue; //已确认
+        struct timeval * expiring=&(swp->expiring_timeval[SWP_SLOT(swp->left+i)]);
+        if (NULL==next || timeval_usecdiff(expiring,next)>0) next=expiring; //比之前找到的更早超时
     }
+    return next;
 }
 
 /**
@@ -120,7 +129,7 @@ void resend_timeout_frame_from_sender_slide_window(SSWP* swp,LLnode ** outgoing_
 void init_receiver_slide_window(RSWP* swp){
     swp->left=0;
     memset(swp->frame,0,sizeof(swp->frame));
-    memset(swp->has_frame,0,sizeof(swp->has_frame));
+    swp->has_frame=0;
 }
 
 /**
@@ -135,34 +144,28 @@ void init_receiver_slide_window(RSWP* swp){
 void put_frame_in_receiver_slide_window(RSWP* swp, Frame* frame){
     uint8_t index=(frame->seq - swp->left + FRAME_MAX_SEQ ) % FRAME_MAX_SEQ; //将seq号映射到滑动窗口中
     if (index>=SWP_WINDOW_SIZE) return; //不在滑动窗口内，不移动窗口
-    if (swp->has_frame[index]) return; //已经接收过的frame，不移动窗口
+    if ((swp->has_frame>>index)&1) return; //已经接收过的frame，不移动窗口
     
     //将frame拷贝到滑动窗口中
-    memcpy(&(swp->frame[index]),frame,sizeof(Frame));
-    swp->has_frame[index]=1;
+    memcpy(&(swp->frame[SWP_SLOT(frame->seq)]),frame,sizeof(Frame));
+    swp->has_frame|=(uint64_t)1<<index;
 
-    uint8_t offset=0;
-    for (uint8_t i=0;i<SWP_WINDOW_SIZE;++i){ //找到一片连续的frame，并将其交付给上一层
-        if (0==swp->has_frame[i]) break;
-        ++offset;
+    uint8_t offset=__builtin_ctzll(~swp->has_frame); //从left开始连续收到的帧数（末尾连续的1）
+    if (0==offset) return; //不需要移动滑动窗口
 
-        Frame *out_frame=(Frame*)malloc(sizeof(Frame));
-        memcpy(out_frame,&(swp->frame[i]),sizeof(Frame));
-        deliver_frame_to_upper(out_frame); //将frame交付给上一层
+    for (uint8_t i=0;i<offset;++i){ //将这一片连续的frame按顺序交付给上一层
+        deliver_frame_to_upper(&(swp->frame[SWP_SLOT(swp->left+i)]));
     }
-    if (0==offset) return; //不需要移动滑动窗口
 
     swp->left=(swp->left+offset)%FRAME_MAX_SEQ; //更新left的值
-
-    logical_left_shift_memory((uint8_t*)swp->frame,sizeof(swp->frame),offset*sizeof(Frame)); //将frame数组左移offset个单位
-    logical_left_shift_memory((uint8_t*)swp->has_frame,sizeof(swp->has_frame),offset*sizeof(uint8_t)); //将has_frame数组左移offset个单位
+    swp->has_frame>>=offset; //位图跟着left移动，帧留在原来的位置
 }
 
 /**
  * @brief 将接收到的帧数据交付给上一层处理。
  *
  * 用于将接收到的帧数据交付给上一层处理，根据帧标志（flag）的不同分别处理段首、段中、段尾或不分段的情况，
- * 并在标准输出上打印相应的信息。
+ * 并在标准输出上打印相应的信息。帧直接从滑动窗口中读，不拷贝也不释放。
  *
  * @param frame 指向接收到的帧的指针。
  */
@@ -181,7 +184,6 @@ void deliver_frame_to_upper(Frame* frame){
     else { //不分段
         printf("<RECV-%d>:[%s]\n", frame->dst, frame->data);
     }
-    free(frame);
 }
 
 /**
@@ -9,7 +9,7 @@
 #include "list.h"
 #include "crc.h"
 #include "time.h"
-#include "memory.h"
+#include "pool.h"
 
 //Remember, your frame can be AT MOST 64 bytes!
 #define MAX_FRAME_SIZE 64 //帧的大小（单位字节）
@@ -44,28 +44,33 @@ struct Frame_t
     uint16_t fcs; //循环冗余余数
 };
 typedef struct Frame_t Frame; //帧
+_Static_assert(sizeof(Frame)==POOL_FRAME_BLOCK_SIZE, "Frame must fit a frame pool block");
 
 
 #define SWP_WINDOW_SIZE 8 //滑动窗口的大小
+#define SWP_SLOT(seq) ((seq)%SWP_WINDOW_SIZE) //序号为seq的帧在环形缓冲区中的位置，窗口滑动时帧不用移动
+
+_Static_assert((1<<(FRAME_SEQ_SIZE*8))%SWP_WINDOW_SIZE==0, "sequence numbers must wrap at a multiple of the window size");
+_Static_assert(SWP_WINDOW_SIZE<64, "window state must fit a 64-bit bitmap");
 
 struct SenderSlideWindowProtocol_t
 {
     uint8_t left; //滑动窗口的左边的序号
-    Frame   frame[SWP_WINDOW_SIZE]; //缓存帧
-    uint8_t is_ack[SWP_WINDOW_SIZE]; //记录该位置的帧是否已收到确认帧
-    struct timeval expiring_timeval[SWP_WINDOW_SIZE]; //记录该位置的帧啥时候超时
+    Frame   frame[SWP_WINDOW_SIZE]; //缓存帧，序号为seq的帧放在SWP_SLOT(seq)
+    uint64_t is_ack; //第i位记录序号为left+i的帧是否已收到确认帧，窗口滑动offset时右移offset位
+    struct timeval expiring_timeval[SWP_WINDOW_SIZE]; //记录该位置的帧啥时候超时，下标和frame相同
 
-    LLnode* output_framelist_head; //待发送帧链表
+    LLqueue output_framelist; //待发送帧队列
 
-    uint8_t first_empty_frame_index; //记录第一个空位的索引
+    uint8_t first_empty_frame_index; //已发送未滑出窗口的帧数，也就是第一个空位相对left的偏移
 };
 typedef struct SenderSlideWindowProtocol_t SSWP; //发送者的滑动窗口
 
 struct ReceiverSlideWindowProtocol_t
 {
     uint8_t left; //滑动窗口的左边的序号
-    Frame frame[SWP_WINDOW_SIZE]; //缓存帧
-    uint8_t has_frame[SWP_WINDOW_SIZE]; //记录该位置是否收到帧
+    Frame frame[SWP_WINDOW_SIZE]; //缓存帧，序号为seq的帧放在SWP_SLOT(seq)
+    uint64_t has_frame; //第i位记录序号为left+i的帧是否已收到，窗口滑动offset时右移offset位
 };
 typedef struct ReceiverSlideWindowProtocol_t RSWP; //接收者的滑动窗口
 
@@ -74,7 +79,7 @@ typedef struct ReceiverSlideWindowProtocol_t RSWP; //接收者的滑动窗口
  * @brief 初始化发送方滑动窗口（Sender Slide Window）结构体。
  *
  * 用于初始化发送方滑动窗口结构体（SSWP），包括设置左边界、初始化帧数据、确认标志、超时时间等相关字段，
- * 并将输出帧列表头指针和第一个空闲帧索引初始化为空和零。
+ * 并将输出帧队列和第一个空闲帧索引初始化为空和零。
  *
  * @param swp 指向发送方滑动窗口结构体的指针。
  */
@@ -91,9 +96,9 @@ void init_sender_slide_window(SSWP* swp);
 void ack_frame_in_sender_slide_window(SSWP* swp,uint8_t ack);
 
 /**
- * @brief 将输出帧追加到发送方滑动窗口（Sender Slide Window）的输出帧列表中。
+ * @brief 将输出帧追加到发送方滑动窗口（Sender Slide Window）的输出帧队列中。
  *
- * 用于将一个输出帧追加到发送方滑动窗口的输出帧列表中。
+ * 用于将一个输出帧追加到发送方滑动窗口的输出帧队列中。
  *
  * @param swp 指向发送方滑动窗口结构体的指针。
  * @param frame 指向要追加的输出帧的指针。
@@ -106,9 +111,9 @@ void append_output_frame_to_sender_slide_window(SSWP* swp,Frame* frame);
  * 用于发送帧。
  *
  * @param swp 指向发送方滑动窗口结构体的指针。
- * @param outgoing_frames_head_ptr 输出帧列表的头指针的地址。
+ * @param outgoing_frames 输出帧队列。
  */
-void send_output_frame_from_sender_slide_window(SSWP* swp,LLnode ** outgoing_frames_head_ptr);
+void send_output_frame_from_sender_slide_window(SSWP* swp,LLqueue* outgoing_frames);
 
 /**
  * @brief 重新发送发送方滑动窗口（Sender Slide Window）中超时的帧。
@@ -117,9 +122,19 @@ void send_output_frame_from_sender_slide_window(SSWP* swp,LLnode ** outgoing_fra
  * 它检查每个帧的超时状态，如果发现某个帧已经超时，则将该帧重新发送，并重新设置计时器。
  *
  * @param swp 指向发送方滑动窗口结构体的指针。
- * @param outgoing_frames_head_ptr 传输层输出帧列表的头指针的地址。
+ * @param outgoing_frames 传输层输出帧队列。
+ */
+void resend_timeout_frame_from_sender_slide_window(SSWP* swp,LLqueue* outgoing_frames);
+
+/**
+ * @brief 找出发送方滑动窗口（Sender Slide Window）中最早超时的计时器。
+ *
+ * 只看已发送但尚未被确认的帧，已确认的帧和空位上残留的计时器不算。
+ *
+ * @param swp 指向发送方滑动窗口结构体的指针。
+ * @return 最早超时的时间，没有在计时的帧时返回NULL。
  */
-void resend_timeout_frame_from_sender_slide_window(SSWP* swp,LLnode ** outgoing_frames_head_ptr);
+struct timeval * next_expiring_timeval_in_sender_slide_window(SSWP* swp);
 
 /**
  * @brief 初始化接收方滑动窗口（Receiver Slide Window）结构体。
@@ -145,7 +160,7 @@ void put_frame_in_receiver_slide_window(RSWP* swp, Frame* frame);
  * @brief 将接收到的帧数据交付给上一层处理。
  *
  * 用于将接收到的帧数据交付给上一层处理，根据帧标志（flag）的不同分别处理段首、段中、段尾或不分段的情况，
- * 并在标准输出上打印相应的信息。
+ * 并在标准输出上打印相应的信息。帧直接从滑动窗口中读，不拷贝也不释放。
  *
  * @param frame 指向接收到的帧的指针。
  */